@@ -0,0 +1,174 @@
+#include "stdafx.h"
+#include "BenchmarkCorpus.h"
+#include <random>
+
+// Chance, in percent, that the next item opens a subfolder or goes back up to
+// the parent folder.  Folders end up with about 50 items each.
+#define CORPUS_OPEN_FOLDER_PERCENT 2
+#define CORPUS_CLOSE_FOLDER_PERCENT 2
+
+namespace
+{
+    struct WeightedString
+    {
+        PCWSTR text;
+        UINT weight;
+    };
+
+    // Roughly the mix of a user profile.  Weights add up to 100.
+    const WeightedString c_extensions[] = {
+        { L".jpg", 26 },
+        { L".JPG", 8 },
+        { L".png", 9 },
+        { L".heic", 4 },
+        { L".CR2", 3 },
+        { L".mp4", 7 },
+        { L".MOV", 3 },
+        { L".mp3", 8 },
+        { L".flac", 2 },
+        { L".pdf", 7 },
+        { L".docx", 6 },
+        { L".xlsx", 3 },
+        { L".txt", 5 },
+        { L".tar.gz", 2 },
+        { L".min.js", 2 },
+        { L"", 5 },
+    };
+
+    const PCWSTR c_words[] = {
+        L"Holiday", L"beach", L"Report", L"final", L"Invoice", L"draft", L"Family", L"birthday",
+        L"Budget", L"notes", L"Meeting", L"scan", L"Project", L"backup", L"Summer", L"trip",
+        L"Wedding", L"copy", L"Resume", L"old", L"Concert", L"live", L"Garden", L"new",
+        L"Receipt", L"edit", L"Kids", L"school", L"Taxes", L"signed", L"Paris", L"export",
+    };
+
+    UINT _Pick(_In_ std::mt19937& random, _In_ UINT count)
+    {
+        return static_cast<UINT>(random() % count);
+    }
+
+    PCWSTR _PickWord(_In_ std::mt19937& random)
+    {
+        return c_words[_Pick(random, ARRAYSIZE(c_words))];
+    }
+
+    PCWSTR _PickExtension(_In_ std::mt19937& random)
+    {
+        UINT roll = _Pick(random, 100);
+        for (const auto& extension : c_extensions)
+        {
+            if (roll < extension.weight)
+            {
+                return extension.text;
+            }
+            roll -= extension.weight;
+        }
+        return L"";
+    }
+
+    std::wstring _MakeFileName(_In_ std::mt19937& random)
+    {
+        // Every value is drawn into its own variable as the order in which
+        // function arguments are evaluated is unspecified
+        wchar_t name[MAX_PATH] = { 0 };
+        UINT style = _Pick(random, 100);
+        if (style < 25)
+        {
+            StringCchPrintf(name, ARRAYSIZE(name), L"IMG_%04u", _Pick(random, 10000));
+        }
+        else if (style < 35)
+        {
+            StringCchPrintf(name, ARRAYSIZE(name), L"DSC%05u", _Pick(random, 100000));
+        }
+        else if (style < 50)
+        {
+            UINT year = 2010 + _Pick(random, 11);
+            UINT month = 1 + _Pick(random, 12);
+            UINT day = 1 + _Pick(random, 28);
+            UINT hour = _Pick(random, 24);
+            UINT minute = _Pick(random, 60);
+            UINT second = _Pick(random, 60);
+            StringCchPrintf(name, ARRAYSIZE(name), L"Screenshot %04u-%02u-%02u %02u%02u%02u", year, month, day, hour, minute, second);
+        }
+        else if (style < 65)
+        {
+            PCWSTR first = _PickWord(random);
+            PCWSTR second = _PickWord(random);
+            StringCchPrintf(name, ARRAYSIZE(name), L"%s %s (%u)", first, second, _Pick(random, 10));
+        }
+        else if (style < 75)
+        {
+            PCWSTR first = _PickWord(random);
+            PCWSTR second = _PickWord(random);
+            StringCchPrintf(name, ARRAYSIZE(name), L"%s_%s_v%u", first, second, 1 + _Pick(random, 9));
+        }
+        else if (style < 90)
+        {
+            UINT track = 1 + _Pick(random, 20);
+            PCWSTR first = _PickWord(random);
+            PCWSTR second = _PickWord(random);
+            StringCchPrintf(name, ARRAYSIZE(name), L"%02u - %s %s", track, first, second);
+        }
+        else
+        {
+            PCWSTR word = _PickWord(random);
+            StringCchPrintf(name, ARRAYSIZE(name), L"%s%u", word, _Pick(random, 1000));
+        }
+
+        std::wstring fileName(name);
+        return fileName + _PickExtension(random);
+    }
+
+    std::wstring _MakeFolderName(_In_ std::mt19937& random)
+    {
+        wchar_t name[MAX_PATH] = { 0 };
+        if (_Pick(random, 2) == 0)
+        {
+            UINT year = 2010 + _Pick(random, 11);
+            UINT month = 1 + _Pick(random, 12);
+            StringCchPrintf(name, ARRAYSIZE(name), L"%04u-%02u %s", year, month, _PickWord(random));
+        }
+        else
+        {
+            PCWSTR first = _PickWord(random);
+            StringCchPrintf(name, ARRAYSIZE(name), L"%s %s", first, _PickWord(random));
+        }
+        return name;
+    }
+}
+
+std::vector<CorpusItem> CreateCorpus(_In_ size_t itemCount, _In_ UINT seed)
+{
+    std::mt19937 random(seed);
+    std::vector<CorpusItem> items;
+    items.reserve(itemCount);
+
+    // Folders from the root to the one items are added to
+    std::vector<std::wstring> folders(1, CORPUS_ROOT);
+    while (items.size() < itemCount)
+    {
+        CorpusItem item;
+        item.depth = static_cast<UINT>(folders.size() - 1);
+
+        UINT roll = _Pick(random, 100);
+        if (roll < CORPUS_OPEN_FOLDER_PERCENT && item.depth < CORPUS_MAX_DEPTH)
+        {
+            item.path = folders.back() + L"\\" + _MakeFolderName(random);
+            item.isFolder = true;
+            folders.push_back(item.path);
+        }
+        else if (roll < CORPUS_OPEN_FOLDER_PERCENT + CORPUS_CLOSE_FOLDER_PERCENT && folders.size() > 1)
+        {
+            folders.pop_back();
+            continue;
+        }
+        else
+        {
+            item.path = folders.back() + L"\\" + _MakeFileName(random);
+        }
+
+        items.push_back(std::move(item));
+    }
+
+    return items;
+}
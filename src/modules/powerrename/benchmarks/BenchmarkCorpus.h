@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Seed of the corpora.  Keep it fixed so that results can be compared
+// between runs and releases.
+#define CORPUS_SEED 20200501
+
+// Deepest folder of a corpus, the items directly under the root being at 0
+#define CORPUS_MAX_DEPTH 6
+
+// Folder that the paths of a corpus start with
+#define CORPUS_ROOT L"C:\\Users\\Someone\\Corpus"
+
+struct CorpusItem
+{
+    std::wstring path;
+    UINT depth = 0;
+    bool isFolder = false;
+};
+
+// Makes a selection of itemCount files and folders with the names, extensions
+// and nesting found in a user's documents, pictures and music: camera and
+// screenshot names, numbered documents, track listings and a mix of upper and
+// lower case extensions, some double and some missing.
+//
+// The same count and seed always give the same corpus, on any machine.  It
+// only uses the raw output of std::mt19937, which the standard defines, and
+// none of the distributions, which are implementation defined.
+std::vector<CorpusItem> CreateCorpus(_In_ size_t itemCount, _In_ UINT seed = CORPUS_SEED);
@@ -0,0 +1,950 @@
+// PowerRenameBenchmarks.cpp : Console benchmarks for the PowerRename library.
+//
+
+#include "stdafx.h"
+#include "BenchmarkCorpus.h"
+#include <PowerRenameInterfaces.h>
+#include <PowerRenameItem.h>
+#include <PowerRenameManifest.h>
+#include <PowerRenameManager.h>
+#include <PowerRenameRegEx.h>
+#include <PowerRenameRegExBackend.h>
+#include <PowerRenameTemplate.h>
+#include <Helpers.h>
+#include <psapi.h>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <regex>
+#include <string>
+#include <vector>
+
+HINSTANCE g_hInst = GetModuleHandle(nullptr);
+
+#define DEFAULT_ITEM_COUNT 1000000
+
+// Longest wait for a preview to complete before a case is reported as failed
+#define PREVIEW_TIMEOUT_MS 600000
+
+// Quiet time after a preview completes before the next case starts.  A pass
+// that completes before a later change is followed by another pass.
+#define PREVIEW_SETTLE_MS 100
+
+class CBenchmarkTimer
+{
+public:
+    CBenchmarkTimer()
+    {
+        QueryPerformanceFrequency(&m_frequency);
+        QueryPerformanceCounter(&m_start);
+    }
+
+    double ElapsedMilliseconds()
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return (static_cast<double>(now.QuadPart - m_start.QuadPart) * 1000.0) / static_cast<double>(m_frequency.QuadPart);
+    }
+
+private:
+    LARGE_INTEGER m_frequency;
+    LARGE_INTEGER m_start;
+};
+
+// Every reported result, written out as JSON with --json
+struct BenchmarkResult
+{
+    std::wstring name;
+    size_t itemCount;
+    PCWSTR metric;
+    double value;
+    double perItem;
+};
+
+std::vector<BenchmarkResult> g_results;
+
+void ReportResult(_In_ PCWSTR name, _In_ size_t itemCount, _In_ double elapsedMs)
+{
+    double nsPerItem = (itemCount > 0) ? (elapsedMs * 1000000.0) / static_cast<double>(itemCount) : 0.0;
+    wprintf(L"%-48s %10zu items %12.2f ms %12.1f ns/item\n", name, itemCount, elapsedMs, nsPerItem);
+    g_results.push_back({ name, itemCount, L"ms", elapsedMs, nsPerItem });
+}
+
+std::vector<std::wstring> CreateFileNames(_In_ size_t itemCount)
+{
+    std::vector<std::wstring> names;
+    names.reserve(itemCount);
+    for (size_t i = 0; i < itemCount; i++)
+    {
+        wchar_t name[MAX_PATH] = { 0 };
+        StringCchPrintf(name, ARRAYSIZE(name), L"IMG_%06zu.jpg", i);
+        names.push_back(name);
+    }
+    return names;
+}
+
+// Adds the items in one batch so the preview is published once, as the
+// enumeration worker does
+void AddBenchmarkItems(_In_ IPowerRenameManager* psrm, _In_ const std::vector<CComPtr<IPowerRenameItem>>& items)
+{
+    std::vector<IPowerRenameItem*> batch(items.begin(), items.end());
+    if (!batch.empty())
+    {
+        psrm->AddItems(batch.data(), static_cast<UINT>(batch.size()));
+    }
+}
+
+// Per-item cost of a regex replace.  The uncached variant mirrors what
+// CPowerRenameRegEx::Replace did before the compiled pattern was cached.
+void BenchmarkRegExReplace(_In_ const std::vector<std::wstring>& names)
+{
+    PCWSTR searchTerm = L"IMG_(\\d+)";
+    PCWSTR replaceTerm = L"Photo_$1";
+
+    {
+        CBenchmarkTimer timer;
+        size_t totalLength = 0;
+        for (const auto& name : names)
+        {
+            std::wregex pattern(searchTerm, std::regex_constants::icase | std::regex_constants::ECMAScript);
+            totalLength += std::regex_replace(name, pattern, replaceTerm).length();
+        }
+        ReportResult(L"RegExReplace (compile per item)", names.size(), timer.ElapsedMilliseconds());
+    }
+
+    CComPtr<IPowerRenameRegEx> spRenameRegEx;
+    if (SUCCEEDED(CPowerRenameRegEx::s_CreateInstance(&spRenameRegEx)))
+    {
+        spRenameRegEx->put_flags(UseRegularExpressions | MatchAllOccurences);
+        spRenameRegEx->put_searchTerm(searchTerm);
+        spRenameRegEx->put_replaceTerm(replaceTerm);
+
+        CBenchmarkTimer timer;
+        for (const auto& name : names)
+        {
+            PWSTR result = nullptr;
+            if (SUCCEEDED(spRenameRegEx->Replace(name.c_str(), &result)))
+            {
+                CoTaskMemFree(result);
+            }
+        }
+        ReportResult(L"RegExReplace (CPowerRenameRegEx)", names.size(), timer.ElapsedMilliseconds());
+    }
+}
+
+// Replace all with each regex backend on its own.  The last pattern makes a
+// backtracking engine retry every split of each run of digits.
+void BenchmarkRegExBackends(_In_ const std::vector<std::wstring>& names)
+{
+    PCWSTR searchTerms[] = { L"IMG_(\\d+)", L"^(.*?)_(\\d+)\\.jpg$", L"(?:\\d|\\d\\d)+x" };
+    PCWSTR replaceTerm = L"Photo_$1";
+
+    for (PCWSTR searchTerm : searchTerms)
+    {
+        CStdRegExBackend stdBackend;
+        CAutomatonRegExBackend automatonBackend;
+        if (!stdBackend.Init(searchTerm, false) || !automatonBackend.Init(searchTerm, false))
+        {
+            continue;
+        }
+
+        const CRegExBackend* backends[] = { &stdBackend, &automatonBackend };
+        PCWSTR backendNames[] = { L"std::wregex", L"automaton" };
+        for (size_t i = 0; i < ARRAYSIZE(backends); i++)
+        {
+            CBenchmarkTimer timer;
+            std::wstring result;
+            for (const auto& name : names)
+            {
+                // Same limits as CPowerRenameRegEx so their cost is included
+                CRegExBudget budget(REGEX_MAX_MATCH_STEPS, REGEX_REPLACE_TIMEOUT_MS, nullptr);
+                backends[i]->Replace(name, replaceTerm, true, budget, result);
+            }
+
+            wchar_t label[MAX_PATH] = { 0 };
+            StringCchPrintf(label, ARRAYSIZE(label), L"%s %s", backendNames[i], searchTerm);
+            ReportResult(label, names.size(), timer.ElapsedMilliseconds());
+        }
+    }
+}
+
+// Plain search and replace as CPowerRenameRegEx::Replace implemented it before the
+// literal matcher: both strings are lowered into new copies for every search.
+size_t FindLowerCopies(std::wstring data, std::wstring toSearch, size_t pos)
+{
+    std::transform(data.begin(), data.end(), data.begin(), ::towlower);
+    std::transform(toSearch.begin(), toSearch.end(), toSearch.begin(), ::towlower);
+    return data.find(toSearch, pos);
+}
+
+// Case insensitive literal replace of every occurrence.
+void BenchmarkLiteralReplace(_In_ const std::vector<std::wstring>& names)
+{
+    PCWSTR searchTerm = L"img";
+    PCWSTR replaceTerm = L"Photo";
+
+    {
+        CBenchmarkTimer timer;
+        size_t totalLength = 0;
+        for (const auto& name : names)
+        {
+            std::wstring res = name;
+            std::wstring sourceToUse(name);
+            std::wstring search(searchTerm);
+            std::wstring replace(replaceTerm);
+            size_t pos = 0;
+            do
+            {
+                pos = FindLowerCopies(sourceToUse, search, pos);
+                if (pos != std::wstring::npos)
+                {
+                    res = sourceToUse.replace(pos, search.length(), replace);
+                    pos += replace.length();
+                }
+            } while (pos != std::wstring::npos);
+            totalLength += res.length();
+        }
+        ReportResult(L"LiteralReplace (lowered copies)", names.size(), timer.ElapsedMilliseconds());
+    }
+
+    CComPtr<IPowerRenameRegEx> spRenameRegEx;
+    if (SUCCEEDED(CPowerRenameRegEx::s_CreateInstance(&spRenameRegEx)))
+    {
+        spRenameRegEx->put_flags(MatchAllOccurences);
+        spRenameRegEx->put_searchTerm(searchTerm);
+        spRenameRegEx->put_replaceTerm(replaceTerm);
+
+        CBenchmarkTimer timer;
+        for (const auto& name : names)
+        {
+            PWSTR result = nullptr;
+            if (SUCCEEDED(spRenameRegEx->Replace(name.c_str(), &result)))
+            {
+                CoTaskMemFree(result);
+            }
+        }
+        ReportResult(L"LiteralReplace (CPowerRenameRegEx)", names.size(), timer.ElapsedMilliseconds());
+    }
+}
+
+// Numbering each new name.  GetEnumeratedFileName parses the name and formats
+// the number for every item where a compiled counter only appends digits.
+void BenchmarkEnumeration(_In_ const std::vector<std::wstring>& names)
+{
+    {
+        CBenchmarkTimer timer;
+        size_t totalLength = 0;
+        unsigned long itemEnumIndex = 1;
+        for (const auto& name : names)
+        {
+            wchar_t uniqueName[MAX_PATH] = { 0 };
+            unsigned long countUsed = 0;
+            if (GetEnumeratedFileName(uniqueName, ARRAYSIZE(uniqueName), name.c_str(), nullptr, itemEnumIndex++, &countUsed))
+            {
+                totalLength += wcslen(uniqueName);
+            }
+        }
+        ReportResult(L"Enumeration (GetEnumeratedFileName)", names.size(), timer.ElapsedMilliseconds());
+    }
+
+    {
+        CPowerRenameTemplate renameTemplate;
+        renameTemplate.Compile(L"Photo ${start=1,padding=6}", false);
+        const std::wstring& replaced = renameTemplate.GetReplaceTerm();
+
+        CBenchmarkTimer timer;
+        size_t totalLength = 0;
+        std::wstring buffer;
+        ULONG counterIndex = 0;
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            buffer.clear();
+            renameTemplate.Expand(replaced.c_str(), replaced.length(), counterIndex++, nullptr, buffer);
+            totalLength += buffer.length();
+        }
+        ReportResult(L"Enumeration (compiled template)", names.size(), timer.ElapsedMilliseconds());
+    }
+}
+
+// Index and id lookups on the manager item store across growing item counts.
+// Total time should scale linearly with the number of items.
+void BenchmarkItemStoreScaling()
+{
+    const UINT itemCounts[] = { 1000, 10000, 100000, 1000000 };
+    for (UINT itemCount : itemCounts)
+    {
+        CComPtr<IPowerRenameManager> spsrm;
+        if (FAILED(CPowerRenameManager::s_CreateInstance(&spsrm)))
+        {
+            continue;
+        }
+
+        std::vector<int> ids;
+        std::vector<CComPtr<IPowerRenameItem>> items;
+        ids.reserve(itemCount);
+        items.reserve(itemCount);
+        for (UINT i = 0; i < itemCount; i++)
+        {
+            CComPtr<IPowerRenameItem> spItem;
+            if (SUCCEEDED(CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&spItem))))
+            {
+                int id = 0;
+                spItem->get_id(&id);
+                ids.push_back(id);
+                items.push_back(spItem);
+            }
+        }
+        AddBenchmarkItems(spsrm, items);
+
+        wchar_t name[64] = { 0 };
+        {
+            CBenchmarkTimer timer;
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                CComPtr<IPowerRenameItem> spItem;
+                spsrm->GetItemByIndex(i, &spItem);
+            }
+            StringCchPrintf(name, ARRAYSIZE(name), L"GetItemByIndex (%u items)", itemCount);
+            ReportResult(name, itemCount, timer.ElapsedMilliseconds());
+        }
+
+        {
+            CBenchmarkTimer timer;
+            for (int id : ids)
+            {
+                CComPtr<IPowerRenameItem> spItem;
+                spsrm->GetItemById(id, &spItem);
+            }
+            StringCchPrintf(name, ARRAYSIZE(name), L"GetItemById (%u items)", itemCount);
+            ReportResult(name, itemCount, timer.ElapsedMilliseconds());
+        }
+
+        spsrm->Shutdown();
+    }
+}
+
+// Makes items from a path without a shell item, like the unit test mock
+class CBenchmarkItem :
+    public CPowerRenameItem
+{
+public:
+    static HRESULT s_CreateInstance(_In_ const std::shared_ptr<CPowerRenameItemStore>& store, _In_ PCWSTR path, _In_ UINT depth, _In_ bool isFolder, _Outptr_ IPowerRenameItem** ppItem)
+    {
+        *ppItem = nullptr;
+        CBenchmarkItem* newItem = new CBenchmarkItem();
+        HRESULT hr = newItem ? S_OK : E_OUTOFMEMORY;
+        if (SUCCEEDED(hr))
+        {
+            newItem->m_store = store;
+            newItem->m_depth = depth;
+            newItem->m_isFolder = isFolder;
+            hr = newItem->_InitNames(path, PathFindFileName(path));
+            if (SUCCEEDED(hr))
+            {
+                hr = newItem->QueryInterface(IID_PPV_ARGS(ppItem));
+            }
+            newItem->Release();
+        }
+        return hr;
+    }
+};
+
+SIZE_T GetPrivateBytes()
+{
+    PROCESS_MEMORY_COUNTERS_EX counters = { 0 };
+    counters.cb = sizeof(counters);
+    GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters));
+    return counters.PrivateUsage;
+}
+
+void ReportMemory(_In_ PCWSTR name, _In_ size_t itemCount, _In_ SIZE_T bytes)
+{
+    double bytesPerItem = (itemCount > 0) ? static_cast<double>(bytes) / itemCount : 0.0;
+    wprintf(L"%-48s %10zu items %12.2f MB %12.1f B/item\n", name, itemCount, bytes / (1024.0 * 1024.0), bytesPerItem);
+    g_results.push_back({ name, itemCount, L"bytes", static_cast<double>(bytes), bytesPerItem });
+}
+
+// Memory held by the names of a large selection.  Items used to hold a full
+// path and a name each in their own CoTaskMem allocations; the store keeps
+// the parent folder once and packs the names into shared blocks.
+void BenchmarkItemMemory(_In_ const std::vector<std::wstring>& names)
+{
+    // 1000 items per folder, a typical camera import
+    std::vector<std::wstring> paths;
+    paths.reserve(names.size());
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        wchar_t folder[MAX_PATH] = { 0 };
+        StringCchPrintf(folder, ARRAYSIZE(folder), L"C:\\Users\\Someone\\Pictures\\Imports\\%04zu\\", i / 1000);
+        paths.push_back(folder + names[i]);
+    }
+
+    {
+        SIZE_T start = GetPrivateBytes();
+        std::vector<std::pair<PWSTR, PWSTR>> strings;
+        strings.reserve(paths.size());
+        SIZE_T reserved = GetPrivateBytes() - start;
+        for (const std::wstring& path : paths)
+        {
+            PWSTR fullPath = nullptr;
+            PWSTR originalName = nullptr;
+            SHStrDup(path.c_str(), &fullPath);
+            SHStrDup(PathFindFileName(path.c_str()), &originalName);
+            strings.emplace_back(fullPath, originalName);
+        }
+        ReportMemory(L"ItemNames (CoTaskMem per item)", paths.size(), GetPrivateBytes() - start - reserved);
+
+        for (auto& pair : strings)
+        {
+            CoTaskMemFree(pair.first);
+            CoTaskMemFree(pair.second);
+        }
+    }
+
+    {
+        SIZE_T start = GetPrivateBytes();
+        std::vector<CComPtr<IPowerRenameItem>> items;
+        items.reserve(paths.size());
+        SIZE_T reserved = GetPrivateBytes() - start;
+        std::shared_ptr<CPowerRenameItemStore> store = std::make_shared<CPowerRenameItemStore>();
+        for (const std::wstring& path : paths)
+        {
+            CComPtr<IPowerRenameItem> spItem;
+            if (SUCCEEDED(CBenchmarkItem::s_CreateInstance(store, path.c_str(), 0, false, &spItem)))
+            {
+                items.push_back(spItem);
+            }
+        }
+        ReportMemory(L"Items (shared store)", items.size(), GetPrivateBytes() - start - reserved);
+        ReportMemory(L"ItemNames (shared store)", items.size(), store->GetAllocatedBytes());
+    }
+}
+
+// Reads every item the way the preview does, once through the COM getters,
+// which copy each name, and once through the fast path of CPowerRenameItem.
+// The checksum keeps the reads from being optimized away.
+void BenchmarkItemAccessors(_In_ const std::vector<std::wstring>& names)
+{
+    std::shared_ptr<CPowerRenameItemStore> store = std::make_shared<CPowerRenameItemStore>();
+    std::vector<CComPtr<IPowerRenameItem>> items;
+    items.reserve(names.size());
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        std::wstring path = L"C:\\Users\\Someone\\Pictures\\" + names[i];
+        CComPtr<IPowerRenameItem> spItem;
+        if (SUCCEEDED(CBenchmarkItem::s_CreateInstance(store, path.c_str(), 0, false, &spItem)))
+        {
+            // Every other item is renamed
+            if (i % 2 == 0)
+            {
+                spItem->put_newName((L"new_" + names[i]).c_str());
+            }
+            items.push_back(spItem);
+        }
+    }
+
+    size_t checksum = 0;
+    {
+        CBenchmarkTimer timer;
+        for (IPowerRenameItem* spItem : items)
+        {
+            bool selected = false;
+            bool shouldRename = false;
+            spItem->get_selected(&selected);
+            spItem->ShouldRenameItem(0, &shouldRename);
+
+            PWSTR name = nullptr;
+            if (SUCCEEDED(spItem->get_originalName(&name)))
+            {
+                checksum += wcslen(name);
+                CoTaskMemFree(name);
+            }
+            if (SUCCEEDED(spItem->get_newName(&name)))
+            {
+                checksum += wcslen(name);
+                CoTaskMemFree(name);
+            }
+            checksum += selected + shouldRename;
+        }
+        ReportResult(L"ItemAccessors (COM getters)", items.size(), timer.ElapsedMilliseconds());
+    }
+
+    {
+        CBenchmarkTimer timer;
+        for (IPowerRenameItem* spItem : items)
+        {
+            CPowerRenameItem* item = CPowerRenameItem::s_FromItem(spItem);
+            std::wstring_view newName;
+            item->GetNewName(&newName);
+            checksum += item->GetOriginalName().length() + newName.length();
+            checksum += item->IsSelected() + item->ShouldRename(0);
+        }
+        ReportResult(L"ItemAccessors (fast path)", items.size(), timer.ElapsedMilliseconds());
+    }
+
+    wprintf(L"%-48s %zu\n", L"ItemAccessors checksum", checksum);
+}
+
+// Shape of the synthetic tree walked by BenchmarkDirectoryWalk.  Wide and
+// shallow like a media library with many sibling folders.
+#define WALK_FOLDER_COUNT 1000
+#define WALK_FILES_PER_FOLDER 20
+
+size_t WalkTree(_In_ PCWSTR root, _In_ bool parallel)
+{
+    // The parallel walk hands shell items to the thread pool so both walks
+    // run in the multithreaded apartment
+    size_t itemCount = 0;
+    std::thread walkThread([&]() {
+        if (SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED)))
+        {
+            CComPtr<IShellItem> spsi;
+            CComPtr<IShellItemArray> spsia;
+            CComPtr<IPowerRenameItemFactory> spsrif;
+            if (SUCCEEDED(SHCreateItemFromParsingName(root, nullptr, IID_PPV_ARGS(&spsi))) &&
+                SUCCEEDED(SHCreateShellItemArrayFromShellItem(spsi, IID_PPV_ARGS(&spsia))) &&
+                SUCCEEDED(CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&spsrif))))
+            {
+                EnumerateItemsCallback countItems = [&itemCount](std::vector<CComPtr<IPowerRenameItem>>& items) {
+                    itemCount += items.size();
+                    return S_OK;
+                };
+                if (parallel)
+                {
+                    EnumerateShellItemsParallel(spsia, spsrif, nullptr, countItems);
+                }
+                else
+                {
+                    EnumerateShellItems(spsia, spsrif, nullptr, countItems);
+                }
+            }
+            CoUninitialize();
+        }
+    });
+    walkThread.join();
+    return itemCount;
+}
+
+// Serial and parallel enumeration of a synthetic tree on the local file
+// system.  The first walk only warms the file system cache.
+void BenchmarkDirectoryWalk()
+{
+    wchar_t tempPath[MAX_PATH] = { 0 };
+    GetTempPath(ARRAYSIZE(tempPath), tempPath);
+    std::filesystem::path root = std::filesystem::path(tempPath) / L"PowerRenameBenchmarkTree";
+
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    for (UINT folder = 0; folder < WALK_FOLDER_COUNT && !ec; folder++)
+    {
+        wchar_t name[MAX_PATH] = { 0 };
+        StringCchPrintf(name, ARRAYSIZE(name), L"Album %04u", folder);
+        std::filesystem::path folderPath = root / name;
+        std::filesystem::create_directories(folderPath, ec);
+        for (UINT file = 0; file < WALK_FILES_PER_FOLDER && !ec; file++)
+        {
+            StringCchPrintf(name, ARRAYSIZE(name), L"IMG_%04u.jpg", file);
+            HANDLE fileHandle = CreateFile((folderPath / name).c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (fileHandle != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(fileHandle);
+            }
+        }
+    }
+
+    if (!ec)
+    {
+        WalkTree(root.c_str(), false);
+
+        {
+            CBenchmarkTimer timer;
+            size_t itemCount = WalkTree(root.c_str(), false);
+            ReportResult(L"DirectoryWalk (serial)", itemCount, timer.ElapsedMilliseconds());
+        }
+
+        {
+            CBenchmarkTimer timer;
+            size_t itemCount = WalkTree(root.c_str(), true);
+            ReportResult(L"DirectoryWalk (parallel)", itemCount, timer.ElapsedMilliseconds());
+        }
+    }
+
+    std::filesystem::remove_all(root, ec);
+}
+
+// Import of a manifest listing every name, a mapping on every other line.
+// The first import only warms the file system cache.
+void BenchmarkManifestImport(_In_ const std::vector<std::wstring>& names)
+{
+    wchar_t tempPath[MAX_PATH] = { 0 };
+    GetTempPath(ARRAYSIZE(tempPath), tempPath);
+    std::filesystem::path manifestPath = std::filesystem::path(tempPath) / L"PowerRenameBenchmarkManifest.txt";
+
+    std::string content;
+    content.reserve(names.size() * 48);
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        // The names are ASCII
+        std::string name(names[i].begin(), names[i].end());
+        content += "C:\\Photos\\" + name;
+        if (i % 2)
+        {
+            content += "\tRenamed_" + name;
+        }
+        content += "\r\n";
+    }
+
+    HANDLE file = CreateFile(manifestPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    DWORD written = 0;
+    BOOL wrote = WriteFile(file, content.data(), static_cast<DWORD>(content.length()), &written, nullptr);
+    CloseHandle(file);
+
+    CComPtr<IPowerRenameItemFactory> spsrif;
+    if (wrote && SUCCEEDED(CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&spsrif))))
+    {
+        for (int run = 0; run < 2; run++)
+        {
+            size_t itemCount = 0;
+            CBenchmarkTimer timer;
+            ImportManifest(manifestPath.c_str(), spsrif, nullptr, [&itemCount](std::vector<CComPtr<IPowerRenameItem>>& items) {
+                itemCount += items.size();
+                return S_OK;
+            });
+            if (run > 0)
+            {
+                ReportResult(L"ManifestImport", itemCount, timer.ElapsedMilliseconds());
+            }
+        }
+    }
+
+    DeleteFile(manifestPath.c_str());
+}
+
+// Times the start and completion of preview passes as the manager reports
+// them on its message window
+class CBenchmarkManagerEvents :
+    public IPowerRenameManagerEvents
+{
+public:
+    // IUnknown
+    IFACEMETHODIMP QueryInterface(_In_ REFIID riid, _Outptr_ void** ppv)
+    {
+        static const QITAB qit[] = {
+            QITABENT(CBenchmarkManagerEvents, IPowerRenameManagerEvents),
+            { 0 },
+        };
+        return QISearch(this, qit, riid, ppv);
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&m_refCount);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        long refCount = InterlockedDecrement(&m_refCount);
+        if (refCount == 0)
+        {
+            delete this;
+        }
+        return refCount;
+    }
+
+    // IPowerRenameManagerEvents
+    IFACEMETHODIMP OnItemAdded(_In_ IPowerRenameItem*) { return S_OK; }
+    IFACEMETHODIMP OnUpdateRange(_In_ UINT, _In_ UINT) { return S_OK; }
+    IFACEMETHODIMP OnItemsAdded(_In_ UINT, _In_ UINT) { return S_OK; }
+    IFACEMETHODIMP OnError(_In_ IPowerRenameItem*, _In_ HRESULT) { return S_OK; }
+    IFACEMETHODIMP OnRenameStarted() { return S_OK; }
+    IFACEMETHODIMP OnRenameProgress(_In_ UINT, _In_ UINT) { return S_OK; }
+    IFACEMETHODIMP OnRenameCompleted() { return S_OK; }
+    IFACEMETHODIMP OnEnumerationCompleted() { return S_OK; }
+    IFACEMETHODIMP OnEnumerationError(_In_ HRESULT) { return S_OK; }
+
+    IFACEMETHODIMP OnRegExStarted(_In_ DWORD)
+    {
+        // Only the latest pass counts, earlier ones were canceled by it
+        m_timer = CBenchmarkTimer();
+        m_canceled = false;
+        m_completed = false;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP OnRegExCanceled(_In_ DWORD)
+    {
+        m_canceled = true;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP OnRegExCompleted(_In_ DWORD)
+    {
+        if (!m_canceled)
+        {
+            m_elapsedMs = m_timer.ElapsedMilliseconds();
+            m_completed = true;
+        }
+        return S_OK;
+    }
+
+    void Reset()
+    {
+        m_completed = false;
+    }
+
+    bool IsCompleted() const { return m_completed; }
+    double GetElapsedMilliseconds() const { return m_elapsedMs; }
+
+private:
+    ~CBenchmarkManagerEvents() = default;
+
+    CBenchmarkTimer m_timer;
+    double m_elapsedMs = 0;
+    bool m_canceled = false;
+    bool m_completed = false;
+    long m_refCount = 1;
+};
+
+// Dispatches the messages of the manager until a preview pass completes.  With
+// settle it keeps going until no new pass starts for PREVIEW_SETTLE_MS.
+bool WaitForPreview(_In_ CBenchmarkManagerEvents* events, _In_ bool settle)
+{
+    ULONGLONG timeout = GetTickCount64() + PREVIEW_TIMEOUT_MS;
+    ULONGLONG quietUntil = 0;
+    while (GetTickCount64() < timeout)
+    {
+        if (events->IsCompleted())
+        {
+            if (!settle)
+            {
+                return true;
+            }
+
+            if (quietUntil == 0)
+            {
+                quietUntil = GetTickCount64() + PREVIEW_SETTLE_MS;
+            }
+            else if (GetTickCount64() >= quietUntil)
+            {
+                return true;
+            }
+        }
+        else
+        {
+            quietUntil = 0;
+        }
+
+        MsgWaitForMultipleObjects(0, nullptr, FALSE, PREVIEW_SETTLE_MS, QS_ALLINPUT);
+        MSG msg;
+        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+        {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+    }
+    return false;
+}
+
+struct PreviewCase
+{
+    PCWSTR name;
+    PCWSTR searchTerm;
+    PCWSTR replaceTerm;
+    DWORD flags;
+};
+
+// The full preview through the manager and its worker, from the pass started
+// by a new search term to its completion, over corpora of growing size.  The
+// corpus has the extensions and folders of a user profile, items come from a
+// path only item factory so no shell items are made.
+void BenchmarkPreviewPipeline(_In_ size_t maxItemCount)
+{
+    const PreviewCase previewCases[] = {
+        { L"literal", L"IMG", L"Photo", MatchAllOccurences | CaseSensitive },
+        { L"literal icase", L"img", L"Photo", MatchAllOccurences },
+        { L"regex", L"(\\d+)", L"[$1]", UseRegularExpressions | MatchAllOccurences | CaseSensitive },
+        { L"regex icase", L"^(img|dsc)_?(\\d+)", L"Photo $2", UseRegularExpressions },
+        { L"name only", L"a", L"4", MatchAllOccurences | NameOnly },
+        { L"extension only", L"jpg", L"jpeg", ExtensionOnly },
+        { L"enumerate", L"^.*", L"Item", UseRegularExpressions | EnumerateItems },
+        { L"counter", L"^.*", L"Item ${padding=7}", UseRegularExpressions },
+    };
+
+    const size_t corpusSizes[] = { 1000, 10000, 100000, 1000000 };
+    for (size_t corpusSize : corpusSizes)
+    {
+        if (corpusSize > maxItemCount)
+        {
+            break;
+        }
+
+        CComPtr<IPowerRenameManager> spsrm;
+        CComPtr<IPowerRenameRegEx> spRenameRegEx;
+        if (FAILED(CPowerRenameManager::s_CreateInstance(&spsrm)) ||
+            FAILED(spsrm->get_renameRegEx(&spRenameRegEx)))
+        {
+            continue;
+        }
+
+        CBenchmarkManagerEvents* events = new CBenchmarkManagerEvents();
+        DWORD cookie = 0;
+        spsrm->Advise(events, &cookie);
+
+        std::shared_ptr<CPowerRenameItemStore> store = std::make_shared<CPowerRenameItemStore>();
+        std::vector<CComPtr<IPowerRenameItem>> items;
+        for (const CorpusItem& corpusItem : CreateCorpus(corpusSize))
+        {
+            CComPtr<IPowerRenameItem> spItem;
+            if (SUCCEEDED(CBenchmarkItem::s_CreateInstance(store, corpusItem.path.c_str(), corpusItem.depth, corpusItem.isFolder, &spItem)))
+            {
+                items.push_back(spItem);
+            }
+        }
+        AddBenchmarkItems(spsrm, items);
+
+        for (const PreviewCase& previewCase : previewCases)
+        {
+            // Settle the flags and replace term first so only the search
+            // term change is timed
+            events->Reset();
+            spRenameRegEx->put_searchTerm(L"");
+            spRenameRegEx->put_flags(previewCase.flags);
+            spRenameRegEx->put_replaceTerm(previewCase.replaceTerm);
+            WaitForPreview(events, true);
+
+            events->Reset();
+            spRenameRegEx->put_searchTerm(previewCase.searchTerm);
+
+            wchar_t name[MAX_PATH] = { 0 };
+            if (WaitForPreview(events, false))
+            {
+                UINT renameCount = 0;
+                spsrm->GetRenameItemCount(&renameCount);
+                StringCchPrintf(name, ARRAYSIZE(name), L"Preview %s (%u renamed)", previewCase.name, renameCount);
+                ReportResult(name, corpusSize, events->GetElapsedMilliseconds());
+            }
+            else
+            {
+                StringCchPrintf(name, ARRAYSIZE(name), L"Preview %s", previewCase.name);
+                wprintf(L"%-48s %10zu items timed out\n", name, corpusSize);
+            }
+        }
+
+        spsrm->UnAdvise(cookie);
+        spsrm->Shutdown();
+        events->Release();
+    }
+}
+
+// Appends text to json as a JSON string
+void AppendJsonString(_In_ PCWSTR text, _Inout_ std::wstring& json)
+{
+    json += L'"';
+    for (PCWSTR ch = text; *ch; ch++)
+    {
+        if (*ch == L'"' || *ch == L'\\')
+        {
+            json += L'\\';
+        }
+        json += *ch;
+    }
+    json += L'"';
+}
+
+// Writes the results as UTF-8 JSON so runs can be compared by a script:
+//
+//   { "seed": 20200501, "itemCount": 1000000, "timestamp": "2020-05-01T12:00:00Z",
+//     "results": [ { "name": "...", "items": 1000, "metric": "ms", "value": 1.5, "perItem": 1500.0 } ] }
+//
+// perItem is in nanoseconds for "ms" results and in bytes for "bytes" results.
+HRESULT WriteJsonResults(_In_ PCWSTR path, _In_ size_t itemCount)
+{
+    SYSTEMTIME now = { 0 };
+    GetSystemTime(&now);
+
+    wchar_t buffer[MAX_PATH] = { 0 };
+    StringCchPrintf(buffer, ARRAYSIZE(buffer), L"{\n  \"seed\": %u,\n  \"itemCount\": %zu,\n  \"timestamp\": \"%04u-%02u-%02uT%02u:%02u:%02uZ\",\n  \"results\": [",
+        CORPUS_SEED, itemCount, now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond);
+    std::wstring json(buffer);
+    for (size_t i = 0; i < g_results.size(); i++)
+    {
+        const BenchmarkResult& result = g_results[i];
+        json += (i > 0) ? L",\n    { \"name\": " : L"\n    { \"name\": ";
+        AppendJsonString(result.name.c_str(), json);
+        StringCchPrintf(buffer, ARRAYSIZE(buffer), L", \"items\": %zu, \"metric\": \"%s\", \"value\": %.3f, \"perItem\": %.3f }",
+            result.itemCount, result.metric, result.value, result.perItem);
+        json += buffer;
+    }
+    json += L"\n  ]\n}\n";
+
+    HRESULT hr = E_FAIL;
+    int length = WideCharToMultiByte(CP_UTF8, 0, json.c_str(), static_cast<int>(json.length()), nullptr, 0, nullptr, nullptr);
+    if (length > 0)
+    {
+        std::string utf8(length, '\0');
+        WideCharToMultiByte(CP_UTF8, 0, json.c_str(), static_cast<int>(json.length()), &utf8[0], length, nullptr, nullptr);
+
+        HANDLE file = CreateFile(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        hr = (file != INVALID_HANDLE_VALUE) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+        if (SUCCEEDED(hr))
+        {
+            DWORD written = 0;
+            hr = WriteFile(file, utf8.data(), static_cast<DWORD>(utf8.length()), &written, nullptr) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+            CloseHandle(file);
+        }
+    }
+    return hr;
+}
+
+// PowerRenameBenchmarks.exe [itemCount] [--json <path>]
+int wmain(int argc, wchar_t* argv[])
+{
+    size_t itemCount = DEFAULT_ITEM_COUNT;
+    PCWSTR jsonPath = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (_wcsicmp(argv[i], L"--json") == 0 && i + 1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else
+        {
+            itemCount = static_cast<size_t>(_wtoi64(argv[i]));
+        }
+    }
+
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+    if (SUCCEEDED(hr))
+    {
+        std::vector<std::wstring> names = CreateFileNames(itemCount);
+
+        BenchmarkRegExReplace(names);
+        BenchmarkRegExBackends(names);
+        BenchmarkLiteralReplace(names);
+        BenchmarkEnumeration(names);
+        BenchmarkItemStoreScaling();
+        BenchmarkItemMemory(names);
+        BenchmarkItemAccessors(names);
+        BenchmarkDirectoryWalk();
+        BenchmarkManifestImport(names);
+        BenchmarkPreviewPipeline(itemCount);
+
+        if (jsonPath)
+        {
+            hr = WriteJsonResults(jsonPath, itemCount);
+            if (FAILED(hr))
+            {
+                fwprintf(stderr, L"Could not write %s (0x%08x)\n", jsonPath, hr);
+            }
+        }
+
+        CoUninitialize();
+    }
+
+    return SUCCEEDED(hr) ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+#include "BatchRenamer.h"
+#include <utility>
+
+namespace fs = std::filesystem;
+
+void CBatchRenamer::Rename(_In_ const fs::path& path)
+{
+    // A trailing separator names the folder itself
+    fs::path itemPath = (path.has_filename() || !path.has_parent_path()) ? path : path.parent_path();
+
+    std::error_code ec;
+    fs::file_status status = fs::symlink_status(itemPath, ec);
+    if (!ec && !fs::exists(status))
+    {
+        ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+
+    if (ec)
+    {
+        m_stats.itemCount++;
+        _ReportError(itemPath, ec);
+        return;
+    }
+
+    _VisitItem(itemPath, fs::is_directory(status), 0);
+}
+
+void CBatchRenamer::Flush()
+{
+    if (m_batch.empty())
+    {
+        return;
+    }
+
+    m_getNewNames(m_batch);
+
+    // Folders still being visited are renamed once their contents are done
+    for (auto& folder : m_openFolders)
+    {
+        if (folder.isBatched)
+        {
+            folder.newName = std::move(m_batch[folder.batchIndex].newName);
+            m_batch[folder.batchIndex].newName.reset();
+            folder.isBatched = false;
+        }
+    }
+
+    // The contents of a folder come after it in the batch
+    for (auto it = m_batch.rbegin(); it != m_batch.rend(); ++it)
+    {
+        if (it->newName.has_value())
+        {
+            _RenameItem(it->path, *it->newName);
+        }
+    }
+    m_batch.clear();
+}
+
+void CBatchRenamer::_VisitItem(_In_ const fs::path& path, _In_ bool isFolder, _In_ unsigned int depth)
+{
+    m_stats.itemCount++;
+
+    BatchRenameItem item;
+    item.path = path;
+    item.isFolder = isFolder;
+    item.depth = depth;
+    m_batch.push_back(std::move(item));
+
+    // The folder is added before its contents so that enumeration numbers
+    // follow the listing order
+    bool visitContents = isFolder && m_recurse;
+    if (visitContents)
+    {
+        OpenFolder folder;
+        folder.batchIndex = m_batch.size() - 1;
+        m_openFolders.push_back(std::move(folder));
+    }
+
+    if (m_batch.size() >= m_batchSize)
+    {
+        Flush();
+    }
+
+    if (visitContents)
+    {
+        _VisitFolderContents(path, depth + 1);
+
+        OpenFolder folder = std::move(m_openFolders.back());
+        m_openFolders.pop_back();
+
+        // A folder still in the batch is renamed after its contents with it.
+        // Otherwise its contents left in the batch go first.
+        if (!folder.isBatched && folder.newName.has_value())
+        {
+            Flush();
+            _RenameItem(path, *folder.newName);
+        }
+    }
+}
+
+void CBatchRenamer::_VisitFolderContents(_In_ const fs::path& folder, _In_ unsigned int depth)
+{
+    // Renaming an item while its folder is being listed can make the listing
+    // return it again under its new name, so list the folder first.  Links are
+    // renamed but not followed.
+    std::vector<std::pair<fs::path, bool>> entries;
+    std::error_code ec;
+    for (fs::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec))
+    {
+        std::error_code statusError;
+        entries.emplace_back(it->path(), fs::is_directory(it->symlink_status(statusError)));
+    }
+
+    if (ec)
+    {
+        _ReportError(folder, ec);
+    }
+
+    for (const auto& entry : entries)
+    {
+        _VisitItem(entry.first, entry.second, depth);
+    }
+}
+
+void CBatchRenamer::_RenameItem(_In_ const fs::path& path, _In_ const std::wstring& newName)
+{
+    std::error_code ec;
+    fs::path target = path.parent_path() / newName;
+    if (newName.empty() || newName.find_first_of(L"\\/") != std::wstring::npos)
+    {
+        // The item would leave its folder
+        ec = std::make_error_code(std::errc::invalid_argument);
+    }
+    else if (fs::exists(target, ec))
+    {
+        // std::filesystem::rename replaces an existing file.  Only allow it
+        // when the target is the item itself and just the case changes.
+        if (!fs::equivalent(path, target, ec) && !ec)
+        {
+            ec = std::make_error_code(std::errc::file_exists);
+        }
+    }
+
+    if (!ec && !m_dryRun)
+    {
+        fs::rename(path, target, ec);
+    }
+
+    if (ec)
+    {
+        _ReportError(path, ec);
+    }
+    else
+    {
+        m_stats.renameCount++;
+        m_onResult(path, newName, ec);
+    }
+}
+
+void CBatchRenamer::_ReportError(_In_ const fs::path& path, _In_ const std::error_code& error)
+{
+    m_stats.errorCount++;
+    m_onResult(path, std::wstring(), error);
+}
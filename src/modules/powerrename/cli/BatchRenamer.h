@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// The walker only uses the standard library so it builds with any C++17
+// compiler.  The annotations come from the Windows SDK when it is there.
+#ifndef _In_
+#define _In_
+#endif
+#ifndef _Inout_
+#define _Inout_
+#endif
+
+struct BatchRenameStats
+{
+    uint64_t itemCount = 0;
+    uint64_t renameCount = 0;
+    uint64_t errorCount = 0;
+};
+
+// An item of a batch.  newName is set by the NewNamesCallback for the items
+// to rename and left empty for the others.
+struct BatchRenameItem
+{
+    std::filesystem::path path;
+    bool isFolder = false;
+    // 0 for the paths passed to Rename, 1 for their contents and so on
+    unsigned int depth = 0;
+    std::optional<std::wstring> newName;
+};
+
+// Walks the file system with std::filesystem and renames items as it goes so
+// the tree never has to be held in memory.  Items are visited in the same
+// order as PowerRenameUI lists them, a folder before its contents, and passed
+// to the NewNamesCallback in batches of up to batchSize.  The batch is renamed
+// as soon as it has its new names.
+//
+// Besides the batch only the listing of the folders on the current path is
+// kept: a folder is listed in full before any of its items are renamed, so a
+// renamed item is never seen twice.  Items are renamed before the folders
+// above them so their paths stay valid.  A folder whose contents go on past
+// its batch keeps its new name until they are done.
+class CBatchRenamer
+{
+public:
+    // Sets the new name of the items of a batch to rename
+    typedef std::function<void(_Inout_ std::vector<BatchRenameItem>& items)> NewNamesCallback;
+
+    // Called for every item that is renamed, or would be in a dry run, and
+    // for every failure.  error is empty on success.
+    typedef std::function<void(_In_ const std::filesystem::path& path, _In_ const std::wstring& newName, _In_ const std::error_code& error)> ResultCallback;
+
+    CBatchRenamer(_In_ NewNamesCallback getNewNames, _In_ ResultCallback onResult, _In_ size_t batchSize, _In_ bool dryRun, _In_ bool recurse) :
+        m_getNewNames(std::move(getNewNames)),
+        m_onResult(std::move(onResult)),
+        m_batchSize((batchSize > 0) ? batchSize : 1),
+        m_dryRun(dryRun),
+        m_recurse(recurse)
+    {
+    }
+
+    // Renames path and, if it is a folder, everything below it.  The last
+    // items may wait in the batch for the next path or Flush.
+    void Rename(_In_ const std::filesystem::path& path);
+
+    // Renames the items waiting in the batch
+    void Flush();
+
+    const BatchRenameStats& GetStats() const { return m_stats; }
+
+private:
+    // A folder whose contents are being visited.  Until its batch is renamed
+    // batchIndex is its index in m_batch, then its new name is kept here.
+    struct OpenFolder
+    {
+        size_t batchIndex = 0;
+        bool isBatched = true;
+        std::optional<std::wstring> newName;
+    };
+
+    void _VisitItem(_In_ const std::filesystem::path& path, _In_ bool isFolder, _In_ unsigned int depth);
+    void _VisitFolderContents(_In_ const std::filesystem::path& folder, _In_ unsigned int depth);
+    void _RenameItem(_In_ const std::filesystem::path& path, _In_ const std::wstring& newName);
+    void _ReportError(_In_ const std::filesystem::path& path, _In_ const std::error_code& error);
+
+    NewNamesCallback m_getNewNames;
+    ResultCallback m_onResult;
+    size_t m_batchSize = 1;
+    bool m_dryRun = false;
+    bool m_recurse = true;
+    BatchRenameStats m_stats;
+
+    std::vector<BatchRenameItem> m_batch;
+    std::vector<OpenFolder> m_openFolders;
+};
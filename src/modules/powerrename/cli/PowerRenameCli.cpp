@@ -0,0 +1,359 @@
+// PowerRenameCli.cpp : Applies a PowerRename search and replace to files from the command line.
+//
+
+#include "stdafx.h"
+#include <PowerRenameInterfaces.h>
+#include <PowerRenameItem.h>
+#include <PowerRenameManager.h>
+#include <PowerRenamePreview.h>
+#include "BatchRenamer.h"
+#include <fcntl.h>
+#include <io.h>
+#include <chrono>
+#include <vector>
+
+HINSTANCE g_hInst = GetModuleHandle(nullptr);
+
+// Size of the stdout buffer.  Every renamed item is written as a line so a
+// large buffer keeps the console from limiting throughput.
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Items passed through the manager at once.  Bounds the memory used whatever
+// the size of the tree while keeping the preview worker busy.
+#define RENAME_BATCH_SIZE 4096
+
+struct FlagOption
+{
+    PCWSTR name;
+    DWORD flag;
+};
+
+// Options that set a PowerRenameFlags value
+static const FlagOption c_flagOptions[] = {
+    { L"--regex", UseRegularExpressions },
+    { L"--case-sensitive", CaseSensitive },
+    { L"--enumerate", EnumerateItems },
+    { L"--exclude-files", ExcludeFiles },
+    { L"--exclude-folders", ExcludeFolders },
+    { L"--exclude-subfolders", ExcludeSubfolders },
+    { L"--name-only", NameOnly },
+    { L"--extension-only", ExtensionOnly },
+};
+
+// Reports the items the search gave up on
+class CCliManagerEvents :
+    public IPowerRenameManagerEvents
+{
+public:
+    // IUnknown
+    IFACEMETHODIMP QueryInterface(_In_ REFIID riid, _Outptr_ void** ppv)
+    {
+        static const QITAB qit[] = {
+            QITABENT(CCliManagerEvents, IPowerRenameManagerEvents),
+            { 0 },
+        };
+        return QISearch(this, qit, riid, ppv);
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&m_refCount);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        long refCount = InterlockedDecrement(&m_refCount);
+        if (refCount == 0)
+        {
+            delete this;
+        }
+        return refCount;
+    }
+
+    // IPowerRenameManagerEvents
+    IFACEMETHODIMP OnItemAdded(_In_ IPowerRenameItem*) { return S_OK; }
+    IFACEMETHODIMP OnUpdateRange(_In_ UINT, _In_ UINT) { return S_OK; }
+    IFACEMETHODIMP OnItemsAdded(_In_ UINT, _In_ UINT) { return S_OK; }
+    IFACEMETHODIMP OnRegExStarted(_In_ DWORD) { return S_OK; }
+    IFACEMETHODIMP OnRegExCanceled(_In_ DWORD) { return S_OK; }
+    IFACEMETHODIMP OnRegExCompleted(_In_ DWORD) { return S_OK; }
+    IFACEMETHODIMP OnRenameStarted() { return S_OK; }
+    IFACEMETHODIMP OnRenameProgress(_In_ UINT, _In_ UINT) { return S_OK; }
+    IFACEMETHODIMP OnRenameCompleted() { return S_OK; }
+    IFACEMETHODIMP OnEnumerationCompleted() { return S_OK; }
+    IFACEMETHODIMP OnEnumerationError(_In_ HRESULT) { return S_OK; }
+
+    // Only the preview runs, so this is an item the search ran out of time on
+    IFACEMETHODIMP OnError(_In_ IPowerRenameItem* renameItem, _In_ HRESULT hr)
+    {
+        m_timeoutCount++;
+        PWSTR path = nullptr;
+        if (SUCCEEDED(renameItem->get_path(&path)))
+        {
+            fwprintf(stderr, L"Search gave up on %s (0x%08X)\n", path, static_cast<unsigned int>(hr));
+            CoTaskMemFree(path);
+        }
+        return S_OK;
+    }
+
+    uint64_t GetTimeoutCount() const { return m_timeoutCount; }
+
+private:
+    ~CCliManagerEvents() = default;
+
+    uint64_t m_timeoutCount = 0;
+    long m_refCount = 1;
+};
+
+// Dispatches the messages the manager posted to its window, which report the
+// errors of the preview and free the snapshots it replaced
+void DispatchManagerMessages()
+{
+    MSG msg;
+    while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+    {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+}
+
+// Sets the new names of a batch with the preview of the manager.  The manager
+// numbers the batch after the ones before it.
+void GetNewNames(_In_ IPowerRenameManager* psrm, _Inout_ std::vector<BatchRenameItem>& items)
+{
+    // The items of a factory share its string store, which is freed with them
+    // once the batch is removed from the manager
+    CComPtr<IPowerRenameItemFactory> spItemFactory;
+    if (FAILED(CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&spItemFactory))))
+    {
+        return;
+    }
+
+    std::vector<CComPtr<IPowerRenameItem>> renameItems;
+    std::vector<IPowerRenameItem*> addedItems;
+    std::vector<size_t> batchIndexes;
+    renameItems.reserve(items.size());
+    addedItems.reserve(items.size());
+    batchIndexes.reserve(items.size());
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        CComPtr<IPowerRenameItem> spItem;
+        if (SUCCEEDED(spItemFactory->CreateFromPath(items[i].path.c_str(), items[i].isFolder, nullptr, &spItem)))
+        {
+            spItem->put_depth(static_cast<int>(items[i].depth));
+            addedItems.push_back(spItem);
+            renameItems.push_back(std::move(spItem));
+            batchIndexes.push_back(i);
+        }
+    }
+
+    UINT count = static_cast<UINT>(addedItems.size());
+    if (count > 0 && SUCCEEDED(psrm->AddItems(addedItems.data(), count)) && SUCCEEDED(psrm->WaitForPreview()))
+    {
+        // Reports the items that ran out of time while they are still there
+        DispatchManagerMessages();
+
+        const CPreviewSnapshot* snapshot = nullptr;
+        if (SUCCEEDED(psrm->GetPreviewSnapshot(&snapshot)))
+        {
+            for (UINT u = 0; u < count && u < snapshot->GetItemCount(); u++)
+            {
+                const PreviewItem* previewItem = snapshot->GetItem(u);
+                if (previewItem && (previewItem->state & PREVIEW_ITEM_SHOULD_RENAME) && previewItem->newName)
+                {
+                    items[batchIndexes[u]].newName = previewItem->newName;
+                }
+            }
+        }
+    }
+
+    psrm->RemoveAllItems();
+    DispatchManagerMessages();
+}
+
+void PrintUsage()
+{
+    fwprintf(stderr,
+             L"Usage: PowerRenameCli [options] <search> <replace> <path>...\n"
+             L"\n"
+             L"Renames each path, and everything below it for folders, with the\n"
+             L"PowerRename search and replace rules.  Renamed items are written to\n"
+             L"stdout as \"<path>\\t<new name>\" as they are processed.\n"
+             L"\n"
+             L"  --regex                Use regular expressions\n"
+             L"  --case-sensitive       Match case\n"
+             L"  --first                Replace the first match only\n"
+             L"  --enumerate            Enumerate items\n"
+             L"  --exclude-files        Do not rename files\n"
+             L"  --exclude-folders      Do not rename folders\n"
+             L"  --exclude-subfolders   Do not visit the contents of folders\n"
+             L"  --name-only            Apply to the name without the extension\n"
+             L"  --extension-only       Apply to the extension only\n"
+             L"  --dry-run              Report the new names without renaming\n"
+             L"  --quiet                Only report errors and the summary\n"
+             L"\n"
+             L"The replace term may contain ${start=1,increment=1,padding=3} counters\n"
+             L"and the $YYYY $YY $MM $DD $hh $mm $ss $fff creation date tokens.\n");
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+    DWORD flags = MatchAllOccurences;
+    bool dryRun = false;
+    bool quiet = false;
+    std::vector<PCWSTR> arguments;
+    for (int i = 1; i < argc; i++)
+    {
+        PCWSTR arg = argv[i];
+        bool known = true;
+        if (wcsncmp(arg, L"--", 2) != 0)
+        {
+            arguments.push_back(arg);
+        }
+        else if (wcscmp(arg, L"--first") == 0)
+        {
+            flags &= ~MatchAllOccurences;
+        }
+        else if (wcscmp(arg, L"--dry-run") == 0)
+        {
+            dryRun = true;
+        }
+        else if (wcscmp(arg, L"--quiet") == 0)
+        {
+            quiet = true;
+        }
+        else
+        {
+            known = false;
+            for (const auto& option : c_flagOptions)
+            {
+                if (wcscmp(arg, option.name) == 0)
+                {
+                    flags |= option.flag;
+                    known = true;
+                    break;
+                }
+            }
+        }
+
+        if (!known)
+        {
+            fwprintf(stderr, L"Unknown option %s\n\n", arg);
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    if (arguments.size() < 3)
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    // Paths and names may contain any character
+    _setmode(_fileno(stdout), _O_U8TEXT);
+    _setmode(_fileno(stderr), _O_U8TEXT);
+    setvbuf(stdout, nullptr, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+    if (FAILED(hr))
+    {
+        fwprintf(stderr, L"Failed to initialize COM (0x%08X)\n", hr);
+        return 1;
+    }
+
+    // The manager evaluates the search and replace, the exclusions and the
+    // numbering exactly as the preview of PowerRenameUI does
+    CComPtr<IPowerRenameManager> spsrm;
+    CComPtr<IPowerRenameRegEx> spRenameRegEx;
+    CCliManagerEvents* events = new CCliManagerEvents();
+    DWORD cookie = 0;
+    hr = CPowerRenameManager::s_CreateInstance(&spsrm);
+    if (SUCCEEDED(hr))
+    {
+        hr = spsrm->Advise(events, &cookie);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = spsrm->get_renameRegEx(&spRenameRegEx);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = spRenameRegEx->put_flags(flags);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = spRenameRegEx->put_searchTerm(arguments[0]);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = spRenameRegEx->put_replaceTerm(arguments[1]);
+    }
+
+    BatchRenameStats stats;
+    std::chrono::duration<double> elapsed(0);
+    if (SUCCEEDED(hr))
+    {
+        auto getNewNames = [&spsrm](_Inout_ std::vector<BatchRenameItem>& items) {
+            GetNewNames(spsrm, items);
+        };
+
+        auto onResult = [quiet](_In_ const std::filesystem::path& path, _In_ const std::wstring& newName, _In_ const std::error_code& error) {
+            if (error)
+            {
+                fwprintf(stderr, L"%s: %S\n", path.c_str(), error.message().c_str());
+            }
+            else if (!quiet)
+            {
+                wprintf(L"%s\t%s\n", path.c_str(), newName.c_str());
+            }
+        };
+
+        // Skipping the contents is faster than visiting and excluding them
+        CBatchRenamer renamer(getNewNames, onResult, RENAME_BATCH_SIZE, dryRun, (flags & ExcludeSubfolders) == 0);
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 2; i < arguments.size(); i++)
+        {
+            renamer.Rename(arguments[i]);
+        }
+        renamer.Flush();
+        elapsed = std::chrono::steady_clock::now() - start;
+        fflush(stdout);
+
+        stats = renamer.GetStats();
+    }
+    else
+    {
+        fwprintf(stderr, L"Failed to set up the search and replace (0x%08X)\n", hr);
+    }
+
+    uint64_t timeoutCount = events->GetTimeoutCount();
+    if (spsrm)
+    {
+        spsrm->UnAdvise(cookie);
+        spsrm->Shutdown();
+    }
+    events->Release();
+    spRenameRegEx.Release();
+    spsrm.Release();
+    CoUninitialize();
+
+    if (FAILED(hr))
+    {
+        return 1;
+    }
+
+    double itemsPerSecond = (elapsed.count() > 0) ? static_cast<double>(stats.itemCount) / elapsed.count() : 0.0;
+    fwprintf(stderr,
+             L"%llu items, %llu %s, %llu errors, %llu timed out in %.2f s (%.0f items/s)\n",
+             stats.itemCount,
+             stats.renameCount,
+             dryRun ? L"to rename" : L"renamed",
+             stats.errorCount,
+             timeoutCount,
+             elapsed.count(),
+             itemsPerSecond);
+
+    return (stats.errorCount > 0 || timeoutCount > 0) ? 1 : 0;
+}
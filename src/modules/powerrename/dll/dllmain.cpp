@@ -257,6 +257,7 @@ public:
             CSettings::SetMaxMRUSize(values.get_int_value(L"int_max_mru_size").value());
             CSettings::SetShowIconOnMenu(values.get_bool_value(L"bool_show_icon_on_menu").value());
             CSettings::SetExtendedContextMenuOnly(values.get_bool_value(L"bool_show_extended_menu").value());
+            CSettings::Flush();
         }
         catch (std::exception)
         {
@@ -294,6 +295,7 @@ public:
     void save_settings()
     {
         CSettings::SetEnabled(m_enabled);
+        CSettings::Flush();
         Trace::EnablePowerRename(m_enabled);
     }
 
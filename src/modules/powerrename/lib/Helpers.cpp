@@ -1,8 +1,66 @@
 #include "stdafx.h"
 #include "Helpers.h"
+#include "PowerRenameRegEx.h"
+#include "PowerRenameTemplate.h"
 #include <ShlGuid.h>
+#include <shlobj.h>
+#include <atomic>
+#include <memory>
 
-HRESULT _ParseEnumItems(_In_ IEnumShellItems* pesi, _In_ IPowerRenameManager* psrm, _In_ int depth = 0)
+// Maximum number of items passed to the callback of EnumerateShellItems at once
+#define ENUM_BATCH_SIZE 1024
+
+// Maximum time an item found by EnumerateShellItems waits before it is passed
+// to the callback.  Keeps the first items appearing quickly in large folders.
+#define ENUM_BATCH_INTERVAL_MS 100
+
+// Number of shell items requested from an enumerator at once
+#define ENUM_FETCH_COUNT 64
+
+// Threads per processor used by EnumerateShellItemsParallel.  Listing a folder
+// mostly waits on the file system.
+#define ENUM_THREADS_PER_PROCESSOR 2
+
+struct EnumerateItemsState
+{
+    IPowerRenameItemFactory* psrif = nullptr;
+    HANDLE cancelEvent = nullptr;
+    const EnumerateItemsCallback* addItems = nullptr;
+    std::vector<CComPtr<IPowerRenameItem>> batch;
+    ULONGLONG nextFlushTick = 0;
+};
+
+HRESULT _FlushEnumItems(_In_ EnumerateItemsState* state)
+{
+    HRESULT hr = S_OK;
+    if (!state->batch.empty())
+    {
+        hr = (*state->addItems)(state->batch);
+        state->batch.clear();
+    }
+
+    state->nextFlushTick = GetTickCount64() + ENUM_BATCH_INTERVAL_MS;
+
+    if (SUCCEEDED(hr) && state->cancelEvent && WaitForSingleObject(state->cancelEvent, 0) == WAIT_OBJECT_0)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    }
+
+    return hr;
+}
+
+HRESULT _AddEnumItem(_In_ EnumerateItemsState* state, _In_ IPowerRenameItem* item)
+{
+    HRESULT hr = S_OK;
+    state->batch.push_back(item);
+    if (state->batch.size() >= ENUM_BATCH_SIZE || GetTickCount64() >= state->nextFlushTick)
+    {
+        hr = _FlushEnumItems(state);
+    }
+    return hr;
+}
+
+HRESULT _ParseEnumItems(_In_ IEnumShellItems* pesi, _In_ EnumerateItemsState* state, _In_ int depth = 0)
 {
     HRESULT hr = E_INVALIDARG;
 
@@ -12,20 +70,31 @@ HRESULT _ParseEnumItems(_In_ IEnumShellItems* pesi, _In_ IPowerRenameManager* ps
     {
         hr = S_OK;
 
-        ULONG celtFetched;
-        CComPtr<IShellItem> spsi;
-        while ((S_OK == pesi->Next(1, &spsi, &celtFetched)) && (SUCCEEDED(hr)))
+        IShellItem* items[ENUM_FETCH_COUNT] = { 0 };
+        ULONG celtFetched = 0;
+        HRESULT hrNext = S_OK;
+        while (SUCCEEDED(hr) && (hrNext == S_OK))
         {
-            CComPtr<IPowerRenameItemFactory> spsrif;
-            hr = psrm->get_renameItemFactory(&spsrif);
-            if (SUCCEEDED(hr))
+            celtFetched = 0;
+            hrNext = pesi->Next(ARRAYSIZE(items), items, &celtFetched);
+            for (ULONG i = 0; i < celtFetched; i++)
             {
+                CComPtr<IShellItem> spsi;
+                spsi.Attach(items[i]);
+                items[i] = nullptr;
+
+                if (FAILED(hr))
+                {
+                    // Release the rest of the fetched items
+                    continue;
+                }
+
                 CComPtr<IPowerRenameItem> spNewItem;
-                hr = spsrif->Create(spsi, &spNewItem);
+                hr = state->psrif->Create(spsi, &spNewItem);
                 if (SUCCEEDED(hr))
                 {
                     spNewItem->put_depth(depth);
-                    hr = psrm->AddItem(spNewItem);
+                    hr = _AddEnumItem(state, spNewItem);
                 }
 
                 if (SUCCEEDED(hr))
@@ -39,46 +108,474 @@ HRESULT _ParseEnumItems(_In_ IEnumShellItems* pesi, _In_ IPowerRenameManager* ps
                         if (SUCCEEDED(hr))
                         {
                             // Parse the folder contents recursively
-                            hr = _ParseEnumItems(spesiNext, psrm, depth + 1);
+                            hr = _ParseEnumItems(spesiNext, state, depth + 1);
                         }
                     }
                 }
             }
+        }
+    }
+
+    return hr;
+}
 
-            spsi = nullptr;
+HRESULT GetPowerRenameDataFolder(_Out_ std::wstring& folder)
+{
+    folder.clear();
+    PWSTR localAppData = nullptr;
+    HRESULT hr = SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr, &localAppData);
+    if (SUCCEEDED(hr))
+    {
+        std::wstring path = std::wstring(localAppData) + L"\\Microsoft\\PowerToys\\PowerRename";
+        CoTaskMemFree(localAppData);
+
+        int result = SHCreateDirectoryEx(nullptr, path.c_str(), nullptr);
+        if (result == ERROR_SUCCESS || result == ERROR_ALREADY_EXISTS)
+        {
+            folder = path;
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(result);
         }
     }
 
     return hr;
 }
 
-// Iterate through the data source and add paths to the rotation manager
-HRESULT EnumerateDataObject(_In_ IUnknown* dataSource, _In_ IPowerRenameManager* psrm)
+HRESULT GetShellItemArrayFromDataObject(_In_ IUnknown* dataSource, _COM_Outptr_ IShellItemArray** items)
 {
-    CComPtr<IShellItemArray> spsia;
-    IDataObject* dataObj{};
+    *items = nullptr;
+    CComPtr<IDataObject> dataObj;
     HRESULT hr;
-    if (SUCCEEDED(dataSource->QueryInterface(IID_IDataObject, reinterpret_cast<void**>(&dataObj))))
+    if (SUCCEEDED(dataSource->QueryInterface(IID_PPV_ARGS(&dataObj))))
     {
-        hr = SHCreateShellItemArrayFromDataObject(dataObj, IID_PPV_ARGS(&spsia));
+        hr = SHCreateShellItemArrayFromDataObject(dataObj, IID_PPV_ARGS(items));
     }
     else
     {
-        hr = dataSource->QueryInterface(IID_IShellItemArray, reinterpret_cast<void**>(&spsia));
+        hr = dataSource->QueryInterface(IID_PPV_ARGS(items));
     }
+
+    return hr;
+}
+
+// Walks the items and the contents of any folders in them.  Items are created
+// with the factory and passed to addItems in batches, in enumeration order.
+// Returns HRESULT_FROM_WIN32(ERROR_CANCELLED) if cancelEvent is signaled.
+HRESULT EnumerateShellItems(_In_ IShellItemArray* psia, _In_ IPowerRenameItemFactory* psrif, _In_opt_ HANDLE cancelEvent, _In_ const EnumerateItemsCallback& addItems)
+{
+    EnumerateItemsState state;
+    state.psrif = psrif;
+    state.cancelEvent = cancelEvent;
+    state.addItems = &addItems;
+    state.nextFlushTick = GetTickCount64() + ENUM_BATCH_INTERVAL_MS;
+    state.batch.reserve(ENUM_BATCH_SIZE);
+
+    CComPtr<IEnumShellItems> spesi;
+    HRESULT hr = psia->EnumItems(&spesi);
     if (SUCCEEDED(hr))
     {
-        CComPtr<IEnumShellItems> spesi;
-        hr = spsia->EnumItems(&spesi);
+        hr = _ParseEnumItems(spesi, &state);
+    }
+
+    // Pass on what was found even if the enumeration failed part way
+    HRESULT hrFlush = _FlushEnumItems(&state);
+    return SUCCEEDED(hr) ? hrFlush : hr;
+}
+
+// A folder whose contents are listed by its own thread pool work item.  The
+// entries are read by the walking thread once doneEvent is signaled.
+struct EnumFolderNode
+{
+    struct Entry
+    {
+        CComPtr<IPowerRenameItem> spItem;
+        std::unique_ptr<EnumFolderNode> folder;
+    };
+
+    struct EnumParallelState* state = nullptr;
+    CComPtr<IShellItem> spsi;
+    int depth = 0;
+    HANDLE doneEvent = nullptr;
+    HRESULT hr = S_OK;
+    std::vector<Entry> entries;
+
+    ~EnumFolderNode()
+    {
+        if (doneEvent)
+        {
+            CloseHandle(doneEvent);
+        }
+    }
+};
+
+struct EnumParallelState : EnumerateItemsState
+{
+    TP_CALLBACK_ENVIRON callbackEnviron;
+    PTP_POOL pool = nullptr;
+    // Set once the walk is over.  Work items still queued return right away.
+    std::atomic<bool> stop{ false };
+    // Work items queued or running plus one held by the walking thread
+    std::atomic<long> pendingCount{ 1 };
+    HANDLE idleEvent = nullptr;
+};
+
+HRESULT _SubmitEnumFolder(_In_ EnumParallelState* state, _In_ EnumFolderNode* node);
+
+// Lists one folder.  Subfolders found are submitted as work items of their own
+// right away so that siblings are listed in parallel.
+VOID CALLBACK _EnumFolderCallback(_Inout_ PTP_CALLBACK_INSTANCE, _Inout_opt_ PVOID pv)
+{
+    EnumFolderNode* node = reinterpret_cast<EnumFolderNode*>(pv);
+    EnumParallelState* state = node->state;
+
+    HRESULT hr = E_INVALIDARG;
+    if (state->stop)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    }
+    // Same limit as _ParseEnumItems
+    else if (node->depth < (MAX_PATH / 2))
+    {
+        hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
         if (SUCCEEDED(hr))
         {
-            hr = _ParseEnumItems(spesi, psrm);
+            CComPtr<IEnumShellItems> spesi;
+            hr = node->spsi->BindToHandler(nullptr, BHID_EnumItems, IID_PPV_ARGS(&spesi));
+
+            IShellItem* items[ENUM_FETCH_COUNT] = { 0 };
+            ULONG celtFetched = 0;
+            HRESULT hrNext = S_OK;
+            while (SUCCEEDED(hr) && (hrNext == S_OK))
+            {
+                if (state->stop || (state->cancelEvent && WaitForSingleObject(state->cancelEvent, 0) == WAIT_OBJECT_0))
+                {
+                    hr = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+                    break;
+                }
+
+                celtFetched = 0;
+                hrNext = spesi->Next(ARRAYSIZE(items), items, &celtFetched);
+                for (ULONG i = 0; i < celtFetched; i++)
+                {
+                    CComPtr<IShellItem> spsi;
+                    spsi.Attach(items[i]);
+                    items[i] = nullptr;
+
+                    if (FAILED(hr))
+                    {
+                        // Release the rest of the fetched items
+                        continue;
+                    }
+
+                    EnumFolderNode::Entry entry;
+                    hr = state->psrif->Create(spsi, &entry.spItem);
+                    if (SUCCEEDED(hr))
+                    {
+                        entry.spItem->put_depth(node->depth);
+
+                        bool isFolder = false;
+                        if (SUCCEEDED(entry.spItem->get_isFolder(&isFolder)) && isFolder)
+                        {
+                            entry.folder.reset(new EnumFolderNode());
+                            entry.folder->state = state;
+                            entry.folder->spsi = spsi;
+                            entry.folder->depth = node->depth + 1;
+                            hr = _SubmitEnumFolder(state, entry.folder.get());
+                            if (FAILED(hr))
+                            {
+                                entry.folder.reset();
+                            }
+                        }
+
+                        node->entries.push_back(std::move(entry));
+                    }
+                }
+            }
+
+            CoUninitialize();
+        }
+    }
+
+    node->hr = hr;
+
+    // The walking thread may free the node as soon as this is signaled
+    SetEvent(node->doneEvent);
+
+    if (--state->pendingCount == 0)
+    {
+        SetEvent(state->idleEvent);
+    }
+}
+
+HRESULT _SubmitEnumFolder(_In_ EnumParallelState* state, _In_ EnumFolderNode* node)
+{
+    node->doneEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    HRESULT hr = node->doneEvent ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    if (SUCCEEDED(hr))
+    {
+        state->pendingCount++;
+        hr = TrySubmitThreadpoolCallback(_EnumFolderCallback, node, &state->callbackEnviron) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+        if (FAILED(hr))
+        {
+            state->pendingCount--;
         }
     }
 
     return hr;
 }
 
+// Passes on the contents of a folder and, depth first, of its subfolders in
+// the same order as _ParseEnumItems.  Each node is released once it is done.
+HRESULT _WalkEnumFolder(_In_ EnumParallelState* state, _In_ EnumFolderNode* node)
+{
+    HANDLE waitHandles[] = { node->doneEvent, state->cancelEvent };
+    DWORD waitCount = state->cancelEvent ? 2 : 1;
+    HRESULT hr = (WaitForMultipleObjects(waitCount, waitHandles, FALSE, INFINITE) == WAIT_OBJECT_0) ? S_OK : HRESULT_FROM_WIN32(ERROR_CANCELLED);
+
+    for (size_t i = 0; SUCCEEDED(hr) && i < node->entries.size(); i++)
+    {
+        EnumFolderNode::Entry& entry = node->entries[i];
+        hr = _AddEnumItem(state, entry.spItem);
+        entry.spItem.Release();
+        if (SUCCEEDED(hr) && entry.folder)
+        {
+            // Descendants may still be listed if the walk stopped early
+            hr = _WalkEnumFolder(state, entry.folder.get());
+            if (SUCCEEDED(hr))
+            {
+                entry.folder.reset();
+            }
+        }
+    }
+
+    // Stop where the serial walk would have stopped
+    if (SUCCEEDED(hr))
+    {
+        hr = node->hr;
+    }
+
+    return hr;
+}
+
+// Same as EnumerateShellItems but every folder is listed by its own thread
+// pool work item.  Items are still passed to addItems in the order and with
+// the depth EnumerateShellItems would give them.  Must be called from a
+// thread in the multithreaded apartment since the shell items are handed to
+// the thread pool.
+HRESULT EnumerateShellItemsParallel(_In_ IShellItemArray* psia, _In_ IPowerRenameItemFactory* psrif, _In_opt_ HANDLE cancelEvent, _In_ const EnumerateItemsCallback& addItems)
+{
+    EnumParallelState state;
+    state.psrif = psrif;
+    state.cancelEvent = cancelEvent;
+    state.addItems = &addItems;
+    state.nextFlushTick = GetTickCount64() + ENUM_BATCH_INTERVAL_MS;
+    state.batch.reserve(ENUM_BATCH_SIZE);
+
+    // A private pool so that a wide tree does not flood the process pool
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    DWORD maxThreads = (std::max)(systemInfo.dwNumberOfProcessors * ENUM_THREADS_PER_PROCESSOR, 2UL);
+
+    InitializeThreadpoolEnvironment(&state.callbackEnviron);
+    state.pool = CreateThreadpool(nullptr);
+    state.idleEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    HRESULT hr = (state.pool && state.idleEvent) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    if (SUCCEEDED(hr))
+    {
+        SetThreadpoolThreadMaximum(state.pool, maxThreads);
+        SetThreadpoolCallbackPool(&state.callbackEnviron, state.pool);
+    }
+
+    // The top level items are few so they are listed here.  Any folders in
+    // them start their work items before the walk below waits on the first.
+    std::vector<EnumFolderNode::Entry> entries;
+    CComPtr<IEnumShellItems> spesi;
+    if (SUCCEEDED(hr))
+    {
+        hr = psia->EnumItems(&spesi);
+    }
+
+    IShellItem* items[ENUM_FETCH_COUNT] = { 0 };
+    ULONG celtFetched = 0;
+    HRESULT hrNext = S_OK;
+    while (SUCCEEDED(hr) && (hrNext == S_OK))
+    {
+        celtFetched = 0;
+        hrNext = spesi->Next(ARRAYSIZE(items), items, &celtFetched);
+        for (ULONG i = 0; i < celtFetched; i++)
+        {
+            CComPtr<IShellItem> spsi;
+            spsi.Attach(items[i]);
+            items[i] = nullptr;
+
+            if (FAILED(hr))
+            {
+                continue;
+            }
+
+            EnumFolderNode::Entry entry;
+            hr = psrif->Create(spsi, &entry.spItem);
+            if (SUCCEEDED(hr))
+            {
+                entry.spItem->put_depth(0);
+
+                bool isFolder = false;
+                if (SUCCEEDED(entry.spItem->get_isFolder(&isFolder)) && isFolder)
+                {
+                    entry.folder.reset(new EnumFolderNode());
+                    entry.folder->state = &state;
+                    entry.folder->spsi = spsi;
+                    entry.folder->depth = 1;
+                    hr = _SubmitEnumFolder(&state, entry.folder.get());
+                    if (FAILED(hr))
+                    {
+                        entry.folder.reset();
+                    }
+                }
+
+                entries.push_back(std::move(entry));
+            }
+        }
+    }
+
+    HRESULT hrWalk = S_OK;
+    for (size_t i = 0; SUCCEEDED(hrWalk) && i < entries.size(); i++)
+    {
+        hrWalk = _AddEnumItem(&state, entries[i].spItem);
+        if (SUCCEEDED(hrWalk) && entries[i].folder)
+        {
+            hrWalk = _WalkEnumFolder(&state, entries[i].folder.get());
+            if (SUCCEEDED(hrWalk))
+            {
+                entries[i].folder.reset();
+            }
+        }
+    }
+
+    // After a failure or cancel some work items may still be queued or running.
+    // Wait for all of them before the nodes they write to are freed.
+    state.stop = true;
+    if (--state.pendingCount != 0)
+    {
+        WaitForSingleObject(state.idleEvent, INFINITE);
+    }
+    entries.clear();
+
+    if (state.pool)
+    {
+        CloseThreadpool(state.pool);
+    }
+    if (state.idleEvent)
+    {
+        CloseHandle(state.idleEvent);
+    }
+    DestroyThreadpoolEnvironment(&state.callbackEnviron);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = hrWalk;
+    }
+
+    // Pass on what was found even if the enumeration failed part way
+    HRESULT hrFlush = _FlushEnumItems(&state);
+    return SUCCEEDED(hr) ? hrFlush : hr;
+}
+
+HRESULT GetRegExNewName(_In_ PCWSTR originalName,
+                        _In_ UINT extensionOffset,
+                        _In_ IPowerRenameRegEx* renameRegEx,
+                        _In_opt_ IPowerRenameTemplateRegEx* templateRegEx,
+                        _In_ DWORD flags,
+                        _In_opt_ HANDLE cancelEvent,
+                        _Out_ std::optional<std::wstring>& newName)
+{
+    newName.reset();
+
+    PCWSTR extension = originalName + extensionOffset;
+
+    wchar_t sourceName[MAX_PATH] = { 0 };
+    if (flags & NameOnly)
+    {
+        StringCchCopyN(sourceName, ARRAYSIZE(sourceName), originalName, extensionOffset);
+    }
+    else if (flags & ExtensionOnly)
+    {
+        StringCchCopy(sourceName, ARRAYSIZE(sourceName), (*extension == L'.') ? extension + 1 : extension);
+    }
+    else
+    {
+        StringCchCopy(sourceName, ARRAYSIZE(sourceName), originalName);
+    }
+
+    PWSTR replaced = nullptr;
+    // Failure here means we didn't match anything or had nothing to match
+    // Leave the result empty in that case to reset the new name
+    HRESULT hr = templateRegEx ? templateRegEx->ReplaceWithPlaceholders(sourceName, cancelEvent, &replaced) : renameRegEx->ReplaceWithCancel(sourceName, cancelEvent, &replaced);
+
+    // replaced == nullptr likely means we have an empty search string.  We should leave
+    // the result empty so we clear the renamed column
+    if (replaced != nullptr)
+    {
+        // The part of the name kept around the replaced part.  If the replace
+        // term has tokens the new name is expanded later, and characters of
+        // the kept part that look like placeholders have to be escaped the
+        // way the search escapes the replaced part.
+        PCWSTR keptPart = (flags & NameOnly) ? extension : originalName;
+        size_t keptLength = (flags & NameOnly) ? wcslen(extension) : ((flags & ExtensionOnly) ? extensionOffset : 0);
+        std::wstring escapedPart;
+        if (templateRegEx && CPowerRenameTemplate::s_HasReservedCharacters(keptPart, keptLength))
+        {
+            PWSTR replaceTerm = nullptr;
+            if (SUCCEEDED(renameRegEx->get_replaceTerm(&replaceTerm)))
+            {
+                CPowerRenameTemplate renameTemplate;
+                renameTemplate.Compile(replaceTerm, !(flags & UseRegularExpressions));
+                if (renameTemplate.HasTokens())
+                {
+                    CPowerRenameTemplate::s_AppendEscaped(keptPart, keptLength, escapedPart);
+                    keptPart = escapedPart.c_str();
+                    keptLength = escapedPart.length();
+                }
+                CoTaskMemFree(replaceTerm);
+            }
+        }
+
+        wchar_t resultName[MAX_PATH] = { 0 };
+        if (flags & NameOnly)
+        {
+            StringCchPrintf(resultName, ARRAYSIZE(resultName), L"%s%.*s", replaced, static_cast<int>(keptLength), keptPart);
+        }
+        else if (flags & ExtensionOnly)
+        {
+            if (*extension != L'\0')
+            {
+                StringCchPrintf(resultName, ARRAYSIZE(resultName), L"%.*s.%s", static_cast<int>(keptLength), keptPart, replaced);
+            }
+            else
+            {
+                StringCchCopy(resultName, ARRAYSIZE(resultName), originalName);
+            }
+        }
+        else
+        {
+            StringCchCopy(resultName, ARRAYSIZE(resultName), replaced);
+        }
+
+        // No change from originalName so leave the result empty
+        // so we clear it from our UI as well.
+        if (lstrcmp(originalName, resultName) != 0)
+        {
+            newName = resultName;
+        }
+
+        CoTaskMemFree(replaced);
+    }
+
+    return hr;
+}
+
 BOOL GetEnumeratedFileName(__out_ecount(cchMax) PWSTR pszUniqueName, UINT cchMax, __in PCWSTR pszTemplate, __in_opt PCWSTR pszDir, unsigned long ulMinLong, __inout unsigned long* pulNumUsed)
 {
     PWSTR pszName = nullptr;
@@ -2,8 +2,34 @@
 
 #include <common.h>
 #include <lib/PowerRenameInterfaces.h>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
 
-HRESULT EnumerateDataObject(_In_ IUnknown* pdo, _In_ IPowerRenameManager* psrm);
+interface IPowerRenameTemplateRegEx;
+
+// Receives a batch of items found by EnumerateShellItems
+typedef std::function<HRESULT(std::vector<CComPtr<IPowerRenameItem>>& items)> EnumerateItemsCallback;
+
+HRESULT EnumerateShellItems(_In_ IShellItemArray* psia, _In_ IPowerRenameItemFactory* psrif, _In_opt_ HANDLE cancelEvent, _In_ const EnumerateItemsCallback& addItems);
+HRESULT EnumerateShellItemsParallel(_In_ IShellItemArray* psia, _In_ IPowerRenameItemFactory* psrif, _In_opt_ HANDLE cancelEvent, _In_ const EnumerateItemsCallback& addItems);
+// Applies the search and replace to an item name, honoring the NameOnly and
+// ExtensionOnly flags.  newName has no value if the name does not change.
+// With templateRegEx, the IPowerRenameTemplateRegEx of renameRegEx, newName
+// keeps the placeholders of the replace term for CPowerRenameTemplate::Expand.
+// Returns the result of the replace.
+HRESULT GetRegExNewName(_In_ PCWSTR originalName,
+                        _In_ UINT extensionOffset,
+                        _In_ IPowerRenameRegEx* renameRegEx,
+                        _In_opt_ IPowerRenameTemplateRegEx* templateRegEx,
+                        _In_ DWORD flags,
+                        _In_opt_ HANDLE cancelEvent,
+                        _Out_ std::optional<std::wstring>& newName);
+// %LOCALAPPDATA%\Microsoft\PowerToys\PowerRename, where PowerRename keeps its
+// files.  The folder is created if needed.
+HRESULT GetPowerRenameDataFolder(_Out_ std::wstring& folder);
+HRESULT GetShellItemArrayFromDataObject(_In_ IUnknown* dataSource, _COM_Outptr_ IShellItemArray** items);
 BOOL GetEnumeratedFileName(
     __out_ecount(cchMax) PWSTR pszUniqueName,
     UINT cchMax,
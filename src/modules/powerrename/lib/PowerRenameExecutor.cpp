@@ -0,0 +1,357 @@
+#include "stdafx.h"
+#include "PowerRenameExecutor.h"
+#include "PowerRenameJournal.h"
+#include <algorithm>
+#include <shlobj.h>
+#include <unordered_map>
+
+// parentGroup of a group with no folder above it
+#define NO_PARENT_GROUP UINT_MAX
+
+std::unique_ptr<CRenameBackend> CRenameBackend::s_Create()
+{
+    return std::make_unique<CWin32RenameBackend>();
+}
+
+HRESULT CWin32RenameBackend::Rename(_In_ const std::wstring& path, _In_ const std::wstring& newPath)
+{
+    // Without MOVEFILE_REPLACE_EXISTING an existing item is never overwritten.
+    // Changing only the case of the name is still allowed.
+    if (!MoveFileEx(path.c_str(), newPath.c_str(), 0))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // IFileOperation used to tell open shell views about the rename.  The
+    // notification is queued and does not wait for the views.
+    bool isFolder = (GetFileAttributes(newPath.c_str()) & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    SHChangeNotify(isFolder ? SHCNE_RENAMEFOLDER : SHCNE_RENAMEITEM, SHCNF_PATH, path.c_str(), newPath.c_str());
+    return S_OK;
+}
+
+bool CWin32RenameBackend::Exists(_In_ const std::wstring& path)
+{
+    return GetFileAttributes(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+// Returns the folder part of path, upper cased so that it can be compared
+// without regard to case like the file system does.  Empty if there is none.
+std::wstring _GetFolderKey(_In_ const std::wstring& path)
+{
+    size_t separator = path.find_last_of(L'\\');
+    if (separator == std::wstring::npos)
+    {
+        return std::wstring();
+    }
+
+    std::wstring folder = path.substr(0, separator);
+    if (!folder.empty())
+    {
+        CharUpperBuff(&folder[0], static_cast<DWORD>(folder.length()));
+    }
+    return folder;
+}
+
+// Returns true if name can be given to an item without moving it out of its
+// folder.  A replace term or a manifest can produce any text.
+bool _IsValidItemName(_In_ const std::wstring& name)
+{
+    if (name.empty() || name == L"." || name == L"..")
+    {
+        return false;
+    }
+
+    for (wchar_t c : name)
+    {
+        if (c < L' ' || wcschr(L"\\/:*?\"<>|", c))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CRenameExecutor::Add(_In_ UINT index, _In_ const std::wstring& path, _In_ const std::wstring& newName)
+{
+    RenameRequest rename;
+    rename.index = index;
+    size_t separator = path.find_last_of(L'\\');
+    rename.folder = (separator == std::wstring::npos) ? std::wstring() : path.substr(0, separator + 1);
+    rename.name = (separator == std::wstring::npos) ? path : path.substr(separator + 1);
+    rename.newName = newName;
+    m_renames.push_back(std::move(rename));
+}
+
+// Puts the renames of the same folder in a group and links each group to the
+// group of the closest folder above it.  A group can start once the groups
+// linked to it are done.  Renames to an invalid name are reported and left
+// out, so the planner only sees items that stay in their folder.
+void CRenameExecutor::_BuildGroups()
+{
+    std::unordered_map<std::wstring, UINT> groupIndexes;
+    std::vector<std::wstring> groupFolders;
+    for (size_t i = 0; i < m_renames.size(); i++)
+    {
+        if (!_IsValidItemName(m_renames[i].newName))
+        {
+            m_onResult(m_renames[i].index, HRESULT_FROM_WIN32(ERROR_INVALID_NAME));
+            continue;
+        }
+
+        std::wstring folder = _GetFolderKey(m_renames[i].folder + m_renames[i].name);
+        auto result = groupIndexes.emplace(folder, static_cast<UINT>(m_groups.size()));
+        if (result.second)
+        {
+            m_groups.emplace_back();
+            groupFolders.push_back(std::move(folder));
+        }
+        m_groups[result.first->second].renames.push_back(i);
+    }
+
+    for (UINT group = 0; group < m_groups.size(); group++)
+    {
+        m_groups[group].parentGroup = NO_PARENT_GROUP;
+        std::wstring folder = groupFolders[group];
+        while (!folder.empty())
+        {
+            // _GetFolderKey of an upper cased folder is its parent folder
+            folder = _GetFolderKey(folder);
+            auto it = groupIndexes.find(folder);
+            if (it != groupIndexes.end())
+            {
+                m_groups[group].parentGroup = it->second;
+                m_groups[it->second].pendingChildren++;
+                break;
+            }
+        }
+    }
+}
+
+// Plans the renames of each folder and reports the ones that conflict
+void CRenameExecutor::_PlanGroups()
+{
+    RenamePlan plan;
+    std::vector<std::wstring> names;
+    std::vector<std::wstring> newNames;
+    for (auto& group : m_groups)
+    {
+        names.clear();
+        newNames.clear();
+        for (size_t i : group.renames)
+        {
+            names.push_back(m_renames[i].name);
+            newNames.push_back(m_renames[i].newName);
+        }
+
+        const std::wstring& folder = m_renames[group.renames.front()].folder;
+        PlanFolderRenames(names, newNames, [&](_In_ const std::wstring& name) { return m_backend->Exists(folder + name); }, plan);
+
+        for (const auto& conflict : plan.conflicts)
+        {
+            m_onResult(m_renames[group.renames[conflict.first]].index, conflict.second);
+        }
+
+        group.steps = std::move(plan.steps);
+    }
+}
+
+// Writes the planned steps to the journal in an order in which they can be
+// done one after the other: a folder deeper in the tree has a longer path, so
+// sorting by length puts every folder after the folders below it.
+void CRenameExecutor::_JournalGroups()
+{
+    std::vector<UINT> order(m_groups.size());
+    for (UINT group = 0; group < m_groups.size(); group++)
+    {
+        order[group] = group;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](_In_ UINT a, _In_ UINT b) {
+        return m_renames[m_groups[a].renames.front()].folder.length() > m_renames[m_groups[b].renames.front()].folder.length();
+    });
+
+    for (UINT group : order)
+    {
+        RenameGroup& renameGroup = m_groups[group];
+        UINT folderId = m_journal->AddFolder(m_renames[renameGroup.renames.front()].folder);
+        for (const auto& step : renameGroup.steps)
+        {
+            size_t i = renameGroup.renames[step.rename];
+            const RenameRequest& rename = m_renames[i];
+            const std::wstring& name = (step.type == PLAN_STEP_UNSTAGE) ? _GetStagingName(i) : rename.name;
+            const std::wstring& newName = (step.type == PLAN_STEP_STAGE) ? _GetStagingName(i) : rename.newName;
+            renameGroup.journalSteps.push_back(m_journal->AddStep(folderId, name, newName));
+        }
+    }
+
+    // The plan has to be on disk before anything it lists is renamed
+    m_journal->Flush();
+}
+
+// Temporary name of a rename that is part of a cycle.  It cannot clash with
+// any name the user picked.
+std::wstring CRenameExecutor::_GetStagingName(_In_ size_t rename) const
+{
+    return m_stagingPrefix + std::to_wstring(rename);
+}
+
+void CRenameExecutor::Run()
+{
+    _BuildGroups();
+    if (m_groups.empty())
+    {
+        return;
+    }
+
+    GUID guid = { 0 };
+    CoCreateGuid(&guid);
+    wchar_t guidString[40] = { 0 };
+    StringFromGUID2(guid, guidString, ARRAYSIZE(guidString));
+    m_stagingPrefix = std::wstring(L"~PowerRename") + guidString + L"_";
+
+    _PlanGroups();
+    if (m_journal)
+    {
+        _JournalGroups();
+    }
+
+    m_remainingGroups = static_cast<UINT>(m_groups.size());
+
+    // Without the thread pool every group is renamed on this thread in the same order
+    m_work = CreateThreadpoolWork(s_WorkCallback, this, nullptr);
+    if (m_work)
+    {
+        m_doneEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        if (!m_doneEvent)
+        {
+            CloseThreadpoolWork(m_work);
+            m_work = nullptr;
+        }
+    }
+
+    // Find the groups that can start before any of them runs and makes more ready
+    std::vector<UINT> readyGroups;
+    for (UINT group = 0; group < m_groups.size(); group++)
+    {
+        if (m_groups[group].pendingChildren == 0)
+        {
+            readyGroups.push_back(group);
+        }
+    }
+
+    for (UINT group : readyGroups)
+    {
+        _Schedule(group);
+    }
+
+    if (m_work)
+    {
+        WaitForSingleObject(m_doneEvent, INFINITE);
+        WaitForThreadpoolWorkCallbacks(m_work, FALSE);
+        CloseThreadpoolWork(m_work);
+        m_work = nullptr;
+        CloseHandle(m_doneEvent);
+        m_doneEvent = nullptr;
+    }
+    else
+    {
+        while (m_remainingGroups > 0)
+        {
+            _RunNextGroup();
+        }
+    }
+
+    if (m_journal)
+    {
+        m_journal->Flush();
+    }
+}
+
+// Marks a group as ready.  Each ready group gets its own thread pool callback.
+void CRenameExecutor::_Schedule(_In_ UINT group)
+{
+    {
+        CSRWExclusiveAutoLock lock(&m_lockReady);
+        m_readyGroups.push_back(group);
+    }
+
+    if (m_work)
+    {
+        SubmitThreadpoolWork(m_work);
+    }
+}
+
+void CRenameExecutor::_RunNextGroup()
+{
+    UINT group = 0;
+    {
+        CSRWExclusiveAutoLock lock(&m_lockReady);
+        group = m_readyGroups.back();
+        m_readyGroups.pop_back();
+    }
+
+    RenameGroup& renameGroup = m_groups[group];
+    for (size_t k = 0; k < renameGroup.steps.size(); k++)
+    {
+        const RenamePlanStep& step = renameGroup.steps[k];
+        size_t i = renameGroup.renames[step.rename];
+        RenameRequest& rename = m_renames[i];
+        HRESULT hr = S_OK;
+        switch (step.type)
+        {
+        case PLAN_STEP_RENAME:
+            hr = m_backend->Rename(rename.folder + rename.name, rename.folder + rename.newName);
+            m_onResult(rename.index, hr);
+            break;
+
+        case PLAN_STEP_STAGE:
+            // Only reported if it fails.  The rest of the cycle then fails
+            // because the name is still taken.
+            hr = m_backend->Rename(rename.folder + rename.name, rename.folder + _GetStagingName(i));
+            if (FAILED(hr))
+            {
+                rename.stagingFailed = true;
+                m_onResult(rename.index, hr);
+            }
+            break;
+
+        case PLAN_STEP_UNSTAGE:
+            if (rename.stagingFailed)
+            {
+                continue;
+            }
+            hr = m_backend->Rename(rename.folder + _GetStagingName(i), rename.folder + rename.newName);
+            m_onResult(rename.index, hr);
+            break;
+        }
+
+        if (m_journal && SUCCEEDED(hr))
+        {
+            m_journal->Commit(renameGroup.journalSteps[k]);
+        }
+    }
+
+    UINT parentGroup = m_groups[group].parentGroup;
+    bool parentReady = false;
+    if (parentGroup != NO_PARENT_GROUP)
+    {
+        CSRWExclusiveAutoLock lock(&m_lockReady);
+        parentReady = (--m_groups[parentGroup].pendingChildren == 0);
+    }
+
+    if (parentReady)
+    {
+        _Schedule(parentGroup);
+    }
+
+    if (--m_remainingGroups == 0 && m_doneEvent)
+    {
+        SetEvent(m_doneEvent);
+    }
+}
+
+VOID CALLBACK CRenameExecutor::s_WorkCallback(_Inout_ PTP_CALLBACK_INSTANCE, _Inout_opt_ PVOID pv, _Inout_ PTP_WORK)
+{
+    CRenameExecutor* executor = reinterpret_cast<CRenameExecutor*>(pv);
+    executor->_RunNextGroup();
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "srwlock.h"
+#include "PowerRenamePlanner.h"
+
+class CRenameJournal;
+
+// Performs a single rename on behalf of CRenameExecutor.  Called concurrently
+// for items in different folders.
+class CRenameBackend
+{
+public:
+    virtual ~CRenameBackend() = default;
+
+    // Renames the item at path to newPath, which is in the same folder.  Must not
+    // replace an existing item.
+    virtual HRESULT Rename(_In_ const std::wstring& path, _In_ const std::wstring& newPath) = 0;
+
+    // Returns true if an item exists at path
+    virtual bool Exists(_In_ const std::wstring& path) = 0;
+
+    // Returns the backend for the file system of this platform
+    static std::unique_ptr<CRenameBackend> s_Create();
+};
+
+// Renames with MoveFileEx and lets the shell know about it
+class CWin32RenameBackend : public CRenameBackend
+{
+public:
+    HRESULT Rename(_In_ const std::wstring& path, _In_ const std::wstring& newPath) override;
+    bool Exists(_In_ const std::wstring& path) override;
+};
+
+// Renames a set of items grouped by the folder they are in.  The items of a
+// folder are renamed one after the other but different folders are renamed
+// in parallel on the thread pool.  A folder is only renamed once every folder
+// below it is done so that paths stay valid.
+//
+// Each folder is planned with PlanFolderRenames before anything is renamed.
+// Conflicting renames are reported first and the others are done in the
+// planned order, so one item never fails because of another.  A new name that
+// would move the item out of its folder, or is not a valid name, fails with
+// ERROR_INVALID_NAME before anything is renamed.
+//
+// If a journal is set, the plan is written to it before anything is renamed
+// and each step is committed to it once done so the batch can be undone.
+class CRenameExecutor
+{
+public:
+    // Called on a worker thread once for each item with the result of its rename
+    typedef std::function<void(_In_ UINT index, _In_ HRESULT result)> ResultCallback;
+
+    CRenameExecutor(_In_ std::unique_ptr<CRenameBackend> backend, _In_ ResultCallback onResult) :
+        m_backend(std::move(backend)),
+        m_onResult(std::move(onResult))
+    {
+    }
+
+    // Queues the rename of the item at path.  index identifies the item to the
+    // result callback.
+    void Add(_In_ UINT index, _In_ const std::wstring& path, _In_ const std::wstring& newName);
+
+    UINT GetCount() const { return static_cast<UINT>(m_renames.size()); }
+
+    // Records the renames in journal, which must outlive Run.  Optional.
+    void SetJournal(_In_opt_ CRenameJournal* journal) { m_journal = journal; }
+
+    // Performs the queued renames and returns when all of them are done
+    void Run();
+
+private:
+    struct RenameRequest
+    {
+        UINT index = 0;
+        // Folder of the item, with the trailing separator
+        std::wstring folder;
+        std::wstring name;
+        std::wstring newName;
+        // Set if moving the item to its temporary name failed
+        bool stagingFailed = false;
+    };
+
+    struct RenameGroup
+    {
+        std::vector<size_t> renames;
+        // Planned order of the renames.  RenamePlanStep::rename indexes renames.
+        std::vector<RenamePlanStep> steps;
+        // Journal step of each of the steps, if there is a journal
+        std::vector<UINT> journalSteps;
+        // Group of the closest folder above this one, or NO_PARENT_GROUP
+        UINT parentGroup = 0;
+        // Groups below this folder that still have to finish.  Guarded by
+        // m_lockReady.
+        UINT pendingChildren = 0;
+    };
+
+    void _BuildGroups();
+    void _PlanGroups();
+    void _JournalGroups();
+    std::wstring _GetStagingName(_In_ size_t rename) const;
+    void _Schedule(_In_ UINT group);
+    void _RunNextGroup();
+
+    static VOID CALLBACK s_WorkCallback(_Inout_ PTP_CALLBACK_INSTANCE instance, _Inout_opt_ PVOID pv, _Inout_ PTP_WORK work);
+
+    std::unique_ptr<CRenameBackend> m_backend;
+    ResultCallback m_onResult;
+    std::vector<RenameRequest> m_renames;
+    std::vector<RenameGroup> m_groups;
+    // Start of the temporary names, unique to this executor
+    std::wstring m_stagingPrefix;
+    CRenameJournal* m_journal = nullptr;
+
+    CSRWLock m_lockReady;
+    _Guarded_by_(m_lockReady) std::vector<UINT> m_readyGroups;
+    std::atomic<UINT> m_remainingGroups{ 0 };
+
+    PTP_WORK m_work = nullptr;
+    HANDLE m_doneEvent = nullptr;
+};
@@ -34,6 +34,7 @@ public:
     IFACEMETHOD(get_flags)(_Out_ DWORD* flags) = 0;
     IFACEMETHOD(put_flags)(_In_ DWORD flags) = 0;
     IFACEMETHOD(Replace)(_In_ PCWSTR source, _Outptr_ PWSTR* result) = 0;
+    IFACEMETHOD(ReplaceWithCancel)(_In_ PCWSTR source, _In_opt_ HANDLE cancelEvent, _Outptr_ PWSTR* result) = 0;
 };
 
 interface __declspec(uuid("C7F59201-4DE1-4855-A3A2-26FC3279C8A5")) IPowerRenameItem : public IUnknown
@@ -52,6 +53,7 @@ public:
     IFACEMETHOD(get_iconIndex)(_Out_ int* iconIndex) = 0;
     IFACEMETHOD(get_depth)(_Out_ UINT* depth) = 0;
     IFACEMETHOD(put_depth)(_In_ int depth) = 0;
+    IFACEMETHOD(get_extensionOffset)(_Out_ UINT* extensionOffset) = 0;
     IFACEMETHOD(ShouldRenameItem)(_In_ DWORD flags, _Out_ bool* shouldRename) = 0;
     IFACEMETHOD(Reset)() = 0;
 };
@@ -60,21 +62,34 @@ interface __declspec(uuid("{26CBFFD9-13B3-424E-BAC9-D12B0539149C}")) IPowerRenam
 {
 public:
     IFACEMETHOD(Create)(_In_ IShellItem* psi, _COM_Outptr_ IPowerRenameItem** ppItem) = 0;
+    // Makes an item from a full path without a shell item or any file system
+    // access.  mappedName, if given, is the name the item is renamed to before
+    // the search and replace is applied to it.
+    IFACEMETHOD(CreateFromPath)(_In_ PCWSTR path, _In_ bool isFolder, _In_opt_ PCWSTR mappedName, _COM_Outptr_ IPowerRenameItem** ppItem) = 0;
 };
 
 interface __declspec(uuid("87FC43F9-7634-43D9-99A5-20876AFCE4AD")) IPowerRenameManagerEvents : public IUnknown
 {
 public:
     IFACEMETHOD(OnItemAdded)(_In_ IPowerRenameItem* renameItem) = 0;
-    IFACEMETHOD(OnUpdate)(_In_ IPowerRenameItem* renameItem) = 0;
-    IFACEMETHOD(OnError)(_In_ IPowerRenameItem* renameItem) = 0;
+    IFACEMETHOD(OnUpdateRange)(_In_ UINT firstIndex, _In_ UINT lastIndex) = 0;
+    IFACEMETHOD(OnItemsAdded)(_In_ UINT firstIndex, _In_ UINT lastIndex) = 0;
+    // The search ran out of time on the item, with HRESULT_FROM_WIN32(ERROR_TIMEOUT),
+    // or the item could not be renamed
+    IFACEMETHOD(OnError)(_In_ IPowerRenameItem* renameItem, _In_ HRESULT hr) = 0;
     IFACEMETHOD(OnRegExStarted)(_In_ DWORD threadId) = 0;
     IFACEMETHOD(OnRegExCanceled)(_In_ DWORD threadId) = 0;
     IFACEMETHOD(OnRegExCompleted)(_In_ DWORD threadId) = 0;
     IFACEMETHOD(OnRenameStarted)() = 0;
+    IFACEMETHOD(OnRenameProgress)(_In_ UINT completedCount, _In_ UINT totalCount) = 0;
     IFACEMETHOD(OnRenameCompleted)() = 0;
+    IFACEMETHOD(OnEnumerationCompleted)() = 0;
+    // Items could not be read.  Those read before the failure were added.
+    IFACEMETHOD(OnEnumerationError)(_In_ HRESULT hr) = 0;
 };
 
+class CPreviewSnapshot;
+
 interface __declspec(uuid("001BBD88-53D2-4FA6-95D2-F9A9FA4F9F70")) IPowerRenameManager : public IUnknown
 {
 public:
@@ -85,18 +100,38 @@ public:
     IFACEMETHOD(Reset)() = 0;
     IFACEMETHOD(Shutdown)() = 0;
     IFACEMETHOD(Rename)(_In_ HWND hwndParent) = 0;
+    // The preview snapshot is made again on its next read, so prefer AddItems
+    // for many items
     IFACEMETHOD(AddItem)(_In_ IPowerRenameItem* pItem) = 0;
+    // Adds the items under a single lock and reports them with OnItemsAdded
+    IFACEMETHOD(AddItems)(_In_reads_(count) IPowerRenameItem* const* items, _In_ UINT count) = 0;
+    // Blocks until every item has its new name for the current search and
+    // replace, for callers without a preview to follow
+    IFACEMETHOD(WaitForPreview)() = 0;
+    // Removes every item, for callers that pass items through the manager a
+    // batch at a time.  Items added after are numbered after the removed ones.
+    IFACEMETHOD(RemoveAllItems)() = 0;
+    IFACEMETHOD(StartEnumeration)(_In_ IUnknown* dataSource) = 0;
+    // Adds the items listed in a manifest file in the background, like
+    // StartEnumeration.  See ImportManifest for the format.
+    IFACEMETHOD(StartManifestImport)(_In_ PCWSTR manifestPath) = 0;
     IFACEMETHOD(GetItemByIndex)(_In_ UINT index, _COM_Outptr_ IPowerRenameItem** ppItem) = 0;
     IFACEMETHOD(GetItemById)(_In_ int id, _COM_Outptr_ IPowerRenameItem** ppItem) = 0;
     IFACEMETHOD(GetItemCount)(_Out_ UINT* count) = 0;
     IFACEMETHOD(GetSelectedItemCount)(_Out_ UINT* count) = 0;
     IFACEMETHOD(GetRenameItemCount)(_Out_ UINT* count) = 0;
+    IFACEMETHOD(SetItemSelected)(_In_ UINT index, _In_ bool selected) = 0;
+    IFACEMETHOD(SetAllItemsSelected)(_In_ bool selected) = 0;
     IFACEMETHOD(get_flags)(_Out_ DWORD* flags) = 0;
     IFACEMETHOD(put_flags)(_In_ DWORD flags) = 0;
     IFACEMETHOD(get_renameRegEx)(_COM_Outptr_ IPowerRenameRegEx** ppRegEx) = 0;
     IFACEMETHOD(put_renameRegEx)(_In_ IPowerRenameRegEx* pRegEx) = 0;
     IFACEMETHOD(get_renameItemFactory)(_COM_Outptr_ IPowerRenameItemFactory** ppItemFactory) = 0;
     IFACEMETHOD(put_renameItemFactory)(_In_ IPowerRenameItemFactory* pItemFactory) = 0;
+    // Latest preview, valid until the calling thread changes the items or
+    // dispatches messages again.  Only for the thread the manager was created
+    // on.
+    IFACEMETHOD(GetPreviewSnapshot)(_Outptr_ const CPreviewSnapshot** snapshot) = 0;
 };
 
 interface __declspec(uuid("E6679DEB-460D-42C1-A7A8-E25897061C99")) IPowerRenameUI : public IUnknown
@@ -111,5 +146,8 @@ interface __declspec(uuid("04AAFABE-B76E-4E13-993A-B5941F52B139")) IPowerRenameM
 {
 public:
     IFACEMETHOD(AddMRUString)(_In_ PCWSTR entry) = 0;
+    // Restricts the strings enumerated after the next Reset to those that
+    // start with prefix
+    IFACEMETHOD(SetPrefix)(_In_ PCWSTR prefix) = 0;
 };
 
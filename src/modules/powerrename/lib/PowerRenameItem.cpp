@@ -1,8 +1,9 @@
 #include "stdafx.h"
 #include "PowerRenameItem.h"
+#include "PowerRenameTemplate.h"
 #include "icon_helpers.h"
 
-int CPowerRenameItem::s_id = 0;
+long CPowerRenameItem::s_id = 0;
 
 IFACEMETHODIMP_(ULONG) CPowerRenameItem::AddRef()
 {
@@ -22,6 +23,14 @@ IFACEMETHODIMP_(ULONG) CPowerRenameItem::Release()
 
 IFACEMETHODIMP CPowerRenameItem::QueryInterface(_In_ REFIID riid, _Outptr_ void** ppv)
 {
+    // Lets the library reach the fast path from an interface pointer
+    if (riid == __uuidof(CPowerRenameItem))
+    {
+        *ppv = this;
+        AddRef();
+        return S_OK;
+    }
+
     static const QITAB qit[] = {
         QITABENT(CPowerRenameItem, IPowerRenameItem),
         QITABENT(CPowerRenameItem, IPowerRenameItemFactory),
@@ -33,23 +42,29 @@ IFACEMETHODIMP CPowerRenameItem::QueryInterface(_In_ REFIID riid, _Outptr_ void*
 IFACEMETHODIMP CPowerRenameItem::get_path(_Outptr_ PWSTR* path)
 {
     *path = nullptr;
-    CSRWSharedAutoLock lock(&m_lock);
-    HRESULT hr = m_path ? S_OK : E_FAIL;
+    std::wstring fullPath;
+    HRESULT hr = _GetPath(fullPath);
     if (SUCCEEDED(hr))
     {
-        hr = SHStrDup(m_path, path);
+        hr = SHStrDup(fullPath.c_str(), path);
     }
     return hr;
 }
 
 IFACEMETHODIMP CPowerRenameItem::get_shellItem(_Outptr_ IShellItem** ppsi)
 {
-    return SHCreateItemFromParsingName(m_path, nullptr, IID_PPV_ARGS(ppsi));
+    *ppsi = nullptr;
+    std::wstring fullPath;
+    HRESULT hr = _GetPath(fullPath);
+    if (SUCCEEDED(hr))
+    {
+        hr = SHCreateItemFromParsingName(fullPath.c_str(), nullptr, IID_PPV_ARGS(ppsi));
+    }
+    return hr;
 }
 
 IFACEMETHODIMP CPowerRenameItem::get_originalName(_Outptr_ PWSTR* originalName)
 {
-    CSRWSharedAutoLock lock(&m_lock);
     HRESULT hr = m_originalName ? S_OK : E_FAIL;
     if (SUCCEEDED(hr))
     {
@@ -60,59 +75,48 @@ IFACEMETHODIMP CPowerRenameItem::get_originalName(_Outptr_ PWSTR* originalName)
 
 IFACEMETHODIMP CPowerRenameItem::put_newName(_In_opt_ PCWSTR newName)
 {
-    CSRWSharedAutoLock lock(&m_lock);
-    CoTaskMemFree(m_newName);
-    m_newName = nullptr;
-    HRESULT hr = S_OK;
-    if (newName != nullptr)
-    {
-        hr = SHStrDup(newName, &m_newName);
-    }
-    return hr;
+    return SetNewName(newName, newName ? wcslen(newName) : 0);
 }
 
 IFACEMETHODIMP CPowerRenameItem::get_newName(_Outptr_ PWSTR* newName)
 {
+    // Shared with SetNewName so the name can't be freed while it is copied
     CSRWSharedAutoLock lock(&m_lock);
-    HRESULT hr = m_newName ? S_OK : E_FAIL;
+    PCWSTR currentName = m_newName;
+    HRESULT hr = currentName ? S_OK : E_FAIL;
     if (SUCCEEDED(hr))
     {
-        hr = SHStrDup(m_newName, newName);
+        hr = SHStrDup(currentName, newName);
     }
     return hr;
 }
 
 IFACEMETHODIMP CPowerRenameItem::get_isFolder(_Out_ bool* isFolder)
 {
-    CSRWSharedAutoLock lock(&m_lock);
     *isFolder = m_isFolder;
     return S_OK;
 }
 
 IFACEMETHODIMP CPowerRenameItem::get_isSubFolderContent(_Out_ bool* isSubFolderContent)
 {
-    CSRWSharedAutoLock lock(&m_lock);
     *isSubFolderContent = m_depth > 0;
     return S_OK;
 }
 
 IFACEMETHODIMP CPowerRenameItem::get_selected(_Out_ bool* selected)
 {
-    CSRWSharedAutoLock lock(&m_lock);
     *selected = m_selected;
     return S_OK;
 }
 
 IFACEMETHODIMP CPowerRenameItem::put_selected(_In_ bool selected)
 {
-    CSRWSharedAutoLock lock(&m_lock);
     m_selected = selected;
     return S_OK;
 }
 
 IFACEMETHODIMP CPowerRenameItem::get_id(_Out_ int* id)
 {
-    CSRWSharedAutoLock lock(&m_lock);
     *id = m_id;
     return S_OK;
 }
@@ -121,7 +125,11 @@ IFACEMETHODIMP CPowerRenameItem::get_iconIndex(_Out_ int* iconIndex)
 {
     if (m_iconIndex == -1)
     {
-        GetIconIndexFromPath((PCWSTR)m_path, &m_iconIndex);
+        std::wstring fullPath;
+        if (SUCCEEDED(_GetPath(fullPath)))
+        {
+            GetIconIndexFromPath(fullPath.c_str(), &m_iconIndex);
+        }
     }
     *iconIndex = m_iconIndex;
     return S_OK;
@@ -139,29 +147,134 @@ IFACEMETHODIMP CPowerRenameItem::put_depth(_In_ int depth)
     return S_OK;
 }
 
+IFACEMETHODIMP CPowerRenameItem::get_extensionOffset(_Out_ UINT* extensionOffset)
+{
+    *extensionOffset = m_extensionOffset;
+    return S_OK;
+}
+
 IFACEMETHODIMP CPowerRenameItem::ShouldRenameItem(_In_ DWORD flags, _Out_ bool* shouldRename)
+{
+    *shouldRename = ShouldRename(flags);
+    return S_OK;
+}
+
+IFACEMETHODIMP CPowerRenameItem::Reset()
+{
+    return SetNewName(nullptr, 0);
+}
+
+CPowerRenameItem* CPowerRenameItem::s_FromItem(_In_ IPowerRenameItem* renameItem)
+{
+    CPowerRenameItem* item = nullptr;
+    if (SUCCEEDED(renameItem->QueryInterface(__uuidof(CPowerRenameItem), reinterpret_cast<void**>(&item))))
+    {
+        item->Release();
+    }
+    return item;
+}
+
+bool CPowerRenameItem::GetNewName(_Out_ std::wstring_view* newName) const
+{
+    PCWSTR currentName = m_newName;
+    *newName = currentName ? std::wstring_view(currentName) : std::wstring_view();
+    return currentName != nullptr;
+}
+
+HRESULT CPowerRenameItem::SetNewName(_In_reads_opt_(length) PCWSTR newName, _In_ size_t length)
+{
+    PWSTR copy = nullptr;
+    if (newName != nullptr)
+    {
+        copy = static_cast<PWSTR>(CoTaskMemAlloc((length + 1) * sizeof(wchar_t)));
+        if (copy == nullptr)
+        {
+            return E_OUTOFMEMORY;
+        }
+        memcpy(copy, newName, length * sizeof(wchar_t));
+        copy[length] = L'\0';
+    }
+
+    PWSTR expiredName = nullptr;
+    {
+        CSRWExclusiveAutoLock lock(&m_lock);
+        expiredName = m_newName.exchange(copy);
+    }
+
+    // No reader holding the lock can still see it
+    CoTaskMemFree(expiredName);
+    return S_OK;
+}
+
+bool CPowerRenameItem::AppendNewName(_Inout_ std::wstring& text) const
+{
+    CSRWSharedAutoLock lock(&m_lock);
+    PCWSTR currentName = m_newName;
+    if (currentName)
+    {
+        text.append(currentName);
+    }
+    return currentName != nullptr;
+}
+
+bool CPowerRenameItem::HasChangedName() const
+{
+    CSRWSharedAutoLock lock(&m_lock);
+    PCWSTR currentName = m_newName;
+    return currentName && (GetOriginalName() != currentName);
+}
+
+bool CPowerRenameItem::ShouldRename(_In_ DWORD flags) const
 {
     // Should we perform a rename on this item given its
     // state and the options that were set?
-    bool hasChanged = m_newName != nullptr && (lstrcmp(m_originalName, m_newName) != 0);
+    bool hasChanged = HasChangedName();
     bool excludeBecauseFolder = (m_isFolder && (flags & PowerRenameFlags::ExcludeFolders));
     bool excludeBecauseFile = (!m_isFolder && (flags & PowerRenameFlags::ExcludeFiles));
     bool excludeBecauseSubFolderContent = (m_depth > 0 && (flags & PowerRenameFlags::ExcludeSubfolders));
-    *shouldRename = (m_selected && hasChanged && !excludeBecauseFile &&
-                     !excludeBecauseFolder && !excludeBecauseSubFolderContent);
-
-    return S_OK;
+    return (m_selected && hasChanged && !excludeBecauseFile &&
+            !excludeBecauseFolder && !excludeBecauseSubFolderContent);
 }
 
-IFACEMETHODIMP CPowerRenameItem::Reset()
+HRESULT CPowerRenameItem::GetFileTime(_Out_ SYSTEMTIME* fileTime)
 {
-    CSRWSharedAutoLock lock(&m_lock);
-    CoTaskMemFree(m_newName);
-    m_newName = nullptr;
-    return S_OK;
+    ZeroMemory(fileTime, sizeof(*fileTime));
+
+    // Workers that race on an item read the same time, so no lock is needed
+    ULONGLONG cachedTime = m_fileTime;
+    if (cachedTime == ITEM_FILE_TIME_UNREAD)
+    {
+        cachedTime = ITEM_FILE_TIME_NONE;
+        std::wstring fullPath;
+        SYSTEMTIME localTime = { 0 };
+        FILETIME packedTime = { 0 };
+        if (SUCCEEDED(_GetPath(fullPath)) &&
+            SUCCEEDED(CPowerRenameTemplate::s_GetFileTime(fullPath.c_str(), &localTime)) &&
+            SystemTimeToFileTime(&localTime, &packedTime))
+        {
+            cachedTime = (static_cast<ULONGLONG>(packedTime.dwHighDateTime) << 32) | packedTime.dwLowDateTime;
+        }
+        m_fileTime = cachedTime;
+    }
+
+    FILETIME packedTime = { static_cast<DWORD>(cachedTime), static_cast<DWORD>(cachedTime >> 32) };
+    return (cachedTime != ITEM_FILE_TIME_NONE && FileTimeToSystemTime(&packedTime, fileTime)) ? S_OK : E_FAIL;
 }
 
 HRESULT CPowerRenameItem::s_CreateInstance(_In_opt_ IShellItem* psi, _In_ REFIID iid, _Outptr_ void** resultInterface)
+{
+    // An item made without a factory, or a new factory, gets a store of its own
+    std::shared_ptr<CPowerRenameItemStore> store(new (std::nothrow) CPowerRenameItemStore());
+    if (!store)
+    {
+        *resultInterface = nullptr;
+        return E_OUTOFMEMORY;
+    }
+
+    return _CreateInstance(psi, store, iid, resultInterface);
+}
+
+HRESULT CPowerRenameItem::_CreateInstance(_In_opt_ IShellItem* psi, _In_ const std::shared_ptr<CPowerRenameItemStore>& store, _In_ REFIID iid, _Outptr_ void** resultInterface)
 {
     *resultInterface = nullptr;
 
@@ -169,6 +282,7 @@ HRESULT CPowerRenameItem::s_CreateInstance(_In_opt_ IShellItem* psi, _In_ REFIID
     HRESULT hr = newRenameItem ? S_OK : E_OUTOFMEMORY;
     if (SUCCEEDED(hr))
     {
+        newRenameItem->m_store = store;
         if (psi != nullptr)
         {
             hr = newRenameItem->_Init(psi);
@@ -184,26 +298,56 @@ HRESULT CPowerRenameItem::s_CreateInstance(_In_opt_ IShellItem* psi, _In_ REFIID
     return hr;
 }
 
+IFACEMETHODIMP CPowerRenameItem::CreateFromPath(_In_ PCWSTR path, _In_ bool isFolder, _In_opt_ PCWSTR mappedName, _COM_Outptr_ IPowerRenameItem** ppItem)
+{
+    *ppItem = nullptr;
+
+    CPowerRenameItem* newRenameItem = new (std::nothrow) CPowerRenameItem();
+    HRESULT hr = newRenameItem ? S_OK : E_OUTOFMEMORY;
+    if (SUCCEEDED(hr))
+    {
+        // Shares the store of this factory like Create
+        newRenameItem->m_store = m_store;
+        newRenameItem->m_isFolder = isFolder;
+        hr = newRenameItem->_InitNames(path, PathFindFileName(path));
+        if (SUCCEEDED(hr) && mappedName != nullptr && mappedName[0] != L'\0')
+        {
+            size_t length = wcslen(mappedName);
+            newRenameItem->m_mappedName = newRenameItem->m_store->AddString(mappedName, length);
+            newRenameItem->m_mappedNameLength = static_cast<UINT>(length);
+            hr = newRenameItem->m_mappedName ? S_OK : E_OUTOFMEMORY;
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = newRenameItem->QueryInterface(IID_PPV_ARGS(ppItem));
+        }
+
+        newRenameItem->Release();
+    }
+    return hr;
+}
+
 CPowerRenameItem::CPowerRenameItem() :
     m_refCount(1),
-    m_id(++s_id)
+    m_id(InterlockedIncrement(&s_id))
 {
 }
 
 CPowerRenameItem::~CPowerRenameItem()
 {
-    CoTaskMemFree(m_path);
     CoTaskMemFree(m_newName);
-    CoTaskMemFree(m_originalName);
 }
 
 HRESULT CPowerRenameItem::_Init(_In_ IShellItem* psi)
 {
     // Get the full filesystem path from the shell item
-    HRESULT hr = psi->GetDisplayName(SIGDN_FILESYSPATH, &m_path);
+    PWSTR path = nullptr;
+    HRESULT hr = psi->GetDisplayName(SIGDN_FILESYSPATH, &path);
     if (SUCCEEDED(hr))
     {
-        hr = SHStrDup(PathFindFileName(m_path), &m_originalName);
+        hr = _InitNames(path, PathFindFileName(path));
+        CoTaskMemFree(path);
         if (SUCCEEDED(hr))
         {
             // Check if we are a folder now so we can check this attribute quickly later
@@ -219,3 +363,48 @@ HRESULT CPowerRenameItem::_Init(_In_ IShellItem* psi)
 
     return hr;
 }
+
+// Splits the path into an interned parent folder and a name in the store
+HRESULT CPowerRenameItem::_InitNames(_In_opt_ PCWSTR path, _In_opt_ PCWSTR originalName)
+{
+    HRESULT hr = S_OK;
+    if (!m_store)
+    {
+        m_store.reset(new (std::nothrow) CPowerRenameItemStore());
+        hr = m_store ? S_OK : E_OUTOFMEMORY;
+    }
+
+    if (SUCCEEDED(hr) && path != nullptr)
+    {
+        PCWSTR pathName = PathFindFileName(path);
+        m_parentPath = m_store->InternParentPath(path, pathName - path);
+        m_pathName = m_store->AddString(pathName, wcslen(pathName));
+        hr = (m_parentPath && m_pathName) ? S_OK : E_OUTOFMEMORY;
+    }
+
+    if (SUCCEEDED(hr) && originalName != nullptr)
+    {
+        size_t length = wcslen(originalName);
+        m_originalName = (m_pathName && lstrcmp(m_pathName, originalName) == 0) ? m_pathName : m_store->AddString(originalName, length);
+        hr = m_originalName ? S_OK : E_OUTOFMEMORY;
+        if (SUCCEEDED(hr))
+        {
+            m_originalNameLength = static_cast<UINT>(length);
+            m_extensionOffset = static_cast<UINT>(GetExtensionOffset(m_originalName, length));
+        }
+    }
+
+    return hr;
+}
+
+HRESULT CPowerRenameItem::_GetPath(_Out_ std::wstring& path)
+{
+    path.clear();
+    HRESULT hr = (m_parentPath && m_pathName) ? S_OK : E_FAIL;
+    if (SUCCEEDED(hr))
+    {
+        path.reserve(wcslen(m_parentPath) + wcslen(m_pathName));
+        path.append(m_parentPath).append(m_pathName);
+    }
+    return hr;
+}
@@ -2,8 +2,16 @@
 #include "stdafx.h"
 #include "PowerRenameInterfaces.h"
 #include "srwlock.h"
+#include "PowerRenameItemStore.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
 
-class CPowerRenameItem :
+#define ITEM_FILE_TIME_UNREAD 0ULL
+#define ITEM_FILE_TIME_NONE ULLONG_MAX
+
+class __declspec(uuid("C283480C-3BDA-429D-84E7-6AE5C80B0654")) CPowerRenameItem :
     public IPowerRenameItem,
     public IPowerRenameItemFactory
 {
@@ -26,6 +34,7 @@ public:
     IFACEMETHODIMP get_id(_Out_ int* id);
     IFACEMETHODIMP get_iconIndex(_Out_ int* iconIndex);
     IFACEMETHODIMP get_depth(_Out_ UINT* depth);
+    IFACEMETHODIMP get_extensionOffset(_Out_ UINT* extensionOffset);
     IFACEMETHODIMP put_depth(_In_ int depth);
     IFACEMETHODIMP Reset();
     IFACEMETHODIMP ShouldRenameItem(_In_ DWORD flags, _Out_ bool* shouldRename);
@@ -33,28 +42,85 @@ public:
     // IPowerRenameItemFactory
     IFACEMETHODIMP Create(_In_ IShellItem* psi, _Outptr_ IPowerRenameItem** ppItem)
     {
-        return CPowerRenameItem::s_CreateInstance(psi, IID_PPV_ARGS(ppItem));
+        // Items made by this factory share its store
+        return CPowerRenameItem::_CreateInstance(psi, m_store, IID_PPV_ARGS(ppItem));
     }
+    IFACEMETHODIMP CreateFromPath(_In_ PCWSTR path, _In_ bool isFolder, _In_opt_ PCWSTR mappedName, _COM_Outptr_ IPowerRenameItem** ppItem);
 
 public:
     static HRESULT s_CreateInstance(_In_opt_ IShellItem* psi, _In_ REFIID iid, _Outptr_ void** resultInterface);
 
+    // The item behind renameItem without taking a reference, or null if it is
+    // not a CPowerRenameItem.  The caller's reference keeps it alive.
+    static CPowerRenameItem* s_FromItem(_In_ IPowerRenameItem* renameItem);
+
+    // Fast path for the library next to the COM getters.  These allocate
+    // nothing and only the new name takes a lock: the flags are atomic or
+    // fixed after the item is made and the names are views into memory the
+    // item owns.
+    int GetId() const { return m_id; }
+    bool IsFolder() const { return m_isFolder; }
+    UINT GetDepth() const { return m_depth; }
+    UINT GetExtensionOffset() const { return m_extensionOffset; }
+    bool IsSelected() const { return m_selected; }
+    void SetSelected(_In_ bool selected) { m_selected = selected; }
+    std::wstring_view GetOriginalName() const { return std::wstring_view(m_originalName ? m_originalName : L"", m_originalNameLength); }
+    // Empty unless the item was made from a manifest with a new name
+    std::wstring_view GetMappedName() const { return std::wstring_view(m_mappedName ? m_mappedName : L"", m_mappedNameLength); }
+
+    // The new name, or false if there is none.  Takes no lock so it is only
+    // for the thread setting the names of the item: setting a new name frees
+    // the one the view points to.  Other threads use AppendNewName.
+    bool GetNewName(_Out_ std::wstring_view* newName) const;
+    // Appends the new name to text under the lock, or returns false if there
+    // is none
+    bool AppendNewName(_Inout_ std::wstring& text) const;
+    HRESULT SetNewName(_In_reads_opt_(length) PCWSTR newName, _In_ size_t length);
+
+    // There is a new name and it differs from the original name.  Safe from
+    // any thread.
+    bool HasChangedName() const;
+    bool ShouldRename(_In_ DWORD flags) const;
+
+    // Creation time of the item in local time, for the date and time tokens
+    // of the replace term.  Read from the file system the first time only.
+    HRESULT GetFileTime(_Out_ SYSTEMTIME* fileTime);
+
 protected:
-    static int s_id;
+    static long s_id;
     CPowerRenameItem();
     virtual ~CPowerRenameItem();
 
+    static HRESULT _CreateInstance(_In_opt_ IShellItem* psi, _In_ const std::shared_ptr<CPowerRenameItemStore>& store, _In_ REFIID iid, _Outptr_ void** resultInterface);
+
     HRESULT _Init(_In_ IShellItem* psi);
+    HRESULT _InitNames(_In_opt_ PCWSTR path, _In_opt_ PCWSTR originalName);
+    HRESULT _GetPath(_Out_ std::wstring& path);
 
-    bool     m_selected = true;
+    std::atomic<bool> m_selected{ true };
     bool     m_isFolder = false;
     int      m_id = -1;
     int      m_iconIndex = -1;
     UINT     m_depth = 0;
     HRESULT  m_error = S_OK;
-    PWSTR    m_path = nullptr;
-    PWSTR    m_originalName = nullptr;
-    PWSTR    m_newName = nullptr;
-    CSRWLock m_lock;
+    UINT     m_extensionOffset = 0;
+    // Parent folder including the trailing separator and the last path
+    // segment.  Both live in m_store as does m_originalName, which usually
+    // is the same string as m_pathName.
+    PCWSTR   m_parentPath = nullptr;
+    PCWSTR   m_pathName = nullptr;
+    PCWSTR   m_originalName = nullptr;
+    UINT     m_originalNameLength = 0;
+    // In m_store
+    PCWSTR   m_mappedName = nullptr;
+    UINT     m_mappedNameLength = 0;
+    // Set under m_lock held exclusively and read under it held shared,
+    // except by GetNewName on the thread setting it
+    std::atomic<PWSTR> m_newName{ nullptr };
+    // Local creation time as a FILETIME, ITEM_FILE_TIME_UNREAD until
+    // GetFileTime reads it or ITEM_FILE_TIME_NONE if it could not
+    std::atomic<ULONGLONG> m_fileTime{ ITEM_FILE_TIME_UNREAD };
+    std::shared_ptr<CPowerRenameItemStore> m_store;
+    mutable CSRWLock m_lock;
     long     m_refCount = 0;
 };
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "stdafx.h"
+#include "PowerRenameItemStore.h"
+
+// Characters per block.  Large enough that a folder of names fits in a few
+// blocks, small enough not to matter for a single item.
+#define STORE_BLOCK_CHARS 16384
+
+PCWSTR CPowerRenameItemStore::AddString(_In_reads_(length) PCWSTR value, _In_ size_t length)
+{
+    CSRWExclusiveAutoLock lock(&m_lock);
+    return _AddString(value, length);
+}
+
+PCWSTR CPowerRenameItemStore::InternParentPath(_In_reads_(length) PCWSTR parentPath, _In_ size_t length)
+{
+    std::wstring_view key(parentPath, length);
+
+    // Most items share their parent with the items enumerated before them
+    {
+        CSRWSharedAutoLock lock(&m_lock);
+        auto it = m_parentPaths.find(key);
+        if (it != m_parentPaths.end())
+        {
+            return it->data();
+        }
+    }
+
+    CSRWExclusiveAutoLock lock(&m_lock);
+    auto it = m_parentPaths.find(key);
+    if (it != m_parentPaths.end())
+    {
+        return it->data();
+    }
+
+    PCWSTR stored = _AddString(parentPath, length);
+    if (stored != nullptr)
+    {
+        m_parentPaths.emplace(stored, length);
+    }
+    return stored;
+}
+
+size_t CPowerRenameItemStore::GetAllocatedBytes()
+{
+    CSRWSharedAutoLock lock(&m_lock);
+    return m_allocatedChars * sizeof(wchar_t);
+}
+
+_Requires_exclusive_lock_held_(m_lock)
+PCWSTR CPowerRenameItemStore::_AddString(_In_reads_(length) PCWSTR value, _In_ size_t length)
+{
+    size_t needed = length + 1;
+
+    // Long strings get a block of their own so the current block keeps its
+    // free space
+    if (needed > STORE_BLOCK_CHARS / 2)
+    {
+        std::unique_ptr<wchar_t[]> block(new (std::nothrow) wchar_t[needed]);
+        if (!block)
+        {
+            return nullptr;
+        }
+
+        wchar_t* stored = block.get();
+        memcpy(stored, value, length * sizeof(wchar_t));
+        stored[length] = L'\0';
+        m_blocks.push_back(std::move(block));
+        m_allocatedChars += needed;
+        return stored;
+    }
+
+    if (m_currentBlock == nullptr || (STORE_BLOCK_CHARS - m_blockUsed) < needed)
+    {
+        std::unique_ptr<wchar_t[]> block(new (std::nothrow) wchar_t[STORE_BLOCK_CHARS]);
+        if (!block)
+        {
+            return nullptr;
+        }
+
+        m_currentBlock = block.get();
+        m_blocks.push_back(std::move(block));
+        m_blockUsed = 0;
+        m_allocatedChars += STORE_BLOCK_CHARS;
+    }
+
+    wchar_t* stored = m_currentBlock + m_blockUsed;
+    memcpy(stored, value, length * sizeof(wchar_t));
+    stored[length] = L'\0';
+    m_blockUsed += needed;
+    return stored;
+}
+
+size_t GetExtensionOffset(_In_reads_(length) PCWSTR name, _In_ size_t length)
+{
+    std::wstring_view view(name, length);
+    if (view == L"." || view == L"..")
+    {
+        return length;
+    }
+
+    // A leading dot starts the stem, not an extension
+    size_t dot = view.rfind(L'.');
+    return (dot == std::wstring_view::npos || dot == 0) ? length : dot;
+}
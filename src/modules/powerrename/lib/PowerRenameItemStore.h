@@ -0,0 +1,43 @@
+#pragma once
+#include "srwlock.h"
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Immutable strings shared by the items made by one factory.  Names are
+// copied into large blocks instead of one heap allocation each, and the
+// parent folder of an item is stored once for all of the items in it.
+// Strings stay valid for the lifetime of the store and may be added from
+// any thread.
+class CPowerRenameItemStore
+{
+public:
+    CPowerRenameItemStore() = default;
+    ~CPowerRenameItemStore() = default;
+
+    // Copies the string into the store.  The copy is null terminated.
+    PCWSTR AddString(_In_reads_(length) PCWSTR value, _In_ size_t length);
+
+    // Returns the stored copy of a parent path, adding it the first time it
+    // is seen.
+    PCWSTR InternParentPath(_In_reads_(length) PCWSTR parentPath, _In_ size_t length);
+
+    // Bytes held by the store including unused space in the current block
+    size_t GetAllocatedBytes();
+
+private:
+    _Requires_exclusive_lock_held_(m_lock)
+    PCWSTR _AddString(_In_reads_(length) PCWSTR value, _In_ size_t length);
+
+    CSRWLock m_lock;
+    _Guarded_by_(m_lock) std::vector<std::unique_ptr<wchar_t[]>> m_blocks;
+    _Guarded_by_(m_lock) wchar_t* m_currentBlock = nullptr;
+    _Guarded_by_(m_lock) size_t m_blockUsed = 0;
+    _Guarded_by_(m_lock) size_t m_allocatedChars = 0;
+    _Guarded_by_(m_lock) std::unordered_set<std::wstring_view> m_parentPaths;
+};
+
+// Offset of the extension, including the dot, in a file name or the length of
+// the name if it has none.  Matches std::filesystem::path::extension().
+size_t GetExtensionOffset(_In_reads_(length) PCWSTR name, _In_ size_t length);
@@ -0,0 +1,378 @@
+#include "stdafx.h"
+#include "PowerRenameJournal.h"
+#include "PowerRenameExecutor.h"
+#include "Helpers.h"
+
+// 'PRNJ'
+#define RENAME_JOURNAL_MAGIC 0x4A4E5250
+#define RENAME_JOURNAL_VERSION 1
+
+#define RENAME_JOURNAL_RECORD_FOLDER 'F'
+#define RENAME_JOURNAL_RECORD_STEP 'S'
+#define RENAME_JOURNAL_RECORD_DONE 'C'
+#define RENAME_JOURNAL_RECORD_UNDONE 'U'
+
+CRenameJournal::~CRenameJournal()
+{
+    _Close();
+}
+
+HRESULT CRenameJournal::Create(_In_ PCWSTR path)
+{
+    _Close();
+    m_folders.clear();
+    m_steps.clear();
+
+    m_file = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    UINT32 header[] = { RENAME_JOURNAL_MAGIC, RENAME_JOURNAL_VERSION };
+    CSRWExclusiveAutoLock lock(&m_lock);
+    _Append(header, sizeof(header));
+    return _FlushLocked();
+}
+
+HRESULT CRenameJournal::Open(_In_ PCWSTR path)
+{
+    _Close();
+    m_folders.clear();
+    m_steps.clear();
+
+    m_file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    LARGE_INTEGER fileSize = { 0 };
+    if (!GetFileSizeEx(m_file, &fileSize))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (fileSize.QuadPart > MAXDWORD)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+
+    std::vector<BYTE> data;
+    if (SUCCEEDED(hr))
+    {
+        data.resize(static_cast<size_t>(fileSize.QuadPart));
+        DWORD bytesRead = 0;
+        if (!data.empty() && (!ReadFile(m_file, data.data(), static_cast<DWORD>(data.size()), &bytesRead, nullptr) || bytesRead != data.size()))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+        }
+    }
+
+    size_t validSize = 0;
+    if (SUCCEEDED(hr) && !_Parse(data, &validSize))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // New records go after the last complete one
+        LARGE_INTEGER position = { 0 };
+        position.QuadPart = validSize;
+        if (!SetFilePointerEx(m_file, position, nullptr, FILE_BEGIN) || !SetEndOfFile(m_file))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        _Close();
+        m_folders.clear();
+        m_steps.clear();
+    }
+
+    return hr;
+}
+
+UINT CRenameJournal::AddFolder(_In_ const std::wstring& folder)
+{
+    UINT id = static_cast<UINT>(m_folders.size());
+    m_folders.push_back(folder);
+
+    CSRWExclusiveAutoLock lock(&m_lock);
+    BYTE type = RENAME_JOURNAL_RECORD_FOLDER;
+    _Append(&type, sizeof(type));
+    UINT32 id32 = id;
+    _Append(&id32, sizeof(id32));
+    _AppendString(folder);
+    return id;
+}
+
+UINT CRenameJournal::AddStep(_In_ UINT folderId, _In_ const std::wstring& name, _In_ const std::wstring& newName)
+{
+    UINT id = static_cast<UINT>(m_steps.size());
+    Step step;
+    step.folderId = folderId;
+    step.name = name;
+    step.newName = newName;
+    m_steps.push_back(std::move(step));
+
+    CSRWExclusiveAutoLock lock(&m_lock);
+    BYTE type = RENAME_JOURNAL_RECORD_STEP;
+    _Append(&type, sizeof(type));
+    UINT32 folderId32 = folderId;
+    _Append(&folderId32, sizeof(folderId32));
+    _AppendString(name);
+    _AppendString(newName);
+    return id;
+}
+
+void CRenameJournal::Commit(_In_ UINT step)
+{
+    CSRWExclusiveAutoLock lock(&m_lock);
+    m_steps[step].done = true;
+    _AppendStepRecord(RENAME_JOURNAL_RECORD_DONE, step);
+}
+
+HRESULT CRenameJournal::Flush()
+{
+    CSRWExclusiveAutoLock lock(&m_lock);
+    return _FlushLocked();
+}
+
+UINT CRenameJournal::GetDoneCount() const
+{
+    UINT count = 0;
+    for (const auto& step : m_steps)
+    {
+        if (step.done)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+HRESULT CRenameJournal::Replay(_In_ bool undo, _In_ CRenameBackend* backend, _Out_opt_ UINT* failedCount)
+{
+    if (failedCount)
+    {
+        *failedCount = 0;
+    }
+
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return E_UNEXPECTED;
+    }
+
+    // The steps were recorded in an order that works one after the other, so
+    // undoing them last first works too.  Parent folders get their old name
+    // back before the items in them are visited.
+    size_t count = m_steps.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        UINT id = static_cast<UINT>(undo ? count - 1 - i : i);
+        Step& step = m_steps[id];
+        const std::wstring& folder = m_folders[step.folderId];
+        std::wstring path = folder + (undo ? step.newName : step.name);
+        std::wstring newPath = folder + (undo ? step.name : step.newName);
+
+        // A step performed before a crash may have lost its done record.  It
+        // is undone all the same if the item is found under its new name only.
+        bool done = step.done || (undo && backend->Exists(path) && !backend->Exists(newPath));
+        if (done != undo)
+        {
+            continue;
+        }
+
+        HRESULT hr = backend->Rename(path, newPath);
+        if (FAILED(hr) && !backend->Exists(path) && backend->Exists(newPath))
+        {
+            // Performed before a crash but its record was lost
+            hr = S_OK;
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            CSRWExclusiveAutoLock lock(&m_lock);
+            step.done = !undo;
+            _AppendStepRecord(undo ? RENAME_JOURNAL_RECORD_UNDONE : RENAME_JOURNAL_RECORD_DONE, id);
+        }
+        else if (failedCount)
+        {
+            (*failedCount)++;
+        }
+    }
+
+    return Flush();
+}
+
+HRESULT CRenameJournal::s_GetDefaultPath(_Out_ std::wstring& path)
+{
+    path.clear();
+    std::wstring folder;
+    HRESULT hr = GetPowerRenameDataFolder(folder);
+    if (SUCCEEDED(hr))
+    {
+        path = folder + L"\\RenameJournal.bin";
+    }
+    return hr;
+}
+
+HRESULT CRenameJournal::s_Undo(_In_ PCWSTR path, _Out_ UINT* failedCount)
+{
+    *failedCount = 0;
+
+    // Scope the journal so its file is closed before it is deleted
+    HRESULT hr = S_OK;
+    {
+        CRenameJournal journal;
+        hr = journal.Open(path);
+        if (SUCCEEDED(hr))
+        {
+            std::unique_ptr<CRenameBackend> backend = CRenameBackend::s_Create();
+            hr = journal.Replay(true, backend.get(), failedCount);
+        }
+    }
+
+    if (SUCCEEDED(hr) && *failedCount == 0 && !DeleteFile(path))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    return hr;
+}
+
+bool CRenameJournal::s_CanUndo(_In_ PCWSTR path)
+{
+    return GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES;
+}
+
+void CRenameJournal::_Append(_In_ const void* data, _In_ size_t size)
+{
+    const BYTE* bytes = reinterpret_cast<const BYTE*>(data);
+    m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+    if (m_buffer.size() >= RENAME_JOURNAL_FLUSH_SIZE)
+    {
+        _FlushLocked();
+    }
+}
+
+void CRenameJournal::_AppendString(_In_ const std::wstring& value)
+{
+    UINT16 length = static_cast<UINT16>((std::min)(value.length(), static_cast<size_t>(UINT16_MAX)));
+    _Append(&length, sizeof(length));
+    _Append(value.c_str(), length * sizeof(wchar_t));
+}
+
+void CRenameJournal::_AppendStepRecord(_In_ BYTE type, _In_ UINT step)
+{
+    _Append(&type, sizeof(type));
+    UINT32 step32 = step;
+    _Append(&step32, sizeof(step32));
+}
+
+HRESULT CRenameJournal::_FlushLocked()
+{
+    HRESULT hr = S_OK;
+    if (!m_buffer.empty() && m_file != INVALID_HANDLE_VALUE)
+    {
+        DWORD bytesWritten = 0;
+        if (!WriteFile(m_file, m_buffer.data(), static_cast<DWORD>(m_buffer.size()), &bytesWritten, nullptr))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    // A record that could not be written is dropped rather than retried.
+    // Replay copes with missing done records.
+    m_buffer.clear();
+    return hr;
+}
+
+// Rebuilds the folders and steps from the records.  Returns false if data is
+// not a journal.  validSize receives the size up to the last complete record.
+bool CRenameJournal::_Parse(_In_ const std::vector<BYTE>& data, _Out_ size_t* validSize)
+{
+    *validSize = 0;
+    size_t offset = 0;
+    auto read = [&](_Out_ void* value, _In_ size_t size) {
+        if (data.size() - offset < size)
+        {
+            return false;
+        }
+        memcpy(value, data.data() + offset, size);
+        offset += size;
+        return true;
+    };
+    auto readString = [&](_Out_ std::wstring& value) {
+        UINT16 length = 0;
+        if (!read(&length, sizeof(length)) || data.size() - offset < length * sizeof(wchar_t))
+        {
+            return false;
+        }
+        value.assign(reinterpret_cast<const wchar_t*>(data.data() + offset), length);
+        offset += length * sizeof(wchar_t);
+        return true;
+    };
+
+    UINT32 header[2] = { 0 };
+    if (!read(header, sizeof(header)) || header[0] != RENAME_JOURNAL_MAGIC || header[1] != RENAME_JOURNAL_VERSION)
+    {
+        return false;
+    }
+    *validSize = offset;
+
+    while (offset < data.size())
+    {
+        BYTE type = 0;
+        UINT32 id = 0;
+        read(&type, sizeof(type));
+        if (type == RENAME_JOURNAL_RECORD_FOLDER)
+        {
+            std::wstring folder;
+            if (!read(&id, sizeof(id)) || !readString(folder) || id != m_folders.size())
+            {
+                break;
+            }
+            m_folders.push_back(std::move(folder));
+        }
+        else if (type == RENAME_JOURNAL_RECORD_STEP)
+        {
+            Step step;
+            if (!read(&id, sizeof(id)) || !readString(step.name) || !readString(step.newName) || id >= m_folders.size())
+            {
+                break;
+            }
+            step.folderId = id;
+            m_steps.push_back(std::move(step));
+        }
+        else if (type == RENAME_JOURNAL_RECORD_DONE || type == RENAME_JOURNAL_RECORD_UNDONE)
+        {
+            if (!read(&id, sizeof(id)) || id >= m_steps.size())
+            {
+                break;
+            }
+            m_steps[id].done = (type == RENAME_JOURNAL_RECORD_DONE);
+        }
+        else
+        {
+            break;
+        }
+
+        *validSize = offset;
+    }
+
+    return true;
+}
+
+void CRenameJournal::_Close()
+{
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        Flush();
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+}
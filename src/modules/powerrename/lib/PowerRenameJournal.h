@@ -0,0 +1,98 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "srwlock.h"
+
+class CRenameBackend;
+
+// Size of the write buffer.  Records are written to the file once this much is
+// pending, so a batch costs one write every few thousand renames.
+#define RENAME_JOURNAL_FLUSH_SIZE (64 * 1024)
+
+// Append-only record of a rename batch that can undo it, redo it or finish it
+// after a crash.
+//
+// The journal lists the folders and the planned steps of the batch, in an
+// order in which they can be performed one after the other, followed by a
+// record each time a step is done or undone.  Steps are recorded by folder id
+// and names so a record is a few dozen bytes:
+//
+//   header   'PRNJ' magic, version
+//   folder   'F', id, path
+//   step     'S', folder id, name, new name      (ids count up from 0)
+//   done     'C', step id
+//   undone   'U', step id
+//
+// Strings are a 16-bit length followed by UTF-16 characters.  Records are only
+// flushed in batches so the last ones may be lost in a crash.  Replay checks
+// the file system for steps whose record was lost.
+class CRenameJournal
+{
+public:
+    CRenameJournal() = default;
+    ~CRenameJournal();
+
+    // Starts a new journal at path, replacing any previous one
+    HRESULT Create(_In_ PCWSTR path);
+
+    // Reads the journal at path so that it can be replayed.  A record cut short
+    // by a crash is dropped.
+    HRESULT Open(_In_ PCWSTR path);
+
+    // Declares a folder, with its trailing separator, and returns its id
+    UINT AddFolder(_In_ const std::wstring& folder);
+
+    // Adds a planned step and returns its id.  Steps must be added in an order
+    // in which they can be performed one after the other.
+    UINT AddStep(_In_ UINT folderId, _In_ const std::wstring& name, _In_ const std::wstring& newName);
+
+    // Records that a step was performed.  Can be called from any thread.
+    void Commit(_In_ UINT step);
+
+    // Writes the pending records to the file
+    HRESULT Flush();
+
+    // Undoes every step that is done, last first, or performs every step that
+    // is not, first first.  The latter redoes an undone batch or finishes one
+    // that was interrupted.  Steps whose done record was lost are found on
+    // the file system either way.  failedCount receives the steps that failed.
+    HRESULT Replay(_In_ bool undo, _In_ CRenameBackend* backend, _Out_opt_ UINT* failedCount);
+
+    UINT GetStepCount() const { return static_cast<UINT>(m_steps.size()); }
+    UINT GetDoneCount() const;
+
+    // %LOCALAPPDATA%\Microsoft\PowerToys\PowerRename\RenameJournal.bin.  The
+    // folder is created if needed.
+    static HRESULT s_GetDefaultPath(_Out_ std::wstring& path);
+
+    // Undoes the batch recorded in the journal at path on the file system.
+    // The journal is deleted once every step is undone, so a batch is only
+    // undone once.  Otherwise it is kept for another try.
+    static HRESULT s_Undo(_In_ PCWSTR path, _Out_ UINT* failedCount);
+
+    // Returns true if there is a journal at path for s_Undo
+    static bool s_CanUndo(_In_ PCWSTR path);
+
+private:
+    struct Step
+    {
+        UINT folderId = 0;
+        std::wstring name;
+        std::wstring newName;
+        bool done = false;
+    };
+
+    void _Append(_In_ const void* data, _In_ size_t size);
+    void _AppendString(_In_ const std::wstring& value);
+    void _AppendStepRecord(_In_ BYTE type, _In_ UINT step);
+    HRESULT _FlushLocked();
+    bool _Parse(_In_ const std::vector<BYTE>& data, _Out_ size_t* validSize);
+    void _Close();
+
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    std::vector<std::wstring> m_folders;
+    std::vector<Step> m_steps;
+
+    CSRWLock m_lock;
+    _Guarded_by_(m_lock) std::vector<BYTE> m_buffer;
+};
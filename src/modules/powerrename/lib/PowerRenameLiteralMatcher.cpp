@@ -0,0 +1,151 @@
+#include "stdafx.h"
+#include "PowerRenameLiteralMatcher.h"
+#include <cwctype>
+#include <cwchar>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#include <intrin.h>
+#define LITERAL_MATCHER_SSE2
+#endif
+
+void CPowerRenameLiteralMatcher::SetSearchTerm(_In_opt_ const wchar_t* searchTerm, _In_ bool caseSensitive)
+{
+    m_caseSensitive = caseSensitive;
+    m_searchTerm = searchTerm ? searchTerm : L"";
+    if (!m_caseSensitive)
+    {
+        for (auto& c : m_searchTerm)
+        {
+            c = static_cast<wchar_t>(towlower(c));
+        }
+    }
+
+    m_firstLower = m_searchTerm.empty() ? 0 : m_searchTerm[0];
+    m_firstUpper = m_caseSensitive ? m_firstLower : static_cast<wchar_t>(towupper(m_firstLower));
+}
+
+bool CPowerRenameLiteralMatcher::_MatchesAt(_In_ const wchar_t* text) const
+{
+    if (m_caseSensitive)
+    {
+        return wmemcmp(text, m_searchTerm.c_str(), m_searchTerm.length()) == 0;
+    }
+
+    for (size_t i = 0; i < m_searchTerm.length(); i++)
+    {
+        if (static_cast<wchar_t>(towlower(text[i])) != m_searchTerm[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t CPowerRenameLiteralMatcher::Find(_In_reads_(length) const wchar_t* text, _In_ size_t length, _In_ size_t start) const
+{
+    size_t searchTermLength = m_searchTerm.length();
+    if (searchTermLength == 0 || length < searchTermLength || start > length - searchTermLength)
+    {
+        return std::wstring::npos;
+    }
+
+    size_t lastStart = length - searchTermLength;
+    size_t i = start;
+
+#ifdef LITERAL_MATCHER_SSE2
+    // Compare 8 UTF-16 code units at a time against the first search term
+    // character.  Outside of ASCII the case mapping is not a simple pair so
+    // every non-ASCII code unit is a candidate when ignoring case.  Each
+    // candidate is then confirmed with a full comparison.
+    const __m128i firstLower = _mm_set1_epi16(static_cast<short>(m_firstLower));
+    const __m128i firstUpper = _mm_set1_epi16(static_cast<short>(m_firstUpper));
+    const __m128i nonAsciiBits = _mm_set1_epi16(static_cast<short>(0xFF80));
+    const __m128i zero = _mm_setzero_si128();
+    for (; (i + 8 <= length) && (i <= lastStart); i += 8)
+    {
+        __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        __m128i candidates = _mm_or_si128(_mm_cmpeq_epi16(chars, firstLower), _mm_cmpeq_epi16(chars, firstUpper));
+        if (!m_caseSensitive)
+        {
+            __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(chars, nonAsciiBits), zero);
+            candidates = _mm_or_si128(candidates, _mm_andnot_si128(ascii, _mm_cmpeq_epi16(zero, zero)));
+        }
+
+        // Two mask bits per code unit
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(candidates));
+        while (mask != 0)
+        {
+            unsigned long bit = 0;
+            _BitScanForward(&bit, mask);
+            size_t candidate = i + (bit / 2);
+            if (candidate > lastStart)
+            {
+                return std::wstring::npos;
+            }
+
+            if (_MatchesAt(text + candidate))
+            {
+                return candidate;
+            }
+            mask &= ~(3u << bit);
+        }
+    }
+#endif
+
+    for (; i <= lastStart; i++)
+    {
+        if (_MatchesAt(text + i))
+        {
+            return i;
+        }
+    }
+
+    return std::wstring::npos;
+}
+
+size_t CPowerRenameLiteralMatcher::Replace(_In_reads_(length) const wchar_t* text,
+                                           _In_ size_t length,
+                                           _In_reads_(replaceLength) const wchar_t* replaceTerm,
+                                           _In_ size_t replaceLength,
+                                           _In_ bool replaceAll,
+                                           _Out_ std::wstring& result) const
+{
+    result.clear();
+
+    size_t searchTermLength = m_searchTerm.length();
+    if (searchTermLength == 0)
+    {
+        result.assign(text, length);
+        return 0;
+    }
+
+    // Reserve for the largest possible result so appending never reallocates
+    size_t capacity = length;
+    if (replaceLength > searchTermLength)
+    {
+        size_t maxMatches = replaceAll ? (length / searchTermLength) : 1;
+        capacity += maxMatches * (replaceLength - searchTermLength);
+    }
+    result.reserve(capacity);
+
+    size_t matchCount = 0;
+    size_t copyFrom = 0;
+    size_t pos = Find(text, length, 0);
+    while (pos != std::wstring::npos)
+    {
+        result.append(text + copyFrom, pos - copyFrom);
+        result.append(replaceTerm, replaceLength);
+        copyFrom = pos + searchTermLength;
+        matchCount++;
+
+        if (!replaceAll)
+        {
+            break;
+        }
+        pos = Find(text, length, copyFrom);
+    }
+
+    result.append(text + copyFrom, length - copyFrom);
+    return matchCount;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+
+// Finds a literal search term in file names for the plain (non regular
+// expression) search mode.  The search term is case folded once when it is
+// set so that each name is only scanned, never copied or lowered.
+class CPowerRenameLiteralMatcher
+{
+public:
+    CPowerRenameLiteralMatcher() = default;
+    ~CPowerRenameLiteralMatcher() = default;
+
+    void SetSearchTerm(_In_opt_ const wchar_t* searchTerm, _In_ bool caseSensitive);
+
+    size_t GetSearchTermLength() const { return m_searchTerm.length(); }
+
+    // Returns the position of the first match that starts at or after start,
+    // or std::wstring::npos if there is none.
+    size_t Find(_In_reads_(length) const wchar_t* text, _In_ size_t length, _In_ size_t start) const;
+
+    // Writes text to result with the first match, or every match if replaceAll
+    // is set, substituted with replaceTerm.  result is sized once up front.
+    // Returns the number of matches that were replaced.
+    size_t Replace(_In_reads_(length) const wchar_t* text,
+                   _In_ size_t length,
+                   _In_reads_(replaceLength) const wchar_t* replaceTerm,
+                   _In_ size_t replaceLength,
+                   _In_ bool replaceAll,
+                   _Out_ std::wstring& result) const;
+
+private:
+    bool _MatchesAt(_In_ const wchar_t* text) const;
+
+    // Lowercased unless the search is case sensitive
+    std::wstring m_searchTerm;
+    bool m_caseSensitive = false;
+    // Both cases of the first search term character.  Used to filter the
+    // positions that need a full comparison.
+    wchar_t m_firstLower = 0;
+    wchar_t m_firstUpper = 0;
+};
@@ -0,0 +1,428 @@
+#include "stdafx.h"
+#include "PowerRenameMRU.h"
+#include "Helpers.h"
+#include <algorithm>
+#include <cmath>
+#include <cwctype>
+
+// 'PRMU'
+#define RENAME_MRU_MAGIC 0x554D5250
+#define RENAME_MRU_VERSION 1
+
+// Uses after which the scores are scaled back down, well before the weight of
+// a use could overflow
+#define RENAME_MRU_RESCALE_USES static_cast<UINT64>(RENAME_MRU_HALF_LIFE * 256)
+
+CRenameMRUStore::CRenameMRUStore(_In_ const std::wstring& path, _In_ size_t maxEntries) :
+    m_path(path),
+    m_maxEntries((std::max)(maxEntries, static_cast<size_t>(1)))
+{
+}
+
+void CRenameMRUStore::Add(_In_ const std::wstring& term)
+{
+    if (term.empty() || term.length() > RENAME_MRU_MAX_TERM_LENGTH)
+    {
+        return;
+    }
+
+    CSRWExclusiveAutoLock lock(&m_lock);
+    _EnsureLoaded();
+
+    if (m_useCount - m_scoreBase >= RENAME_MRU_RESCALE_USES)
+    {
+        // Scaling every score by the same amount keeps their order
+        double scale = std::exp2(-static_cast<double>(m_useCount - m_scoreBase) / RENAME_MRU_HALF_LIFE);
+        for (auto& entry : m_entries)
+        {
+            entry.score *= scale;
+        }
+        m_scoreBase = m_useCount;
+    }
+
+    UINT id = 0;
+    auto it = m_index.find(term);
+    if (it != m_index.end())
+    {
+        id = it->second;
+    }
+    else if (m_entries.size() < m_maxEntries)
+    {
+        id = static_cast<UINT>(m_entries.size());
+        m_entries.emplace_back();
+    }
+    else
+    {
+        // Replace the lowest ranked term
+        for (UINT i = 1; i < m_entries.size(); i++)
+        {
+            if (_IsRankedBefore(id, i))
+            {
+                id = i;
+            }
+        }
+        m_index.erase(m_entries[id].term);
+        m_entries[id] = Entry();
+    }
+
+    Entry& entry = m_entries[id];
+    if (entry.term.empty())
+    {
+        entry.term = term;
+        entry.key = _Fold(term);
+        m_index.emplace(term, id);
+    }
+
+    entry.useCount++;
+    entry.lastUse = m_useCount;
+    entry.score += std::exp2(static_cast<double>(m_useCount - m_scoreBase) / RENAME_MRU_HALF_LIFE);
+    m_useCount++;
+
+    m_changed = true;
+    m_trieValid = false;
+}
+
+void CRenameMRUStore::Find(_In_ const std::wstring& prefix, _In_ size_t maxResults, _Out_ std::vector<std::wstring>& results)
+{
+    results.clear();
+
+    // Exclusive as the first lookup reads the file and builds the trie
+    CSRWExclusiveAutoLock lock(&m_lock);
+    _EnsureLoaded();
+    if (!m_trieValid)
+    {
+        _Rebuild();
+    }
+
+    std::wstring key = _Fold(prefix);
+    UINT node = 0;
+    for (size_t i = 0; i < key.length() && node != UINT_MAX; i++)
+    {
+        UINT child = m_nodes[node].firstChild;
+        while (child != 0 && m_nodes[child].ch != key[i])
+        {
+            child = m_nodes[child].nextSibling;
+        }
+        node = (child != 0) ? child : UINT_MAX;
+    }
+
+    if (node == UINT_MAX || maxResults == 0)
+    {
+        return;
+    }
+
+    const Node& found = m_nodes[node];
+    std::vector<UINT> ranked;
+    if (found.topCount > 0 && maxResults <= found.topCount)
+    {
+        ranked.assign(m_top.begin() + found.topFirst, m_top.begin() + found.topFirst + maxResults);
+    }
+    else
+    {
+        _Rank(found.first, found.last, maxResults, ranked);
+    }
+
+    results.reserve(ranked.size());
+    for (UINT id : ranked)
+    {
+        results.push_back(m_entries[id].term);
+    }
+}
+
+HRESULT CRenameMRUStore::Save()
+{
+    CSRWExclusiveAutoLock lock(&m_lock);
+    if (!m_changed)
+    {
+        return S_FALSE;
+    }
+
+    std::vector<BYTE> data;
+    auto append = [&](_In_ const void* value, _In_ size_t size) {
+        const BYTE* bytes = reinterpret_cast<const BYTE*>(value);
+        data.insert(data.end(), bytes, bytes + size);
+    };
+
+    UINT32 header[] = { RENAME_MRU_MAGIC, RENAME_MRU_VERSION, static_cast<UINT32>(m_entries.size()) };
+    append(header, sizeof(header));
+    append(&m_useCount, sizeof(m_useCount));
+    append(&m_scoreBase, sizeof(m_scoreBase));
+    for (const auto& entry : m_entries)
+    {
+        append(&entry.useCount, sizeof(entry.useCount));
+        append(&entry.lastUse, sizeof(entry.lastUse));
+        append(&entry.score, sizeof(entry.score));
+        UINT16 length = static_cast<UINT16>(entry.term.length());
+        append(&length, sizeof(length));
+        append(entry.term.c_str(), length * sizeof(wchar_t));
+    }
+
+    // Written next to the file and moved over it so a crash leaves either the
+    // old terms or the new ones
+    std::wstring tempPath = m_path + L".tmp";
+    HRESULT hr = S_OK;
+    HANDLE file = CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else
+    {
+        DWORD bytesWritten = 0;
+        if (!WriteFile(file, data.data(), static_cast<DWORD>(data.size()), &bytesWritten, nullptr) || bytesWritten != data.size())
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+        }
+        CloseHandle(file);
+
+        if (SUCCEEDED(hr) && !MoveFileEx(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        if (FAILED(hr))
+        {
+            DeleteFile(tempPath.c_str());
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_changed = false;
+    }
+
+    return hr;
+}
+
+size_t CRenameMRUStore::GetCount()
+{
+    CSRWExclusiveAutoLock lock(&m_lock);
+    _EnsureLoaded();
+    return m_entries.size();
+}
+
+HRESULT CRenameMRUStore::s_GetDefaultPath(_In_ PCWSTR name, _Out_ std::wstring& path)
+{
+    path.clear();
+    std::wstring folder;
+    HRESULT hr = GetPowerRenameDataFolder(folder);
+    if (SUCCEEDED(hr))
+    {
+        path = folder + L"\\" + name + L".bin";
+    }
+    return hr;
+}
+
+// Higher score first, then the most recently used
+bool CRenameMRUStore::_IsRankedBefore(_In_ UINT entry, _In_ UINT other) const
+{
+    const Entry& first = m_entries[entry];
+    const Entry& second = m_entries[other];
+    if (first.score != second.score)
+    {
+        return first.score > second.score;
+    }
+    return first.lastUse > second.lastUse;
+}
+
+// Fills ranked with the count best ranked entries of m_order[first, last)
+void CRenameMRUStore::_Rank(_In_ UINT first, _In_ UINT last, _In_ size_t count, _Out_ std::vector<UINT>& ranked) const
+{
+    ranked.assign(m_order.begin() + first, m_order.begin() + last);
+    count = (std::min)(count, ranked.size());
+    auto isRankedBefore = [this](UINT entry, UINT other) { return _IsRankedBefore(entry, other); };
+    std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(), isRankedBefore);
+    ranked.resize(count);
+}
+
+void CRenameMRUStore::_EnsureLoaded()
+{
+    if (!m_loaded)
+    {
+        m_loaded = true;
+        // A missing or damaged file leaves the list empty
+        _Load();
+    }
+}
+
+HRESULT CRenameMRUStore::_Load()
+{
+    HANDLE file = CreateFile(m_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    LARGE_INTEGER fileSize = { 0 };
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (fileSize.QuadPart > MAXDWORD)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+
+    std::vector<BYTE> data;
+    if (SUCCEEDED(hr))
+    {
+        data.resize(static_cast<size_t>(fileSize.QuadPart));
+        DWORD bytesRead = 0;
+        if (!data.empty() && (!ReadFile(file, data.data(), static_cast<DWORD>(data.size()), &bytesRead, nullptr) || bytesRead != data.size()))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+        }
+    }
+    CloseHandle(file);
+
+    size_t offset = 0;
+    auto read = [&](_Out_ void* value, _In_ size_t size) {
+        if (data.size() - offset < size)
+        {
+            return false;
+        }
+        memcpy(value, data.data() + offset, size);
+        offset += size;
+        return true;
+    };
+
+    UINT32 header[3] = { 0 };
+    UINT64 useCount = 0;
+    UINT64 scoreBase = 0;
+    if (SUCCEEDED(hr) &&
+        (!read(header, sizeof(header)) || !read(&useCount, sizeof(useCount)) || !read(&scoreBase, sizeof(scoreBase)) ||
+         header[0] != RENAME_MRU_MAGIC || header[1] != RENAME_MRU_VERSION || scoreBase > useCount))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    std::vector<Entry> entries;
+    std::unordered_map<std::wstring, UINT> index;
+    for (UINT32 i = 0; SUCCEEDED(hr) && i < header[2] && entries.size() < m_maxEntries; i++)
+    {
+        Entry entry;
+        UINT16 length = 0;
+        if (!read(&entry.useCount, sizeof(entry.useCount)) ||
+            !read(&entry.lastUse, sizeof(entry.lastUse)) ||
+            !read(&entry.score, sizeof(entry.score)) ||
+            !read(&length, sizeof(length)) ||
+            length == 0 || data.size() - offset < length * sizeof(wchar_t) ||
+            entry.lastUse >= useCount || !std::isfinite(entry.score))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            break;
+        }
+
+        entry.term.assign(reinterpret_cast<const wchar_t*>(data.data() + offset), length);
+        offset += length * sizeof(wchar_t);
+        if (!index.emplace(entry.term, static_cast<UINT>(entries.size())).second)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            break;
+        }
+
+        entry.key = _Fold(entry.term);
+        entries.push_back(std::move(entry));
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_entries = std::move(entries);
+        m_index = std::move(index);
+        m_useCount = useCount;
+        m_scoreBase = scoreBase;
+        m_trieValid = false;
+    }
+
+    return hr;
+}
+
+// Builds the trie from the keys in alphabetical order.  The nodes on the path
+// of a key are the ones it shares with the previous key plus new ones for the
+// rest of it, so each node is created once and its range grows as keys are
+// added.
+void CRenameMRUStore::_Rebuild()
+{
+    m_order.resize(m_entries.size());
+    for (UINT id = 0; id < m_order.size(); id++)
+    {
+        m_order[id] = id;
+    }
+    std::sort(m_order.begin(), m_order.end(), [this](UINT entry, UINT other) {
+        return m_entries[entry].key < m_entries[other].key;
+    });
+
+    m_nodes.assign(1, Node());
+    m_top.clear();
+
+    std::vector<UINT> path(1, 0);
+    std::vector<UINT> lastChild(1, 0);
+    const std::wstring* previous = nullptr;
+    for (UINT i = 0; i < m_order.size(); i++)
+    {
+        const std::wstring& key = m_entries[m_order[i]].key;
+        size_t shared = 0;
+        if (previous)
+        {
+            size_t length = (std::min)(previous->length(), key.length());
+            while (shared < length && (*previous)[shared] == key[shared])
+            {
+                shared++;
+            }
+        }
+        path.resize(shared + 1);
+
+        for (size_t depth = shared; depth < key.length(); depth++)
+        {
+            UINT parent = path[depth];
+            UINT node = static_cast<UINT>(m_nodes.size());
+            Node child;
+            child.ch = key[depth];
+            child.first = i;
+            m_nodes.push_back(child);
+            lastChild.push_back(0);
+
+            if (lastChild[parent] != 0)
+            {
+                m_nodes[lastChild[parent]].nextSibling = node;
+            }
+            else
+            {
+                m_nodes[parent].firstChild = node;
+            }
+            lastChild[parent] = node;
+            path.push_back(node);
+        }
+
+        for (UINT node : path)
+        {
+            m_nodes[node].last = i + 1;
+        }
+        previous = &key;
+    }
+
+    std::vector<UINT> ranked;
+    for (auto& node : m_nodes)
+    {
+        if (node.last - node.first > RENAME_MRU_SCAN_LIMIT)
+        {
+            _Rank(node.first, node.last, RENAME_MRU_TOP_COUNT, ranked);
+            node.topFirst = static_cast<UINT>(m_top.size());
+            node.topCount = static_cast<UINT>(ranked.size());
+            m_top.insert(m_top.end(), ranked.begin(), ranked.end());
+        }
+    }
+
+    m_trieValid = true;
+}
+
+std::wstring CRenameMRUStore::_Fold(_In_ const std::wstring& term)
+{
+    std::wstring key(term);
+    for (auto& ch : key)
+    {
+        ch = static_cast<wchar_t>(std::towlower(ch));
+    }
+    return key;
+}
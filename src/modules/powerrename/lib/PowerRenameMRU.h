@@ -0,0 +1,113 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "srwlock.h"
+
+// Number of terms kept.  Past that the lowest ranked term makes room for a
+// new one.
+#define RENAME_MRU_MAX_ENTRIES 4096
+
+// Longest term that is kept.  Longer ones are not remembered.
+#define RENAME_MRU_MAX_TERM_LENGTH 1024
+
+// Number of uses after which a use counts half as much as a new one
+#define RENAME_MRU_HALF_LIFE 32.0
+
+// Trie nodes under which more than this many terms start keep their best
+// ranked terms so a short prefix does not rank them all on each lookup
+#define RENAME_MRU_SCAN_LIMIT 128
+
+// Number of best ranked terms kept by those nodes
+#define RENAME_MRU_TOP_COUNT 32
+
+// Terms typed in the search or replace box, ranked by how often and how
+// recently they were used, with lookup by prefix for autocomplete.
+//
+// Each use adds 2^(n / RENAME_MRU_HALF_LIFE) to the score of the term, n
+// counting the uses of any term.  This ranks terms the same as a use count
+// that halves every RENAME_MRU_HALF_LIFE uses, but the score of a term only
+// changes when it is used.
+//
+// Lookups go through a trie of the terms folded to lower case.  The terms under
+// a trie node are contiguous in alphabetical order so a node only stores that
+// range, and nodes with many terms under them keep their best ranked terms
+// too.  The trie is rebuilt by the first lookup after a change.
+//
+// Terms are kept in a single file, read by the first lookup or use:
+//
+//   header   'PRMU' magic, version, term count, use count, score base
+//   term     use count, last use, score, term
+//
+// Strings are a 16-bit length followed by UTF-16 characters.  All methods can
+// be called from any thread.
+class CRenameMRUStore
+{
+public:
+    CRenameMRUStore(_In_ const std::wstring& path, _In_ size_t maxEntries = RENAME_MRU_MAX_ENTRIES);
+    ~CRenameMRUStore() = default;
+
+    // Records a use of term
+    void Add(_In_ const std::wstring& term);
+
+    // Fills results with up to maxResults terms that start with prefix,
+    // ignoring case, best ranked first
+    void Find(_In_ const std::wstring& prefix, _In_ size_t maxResults, _Out_ std::vector<std::wstring>& results);
+
+    // Writes the terms to the file if they changed since it was read
+    HRESULT Save();
+
+    size_t GetCount();
+
+    // %LOCALAPPDATA%\Microsoft\PowerToys\PowerRename\<name>.bin.  The folder is
+    // created if needed.
+    static HRESULT s_GetDefaultPath(_In_ PCWSTR name, _Out_ std::wstring& path);
+
+private:
+    struct Entry
+    {
+        std::wstring term;
+        std::wstring key;
+        UINT32 useCount = 0;
+        UINT64 lastUse = 0;
+        double score = 0;
+    };
+
+    struct Node
+    {
+        wchar_t ch = 0;
+        UINT firstChild = 0;
+        UINT nextSibling = 0;
+        // Range of m_order with the terms that start with the node
+        UINT first = 0;
+        UINT last = 0;
+        // Range of m_top with the best ranked of them, if any
+        UINT topFirst = 0;
+        UINT topCount = 0;
+    };
+
+    bool _IsRankedBefore(_In_ UINT entry, _In_ UINT other) const;
+    void _Rank(_In_ UINT first, _In_ UINT last, _In_ size_t count, _Out_ std::vector<UINT>& ranked) const;
+    void _EnsureLoaded();
+    HRESULT _Load();
+    void _Rebuild();
+    static std::wstring _Fold(_In_ const std::wstring& term);
+
+    CSRWLock m_lock;
+    const std::wstring m_path;
+    const size_t m_maxEntries;
+
+    _Guarded_by_(m_lock) bool m_loaded = false;
+    _Guarded_by_(m_lock) bool m_changed = false;
+    _Guarded_by_(m_lock) bool m_trieValid = false;
+    _Guarded_by_(m_lock) UINT64 m_useCount = 0;
+    // Use at which a use adds 1 to a score
+    _Guarded_by_(m_lock) UINT64 m_scoreBase = 0;
+    _Guarded_by_(m_lock) std::vector<Entry> m_entries;
+    _Guarded_by_(m_lock) std::unordered_map<std::wstring, UINT> m_index;
+
+    // Entries sorted by key, the trie and the ranked lists of its nodes
+    _Guarded_by_(m_lock) std::vector<UINT> m_order;
+    _Guarded_by_(m_lock) std::vector<Node> m_nodes;
+    _Guarded_by_(m_lock) std::vector<UINT> m_top;
+};
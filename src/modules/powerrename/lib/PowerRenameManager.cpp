@@ -4,17 +4,27 @@
 #include <algorithm>
 #include <shlobj.h>
 #include "helpers.h"
+#include "PowerRenameExecutor.h"
+#include "PowerRenameItem.h"
+#include "PowerRenameJournal.h"
+#include "PowerRenameManifest.h"
+#include "PowerRenamePreview.h"
+#include "PowerRenameTemplate.h"
+#include "PowerRenameTimings.h"
 #include "window_helpers.h"
-#include <filesystem>
+#include <optional>
+#include <atomic>
+#include "Settings.h"
 #include "trace.h"
 
-namespace fs = std::filesystem;
+// Per item state flags tracked by the manager.  The same bits as the preview
+// so the states are copied into it as they are.
+#define ITEM_STATE_SELECTED PREVIEW_ITEM_SELECTED
+#define ITEM_STATE_SHOULD_RENAME PREVIEW_ITEM_SHOULD_RENAME
+#define ITEM_STATE_CHANGED PREVIEW_ITEM_CHANGED
 
 extern HINSTANCE g_hInst;
 
-// The default FOF flags to use in the rename operations
-#define FOF_DEFAULTFLAGS (FOF_ALLOWUNDO | FOFX_ADDUNDORECORD | FOFX_SHOWELEVATIONPROMPT | FOF_RENAMEONCOLLISION)
-
 IFACEMETHODIMP_(ULONG) CPowerRenameManager::AddRef()
 {
     return InterlockedIncrement(&m_refCount);
@@ -89,9 +99,14 @@ IFACEMETHODIMP CPowerRenameManager::Stop()
     return E_NOTIMPL;
 }
 
-IFACEMETHODIMP CPowerRenameManager::Rename(_In_ HWND hwndParent)
+IFACEMETHODIMP CPowerRenameManager::Rename(_In_ HWND /*hwndParent*/)
 {
-    m_hwndParent = hwndParent;
+    // Folders may still be enumerated
+    if (!m_enumWorkerThreadHandles.empty())
+    {
+        return HRESULT_FROM_WIN32(ERROR_BUSY);
+    }
+
     return _PerformFileOperation();
 }
 
@@ -104,6 +119,8 @@ IFACEMETHODIMP CPowerRenameManager::Reset()
 
 IFACEMETHODIMP CPowerRenameManager::Shutdown()
 {
+    _StopRegExWorkerThread();
+    _CancelEnumWorkerThreads();
     _ClearRegEx();
     _Cleanup();
     return S_OK;
@@ -111,29 +128,67 @@ IFACEMETHODIMP CPowerRenameManager::Shutdown()
 
 IFACEMETHODIMP CPowerRenameManager::AddItem(_In_ IPowerRenameItem* pItem)
 {
-    HRESULT hr = E_FAIL;
+    bool added = false;
     // Scope lock
     {
         CSRWExclusiveAutoLock lock(&m_lockItems);
-        int id = 0;
-        pItem->get_id(&id);
-        // Verify the item isn't already added
-        if (m_renameItems.find(id) == m_renameItems.end())
-        {
-            m_renameItems[id] = pItem;
-            pItem->AddRef();
-            hr = S_OK;
-        }
+        added = _AddItem(pItem);
     }
 
-    if (SUCCEEDED(hr))
+    if (added)
     {
+        // Published when the snapshot is next read, so a loop of AddItem
+        // calls builds one snapshot rather than one per item
+        m_previewPublishPending = true;
         _OnItemAdded(pItem);
     }
 
+    return added ? S_OK : E_FAIL;
+}
+
+IFACEMETHODIMP CPowerRenameManager::AddItems(_In_reads_(count) IPowerRenameItem* const* items, _In_ UINT count)
+{
+    std::vector<CComPtr<IPowerRenameItem>> batch(items, items + count);
+    UINT firstIndex = 0;
+    UINT lastIndex = 0;
+    bool added = _AddItems(batch, &firstIndex, &lastIndex);
+    if (added)
+    {
+        PublishPreview();
+        _OnItemsAdded(firstIndex, lastIndex);
+    }
+
+    return added ? S_OK : E_FAIL;
+}
+
+IFACEMETHODIMP CPowerRenameManager::WaitForPreview()
+{
+    // The worker is only started by the first search otherwise
+    HRESULT hr = _SignalRegExWorkerThread();
+    if (SUCCEEDED(hr))
+    {
+        _WaitForRegExWorkerIdle();
+    }
     return hr;
 }
 
+IFACEMETHODIMP CPowerRenameManager::RemoveAllItems()
+{
+    _CancelEnumWorkerThreads();
+
+    // Once the worker has caught up the renamed count covers every item
+    _WaitForRegExWorkerIdle();
+    m_regExRemovedRenamedCount = m_regExRenamedCount;
+    m_regExRemovedGeneration = m_regExEvaluatedGeneration;
+    m_regExEvaluatedIndex = 0;
+
+    // The snapshot points to the removed items.  Only this thread reads it
+    // and it is replaced before this returns.
+    _ClearPowerRenameItems();
+    PublishPreview();
+    return S_OK;
+}
+
 IFACEMETHODIMP CPowerRenameManager::GetItemByIndex(_In_ UINT index, _COM_Outptr_ IPowerRenameItem** ppItem)
 {
     *ppItem = nullptr;
@@ -141,9 +196,7 @@ IFACEMETHODIMP CPowerRenameManager::GetItemByIndex(_In_ UINT index, _COM_Outptr_
     HRESULT hr = E_FAIL;
     if (index < m_renameItems.size())
     {
-        std::map<int, IPowerRenameItem*>::iterator it = m_renameItems.begin();
-        std::advance(it, index);
-        *ppItem = it->second;
+        *ppItem = m_renameItems[index];
         (*ppItem)->AddRef();
         hr = S_OK;
     }
@@ -157,11 +210,10 @@ IFACEMETHODIMP CPowerRenameManager::GetItemById(_In_ int id, _COM_Outptr_ IPower
 
     CSRWSharedAutoLock lock(&m_lockItems);
     HRESULT hr = E_FAIL;
-    std::map<int, IPowerRenameItem*>::iterator it;
-    it = m_renameItems.find(id);
-    if (it !=  m_renameItems.end())
+    auto it = m_renameItemIndexes.find(id);
+    if (it != m_renameItemIndexes.end())
     {
-        *ppItem = m_renameItems[id];
+        *ppItem = m_renameItems[it->second];
         (*ppItem)->AddRef();
         hr = S_OK;
     }
@@ -178,37 +230,53 @@ IFACEMETHODIMP CPowerRenameManager::GetItemCount(_Out_ UINT* count)
 
 IFACEMETHODIMP CPowerRenameManager::GetSelectedItemCount(_Out_ UINT* count)
 {
-    *count = 0;
     CSRWSharedAutoLock lock(&m_lockItems);
+    *count = m_selectedItemCount;
+    return S_OK;
+}
+
+IFACEMETHODIMP CPowerRenameManager::GetRenameItemCount(_Out_ UINT* count)
+{
+    CSRWSharedAutoLock lock(&m_lockItems);
+    *count = m_renameItemCount;
+    return S_OK;
+}
 
-    for (auto it : m_renameItems)
+IFACEMETHODIMP CPowerRenameManager::SetItemSelected(_In_ UINT index, _In_ bool selected)
+{
+    HRESULT hr = E_FAIL;
+    // Scope lock
     {
-        IPowerRenameItem* pItem = it.second;
-        bool selected = false;
-        if (SUCCEEDED(pItem->get_selected(&selected)) && selected)
+        CSRWExclusiveAutoLock lock(&m_lockItems);
+        if (index < m_renameItems.size())
         {
-            (*count)++;
+            hr = m_renameItems[index]->put_selected(selected);
+            _SetItemState(index, _GetItemState(m_renameItems[index]));
         }
     }
 
-    return S_OK;
+    if (SUCCEEDED(hr))
+    {
+        PublishPreview();
+    }
+
+    return hr;
 }
 
-IFACEMETHODIMP CPowerRenameManager::GetRenameItemCount(_Out_ UINT* count)
+IFACEMETHODIMP CPowerRenameManager::SetAllItemsSelected(_In_ bool selected)
 {
-    *count = 0;
-    CSRWSharedAutoLock lock(&m_lockItems);
-
-    for (auto it : m_renameItems)
+    // Scope lock
     {
-        IPowerRenameItem* pItem = it.second;
-        bool shouldRename = false;
-        if (SUCCEEDED(pItem->ShouldRenameItem(m_flags, &shouldRename)) && shouldRename)
+        CSRWExclusiveAutoLock lock(&m_lockItems);
+        for (UINT u = 0; u < m_renameItems.size(); u++)
         {
-            (*count)++;
+            m_renameItems[u]->put_selected(selected);
+            _SetItemState(u, _GetItemState(m_renameItems[u]));
         }
     }
- 
+
+    PublishPreview();
+
     return S_OK;
 }
 
@@ -268,6 +336,20 @@ IFACEMETHODIMP CPowerRenameManager::put_renameItemFactory(_In_ IPowerRenameItemF
     return S_OK;
 }
 
+IFACEMETHODIMP CPowerRenameManager::GetPreviewSnapshot(_Outptr_ const CPreviewSnapshot** snapshot)
+{
+    // Whoever changes the items publishes the new snapshot, so reading it
+    // never takes a lock or allocates.  Only items added with AddItem are
+    // published here, keeping the snapshot the caller may still hold.
+    if (m_previewPublishPending)
+    {
+        _PublishPreview(false);
+    }
+
+    *snapshot = m_previewSnapshot;
+    return *snapshot ? S_OK : E_FAIL;
+}
+
 IFACEMETHODIMP CPowerRenameManager::OnSearchTermChanged(_In_ PCWSTR /*searchTerm*/)
 {
     _PerformRegExRename();
@@ -305,25 +387,43 @@ HRESULT CPowerRenameManager::s_CreateInstance(_Outptr_ IPowerRenameManager** pps
     return hr;
 }
 
+void CPowerRenameManager::UpdateItemStates(_In_ UINT firstIndex, _In_ UINT endIndex)
+{
+    CSRWExclusiveAutoLock lock(&m_lockItems);
+    endIndex = (std::min)(endIndex, static_cast<UINT>(m_renameItems.size()));
+    for (UINT u = firstIndex; u < endIndex; u++)
+    {
+        _SetItemState(u, _GetItemState(m_renameItems[u]));
+    }
+}
+
 CPowerRenameManager::CPowerRenameManager() :
     m_refCount(1)
 {
-    InitializeCriticalSection(&m_critsecReentrancy);
 }
 
 CPowerRenameManager::~CPowerRenameManager()
 {
-    DeleteCriticalSection(&m_critsecReentrancy);
+    // The preview worker does not hold a reference so it must be gone
+    // before the manager is
+    _StopRegExWorkerThread();
+    _ClearPreview();
 }
 
 HRESULT CPowerRenameManager::_Init()
 {
     // Guaranteed to succeed
     m_startFileOpWorkerEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
-    m_startRegExWorkerEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
-    m_cancelRegExWorkerEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    m_regExWorkEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    m_regExIdleEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    m_stopRegExWorkerEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    m_cancelRegExPassEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    m_cancelEnumWorkerEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    m_regExDelay = CSettings::GetPreviewDelay();
 
     m_hwndMessage = CreateMsgWindow(g_hInst, s_msgWndProc, this);
+    m_managerThreadId = GetCurrentThreadId();
 
     return S_OK;
 }
@@ -331,11 +431,18 @@ HRESULT CPowerRenameManager::_Init()
 // Custom messages for worker threads
 enum
 {
-    SRM_REGEX_ITEM_UPDATED = (WM_APP + 1),  // Single rename item processed by regex worker thread
+    SRM_REGEX_ITEMS_UPDATED = (WM_APP + 1), // Range of rename items processed by regex worker thread
     SRM_REGEX_STARTED,                      // RegEx operation was started
     SRM_REGEX_CANCELED,                     // Regex operation was canceled
     SRM_REGEX_COMPLETE,                     // Regex worker thread completed
-    SRM_FILEOP_COMPLETE                     // File Operation worker thread completed
+    SRM_REGEX_ITEM_ERROR,                   // Regex ran out of time on an item
+    SRM_FILEOP_PROGRESS,                    // Number of items the file operation worker has processed
+    SRM_FILEOP_ITEM_ERROR,                  // File operation worker failed to rename an item
+    SRM_FILEOP_COMPLETE,                    // File Operation worker thread completed
+    SRM_ENUM_ITEMS_ADDED,                   // Range of items added by an enumeration worker thread
+    SRM_ENUM_ERROR,                         // Enumeration worker thread failed to read its items
+    SRM_ENUM_COMPLETE,                      // Enumeration worker thread completed
+    SRM_PREVIEW_RETIRED                     // A preview snapshot was replaced by a newer one
 };
 
 struct WorkerThreadData
@@ -343,10 +450,29 @@ struct WorkerThreadData
     HWND hwndManager = nullptr;
     HANDLE startEvent = nullptr;
     HANDLE cancelEvent = nullptr;
-    HWND hwndParent = nullptr;
     CComPtr<IPowerRenameManager> spsrm;
 };
 
+struct EnumWorkerThreadData
+{
+    HWND hwndManager = nullptr;
+    HANDLE cancelEvent = nullptr;
+    CComPtr<IPowerRenameManager> spsrm;
+    CComPtr<IPowerRenameItemFactory> spItemFactory;
+    // Items to enumerate, in order
+    std::vector<PIDLIST_ABSOLUTE> idLists;
+    // Manifest to import instead, if not empty
+    std::wstring manifestPath;
+
+    ~EnumWorkerThreadData()
+    {
+        for (PIDLIST_ABSOLUTE idList : idLists)
+        {
+            CoTaskMemFree(idList);
+        }
+    }
+};
+
 // Msg-only worker window proc for communication from our worker threads
 LRESULT CALLBACK CPowerRenameManager::s_msgWndProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ WPARAM wParam, _In_ LPARAM lParam)
 {
@@ -376,15 +502,23 @@ LRESULT CPowerRenameManager::_WndProc(_In_ HWND hwnd, _In_ UINT msg, _In_ WPARAM
 
     AddRef();
 
+    // Each message counts as one item, or as the items in its range
+    CRenamePhaseTimer timer(RenamePhaseNotification, 1);
+
     switch (msg)
     {
-    case SRM_REGEX_ITEM_UPDATED:
+    case SRM_REGEX_ITEMS_UPDATED:
     {
-        int id = static_cast<int>(lParam);
-        CComPtr<IPowerRenameItem> spItem;
-        if (SUCCEEDED(GetItemById(id, &spItem)))
+        UINT firstIndex = static_cast<UINT>(wParam);
+        UINT lastIndex = static_cast<UINT>(lParam);
+        UINT itemCount = 0;
+        GetItemCount(&itemCount);
+        // The items may have been cleared since the worker posted the range
+        if (firstIndex < itemCount)
         {
-            _OnUpdate(spItem);
+            lastIndex = (std::min)(lastIndex, itemCount - 1);
+            timer.AddItems(lastIndex - firstIndex);
+            _OnUpdateRange(firstIndex, lastIndex);
         }
         break;
     }
@@ -400,6 +534,74 @@ LRESULT CPowerRenameManager::_WndProc(_In_ HWND hwnd, _In_ UINT msg, _In_ WPARAM
         _OnRegExCompleted(static_cast<DWORD>(wParam));
         break;
 
+    case SRM_REGEX_ITEM_ERROR:
+    {
+        // The items may have been cleared since the worker posted the index
+        CComPtr<IPowerRenameItem> spItem;
+        if (SUCCEEDED(GetItemByIndex(static_cast<UINT>(wParam), &spItem)))
+        {
+            _OnError(spItem, static_cast<HRESULT>(lParam));
+        }
+        break;
+    }
+
+    case SRM_FILEOP_PROGRESS:
+        _OnRenameProgress(static_cast<UINT>(wParam), static_cast<UINT>(lParam));
+        break;
+
+    case SRM_FILEOP_ITEM_ERROR:
+    {
+        CComPtr<IPowerRenameItem> spItem;
+        if (SUCCEEDED(GetItemByIndex(static_cast<UINT>(wParam), &spItem)))
+        {
+            _OnError(spItem, static_cast<HRESULT>(lParam));
+        }
+        break;
+    }
+
+    case SRM_ENUM_ITEMS_ADDED:
+        timer.AddItems(static_cast<UINT>(lParam - wParam));
+        _OnItemsAdded(static_cast<UINT>(wParam), static_cast<UINT>(lParam));
+        _PerformPendingRegExRename();
+        break;
+
+    case SRM_PREVIEW_RETIRED:
+        _ReclaimPreviewSnapshots();
+        break;
+
+    case SRM_ENUM_ERROR:
+    {
+        // Not reported if the enumeration was canceled since
+        DWORD threadId = static_cast<DWORD>(wParam);
+        if (std::any_of(m_enumWorkerThreadHandles.begin(), m_enumWorkerThreadHandles.end(), [threadId](HANDLE threadHandle) {
+                return GetThreadId(threadHandle) == threadId;
+            }))
+        {
+            _OnEnumerationError(static_cast<HRESULT>(lParam));
+        }
+        break;
+    }
+
+    case SRM_ENUM_COMPLETE:
+    {
+        DWORD threadId = static_cast<DWORD>(wParam);
+        auto it = std::find_if(m_enumWorkerThreadHandles.begin(), m_enumWorkerThreadHandles.end(), [threadId](HANDLE threadHandle) {
+            return GetThreadId(threadHandle) == threadId;
+        });
+        // Not found if the enumeration was canceled
+        if (it != m_enumWorkerThreadHandles.end())
+        {
+            WaitForSingleObject(*it, INFINITE);
+            CloseHandle(*it);
+            m_enumWorkerThreadHandles.erase(it);
+            if (m_enumWorkerThreadHandles.empty())
+            {
+                _OnEnumerationCompleted();
+            }
+        }
+        break;
+    }
+
     default:
         lRes = DefWindowProc(hwnd, msg, wParam, lParam);
         break;
@@ -410,6 +612,115 @@ LRESULT CPowerRenameManager::_WndProc(_In_ HWND hwnd, _In_ UINT msg, _In_ WPARAM
     return lRes;
 }
 
+void CPowerRenameManager::MarkPreviewChanged(_In_ UINT firstIndex, _In_ UINT lastIndex)
+{
+    CSRWExclusiveAutoLock lock(&m_lockPreviewDirty);
+    UINT lastPage = lastIndex / PREVIEW_PAGE_SIZE;
+    if (m_previewDirtyPages.size() <= lastPage)
+    {
+        m_previewDirtyPages.resize(lastPage + 1);
+    }
+
+    for (UINT page = firstIndex / PREVIEW_PAGE_SIZE; page <= lastPage; page++)
+    {
+        m_previewDirtyPages[page] = true;
+    }
+}
+
+// The manager thread is the only reader and it is not in the middle of a read
+// while it changes the items, so the snapshot it replaces is deleted at once
+void CPowerRenameManager::PublishPreview()
+{
+    _PublishPreview(GetCurrentThreadId() == m_managerThreadId);
+}
+
+// Makes a snapshot with the changed pages made again and the others shared
+// with the previous snapshot.  The previous snapshot is deleted now if reclaim
+// is true or else when the manager thread handles SRM_PREVIEW_RETIRED.
+void CPowerRenameManager::_PublishPreview(_In_ bool reclaim)
+{
+    CSRWExclusiveAutoLock lock(&m_lockPreview);
+    m_previewPublishPending = false;
+
+    std::vector<bool> dirtyPages;
+    {
+        CSRWExclusiveAutoLock dirtyLock(&m_lockPreviewDirty);
+        dirtyPages.swap(m_previewDirtyPages);
+    }
+
+    const CPreviewSnapshot* previous = m_previewSnapshot;
+    std::vector<std::shared_ptr<const PreviewPage>> pages;
+    if (previous)
+    {
+        pages = previous->GetPages();
+    }
+
+    UINT itemCount = 0;
+    bool changed = false;
+    {
+        CSRWSharedAutoLock itemsLock(&m_lockItems);
+        itemCount = static_cast<UINT>(m_renameItems.size());
+        pages.resize((itemCount + PREVIEW_PAGE_SIZE - 1) / PREVIEW_PAGE_SIZE);
+        for (UINT page = 0; page < pages.size(); page++)
+        {
+            // The last page is also made again when items were added to it
+            UINT first = page * PREVIEW_PAGE_SIZE;
+            UINT count = (std::min)(static_cast<UINT>(PREVIEW_PAGE_SIZE), itemCount - first);
+            if (!pages[page] || pages[page]->items.size() != count || (page < dirtyPages.size() && dirtyPages[page]))
+            {
+                pages[page] = PreviewPage::s_Create(&m_renameItems[first], &m_renameItemStates[first], &m_changedItemBits[page * PREVIEW_PAGE_WORDS], count);
+                changed = true;
+            }
+        }
+    }
+
+    if (!changed && previous && previous->GetItemCount() == itemCount)
+    {
+        return;
+    }
+
+    m_previewSnapshot = new CPreviewSnapshot(itemCount, std::move(pages));
+    if (previous)
+    {
+        m_retiredPreviewSnapshots.push_back(previous);
+        if (reclaim)
+        {
+            _ReclaimPreviewSnapshotsLocked();
+        }
+        else if (m_retiredPreviewSnapshots.size() == 1)
+        {
+            // One message reclaims every snapshot retired until it is handled
+            PostMessage(m_hwndMessage, SRM_PREVIEW_RETIRED, 0, 0);
+        }
+    }
+}
+
+// Runs on the manager thread, outside of any read of a snapshot
+void CPowerRenameManager::_ReclaimPreviewSnapshots()
+{
+    CSRWExclusiveAutoLock lock(&m_lockPreview);
+    _ReclaimPreviewSnapshotsLocked();
+}
+
+void CPowerRenameManager::_ReclaimPreviewSnapshotsLocked()
+{
+    for (const CPreviewSnapshot* snapshot : m_retiredPreviewSnapshots)
+    {
+        delete snapshot;
+    }
+    m_retiredPreviewSnapshots.clear();
+}
+
+void CPowerRenameManager::_ClearPreview()
+{
+    _ReclaimPreviewSnapshots();
+    delete m_previewSnapshot.exchange(nullptr);
+    m_previewPublishPending = false;
+
+    CSRWExclusiveAutoLock dirtyLock(&m_lockPreviewDirty);
+    m_previewDirtyPages.clear();
+}
+
 void CPowerRenameManager::_LogOperationTelemetry()
 {
     UINT renameItemCount = 0;
@@ -422,47 +733,28 @@ void CPowerRenameManager::_LogOperationTelemetry()
     GetRenameItemCount(&renameItemCount);
     get_flags(&flags);
 
-
-    // Enumerate extensions used into a map
-    std::map<std::wstring, int> extensionsMap;
-    for (UINT i = 0; i < totalItemCount; i++)
+    // Extensions are counted as items are added
+    std::wstring extensionList = L"";
     {
-        CComPtr<IPowerRenameItem> spItem;
-        if (SUCCEEDED(GetItemByIndex(i, &spItem)))
+        CSRWSharedAutoLock lock(&m_lockItems);
+        for (const auto& elem : m_extensionCounts)
         {
-            PWSTR originalName;
-            if (SUCCEEDED(spItem->get_originalName(&originalName)))
-            {
-                std::wstring extension = fs::path(originalName).extension().wstring();
-                std::map<std::wstring, int>::iterator it = extensionsMap.find(extension);
-                if (it == extensionsMap.end())
-                {
-                    extensionsMap.insert({ extension, 1 });
-                }
-                else
-                {
-                    it->second++;
-                }
-
-                CoTaskMemFree(originalName);
-            }
+            extensionList.append(elem.first);
+            extensionList.append(L":");
+            extensionList.append(std::to_wstring(elem.second));
+            extensionList.append(L",");
         }
     }
 
-    std::wstring extensionList = L"";
-    for (auto elem : extensionsMap)
-    {
-        extensionList.append(elem.first);
-        extensionList.append(L":");
-        extensionList.append(std::to_wstring(elem.second));
-        extensionList.append(L",");
-    }
-
     Trace::RenameOperation(totalItemCount, selectedItemCount, renameItemCount, flags, extensionList.c_str());
 }
 
 HRESULT CPowerRenameManager::_PerformFileOperation()
 {
+    // Wait for the preview to catch up with the latest search and replace so
+    // the count and telemetry below describe the names that are applied
+    _WaitForRegExWorkerIdle();
+
     // Do we have items to rename?
     UINT renameItemCount = 0;
     if (FAILED(GetRenameItemCount(&renameItemCount)) || renameItemCount == 0)
@@ -472,9 +764,6 @@ HRESULT CPowerRenameManager::_PerformFileOperation()
 
     _LogOperationTelemetry();
 
-    // Wait for existing regex thread to finish
-    _WaitForRegExWorkerThread();
-
     // Create worker thread which will perform the actual rename
     HRESULT hr = _CreateFileOpWorkerThread();
     if (SUCCEEDED(hr))
@@ -485,23 +774,13 @@ HRESULT CPowerRenameManager::_PerformFileOperation()
         // were ready to process thread messages.
         SetEvent(m_startFileOpWorkerEvent);
 
-        while (true)
+        // Dispatch the progress and errors posted by the worker until it exits
+        while (MsgWaitForMultipleObjects(1, &m_fileOpWorkerThreadHandle, FALSE, INFINITE, QS_ALLINPUT) != WAIT_OBJECT_0)
         {
-            // Check if worker thread has exited
-            if (WaitForSingleObject(m_fileOpWorkerThreadHandle, 0) == WAIT_OBJECT_0)
-            {
-                break;
-            }
-
             MSG msg;
             while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
             {
-                if (msg.message == SRM_FILEOP_COMPLETE)
-                {
-                    // Worker thread completed
-                    break;
-                }
-                else
+                if (msg.message != SRM_FILEOP_COMPLETE)
                 {
                     TranslateMessage(&msg);
                     DispatchMessage(&msg);
@@ -509,6 +788,16 @@ HRESULT CPowerRenameManager::_PerformFileOperation()
             }
         }
 
+        // Deliver whatever the worker posted before it exited ahead of the completion
+        MSG msg;
+        while (PeekMessage(&msg, m_hwndMessage, 0, 0, PM_REMOVE))
+        {
+            if (msg.message != SRM_FILEOP_COMPLETE)
+            {
+                DispatchMessage(&msg);
+            }
+        }
+
         _OnRenameCompleted();
     }
 
@@ -522,7 +811,7 @@ HRESULT CPowerRenameManager::_CreateFileOpWorkerThread()
     if (SUCCEEDED(hr))
     {
         pwtd->hwndManager = m_hwndMessage;
-        pwtd->startEvent = m_startRegExWorkerEvent;
+        pwtd->startEvent = m_startFileOpWorkerEvent;
         pwtd->cancelEvent = nullptr;
         pwtd->spsrm = this;
         m_fileOpWorkerThreadHandle = CreateThread(nullptr, 0, s_fileOpWorkerThread, pwtd, 0, nullptr);
@@ -536,6 +825,9 @@ HRESULT CPowerRenameManager::_CreateFileOpWorkerThread()
     return hr;
 }
 
+// Minimum time between two rename progress notifications
+#define FILEOP_PROGRESS_INTERVAL_MS 16
+
 DWORD WINAPI CPowerRenameManager::s_fileOpWorkerThread(_In_ void* pv)
 {
     if (SUCCEEDED(CoInitializeEx(NULL, 0)))
@@ -546,78 +838,71 @@ DWORD WINAPI CPowerRenameManager::s_fileOpWorkerThread(_In_ void* pv)
             // Wait to be told we can begin
             if (WaitForSingleObject(pwtd->startEvent, INFINITE) == WAIT_OBJECT_0)
             {
+                CRenamePhaseTimer timer(RenamePhaseFileOp);
                 CComPtr<IPowerRenameRegEx> spRenameRegEx;
                 if (SUCCEEDED(pwtd->spsrm->get_renameRegEx(&spRenameRegEx)))
                 {
-                    // Create IFileOperation interface
-                    CComPtr<IFileOperation> spFileOp;
-                    if (SUCCEEDED(CoCreateInstance(CLSID_FileOperation, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&spFileOp))))
-                    {
-                        DWORD flags = 0;
-                        spRenameRegEx->get_flags(&flags);
-
-                        UINT itemCount = 0;
-                        pwtd->spsrm->GetItemCount(&itemCount);
-
-                        // We add the items to the operation in depth-first order.  This allows child items to be
-                        // renamed before parent items.
+                    DWORD flags = 0;
+                    spRenameRegEx->get_flags(&flags);
 
-                        // Creating a vector of vectors of items of the same depth
-                        std::vector<std::vector<UINT>> matrix(itemCount);
+                    HWND hwndManager = pwtd->hwndManager;
+                    UINT totalCount = 0;
+                    std::atomic<UINT> completedCount{ 0 };
+                    std::atomic<ULONGLONG> nextProgressTick{ 0 };
+                    CRenameExecutor executor(CRenameBackend::s_Create(), [&](_In_ UINT index, _In_ HRESULT result) {
+                        if (FAILED(result))
+                        {
+                            PostMessage(hwndManager, SRM_FILEOP_ITEM_ERROR, index, result);
+                        }
 
-                        for (UINT u = 0; u < itemCount; u++)
+                        // Only one worker posts each progress update
+                        UINT completed = ++completedCount;
+                        ULONGLONG now = GetTickCount64();
+                        ULONGLONG nextTick = nextProgressTick;
+                        if (now >= nextTick && nextProgressTick.compare_exchange_strong(nextTick, now + FILEOP_PROGRESS_INTERVAL_MS))
                         {
-                            CComPtr<IPowerRenameItem> spItem;
-                            if (SUCCEEDED(pwtd->spsrm->GetItemByIndex(u, &spItem)))
-                            {
-                                UINT depth = 0;
-                                spItem->get_depth(&depth);
-                                matrix[depth].push_back(u);
-                            }
+                            PostMessage(hwndManager, SRM_FILEOP_PROGRESS, completed, totalCount);
                         }
+                    });
 
-                        // From the greatest depth first, add all items of that depth to the operation
-                        for (LONG v = itemCount - 1; v >= 0; v--)
+                    // The executor renames the items of each folder before the folder itself
+                    UINT itemCount = 0;
+                    pwtd->spsrm->GetItemCount(&itemCount);
+                    for (UINT u = 0; u < itemCount; u++)
+                    {
+                        CComPtr<IPowerRenameItem> spItem;
+                        if (SUCCEEDED(pwtd->spsrm->GetItemByIndex(u, &spItem)))
                         {
-                            for (auto it : matrix[v])
+                            bool shouldRename = false;
+                            if (SUCCEEDED(spItem->ShouldRenameItem(flags, &shouldRename)) && shouldRename)
                             {
-                                CComPtr<IPowerRenameItem> spItem;
-                                if (SUCCEEDED(pwtd->spsrm->GetItemByIndex(it, &spItem)))
+                                PWSTR newName = nullptr;
+                                PWSTR path = nullptr;
+                                if (SUCCEEDED(spItem->get_newName(&newName)) &&
+                                    SUCCEEDED(spItem->get_path(&path)))
                                 {
-                                    bool shouldRename = false;
-                                    if (SUCCEEDED(spItem->ShouldRenameItem(flags, &shouldRename)) && shouldRename)
-                                    {
-                                        PWSTR newName = nullptr;
-                                        if (SUCCEEDED(spItem->get_newName(&newName)))
-                                        {
-                                            CComPtr<IShellItem> spShellItem;
-                                            if (SUCCEEDED(spItem->get_shellItem(&spShellItem)))
-                                            {
-                                                spFileOp->RenameItem(spShellItem, newName, nullptr);
-                                            }
-                                            CoTaskMemFree(newName);
-                                        }
-                                    }
+                                    executor.Add(u, path, newName);
                                 }
+                                CoTaskMemFree(path);
+                                CoTaskMemFree(newName);
                             }
                         }
+                    }
 
-                        // Set the operation flags
-                        if (SUCCEEDED(spFileOp->SetOperationFlags(FOF_DEFAULTFLAGS)))
-                        {
-                            // Set the parent window
-                            if (pwtd->hwndParent)
-                            {
-                                spFileOp->SetOwnerWindow(pwtd->hwndParent);
-                            }
-                            
-                            // Perform the operation
-                            // We don't care about the return code here. We would rather
-                            // return control back to explorer so the user can cleanly
-                            // undo the operation if it failed halfway through.
-                            spFileOp->PerformOperations();
-                        }
+                    // The journal is what lets the batch be undone.  Renaming
+                    // goes ahead without it if it cannot be created.
+                    CRenameJournal journal;
+                    std::wstring journalPath;
+                    if (SUCCEEDED(CRenameJournal::s_GetDefaultPath(journalPath)) &&
+                        SUCCEEDED(journal.Create(journalPath.c_str())))
+                    {
+                        executor.SetJournal(&journal);
                     }
+
+                    totalCount = executor.GetCount();
+                    timer.AddItems(totalCount);
+                    executor.Run();
+                    PostMessage(hwndManager, SRM_FILEOP_PROGRESS, totalCount, totalCount);
                 }
             }
 
@@ -634,248 +919,861 @@ DWORD WINAPI CPowerRenameManager::s_fileOpWorkerThread(_In_ void* pv)
 
 HRESULT CPowerRenameManager::_PerformRegExRename()
 {
-    HRESULT hr = E_FAIL;
-
-    if (!TryEnterCriticalSection(&m_critsecReentrancy))
-    {
-        // Ensure we do not re-enter since we pump messages here.
-        // TODO: If we do, post a message back to ourselves
-    }
-    else
-    {
-        // Ensure previous thread is canceled
-        _CancelRegExWorkerThread();
-
-        // Create worker thread which will message us progress and completion.
-        hr = _CreateRegExWorkerThread();
-        if (SUCCEEDED(hr))
-        {
-            ResetEvent(m_cancelRegExWorkerEvent);
-
-            // Signal the worker thread that they can start working. We needed to wait until we
-            // were ready to process thread messages.
-            SetEvent(m_startRegExWorkerEvent);
-        }
-    }
+    // The search and replace changed so every item is evaluated again.  A
+    // pass still running for the previous generation stops at its next chunk.
+    m_regExGeneration++;
+    SetEvent(m_cancelRegExPassEvent);
+    return _SignalRegExWorkerThread();
+}
 
-    return hr;
+// Evaluates the items added since the last regex pass
+void CPowerRenameManager::_PerformPendingRegExRename()
+{
+    _SignalRegExWorkerThread();
 }
 
-HRESULT CPowerRenameManager::_CreateRegExWorkerThread()
+// Wakes the preview worker, starting it the first time.  Thread creation only
+// happens once so it stays out of the typing path.
+HRESULT CPowerRenameManager::_SignalRegExWorkerThread()
 {
-    WorkerThreadData* pwtd = new WorkerThreadData;
-    HRESULT hr = pwtd ? S_OK : E_OUTOFMEMORY;
+    HRESULT hr = S_OK;
+    if (!m_regExWorkerThreadHandle)
+    {
+        m_regExWorkerThreadHandle = CreateThread(nullptr, 0, s_regexWorkerThread, this, 0, nullptr);
+        hr = m_regExWorkerThreadHandle ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    }
+
     if (SUCCEEDED(hr))
     {
-        pwtd->hwndManager = m_hwndMessage;
-        pwtd->startEvent = m_startRegExWorkerEvent;
-        pwtd->cancelEvent = m_cancelRegExWorkerEvent;
-        pwtd->hwndParent = m_hwndParent;
-        pwtd->spsrm = this;
-        m_regExWorkerThreadHandle = CreateThread(nullptr, 0, s_regexWorkerThread, pwtd, 0, nullptr);
-        hr = (m_regExWorkerThreadHandle) ? S_OK : E_FAIL;
-        if (FAILED(hr))
-        {
-            delete pwtd;
-        }
+        SetEvent(m_regExWorkEvent);
     }
 
     return hr;
 }
 
-DWORD WINAPI CPowerRenameManager::s_regexWorkerThread(_In_ void* pv)
+// Number of items evaluated by a single regex worker task.  Cancellation is
+// checked before each chunk is started and, for regular expressions, while an
+// item is being matched.
+#define REGEX_WORKER_CHUNK_SIZE 512
+
+// Minimum time between two update notifications from the regex worker.  This
+// keeps the UI repainting at most about once per frame during a long preview.
+#define REGEX_UPDATE_FLUSH_INTERVAL_MS 16
+
+// Changed items closer together than this are reported as a single range.
+// Repainting a few unchanged rows is cheaper than an extra notification.
+#define REGEX_UPDATE_MERGE_GAP 64
+
+struct RegExWorkerChunk
 {
-    if (SUCCEEDED(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE)))
-    {
-        WorkerThreadData* pwtd = reinterpret_cast<WorkerThreadData*>(pv);
-        if (pwtd)
-        {
-            PostMessage(pwtd->hwndManager, SRM_REGEX_STARTED, GetCurrentThreadId(), 0);
+    UINT firstIndex = 0;
+    UINT endIndex = 0;
+    // Number of items in the chunk that received a new name.  Used to compute
+    // the starting enumeration value of each chunk.
+    unsigned long renameCount = 0;
+    // New names waiting for the enumeration pass.  Only populated when the
+    // pass enumerates.
+    std::vector<std::optional<std::wstring>> newNames;
+};
 
-            // Wait to be told we can begin
-            if (WaitForSingleObject(pwtd->startEvent, INFINITE) == WAIT_OBJECT_0)
+struct RegExWorkerContext
+{
+    HWND hwndManager = nullptr;
+    HANDLE cancelEvent = nullptr;
+    // The pass is canceled once latestGeneration moves past generation
+    UINT generation = 0;
+    const std::atomic<UINT>* latestGeneration = nullptr;
+    DWORD flags = 0;
+    // Set if new names depend on the order of the items: the EnumerateItems
+    // flag is set or the replace term has a counter
+    bool enumerate = false;
+    bool enumeratePass = false;
+    // Compiled replace term, used to fill in counters and dates
+    CPowerRenameTemplate renameTemplate;
+    // Not AddRef'd.  The manager stops the worker before it is destroyed.
+    IPowerRenameManager* psrm = nullptr;
+    CPowerRenameManager* pManager = nullptr;
+    CComPtr<IPowerRenameRegEx> spRenameRegEx;
+    // Null for a regex handler from outside the library, whose results have
+    // their tokens expanded already
+    CComPtr<IPowerRenameTemplateRegEx> spTemplateRegEx;
+    std::vector<RegExWorkerChunk> chunks;
+    std::atomic<UINT> nextChunk{ 0 };
+    std::atomic<bool> canceled{ false };
+
+    // Items whose new name changed since the last update notification was posted.
+    CSRWLock dirtyLock;
+    _Guarded_by_(dirtyLock) std::vector<bool> dirtyItems;
+    _Guarded_by_(dirtyLock) UINT dirtyFirst = UINT_MAX;
+    _Guarded_by_(dirtyLock) UINT dirtyLast = 0;
+    std::atomic<ULONGLONG> nextFlushTick{ 0 };
+};
+
+// Evaluates the search and replace for a single item.  Returns the name to show
+// in the preview (before enumeration), or no value if the item is not renamed.
+// replaceResult is HRESULT_FROM_WIN32(ERROR_TIMEOUT) if the regex gave up on the
+// item and HRESULT_FROM_WIN32(ERROR_CANCELLED) if cancelEvent interrupted it.
+// renameTemplate is the compiled replace term the name is expanded with.
+std::optional<std::wstring> _GetRegExNewName(_In_ IPowerRenameItem* spItem,
+                                             _In_ IPowerRenameRegEx* spRenameRegEx,
+                                             _In_opt_ IPowerRenameTemplateRegEx* spTemplateRegEx,
+                                             _In_ const CPowerRenameTemplate& renameTemplate,
+                                             _In_ DWORD flags,
+                                             _In_opt_ HANDLE cancelEvent,
+                                             _Out_ HRESULT* replaceResult)
+{
+    std::optional<std::wstring> result;
+    *replaceResult = S_OK;
+
+    // Items of the library are read in place instead of through copies
+    CPowerRenameItem* item = CPowerRenameItem::s_FromItem(spItem);
+
+    bool isFolder = false;
+    bool isSubFolderContent = false;
+    if (item)
+    {
+        isFolder = item->IsFolder();
+        isSubFolderContent = item->GetDepth() > 0;
+    }
+    else
+    {
+        spItem->get_isFolder(&isFolder);
+        spItem->get_isSubFolderContent(&isSubFolderContent);
+    }
+
+    if ((isFolder && (flags & PowerRenameFlags::ExcludeFolders)) ||
+        (!isFolder && (flags & PowerRenameFlags::ExcludeFiles)) ||
+        (isSubFolderContent && (flags & PowerRenameFlags::ExcludeSubfolders)))
+    {
+        // Exclude this item from renaming.  Ensure new name is cleared.
+        return result;
+    }
+
+    if (item)
+    {
+        // A name mapped by a manifest replaces the original name, so the
+        // search and replace applies on top of it and it is kept when
+        // nothing matches.  Names in the item store are null terminated.
+        std::wstring_view mappedName = item->GetMappedName();
+        if (!mappedName.empty())
+        {
+            *replaceResult = GetRegExNewName(mappedName.data(), GetExtensionOffset(mappedName.data(), mappedName.length()), spRenameRegEx, spTemplateRegEx, flags, cancelEvent, result);
+            if (!result)
             {
-                CComPtr<IPowerRenameRegEx> spRenameRegEx;
-                if (SUCCEEDED(pwtd->spsrm->get_renameRegEx(&spRenameRegEx)))
+                // Escaped like a result of the search if it is expanded
+                result.emplace();
+                if (renameTemplate.HasTokens())
                 {
-                    DWORD flags = 0;
-                    spRenameRegEx->get_flags(&flags);
+                    CPowerRenameTemplate::s_AppendEscaped(mappedName.data(), mappedName.length(), *result);
+                }
+                else
+                {
+                    result->assign(mappedName);
+                }
+            }
+            return result;
+        }
 
-                    UINT itemCount = 0;
-                    unsigned long itemEnumIndex = 1;
-                    pwtd->spsrm->GetItemCount(&itemCount);
-                    for (UINT u = 0; u <= itemCount; u++)
-                    {
-                        // Check if cancel event is signaled
-                        if (WaitForSingleObject(pwtd->cancelEvent, 0) == WAIT_OBJECT_0)
-                        {
-                            // Canceled from manager
-                            // Send the manager thread the canceled message
-                            PostMessage(pwtd->hwndManager, SRM_REGEX_CANCELED, GetCurrentThreadId(), 0);
-                            break;
-                        }
+        *replaceResult = GetRegExNewName(item->GetOriginalName().data(), item->GetExtensionOffset(), spRenameRegEx, spTemplateRegEx, flags, cancelEvent, result);
+        return result;
+    }
 
-                        CComPtr<IPowerRenameItem> spItem;
-                        if (SUCCEEDED(pwtd->spsrm->GetItemByIndex(u, &spItem)))
-                        {
-                            int id = -1;
-                            spItem->get_id(&id);
-
-                            bool isFolder = false;
-                            bool isSubFolderContent = false;
-                            spItem->get_isFolder(&isFolder);
-                            spItem->get_isSubFolderContent(&isSubFolderContent);
-                            if ((isFolder && (flags & PowerRenameFlags::ExcludeFolders)) ||
-                                (!isFolder && (flags & PowerRenameFlags::ExcludeFiles)) ||
-                                (isSubFolderContent && (flags & PowerRenameFlags::ExcludeSubfolders)))
-                            {
-                                // Exclude this item from renaming.  Ensure new name is cleared.
-                                spItem->put_newName(nullptr);
+    PWSTR originalName = nullptr;
+    if (SUCCEEDED(spItem->get_originalName(&originalName)))
+    {
+        // The stem and extension split is computed once when the item is made
+        UINT extensionOffset = 0;
+        spItem->get_extensionOffset(&extensionOffset);
+        *replaceResult = GetRegExNewName(originalName, extensionOffset, spRenameRegEx, spTemplateRegEx, flags, cancelEvent, result);
+        CoTaskMemFree(originalName);
+    }
 
-                                // Send the manager thread the item processed message
-                                PostMessage(pwtd->hwndManager, SRM_REGEX_ITEM_UPDATED, GetCurrentThreadId(), id);
+    return result;
+}
 
-                                continue;
-                            }
+// Appends newName to buffer with the tokens of the replace term filled in for the item
+void _ExpandRegExNewName(_In_ RegExWorkerContext* context, _In_ IPowerRenameItem* spItem, _In_ const std::wstring& newName, _In_ ULONG counterIndex, _Inout_ std::wstring& buffer)
+{
+    SYSTEMTIME fileTime = { 0 };
+    bool hasFileTime = false;
+    if (context->renameTemplate.HasFileTime())
+    {
+        // Items of the library keep the time across preview passes
+        CPowerRenameItem* item = CPowerRenameItem::s_FromItem(spItem);
+        PWSTR path = nullptr;
+        if (item)
+        {
+            hasFileTime = SUCCEEDED(item->GetFileTime(&fileTime));
+        }
+        else if (SUCCEEDED(spItem->get_path(&path)))
+        {
+            hasFileTime = SUCCEEDED(CPowerRenameTemplate::s_GetFileTime(path, &fileTime));
+            CoTaskMemFree(path);
+        }
+    }
 
-                            PWSTR originalName = nullptr;
-                            if (SUCCEEDED(spItem->get_originalName(&originalName)))
-                            {
-                                PWSTR currentNewName = nullptr;
-                                spItem->get_newName(&currentNewName);
+    buffer.clear();
+    context->renameTemplate.Expand(newName.c_str(), newName.length(), counterIndex, hasFileTime ? &fileTime : nullptr, buffer);
+}
 
-                                wchar_t sourceName[MAX_PATH] = { 0 };
-                                if (flags & NameOnly)
-                                {
-                                    StringCchCopy(sourceName, ARRAYSIZE(sourceName), fs::path(originalName).stem().c_str());
-                                }
-                                else if (flags & ExtensionOnly)
-                                {
-                                    std::wstring extension = fs::path(originalName).extension().wstring();
-                                    if (!extension.empty() && extension.front() == '.')
-                                    {
-                                        extension = extension.erase(0, 1);
-                                    }
-                                    StringCchCopy(sourceName, ARRAYSIZE(sourceName), extension.c_str());
-                                }
-                                else
-                                {
-                                    StringCchCopy(sourceName, ARRAYSIZE(sourceName), originalName);
-                                }
+// Stores the new name on the item.  Returns true if the preview changed.
+bool _UpdateRegExNewName(_In_ IPowerRenameItem* spItem, _In_opt_ PCWSTR newNameToUse)
+{
+    CPowerRenameItem* item = CPowerRenameItem::s_FromItem(spItem);
+    if (item)
+    {
+        // Compare in place and leave an unchanged name alone
+        std::wstring_view currentNewName;
+        bool hasNewName = item->GetNewName(&currentNewName);
+        bool changed = newNameToUse ? (!hasNewName || currentNewName != newNameToUse) : hasNewName;
+        if (changed)
+        {
+            item->SetNewName(newNameToUse, newNameToUse ? wcslen(newNameToUse) : 0);
+        }
+        return changed;
+    }
 
+    PWSTR currentNewName = nullptr;
+    spItem->get_newName(&currentNewName);
 
-                                PWSTR newName = nullptr;
-                                // Failure here means we didn't match anything or had nothing to match
-                                // Call put_newName with null in that case to reset it
-                                spRenameRegEx->Replace(sourceName, &newName);
+    spItem->put_newName(newNameToUse);
 
-                                wchar_t resultName[MAX_PATH] = { 0 };
+    // Was there a change?
+    bool changed = (lstrcmp(currentNewName, newNameToUse) != 0);
 
-                                PWSTR newNameToUse = nullptr;
+    CoTaskMemFree(currentNewName);
 
-                                // newName == nullptr likely means we have an empty search string.  We should leave newNameToUse
-                                // as nullptr so we clear the renamed column
-                                if (newName != nullptr)
-                                {
-                                    newNameToUse = resultName;
-                                    if (flags & NameOnly)
-                                    {
-                                        StringCchPrintf(resultName, ARRAYSIZE(resultName), L"%s%s", newName, fs::path(originalName).extension().c_str());
-                                    }
-                                    else if (flags & ExtensionOnly)
-                                    {
-                                        std::wstring extension = fs::path(originalName).extension().wstring();
-                                        if (!extension.empty())
-                                        {
-                                            StringCchPrintf(resultName, ARRAYSIZE(resultName), L"%s.%s", fs::path(originalName).stem().c_str(), newName);
-                                        }
-                                        else
-                                        {
-                                            StringCchCopy(resultName, ARRAYSIZE(resultName), originalName);
-                                        }
-                                    }
-                                    else
-                                    {
-                                        StringCchCopy(resultName, ARRAYSIZE(resultName), newName);
-                                    }
-                                }
-                                
-                                // No change from originalName so set newName to
-                                // null so we clear it from our UI as well.
-                                if (lstrcmp(originalName, newNameToUse) == 0)
-                                {
-                                    newNameToUse = nullptr;
-                                }
+    return changed;
+}
 
-                                wchar_t uniqueName[MAX_PATH] = { 0 };
-                                if (newNameToUse != nullptr && (flags & EnumerateItems))
-                                {
-                                    unsigned long countUsed = 0;
-                                    if (GetEnumeratedFileName(uniqueName, ARRAYSIZE(uniqueName), newNameToUse, nullptr, itemEnumIndex, &countUsed))
-                                    {
-                                        newNameToUse = uniqueName;
-                                    }
-                                    itemEnumIndex++;
-                                }
+void _MarkRegExItemsDirty(_In_ RegExWorkerContext* context, _In_ const std::vector<UINT>& changedIndexes)
+{
+    if (!changedIndexes.empty())
+    {
+        CSRWExclusiveAutoLock lock(&context->dirtyLock);
+        for (UINT index : changedIndexes)
+        {
+            context->dirtyItems[index] = true;
+        }
+        // Indexes are added in increasing order within a chunk
+        context->dirtyFirst = (std::min)(context->dirtyFirst, changedIndexes.front());
+        context->dirtyLast = (std::max)(context->dirtyLast, changedIndexes.back());
+    }
+}
 
-                                spItem->put_newName(newNameToUse);
+// Sends the manager thread the ranges of items that changed since the last flush.
+// Unless forced, this does nothing if the last flush happened less than a frame ago.
+void _FlushRegExUpdates(_In_ RegExWorkerContext* context, _In_ bool force)
+{
+    ULONGLONG now = GetTickCount64();
+    if (force)
+    {
+        context->nextFlushTick = now + REGEX_UPDATE_FLUSH_INTERVAL_MS;
+    }
+    else
+    {
+        // Only one worker performs each flush
+        ULONGLONG nextFlushTick = context->nextFlushTick;
+        if (now < nextFlushTick ||
+            !context->nextFlushTick.compare_exchange_strong(nextFlushTick, now + REGEX_UPDATE_FLUSH_INTERVAL_MS))
+        {
+            return;
+        }
+    }
 
-                                // Was there a change?
-                                if (lstrcmp(currentNewName, newNameToUse) != 0)
-                                {
-                                    // Send the manager thread the item processed message
-                                    PostMessage(pwtd->hwndManager, SRM_REGEX_ITEM_UPDATED, GetCurrentThreadId(), id);
-                                }
+    CSRWExclusiveAutoLock lock(&context->dirtyLock);
+    if (context->dirtyFirst > context->dirtyLast)
+    {
+        return;
+    }
 
-                                CoTaskMemFree(newName);
-                                CoTaskMemFree(currentNewName);
-                                CoTaskMemFree(originalName);
-                            }
+    // Merge the changed items into ranges
+    std::vector<std::pair<UINT, UINT>> ranges;
+    for (UINT u = context->dirtyFirst; u <= context->dirtyLast; u++)
+    {
+        if (context->dirtyItems[u])
+        {
+            context->dirtyItems[u] = false;
+            if (ranges.empty() || (u - ranges.back().second) > REGEX_UPDATE_MERGE_GAP)
+            {
+                ranges.emplace_back(u, u);
+            }
+            ranges.back().second = u;
+        }
+    }
+
+    // The snapshot goes out before the manager thread hears about the ranges
+    for (const auto& range : ranges)
+    {
+        context->pManager->MarkPreviewChanged(range.first, range.second);
+    }
+    context->pManager->PublishPreview();
+
+    for (const auto& range : ranges)
+    {
+        PostMessage(context->hwndManager, SRM_REGEX_ITEMS_UPDATED, range.first, range.second);
+    }
+
+    context->dirtyFirst = UINT_MAX;
+    context->dirtyLast = 0;
+}
+
+void _ProcessRegExChunk(_In_ RegExWorkerContext* context, _Inout_ RegExWorkerChunk& chunk)
+{
+    bool enumerate = context->enumerate;
+    bool expand = context->renameTemplate.HasTokens();
+    std::vector<UINT> changedIndexes;
+    // Reused for the expanded name of every item of the chunk
+    std::wstring expandedName;
+    if (!context->enumeratePass)
+    {
+        if (enumerate)
+        {
+            chunk.newNames.resize(chunk.endIndex - chunk.firstIndex);
+        }
+
+        for (UINT u = chunk.firstIndex; u < chunk.endIndex; u++)
+        {
+            CComPtr<IPowerRenameItem> spItem;
+            if (SUCCEEDED(context->psrm->GetItemByIndex(u, &spItem)))
+            {
+                HRESULT replaceResult = S_OK;
+                std::optional<std::wstring> newName = _GetRegExNewName(spItem, context->spRenameRegEx, context->spTemplateRegEx, context->renameTemplate, context->flags, context->cancelEvent, &replaceResult);
+                if (replaceResult == HRESULT_FROM_WIN32(ERROR_CANCELLED))
+                {
+                    // Leave this item and the rest of the chunk to the next pass
+                    context->canceled = true;
+                    break;
+                }
+
+                if (replaceResult == HRESULT_FROM_WIN32(ERROR_TIMEOUT))
+                {
+                    // The item keeps no new name.  Let the UI flag it.
+                    PostMessage(context->hwndManager, SRM_REGEX_ITEM_ERROR, u, replaceResult);
+                }
+
+                if (newName.has_value())
+                {
+                    chunk.renameCount++;
+                }
+
+                PCWSTR newNameToUse = newName.has_value() ? newName->c_str() : nullptr;
+                if (enumerate)
+                {
+                    // Enumeration depends on the items before this one.  Apply it in the second pass.
+                    chunk.newNames[u - chunk.firstIndex] = std::move(newName);
+                    continue;
+                }
+
+                if (newName.has_value() && expand)
+                {
+                    // Only date and time tokens get here.  A counter needs the
+                    // position of the item, so it always takes the second pass.
+                    _ExpandRegExNewName(context, spItem, *newName, 0, expandedName);
+                    newNameToUse = expandedName.c_str();
+                }
+
+                if (_UpdateRegExNewName(spItem, newNameToUse))
+                {
+                    changedIndexes.push_back(u);
+                }
+            }
+        }
+    }
+    else
+    {
+        // The chunk's renameCount has been replaced by the enumeration value of
+        // its first renamed item.  This matches the sequential numbering exactly.
+        unsigned long itemEnumIndex = chunk.renameCount;
+        for (UINT u = chunk.firstIndex; u < chunk.endIndex; u++)
+        {
+            CComPtr<IPowerRenameItem> spItem;
+            if (SUCCEEDED(context->psrm->GetItemByIndex(u, &spItem)))
+            {
+                std::optional<std::wstring>& newName = chunk.newNames[u - chunk.firstIndex];
+                PCWSTR newNameToUse = nullptr;
+                wchar_t uniqueName[MAX_PATH] = { 0 };
+                if (newName.has_value())
+                {
+                    newNameToUse = newName->c_str();
+                    if (expand)
+                    {
+                        // Counters start from 0 where enumeration starts from 1
+                        _ExpandRegExNewName(context, spItem, *newName, itemEnumIndex - 1, expandedName);
+                        newNameToUse = expandedName.c_str();
+                    }
+
+                    if (!context->renameTemplate.HasCounter())
+                    {
+                        // Without a counter the EnumerateItems flag numbers the names
+                        unsigned long countUsed = 0;
+                        if (GetEnumeratedFileName(uniqueName, ARRAYSIZE(uniqueName), newNameToUse, nullptr, itemEnumIndex, &countUsed))
+                        {
+                            newNameToUse = uniqueName;
                         }
                     }
+                    itemEnumIndex++;
+                }
+
+                if (_UpdateRegExNewName(spItem, newNameToUse))
+                {
+                    changedIndexes.push_back(u);
                 }
             }
+        }
 
-            // Send the manager thread the completion message
-            PostMessage(pwtd->hwndManager, SRM_REGEX_COMPLETE, GetCurrentThreadId(), 0);
+        chunk.newNames.clear();
+    }
 
-            delete pwtd;
+    if (!enumerate || context->enumeratePass)
+    {
+        // New names of the chunk are final.  Refresh the manager's selected and rename counts.
+        context->pManager->UpdateItemStates(chunk.firstIndex, chunk.endIndex);
+    }
+
+    _MarkRegExItemsDirty(context, changedIndexes);
+    _FlushRegExUpdates(context, false);
+}
+
+// Thread pool callback.  Each callback keeps claiming chunks until there are none left.
+VOID CALLBACK _RegExWorkCallback(_Inout_ PTP_CALLBACK_INSTANCE, _Inout_opt_ PVOID pv, _Inout_ PTP_WORK)
+{
+    RegExWorkerContext* context = reinterpret_cast<RegExWorkerContext*>(pv);
+    while (!context->canceled)
+    {
+        UINT chunkIndex = context->nextChunk++;
+        if (chunkIndex >= context->chunks.size())
+        {
+            break;
+        }
+
+        // Check if the worker is stopping or the search and replace changed
+        if (WaitForSingleObject(context->cancelEvent, 0) == WAIT_OBJECT_0 ||
+            *context->latestGeneration != context->generation)
+        {
+            context->canceled = true;
+            break;
+        }
+
+        _ProcessRegExChunk(context, context->chunks[chunkIndex]);
+    }
+}
+
+// Runs a pass over all the chunks on the thread pool and waits for it to finish
+bool _RunRegExPass(_In_ RegExWorkerContext* context)
+{
+    context->nextChunk = 0;
+
+    SYSTEM_INFO systemInfo = { 0 };
+    GetSystemInfo(&systemInfo);
+    UINT workerCount = (std::min)(static_cast<UINT>(systemInfo.dwNumberOfProcessors), static_cast<UINT>(context->chunks.size()));
+
+    PTP_WORK work = CreateThreadpoolWork(_RegExWorkCallback, context, nullptr);
+    if (work)
+    {
+        for (UINT u = 0; u < workerCount; u++)
+        {
+            SubmitThreadpoolWork(work);
         }
+
+        WaitForThreadpoolWorkCallbacks(work, FALSE);
+        CloseThreadpoolWork(work);
+    }
+    else
+    {
+        // Fall back to evaluating every chunk on this thread
+        _RegExWorkCallback(nullptr, context, nullptr);
+    }
+
+    return !context->canceled;
+}
+
+DWORD WINAPI CPowerRenameManager::s_regexWorkerThread(_In_ void* pv)
+{
+    CPowerRenameManager* pManager = reinterpret_cast<CPowerRenameManager*>(pv);
+    if (SUCCEEDED(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE)))
+    {
+        pManager->_RegExWorkerLoop();
         CoUninitialize();
     }
 
     return 0;
 }
 
-void CPowerRenameManager::_CancelRegExWorkerThread()
+// Runs on the preview worker until it is stopped.  Each time it is woken up it
+// evaluates the latest generation of the search and replace, then any items
+// added since, until it has caught up.
+void CPowerRenameManager::_RegExWorkerLoop()
 {
-    if (m_startRegExWorkerEvent)
+    HANDLE waitHandles[] = { m_stopRegExWorkerEvent, m_regExWorkEvent };
+    bool stopped = false;
+    while (!stopped && WaitForMultipleObjects(ARRAYSIZE(waitHandles), waitHandles, FALSE, INFINITE) == (WAIT_OBJECT_0 + 1))
     {
-        SetEvent(m_startRegExWorkerEvent);
+        while (!stopped)
+        {
+            UINT generation = m_regExGeneration;
+            UINT firstIndex = m_regExEvaluatedIndex;
+            if (generation != m_regExEvaluatedGeneration)
+            {
+                // Wait for the edits to pause.  Every edit during the delay
+                // restarts it so only the last of a burst is evaluated.
+                DWORD waitResult = WAIT_TIMEOUT;
+                do
+                {
+                    generation = m_regExGeneration;
+                    waitResult = WaitForSingleObject(m_stopRegExWorkerEvent, m_regExDelay);
+                } while (waitResult == WAIT_TIMEOUT && generation != m_regExGeneration);
+
+                stopped = (waitResult != WAIT_TIMEOUT);
+                firstIndex = 0;
+            }
+
+            UINT itemCount = 0;
+            GetItemCount(&itemCount);
+            if (stopped || (generation == m_regExEvaluatedGeneration && firstIndex >= itemCount))
+            {
+                // Caught up.  Let _WaitForRegExWorkerIdle check again.
+                SetEvent(m_regExIdleEvent);
+                break;
+            }
+
+            UINT evaluatedIndex = 0;
+            if (_RunRegExWorkerPass(generation, firstIndex, &evaluatedIndex))
+            {
+                m_regExEvaluatedIndex = evaluatedIndex;
+                m_regExEvaluatedGeneration = generation;
+            }
+
+            stopped = (WaitForSingleObject(m_stopRegExWorkerEvent, 0) == WAIT_OBJECT_0);
+        }
     }
+}
 
-    if (m_cancelRegExWorkerEvent)
+// Evaluates the items from firstIndex on with the given generation of the
+// search and replace.  Returns false if the pass was canceled.
+bool CPowerRenameManager::_RunRegExWorkerPass(_In_ UINT generation, _In_ UINT firstIndex, _Out_ UINT* evaluatedIndex)
+{
+    *evaluatedIndex = firstIndex;
+    bool completed = false;
+    CRenamePhaseTimer timer(RenamePhaseRegEx);
+
+    // Signaled by a newer generation or by shutdown to interrupt a match part
+    // way through an item.  Either may have happened just before the reset and
+    // is caught by the generation check of the first chunk or by the stop event.
+    ResetEvent(m_cancelRegExPassEvent);
+    if (WaitForSingleObject(m_stopRegExWorkerEvent, 0) == WAIT_OBJECT_0)
     {
-        SetEvent(m_cancelRegExWorkerEvent);
+        SetEvent(m_cancelRegExPassEvent);
     }
 
-    _WaitForRegExWorkerThread();
+    PostMessage(m_hwndMessage, SRM_REGEX_STARTED, GetCurrentThreadId(), 0);
+
+    RegExWorkerContext context;
+    context.hwndManager = m_hwndMessage;
+    context.cancelEvent = m_cancelRegExPassEvent;
+    context.generation = generation;
+    context.latestGeneration = &m_regExGeneration;
+    context.psrm = this;
+    context.pManager = this;
+    if (SUCCEEDED(get_renameRegEx(&context.spRenameRegEx)))
+    {
+        context.spRenameRegEx->get_flags(&context.flags);
+
+        // The search copies the tokens of the replace term as placeholders.
+        // Compiling the same term here tells what each placeholder stands for.
+        PWSTR replaceTerm = nullptr;
+        if (SUCCEEDED(context.spRenameRegEx->QueryInterface(IID_PPV_ARGS(&context.spTemplateRegEx))) &&
+            SUCCEEDED(context.spRenameRegEx->get_replaceTerm(&replaceTerm)))
+        {
+            context.renameTemplate.Compile(replaceTerm, !(context.flags & UseRegularExpressions));
+            CoTaskMemFree(replaceTerm);
+        }
+        // A counter numbers the renamed items in order whether or not the
+        // EnumerateItems flag is set
+        context.enumerate = (context.flags & EnumerateItems) || context.renameTemplate.HasCounter();
+
+        UINT itemCount = 0;
+        GetItemCount(&itemCount);
+        timer.AddItems(itemCount - (std::min)(firstIndex, itemCount));
+
+        // Split the items into chunks that are evaluated in parallel.  Each item's
+        // new name only depends on the item itself so the results are the same as
+        // evaluating them in order.  Items before firstIndex were evaluated by an
+        // earlier pass with the same search and replace.
+        for (UINT u = firstIndex; u < itemCount; u += REGEX_WORKER_CHUNK_SIZE)
+        {
+            RegExWorkerChunk chunk;
+            chunk.firstIndex = u;
+            chunk.endIndex = (std::min)(u + REGEX_WORKER_CHUNK_SIZE, itemCount);
+            context.chunks.push_back(std::move(chunk));
+        }
+        context.dirtyItems.resize(itemCount);
+
+        // Items before firstIndex, or removed before this pass, were renamed by
+        // earlier passes of this generation
+        unsigned long renamedCount = 0;
+        if (firstIndex > 0)
+        {
+            renamedCount = m_regExRenamedCount;
+        }
+        else if (generation == m_regExRemovedGeneration)
+        {
+            renamedCount = m_regExRemovedRenamedCount;
+        }
+        completed = _RunRegExPass(&context);
+        if (completed)
+        {
+            // Enumeration numbers renamed items in order.  An exclusive prefix sum over the
+            // number of renamed items per chunk gives each chunk its starting value.
+            for (auto& chunk : context.chunks)
+            {
+                unsigned long renameCount = chunk.renameCount;
+                chunk.renameCount = renamedCount + 1;
+                renamedCount += renameCount;
+            }
+
+            if (context.enumerate)
+            {
+                context.enumeratePass = true;
+                completed = _RunRegExPass(&context);
+            }
+        }
+
+        // Report any remaining changes, even if canceled, since those items were updated
+        _FlushRegExUpdates(&context, true);
+
+        if (completed)
+        {
+            *evaluatedIndex = (std::max)(itemCount, firstIndex);
+            m_regExRenamedCount = renamedCount;
+        }
+        else
+        {
+            // Canceled by a newer search and replace or by shutdown
+            // Send the manager thread the canceled message
+            PostMessage(m_hwndMessage, SRM_REGEX_CANCELED, GetCurrentThreadId(), 0);
+        }
+    }
+
+    // Send the manager thread the completion message
+    PostMessage(m_hwndMessage, SRM_REGEX_COMPLETE, GetCurrentThreadId(), 0);
+
+    return completed;
 }
 
-void CPowerRenameManager::_WaitForRegExWorkerThread()
+void CPowerRenameManager::_StopRegExWorkerThread()
 {
     if (m_regExWorkerThreadHandle)
     {
+        SetEvent(m_stopRegExWorkerEvent);
+        SetEvent(m_cancelRegExPassEvent);
         WaitForSingleObject(m_regExWorkerThreadHandle, INFINITE);
         CloseHandle(m_regExWorkerThreadHandle);
         m_regExWorkerThreadHandle = nullptr;
+        ResetEvent(m_stopRegExWorkerEvent);
+    }
+}
+
+// Blocks until the preview reflects the latest search and replace for every item
+void CPowerRenameManager::_WaitForRegExWorkerIdle()
+{
+    if (m_regExWorkerThreadHandle)
+    {
+        // Items added with AddItem do not wake the worker on their own
+        SetEvent(m_regExWorkEvent);
+
+        HANDLE waitHandles[] = { m_regExIdleEvent, m_regExWorkerThreadHandle };
+        while (true)
+        {
+            UINT itemCount = 0;
+            GetItemCount(&itemCount);
+            if (m_regExEvaluatedGeneration == m_regExGeneration && m_regExEvaluatedIndex >= itemCount)
+            {
+                break;
+            }
+
+            // The worker only exits if it was stopped
+            if (WaitForMultipleObjects(ARRAYSIZE(waitHandles), waitHandles, FALSE, INFINITE) != WAIT_OBJECT_0)
+            {
+                break;
+            }
+        }
     }
 }
 
 void CPowerRenameManager::_Cancel()
 {
     SetEvent(m_startFileOpWorkerEvent);
-    _CancelRegExWorkerThread();
+    _StopRegExWorkerThread();
+    _CancelEnumWorkerThreads();
+}
+
+IFACEMETHODIMP CPowerRenameManager::StartEnumeration(_In_ IUnknown* dataSource)
+{
+    EnumWorkerThreadData* pewtd = new EnumWorkerThreadData;
+    HRESULT hr = pewtd ? S_OK : E_OUTOFMEMORY;
+    if (SUCCEEDED(hr))
+    {
+        hr = get_renameItemFactory(&pewtd->spItemFactory);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // Only the items of the data object are read on this thread.  The worker
+        // creates its own shell items from their IDLists so that walking the
+        // folders never calls back into this apartment.
+        CComPtr<IShellItemArray> spsia;
+        hr = GetShellItemArrayFromDataObject(dataSource, &spsia);
+        DWORD count = 0;
+        if (SUCCEEDED(hr))
+        {
+            hr = spsia->GetCount(&count);
+        }
+
+        for (DWORD i = 0; SUCCEEDED(hr) && i < count; i++)
+        {
+            CComPtr<IShellItem> spsi;
+            hr = spsia->GetItemAt(i, &spsi);
+            if (SUCCEEDED(hr))
+            {
+                PIDLIST_ABSOLUTE idList = nullptr;
+                hr = SHGetIDListFromObject(spsi, &idList);
+                if (SUCCEEDED(hr))
+                {
+                    pewtd->idLists.push_back(idList);
+                }
+            }
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pewtd->hwndManager = m_hwndMessage;
+        pewtd->cancelEvent = m_cancelEnumWorkerEvent;
+        pewtd->spsrm = this;
+        HANDLE threadHandle = CreateThread(nullptr, 0, s_enumWorkerThread, pewtd, 0, nullptr);
+        hr = threadHandle ? S_OK : E_FAIL;
+        if (SUCCEEDED(hr))
+        {
+            m_enumWorkerThreadHandles.push_back(threadHandle);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        delete pewtd;
+    }
+
+    return hr;
+}
+
+IFACEMETHODIMP CPowerRenameManager::StartManifestImport(_In_ PCWSTR manifestPath)
+{
+    EnumWorkerThreadData* pewtd = new EnumWorkerThreadData;
+    HRESULT hr = pewtd ? S_OK : E_OUTOFMEMORY;
+    if (SUCCEEDED(hr))
+    {
+        hr = (manifestPath && *manifestPath) ? S_OK : E_INVALIDARG;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = get_renameItemFactory(&pewtd->spItemFactory);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // The manifest is read on the worker so a large one does not hold up
+        // the UI.  Items are added as they are parsed, like an enumeration.
+        pewtd->manifestPath = manifestPath;
+        pewtd->hwndManager = m_hwndMessage;
+        pewtd->cancelEvent = m_cancelEnumWorkerEvent;
+        pewtd->spsrm = this;
+        HANDLE threadHandle = CreateThread(nullptr, 0, s_enumWorkerThread, pewtd, 0, nullptr);
+        hr = threadHandle ? S_OK : E_FAIL;
+        if (SUCCEEDED(hr))
+        {
+            m_enumWorkerThreadHandles.push_back(threadHandle);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        delete pewtd;
+    }
+
+    return hr;
+}
+
+DWORD WINAPI CPowerRenameManager::s_enumWorkerThread(_In_ void* pv)
+{
+    EnumWorkerThreadData* pewtd = reinterpret_cast<EnumWorkerThreadData*>(pv);
+    // Multithreaded so the shell items can be handed to the folder work items
+    if (SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE)))
+    {
+        CRenamePhaseTimer timer(RenamePhaseEnumeration);
+        std::atomic<UINT> addedCount{ 0 };
+        CPowerRenameManager* pManager = static_cast<CPowerRenameManager*>(pewtd->spsrm.p);
+        HWND hwndManager = pewtd->hwndManager;
+        EnumerateItemsCallback addItems = [pManager, hwndManager, &addedCount](std::vector<CComPtr<IPowerRenameItem>>& items) {
+            // One lock per batch.  The manager thread is told about the new
+            // range and evaluates it with the current search and replace.
+            UINT firstIndex = 0;
+            UINT lastIndex = 0;
+            if (pManager->_AddItems(items, &firstIndex, &lastIndex))
+            {
+                addedCount += lastIndex - firstIndex + 1;
+                pManager->PublishPreview();
+                PostMessage(hwndManager, SRM_ENUM_ITEMS_ADDED, firstIndex, lastIndex);
+            }
+            return S_OK;
+        };
+
+        if (!pewtd->manifestPath.empty())
+        {
+            // A canceled import is not an error, the items are going away
+            HRESULT hr = ImportManifest(pewtd->manifestPath.c_str(), pewtd->spItemFactory, pewtd->cancelEvent, addItems);
+            if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_CANCELLED))
+            {
+                PostMessage(pewtd->hwndManager, SRM_ENUM_ERROR, GetCurrentThreadId(), hr);
+            }
+        }
+        else
+        {
+            CComPtr<IShellItemArray> spsia;
+            if (SUCCEEDED(SHCreateShellItemArrayFromIDLists(static_cast<UINT>(pewtd->idLists.size()), reinterpret_cast<PCIDLIST_ABSOLUTE_ARRAY>(pewtd->idLists.data()), &spsia)))
+            {
+                EnumerateShellItemsParallel(spsia, pewtd->spItemFactory, pewtd->cancelEvent, addItems);
+            }
+        }
+        timer.AddItems(addedCount);
+
+        CoUninitialize();
+    }
+
+    // Send the manager thread the completion message
+    PostMessage(pewtd->hwndManager, SRM_ENUM_COMPLETE, GetCurrentThreadId(), 0);
+
+    delete pewtd;
+
+    return 0;
+}
+
+void CPowerRenameManager::_CancelEnumWorkerThreads()
+{
+    if (!m_enumWorkerThreadHandles.empty())
+    {
+        SetEvent(m_cancelEnumWorkerEvent);
+
+        for (HANDLE threadHandle : m_enumWorkerThreadHandles)
+        {
+            WaitForSingleObject(threadHandle, INFINITE);
+            CloseHandle(threadHandle);
+        }
+        m_enumWorkerThreadHandles.clear();
+
+        ResetEvent(m_cancelEnumWorkerEvent);
+    }
 }
 
 HRESULT CPowerRenameManager::_EnsureRegEx()
@@ -931,7 +1829,20 @@ void CPowerRenameManager::_OnItemAdded(_In_ IPowerRenameItem* renameItem)
     }
 }
 
-void CPowerRenameManager::_OnUpdate(_In_ IPowerRenameItem* renameItem)
+void CPowerRenameManager::_OnItemsAdded(_In_ UINT firstIndex, _In_ UINT lastIndex)
+{
+    CSRWSharedAutoLock lock(&m_lockEvents);
+
+    for (auto it : m_powerRenameManagerEvents)
+    {
+        if (it.pEvents)
+        {
+            it.pEvents->OnItemsAdded(firstIndex, lastIndex);
+        }
+    }
+}
+
+void CPowerRenameManager::_OnUpdateRange(_In_ UINT firstIndex, _In_ UINT lastIndex)
 {
     CSRWSharedAutoLock lock(&m_lockEvents);
 
@@ -939,12 +1850,12 @@ void CPowerRenameManager::_OnUpdate(_In_ IPowerRenameItem* renameItem)
     {
         if (it.pEvents)
         {
-            it.pEvents->OnUpdate(renameItem);
+            it.pEvents->OnUpdateRange(firstIndex, lastIndex);
         }
     }
 }
 
-void CPowerRenameManager::_OnError(_In_ IPowerRenameItem* renameItem)
+void CPowerRenameManager::_OnError(_In_ IPowerRenameItem* renameItem, _In_ HRESULT hr)
 {
     CSRWSharedAutoLock lock(&m_lockEvents);
 
@@ -952,7 +1863,7 @@ void CPowerRenameManager::_OnError(_In_ IPowerRenameItem* renameItem)
     {
         if (it.pEvents)
         {
-            it.pEvents->OnError(renameItem);
+            it.pEvents->OnError(renameItem, hr);
         }
     }
 }
@@ -1009,6 +1920,19 @@ void CPowerRenameManager::_OnRenameStarted()
     }
 }
 
+void CPowerRenameManager::_OnRenameProgress(_In_ UINT completedCount, _In_ UINT totalCount)
+{
+    CSRWSharedAutoLock lock(&m_lockEvents);
+
+    for (auto it : m_powerRenameManagerEvents)
+    {
+        if (it.pEvents)
+        {
+            it.pEvents->OnRenameProgress(completedCount, totalCount);
+        }
+    }
+}
+
 void CPowerRenameManager::_OnRenameCompleted()
 {
     CSRWSharedAutoLock lock(&m_lockEvents);
@@ -1022,6 +1946,32 @@ void CPowerRenameManager::_OnRenameCompleted()
     }
 }
 
+void CPowerRenameManager::_OnEnumerationCompleted()
+{
+    CSRWSharedAutoLock lock(&m_lockEvents);
+
+    for (auto it : m_powerRenameManagerEvents)
+    {
+        if (it.pEvents)
+        {
+            it.pEvents->OnEnumerationCompleted();
+        }
+    }
+}
+
+void CPowerRenameManager::_OnEnumerationError(_In_ HRESULT hr)
+{
+    CSRWSharedAutoLock lock(&m_lockEvents);
+
+    for (auto it : m_powerRenameManagerEvents)
+    {
+        if (it.pEvents)
+        {
+            it.pEvents->OnEnumerationError(hr);
+        }
+    }
+}
+
 void CPowerRenameManager::_ClearEventHandlers()
 {
     CSRWExclusiveAutoLock lock(&m_lockEvents);
@@ -1045,17 +1995,158 @@ void CPowerRenameManager::_ClearPowerRenameItems()
     CSRWExclusiveAutoLock lock(&m_lockItems);
 
     // Cleanup rename items
-    for (std::map<int, IPowerRenameItem*>::iterator it = m_renameItems.begin(); it != m_renameItems.end(); ++it)
+    for (std::vector<IPowerRenameItem*>::iterator it = m_renameItems.begin(); it != m_renameItems.end(); ++it)
     {
-        IPowerRenameItem* pItem = it->second;
+        IPowerRenameItem* pItem = *it;
         if (pItem)
         {
             pItem->Release();
-            it->second = nullptr;
+            *it = nullptr;
         }
     }
 
     m_renameItems.clear();
+    m_renameItemIndexes.clear();
+    m_renameItemStates.clear();
+    m_changedItemBits.clear();
+    m_selectedItemCount = 0;
+    m_renameItemCount = 0;
+    m_extensionCounts.clear();
+}
+
+// Adds the item unless an item with the same id was already added.  Must be
+// called with m_lockItems held exclusively.
+bool CPowerRenameManager::_AddItem(_In_ IPowerRenameItem* pItem)
+{
+    int id = 0;
+    pItem->get_id(&id);
+    // Verify the item isn't already added
+    if (m_renameItemIndexes.find(id) != m_renameItemIndexes.end())
+    {
+        return false;
+    }
+
+    UINT index = static_cast<UINT>(m_renameItems.size());
+    m_renameItemIndexes[id] = index;
+    m_renameItems.push_back(pItem);
+    pItem->AddRef();
+
+    m_renameItemStates.push_back(0);
+    // Whole pages of bits so a preview page can copy its words as they are
+    m_changedItemBits.resize((index / PREVIEW_PAGE_SIZE + 1) * PREVIEW_PAGE_WORDS);
+    _SetItemState(index, _GetItemState(pItem));
+    MarkPreviewChanged(index, index);
+
+    PWSTR originalName = nullptr;
+    if (SUCCEEDED(pItem->get_originalName(&originalName)))
+    {
+        UINT extensionOffset = 0;
+        pItem->get_extensionOffset(&extensionOffset);
+        m_extensionCounts[originalName + extensionOffset]++;
+        CoTaskMemFree(originalName);
+    }
+    return true;
+}
+
+// Adds a batch of items under a single lock.  The added items are contiguous.
+// Returns false if none of them were added.
+bool CPowerRenameManager::_AddItems(_In_ const std::vector<CComPtr<IPowerRenameItem>>& items, _Out_ UINT* firstIndex, _Out_ UINT* lastIndex)
+{
+    CSRWExclusiveAutoLock lock(&m_lockItems);
+    *firstIndex = static_cast<UINT>(m_renameItems.size());
+    for (const auto& item : items)
+    {
+        _AddItem(item);
+    }
+    *lastIndex = static_cast<UINT>(m_renameItems.size()) - 1;
+    return m_renameItems.size() > *firstIndex;
+}
+
+BYTE CPowerRenameManager::_GetItemState(_In_ IPowerRenameItem* pItem)
+{
+    BYTE state = 0;
+    CPowerRenameItem* item = CPowerRenameItem::s_FromItem(pItem);
+    if (item)
+    {
+        state |= item->IsSelected() ? ITEM_STATE_SELECTED : 0;
+        state |= item->ShouldRename(m_flags) ? ITEM_STATE_SHOULD_RENAME : 0;
+        state |= item->HasChangedName() ? ITEM_STATE_CHANGED : 0;
+        return state;
+    }
+
+    bool selected = false;
+    if (SUCCEEDED(pItem->get_selected(&selected)) && selected)
+    {
+        state |= ITEM_STATE_SELECTED;
+    }
+
+    bool shouldRename = false;
+    if (SUCCEEDED(pItem->ShouldRenameItem(m_flags, &shouldRename)) && shouldRename)
+    {
+        state |= ITEM_STATE_SHOULD_RENAME;
+    }
+
+    PWSTR newName = nullptr;
+    if (SUCCEEDED(pItem->get_newName(&newName)))
+    {
+        PWSTR originalName = nullptr;
+        if (SUCCEEDED(pItem->get_originalName(&originalName)))
+        {
+            state |= (wcscmp(originalName, newName) != 0) ? ITEM_STATE_CHANGED : 0;
+            CoTaskMemFree(originalName);
+        }
+        CoTaskMemFree(newName);
+    }
+
+    return state;
+}
+
+// Caller must hold m_lockItems exclusively
+void CPowerRenameManager::_SetItemState(_In_ UINT index, _In_ BYTE state)
+{
+    BYTE previousState = m_renameItemStates[index];
+    if ((previousState & ITEM_STATE_SELECTED) != (state & ITEM_STATE_SELECTED))
+    {
+        if (state & ITEM_STATE_SELECTED)
+        {
+            m_selectedItemCount++;
+        }
+        else
+        {
+            m_selectedItemCount--;
+        }
+    }
+
+    if ((previousState & ITEM_STATE_SHOULD_RENAME) != (state & ITEM_STATE_SHOULD_RENAME))
+    {
+        if (state & ITEM_STATE_SHOULD_RENAME)
+        {
+            m_renameItemCount++;
+        }
+        else
+        {
+            m_renameItemCount--;
+        }
+    }
+
+    if ((previousState & ITEM_STATE_CHANGED) != (state & ITEM_STATE_CHANGED))
+    {
+        UINT64 bit = 1ull << (index % 64);
+        if (state & ITEM_STATE_CHANGED)
+        {
+            m_changedItemBits[index / 64] |= bit;
+        }
+        else
+        {
+            m_changedItemBits[index / 64] &= ~bit;
+        }
+    }
+
+    if (previousState != state)
+    {
+        m_renameItemStates[index] = state;
+        MarkPreviewChanged(index, index);
+    }
 }
 
 void CPowerRenameManager::_Cleanup()
@@ -1069,13 +2160,25 @@ void CPowerRenameManager::_Cleanup()
     CloseHandle(m_startFileOpWorkerEvent);
     m_startFileOpWorkerEvent = nullptr;
 
-    CloseHandle(m_startRegExWorkerEvent);
-    m_startRegExWorkerEvent = nullptr;
+    _StopRegExWorkerThread();
+
+    CloseHandle(m_regExWorkEvent);
+    m_regExWorkEvent = nullptr;
+
+    CloseHandle(m_regExIdleEvent);
+    m_regExIdleEvent = nullptr;
+
+    CloseHandle(m_stopRegExWorkerEvent);
+    m_stopRegExWorkerEvent = nullptr;
+
+    CloseHandle(m_cancelRegExPassEvent);
+    m_cancelRegExPassEvent = nullptr;
 
-    CloseHandle(m_cancelRegExWorkerEvent);
-    m_cancelRegExWorkerEvent = nullptr;
+    CloseHandle(m_cancelEnumWorkerEvent);
+    m_cancelEnumWorkerEvent = nullptr;
 
     _ClearRegEx();
     _ClearEventHandlers();
+    _ClearPreview();
     _ClearPowerRenameItems();
 }
@@ -1,6 +1,8 @@
 #pragma once
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <atomic>
 #include "srwlock.h"
 
 #include <lib/PowerRenameManager.h>
@@ -25,17 +27,25 @@ public:
     IFACEMETHODIMP Shutdown();
     IFACEMETHODIMP Rename(_In_ HWND hwndParent);
     IFACEMETHODIMP AddItem(_In_ IPowerRenameItem* pItem);
+    IFACEMETHODIMP AddItems(_In_reads_(count) IPowerRenameItem* const* items, _In_ UINT count);
+    IFACEMETHODIMP WaitForPreview();
+    IFACEMETHODIMP RemoveAllItems();
+    IFACEMETHODIMP StartEnumeration(_In_ IUnknown* dataSource);
+    IFACEMETHODIMP StartManifestImport(_In_ PCWSTR manifestPath);
     IFACEMETHODIMP GetItemByIndex(_In_ UINT index, _COM_Outptr_ IPowerRenameItem** ppItem);
     IFACEMETHODIMP GetItemById(_In_ int id, _COM_Outptr_ IPowerRenameItem** ppItem);
     IFACEMETHODIMP GetItemCount(_Out_ UINT* count);
     IFACEMETHODIMP GetSelectedItemCount(_Out_ UINT* count);
     IFACEMETHODIMP GetRenameItemCount(_Out_ UINT* count);
+    IFACEMETHODIMP SetItemSelected(_In_ UINT index, _In_ bool selected);
+    IFACEMETHODIMP SetAllItemsSelected(_In_ bool selected);
     IFACEMETHODIMP get_flags(_Out_ DWORD* flags);
     IFACEMETHODIMP put_flags(_In_ DWORD flags);
     IFACEMETHODIMP get_renameRegEx(_COM_Outptr_ IPowerRenameRegEx** ppRegEx);
     IFACEMETHODIMP put_renameRegEx(_In_ IPowerRenameRegEx* pRegEx);
     IFACEMETHODIMP get_renameItemFactory(_COM_Outptr_ IPowerRenameItemFactory** ppItemFactory);
     IFACEMETHODIMP put_renameItemFactory(_In_ IPowerRenameItemFactory* pItemFactory);
+    IFACEMETHODIMP GetPreviewSnapshot(_Outptr_ const CPreviewSnapshot** snapshot);
 
     // IPowerRenameRegExEvents
     IFACEMETHODIMP OnSearchTermChanged(_In_ PCWSTR searchTerm);
@@ -44,6 +54,17 @@ public:
 
     static HRESULT s_CreateInstance(_Outptr_ IPowerRenameManager** ppsrm);
 
+    // Called by the regex worker after it updates the new names of a range of items
+    void UpdateItemStates(_In_ UINT firstIndex, _In_ UINT endIndex);
+
+    // Called for the items whose state or new name changed, then once to
+    // publish them after the items lock is released.  The regex worker
+    // publishes before it tells the manager thread, AddItem leaves it to the
+    // next GetPreviewSnapshot and the other mutators publish before they
+    // return.
+    void MarkPreviewChanged(_In_ UINT firstIndex, _In_ UINT lastIndex);
+    void PublishPreview();
+
 protected:
     CPowerRenameManager();
     virtual ~CPowerRenameManager();
@@ -54,42 +75,91 @@ protected:
     void _Cancel();
 
     void _OnItemAdded(_In_ IPowerRenameItem* renameItem);
-    void _OnUpdate(_In_ IPowerRenameItem* renameItem);
-    void _OnError(_In_ IPowerRenameItem* renameItem);
+    void _OnItemsAdded(_In_ UINT firstIndex, _In_ UINT lastIndex);
+    void _OnUpdateRange(_In_ UINT firstIndex, _In_ UINT lastIndex);
+    void _OnError(_In_ IPowerRenameItem* renameItem, _In_ HRESULT hr);
     void _OnRegExStarted(_In_ DWORD threadId);
     void _OnRegExCanceled(_In_ DWORD threadId);
     void _OnRegExCompleted(_In_ DWORD threadId);
     void _OnRenameStarted();
+    void _OnRenameProgress(_In_ UINT completedCount, _In_ UINT totalCount);
     void _OnRenameCompleted();
+    void _OnEnumerationCompleted();
+    void _OnEnumerationError(_In_ HRESULT hr);
 
     void _ClearEventHandlers();
     void _ClearPowerRenameItems();
 
+    bool _AddItem(_In_ IPowerRenameItem* pItem);
+    bool _AddItems(_In_ const std::vector<CComPtr<IPowerRenameItem>>& items, _Out_ UINT* firstIndex, _Out_ UINT* lastIndex);
+
+    BYTE _GetItemState(_In_ IPowerRenameItem* pItem);
+    void _SetItemState(_In_ UINT index, _In_ BYTE state);
+
     HRESULT _PerformRegExRename();
+    void _PerformPendingRegExRename();
     HRESULT _PerformFileOperation();
 
-    HRESULT _CreateRegExWorkerThread();
-    void _CancelRegExWorkerThread();
-    void _WaitForRegExWorkerThread();
+    HRESULT _SignalRegExWorkerThread();
+    void _StopRegExWorkerThread();
+    void _WaitForRegExWorkerIdle();
+    void _RegExWorkerLoop();
+    bool _RunRegExWorkerPass(_In_ UINT generation, _In_ UINT firstIndex, _Out_ UINT* evaluatedIndex);
     HRESULT _CreateFileOpWorkerThread();
+    void _CancelEnumWorkerThreads();
 
     HRESULT _EnsureRegEx();
     HRESULT _InitRegEx();
     void _ClearRegEx();
 
-    // Thread proc for performing the regex rename of each item
+    // Thread proc of the preview worker that performs the regex rename of each item
     static DWORD WINAPI s_regexWorkerThread(_In_ void* pv);
     // Thread proc for performing the actual file operation that does the file rename
     static DWORD WINAPI s_fileOpWorkerThread(_In_ void* pv);
+    // Thread proc for enumerating the items of a data object
+    static DWORD WINAPI s_enumWorkerThread(_In_ void* pv);
 
     static LRESULT CALLBACK s_msgWndProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ WPARAM wParam, _In_ LPARAM lParam);
     LRESULT _WndProc(_In_ HWND hwnd, _In_ UINT msg, _In_ WPARAM wParam, _In_ LPARAM lParam);
 
     void _LogOperationTelemetry();
 
+    void _PublishPreview(_In_ bool reclaim);
+    void _ReclaimPreviewSnapshots();
+    void _ReclaimPreviewSnapshotsLocked();
+    void _ClearPreview();
+
+    // The preview worker is started with the first search and lives until
+    // shutdown.  m_regExWorkEvent wakes it up, m_regExIdleEvent is signaled
+    // when it has caught up and m_stopRegExWorkerEvent ends it.
     HANDLE m_regExWorkerThreadHandle = nullptr;
-    HANDLE m_startRegExWorkerEvent = nullptr;
-    HANDLE m_cancelRegExWorkerEvent = nullptr;
+    HANDLE m_regExWorkEvent = nullptr;
+    HANDLE m_regExIdleEvent = nullptr;
+    HANDLE m_stopRegExWorkerEvent = nullptr;
+    // Interrupts the item being matched when the pass is out of date
+    HANDLE m_cancelRegExPassEvent = nullptr;
+    DWORD m_regExDelay = 0;
+
+    // Incremented whenever the search, replace or flags change.  A pass over
+    // an older generation stops at its next chunk.
+    std::atomic<UINT> m_regExGeneration{ 0 };
+    // Last generation the worker completed a pass for.  Items before
+    // m_regExEvaluatedIndex have been evaluated with it and any added after
+    // are evaluated by the next pass.
+    std::atomic<UINT> m_regExEvaluatedGeneration{ 0 };
+    std::atomic<UINT> m_regExEvaluatedIndex{ 0 };
+    // Items before m_regExEvaluatedIndex with a new name.  A pass over the
+    // items added after them continues the enumeration numbering from it.
+    // m_regExRemovedRenamedCount is the same for the items taken out by
+    // RemoveAllItems, where a pass over all items of m_regExRemovedGeneration
+    // starts numbering.  Only used by the preview worker, or while it is idle.
+    unsigned long m_regExRenamedCount = 0;
+    unsigned long m_regExRemovedRenamedCount = 0;
+    UINT m_regExRemovedGeneration = 0;
+
+    // Enumeration worker threads that have not reported completion yet
+    std::vector<HANDLE> m_enumWorkerThreadHandles;
+    HANDLE m_cancelEnumWorkerEvent = nullptr;
 
     HANDLE m_fileOpWorkerThreadHandle = nullptr;
     HANDLE m_startFileOpWorkerEvent = nullptr;
@@ -112,14 +182,39 @@ protected:
     CComPtr<IPowerRenameRegEx> m_spRegEx;
 
     _Guarded_by_(m_lockEvents) std::vector<RENAME_MGR_EVENT> m_powerRenameManagerEvents;
-    _Guarded_by_(m_lockItems) std::map<int, IPowerRenameItem*> m_renameItems;
-
-    // Parent HWND used by IFileOperation
-    HWND m_hwndParent = nullptr;
+    // Items are stored densely in the order they were added.  The id map
+    // gives O(1) lookup from an item id to its index in m_renameItems.
+    _Guarded_by_(m_lockItems) std::vector<IPowerRenameItem*> m_renameItems;
+    _Guarded_by_(m_lockItems) std::unordered_map<int, UINT> m_renameItemIndexes;
+
+    // Aggregates kept up to date as items are added, selected or given a new
+    // name so that the count queries do not need to visit every item.
+    // m_renameItemStates holds the ITEM_STATE_* flags of each item, indexed
+    // like m_renameItems, and m_changedItemBits a bit per item with
+    // ITEM_STATE_CHANGED, padded to whole preview pages.
+    _Guarded_by_(m_lockItems) std::vector<BYTE> m_renameItemStates;
+    _Guarded_by_(m_lockItems) std::vector<UINT64> m_changedItemBits;
+    _Guarded_by_(m_lockItems) UINT m_selectedItemCount = 0;
+    _Guarded_by_(m_lockItems) UINT m_renameItemCount = 0;
+    _Guarded_by_(m_lockItems) std::map<std::wstring, int> m_extensionCounts;
+
+    // Preview read by the list view.  Only the manager thread reads it so a
+    // snapshot that thread replaces while changing the items is deleted right
+    // away.  Any other is deleted when the manager thread handles
+    // SRM_PREVIEW_RETIRED: it is not in the middle of a read then and any
+    // later read gets the newer snapshot.
+    std::atomic<const CPreviewSnapshot*> m_previewSnapshot{ nullptr };
+    // Set by AddItem, whose items are published on the next read
+    std::atomic<bool> m_previewPublishPending{ false };
+    DWORD m_managerThreadId = 0;
+    // Serializes publishing.  Taken before m_lockItems.
+    CSRWLock m_lockPreview;
+    _Guarded_by_(m_lockPreview) std::vector<const CPreviewSnapshot*> m_retiredPreviewSnapshots;
+    // Pages with items that changed since the last snapshot.  Taken last.
+    CSRWLock m_lockPreviewDirty;
+    _Guarded_by_(m_lockPreviewDirty) std::vector<bool> m_previewDirtyPages;
 
     HWND m_hwndMessage = nullptr;
 
-    CRITICAL_SECTION m_critsecReentrancy;
-
     long m_refCount;
 };
\ No newline at end of file
@@ -0,0 +1,250 @@
+#include "stdafx.h"
+#include "PowerRenameManifest.h"
+#include <atomic>
+#include <memory>
+
+// Bytes of a manifest parsed by one thread pool work item.  Also the most
+// items passed to the callback at once, about 16k lines of typical paths.
+#define MANIFEST_CHUNK_SIZE (1024 * 1024)
+
+// Lines parsed between two checks for cancellation
+#define MANIFEST_CANCEL_CHECK_LINES 1024
+
+namespace
+{
+    struct ManifestImportState
+    {
+        IPowerRenameItemFactory* psrif = nullptr;
+        HANDLE cancelEvent = nullptr;
+        // Set once the import is over.  Chunks not parsed yet return right away.
+        std::atomic<bool> stop{ false };
+    };
+
+    // Lines [begin, end) of the manifest and the items made from them.  The
+    // items are read by the importing thread once doneEvent is signaled.
+    struct ManifestChunk
+    {
+        ManifestImportState* state = nullptr;
+        const char* begin = nullptr;
+        const char* end = nullptr;
+        HANDLE doneEvent = nullptr;
+        HRESULT hr = S_OK;
+        std::vector<CComPtr<IPowerRenameItem>> items;
+
+        ~ManifestChunk()
+        {
+            if (doneEvent)
+            {
+                CloseHandle(doneEvent);
+            }
+        }
+    };
+
+    HRESULT _ConvertUtf8(_In_reads_(length) const char* text, _In_ size_t length, _Inout_ std::wstring& result)
+    {
+        result.clear();
+        if (length == 0)
+        {
+            return S_OK;
+        }
+
+        HRESULT hr = (length <= MAXINT) ? S_OK : E_INVALIDARG;
+        if (SUCCEEDED(hr))
+        {
+            // No UTF-8 sequence takes more UTF-16 units than it has bytes
+            result.resize(length);
+            int converted = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, text, static_cast<int>(length), &result[0], static_cast<int>(length));
+            hr = (converted > 0) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+            result.resize(SUCCEEDED(hr) ? converted : 0);
+        }
+        return hr;
+    }
+
+    // Makes the item of a line without its line break.  path and mappedName
+    // are reused between lines to save allocations.
+    HRESULT _ParseManifestLine(_In_ ManifestImportState* state, _In_reads_(length) const char* line, _In_ size_t length, _Inout_ std::wstring& path, _Inout_ std::wstring& mappedName, _Inout_ std::vector<CComPtr<IPowerRenameItem>>& items)
+    {
+        if (length > 0 && line[length - 1] == '\r')
+        {
+            length--;
+        }
+
+        if (length == 0)
+        {
+            return S_OK;
+        }
+
+        const char* tab = static_cast<const char*>(memchr(line, '\t', length));
+        size_t pathLength = tab ? static_cast<size_t>(tab - line) : length;
+        HRESULT hr = _ConvertUtf8(line, pathLength, path);
+        mappedName.clear();
+        if (SUCCEEDED(hr) && tab)
+        {
+            hr = _ConvertUtf8(tab + 1, length - pathLength - 1, mappedName);
+        }
+
+        bool isFolder = false;
+        while (!path.empty() && path.back() == L'\\')
+        {
+            path.pop_back();
+            isFolder = true;
+        }
+
+        if (SUCCEEDED(hr) && !path.empty())
+        {
+            CComPtr<IPowerRenameItem> spItem;
+            hr = state->psrif->CreateFromPath(path.c_str(), isFolder, mappedName.empty() ? nullptr : mappedName.c_str(), &spItem);
+            if (SUCCEEDED(hr))
+            {
+                items.push_back(spItem);
+            }
+        }
+
+        return hr;
+    }
+
+    VOID CALLBACK _ParseManifestChunk(_Inout_ PTP_CALLBACK_INSTANCE, _Inout_opt_ PVOID pv)
+    {
+        ManifestChunk* chunk = reinterpret_cast<ManifestChunk*>(pv);
+        ManifestImportState* state = chunk->state;
+
+        std::wstring path;
+        std::wstring mappedName;
+        HRESULT hr = S_OK;
+        UINT lineCount = 0;
+        for (const char* line = chunk->begin; SUCCEEDED(hr) && line < chunk->end; lineCount++)
+        {
+            if ((lineCount % MANIFEST_CANCEL_CHECK_LINES) == 0 &&
+                (state->stop || (state->cancelEvent && WaitForSingleObject(state->cancelEvent, 0) == WAIT_OBJECT_0)))
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+                break;
+            }
+
+            const char* lineEnd = static_cast<const char*>(memchr(line, '\n', chunk->end - line));
+            if (!lineEnd)
+            {
+                lineEnd = chunk->end;
+            }
+
+            hr = _ParseManifestLine(state, line, lineEnd - line, path, mappedName, chunk->items);
+            line = lineEnd + 1;
+        }
+
+        chunk->hr = hr;
+
+        // The importing thread may free the chunk as soon as this is signaled
+        SetEvent(chunk->doneEvent);
+    }
+
+    HRESULT _ImportManifestView(_In_reads_(size) const char* view, _In_ size_t size, _In_ IPowerRenameItemFactory* psrif, _In_opt_ HANDLE cancelEvent, _In_ const EnumerateItemsCallback& addItems)
+    {
+        const char* begin = view;
+        const char* end = view + size;
+        if (size >= 3 && memcmp(begin, "\xEF\xBB\xBF", 3) == 0)
+        {
+            // UTF-8 byte order mark
+            begin += 3;
+        }
+
+        ManifestImportState state;
+        state.psrif = psrif;
+        state.cancelEvent = cancelEvent;
+
+        // Every chunk is submitted up front.  Chunks end after a line break so
+        // no line is split between two of them.
+        HRESULT hr = S_OK;
+        std::vector<std::unique_ptr<ManifestChunk>> chunks;
+        for (const char* chunkBegin = begin; SUCCEEDED(hr) && chunkBegin < end;)
+        {
+            const char* chunkEnd = end;
+            if (static_cast<size_t>(end - chunkBegin) > MANIFEST_CHUNK_SIZE)
+            {
+                const char* lineEnd = static_cast<const char*>(memchr(chunkBegin + MANIFEST_CHUNK_SIZE, '\n', end - chunkBegin - MANIFEST_CHUNK_SIZE));
+                chunkEnd = lineEnd ? lineEnd + 1 : end;
+            }
+
+            std::unique_ptr<ManifestChunk> chunk(new (std::nothrow) ManifestChunk());
+            hr = chunk ? S_OK : E_OUTOFMEMORY;
+            if (SUCCEEDED(hr))
+            {
+                chunk->state = &state;
+                chunk->begin = chunkBegin;
+                chunk->end = chunkEnd;
+                chunk->doneEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+                hr = chunk->doneEvent ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                hr = TrySubmitThreadpoolCallback(_ParseManifestChunk, chunk.get(), nullptr) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                chunks.push_back(std::move(chunk));
+            }
+            chunkBegin = chunkEnd;
+        }
+
+        // Pass on the items of the chunks in order, stopping at the first
+        // chunk that failed
+        HRESULT hrAdd = S_OK;
+        for (size_t i = 0; SUCCEEDED(hrAdd) && i < chunks.size(); i++)
+        {
+            ManifestChunk* chunk = chunks[i].get();
+            HANDLE waitHandles[] = { chunk->doneEvent, cancelEvent };
+            DWORD waitCount = cancelEvent ? 2 : 1;
+            hrAdd = (WaitForMultipleObjects(waitCount, waitHandles, FALSE, INFINITE) == WAIT_OBJECT_0) ? chunk->hr : HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            if (SUCCEEDED(hrAdd) && !chunk->items.empty())
+            {
+                hrAdd = addItems(chunk->items);
+            }
+            chunk->items.clear();
+        }
+
+        // After a failure or cancel some chunks may still be queued or being
+        // parsed.  Wait for all of them before they are freed.
+        state.stop = true;
+        for (const auto& chunk : chunks)
+        {
+            WaitForSingleObject(chunk->doneEvent, INFINITE);
+        }
+
+        return SUCCEEDED(hr) ? hrAdd : hr;
+    }
+}
+
+HRESULT ImportManifest(_In_ PCWSTR manifestPath, _In_ IPowerRenameItemFactory* psrif, _In_opt_ HANDLE cancelEvent, _In_ const EnumerateItemsCallback& addItems)
+{
+    HANDLE file = CreateFile(manifestPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    HRESULT hr = (file != INVALID_HANDLE_VALUE) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    LARGE_INTEGER size = { 0 };
+    hr = GetFileSizeEx(file, &size) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+
+    // An empty file can't be mapped and has no items anyway
+    if (SUCCEEDED(hr) && size.QuadPart > 0)
+    {
+        HANDLE mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        hr = mapping ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+        if (SUCCEEDED(hr))
+        {
+            const char* view = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            hr = view ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+            if (SUCCEEDED(hr))
+            {
+                hr = _ImportManifestView(view, static_cast<size_t>(size.QuadPart), psrif, cancelEvent, addItems);
+                UnmapViewOfFile(view);
+            }
+            CloseHandle(mapping);
+        }
+    }
+
+    CloseHandle(file);
+    return hr;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "Helpers.h"
+
+// Adds the items listed in a manifest file, for pipelines that produce the
+// set of items to rename with other tools.
+//
+// A manifest is UTF-8 text, with or without a byte order mark, with a line
+// per item ending in LF or CRLF.  A line is the full path of the item, with a
+// trailing separator for a folder, optionally followed by a tab and the name
+// the item is renamed to.  Empty lines are skipped.
+//
+//     C:\Photos\IMG_0001.JPG
+//     C:\Photos\IMG_0002.JPG<TAB>Beach.jpg
+//     C:\Photos\Raw\
+//
+// The file is memory mapped and split into chunks at line breaks, which are
+// parsed in parallel on the thread pool.  Items are made with
+// IPowerRenameItemFactory::CreateFromPath, without touching the items on
+// disk, and passed to addItems a chunk at a time in the order of the manifest.
+HRESULT ImportManifest(_In_ PCWSTR manifestPath, _In_ IPowerRenameItemFactory* psrif, _In_opt_ HANDLE cancelEvent, _In_ const EnumerateItemsCallback& addItems);
@@ -0,0 +1,150 @@
+#include "stdafx.h"
+#include "PowerRenamePlanner.h"
+#include <unordered_map>
+
+// next and prev of a rename not linked to another one
+#define NO_RENAME SIZE_MAX
+
+// Key under which the file system considers two names the same
+std::wstring _GetNameKey(_In_ const std::wstring& name)
+{
+    std::wstring key = name;
+    if (!key.empty())
+    {
+        CharUpperBuff(&key[0], static_cast<DWORD>(key.length()));
+    }
+    return key;
+}
+
+void PlanFolderRenames(_In_ const std::vector<std::wstring>& names,
+                       _In_ const std::vector<std::wstring>& newNames,
+                       _In_ const std::function<bool(_In_ const std::wstring& name)>& nameExists,
+                       _Out_ RenamePlan& plan)
+{
+    plan.steps.clear();
+    plan.conflicts.clear();
+
+    size_t count = names.size();
+    std::vector<std::wstring> nameKeys(count);
+    std::vector<std::wstring> newNameKeys(count);
+    std::unordered_map<std::wstring, size_t> sources;
+    for (size_t i = 0; i < count; i++)
+    {
+        nameKeys[i] = _GetNameKey(names[i]);
+        newNameKeys[i] = _GetNameKey(newNames[i]);
+        sources.emplace(nameKeys[i], i);
+    }
+
+    // next links a rename to the rename of the item holding its new name and
+    // prev is the reverse.  New names are unique so each rename has at most
+    // one of each and the links form chains and cycles.
+    std::vector<HRESULT> results(count, S_OK);
+    std::vector<size_t> next(count, NO_RENAME);
+    std::vector<size_t> prev(count, NO_RENAME);
+    std::unordered_map<std::wstring, size_t> targets;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (newNameKeys[i] == nameKeys[i])
+        {
+            // Only the case changes.  The item keeps its name.
+            continue;
+        }
+
+        if (!targets.emplace(newNameKeys[i], i).second)
+        {
+            results[i] = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+            continue;
+        }
+
+        auto source = sources.find(newNameKeys[i]);
+        if (source == sources.end())
+        {
+            if (nameExists(newNames[i]))
+            {
+                results[i] = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+            }
+        }
+        else if (newNameKeys[source->second] == nameKeys[source->second])
+        {
+            // The item holding the name only changes its case
+            results[i] = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+        }
+        else
+        {
+            next[i] = source->second;
+            prev[source->second] = i;
+        }
+    }
+
+    // An item whose rename conflicts keeps its name, so the rename waiting for
+    // that name conflicts too, and so on up the chain
+    for (size_t i = 0; i < count; i++)
+    {
+        if (FAILED(results[i]))
+        {
+            for (size_t j = prev[i]; j != NO_RENAME && SUCCEEDED(results[j]); j = prev[j])
+            {
+                results[j] = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (FAILED(results[i]))
+        {
+            plan.conflicts.emplace_back(i, results[i]);
+            if (next[i] != NO_RENAME)
+            {
+                prev[next[i]] = NO_RENAME;
+                next[i] = NO_RENAME;
+            }
+        }
+    }
+
+    // A chain starts with a rename nobody waits for and ends with one whose new
+    // name is free.  Rename from the end back to the start.
+    std::vector<bool> planned(count);
+    std::vector<size_t> chain;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (SUCCEEDED(results[i]) && prev[i] == NO_RENAME)
+        {
+            chain.clear();
+            for (size_t j = i; j != NO_RENAME; j = next[j])
+            {
+                chain.push_back(j);
+                planned[j] = true;
+            }
+
+            for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+            {
+                plan.steps.push_back({ *it, PLAN_STEP_RENAME });
+            }
+        }
+    }
+
+    // The renames left form cycles.  Moving the first item of a cycle out of
+    // the way turns the rest into a chain.
+    for (size_t i = 0; i < count; i++)
+    {
+        if (SUCCEEDED(results[i]) && !planned[i])
+        {
+            chain.clear();
+            size_t j = i;
+            do
+            {
+                chain.push_back(j);
+                planned[j] = true;
+                j = next[j];
+            } while (j != i);
+
+            plan.steps.push_back({ i, PLAN_STEP_STAGE });
+            for (size_t k = chain.size() - 1; k > 0; k--)
+            {
+                plan.steps.push_back({ chain[k], PLAN_STEP_RENAME });
+            }
+            plan.steps.push_back({ i, PLAN_STEP_UNSTAGE });
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum RenamePlanStepType
+{
+    // Renames the item to its new name
+    PLAN_STEP_RENAME,
+    // Moves the item out of the way under a temporary name
+    PLAN_STEP_STAGE,
+    // Renames an item from its temporary name to its new name
+    PLAN_STEP_UNSTAGE
+};
+
+struct RenamePlanStep
+{
+    // Index of the rename in the folder
+    size_t rename = 0;
+    RenamePlanStepType type = PLAN_STEP_RENAME;
+};
+
+struct RenamePlan
+{
+    // Order in which to rename the items that have no conflict
+    std::vector<RenamePlanStep> steps;
+    // Renames that cannot be performed, in order, with the reason
+    std::vector<std::pair<size_t, HRESULT>> conflicts;
+};
+
+// Plans the renames of the items of a single folder so that none of them
+// replaces another item or fails because of the order they are done in.
+// Names are compared without regard to case like the file system does.
+//
+// A rename conflicts, with HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS), if an
+// earlier rename has the same new name, if its new name is taken by an item
+// that is not renamed, or if it would take the name of an item whose rename
+// conflicts.  A change of case only never conflicts.
+//
+// The others are ordered so that an item is renamed after the item holding its
+// new name.  A cycle of renames (a to b and b to a) is broken by staging one of
+// its items under a temporary name.  Runs in time linear in the number of
+// renames plus one nameExists call per new name not taken by another item.
+void PlanFolderRenames(_In_ const std::vector<std::wstring>& names,
+                       _In_ const std::vector<std::wstring>& newNames,
+                       _In_ const std::function<bool(_In_ const std::wstring& name)>& nameExists,
+                       _Out_ RenamePlan& plan);
@@ -0,0 +1,173 @@
+#include "stdafx.h"
+#include "PowerRenamePreview.h"
+#include "PowerRenameItem.h"
+#include <algorithm>
+#include <bitset>
+#include <intrin.h>
+
+namespace
+{
+    UINT _CountBits(_In_ UINT64 bits)
+    {
+        return static_cast<UINT>(std::bitset<64>(bits).count());
+    }
+
+    // Position of the set bit of the given rank in bits, which has more set
+    // bits than rank
+    UINT _SelectBit(_In_ UINT64 bits, _In_ UINT rank)
+    {
+        for (; rank > 0; rank--)
+        {
+            bits &= bits - 1;
+        }
+
+        unsigned long bit = 0;
+        _BitScanForward64(&bit, bits);
+        return bit;
+    }
+
+    // Copies the names of item into text without making copies of its own.
+    // Preview workers may set a new name meanwhile, so it is copied under
+    // the item lock.
+    void _AppendNames(_In_ const CPowerRenameItem* item, _Inout_ std::wstring& text, _Out_ size_t* originalNameOffset, _Out_ size_t* newNameOffset)
+    {
+        *originalNameOffset = text.length();
+        text.append(item->GetOriginalName());
+        text += L'\0';
+
+        *newNameOffset = text.length();
+        if (item->AppendNewName(text))
+        {
+            text += L'\0';
+        }
+        else
+        {
+            *newNameOffset = SIZE_MAX;
+        }
+    }
+}
+
+std::shared_ptr<const PreviewPage> PreviewPage::s_Create(_In_reads_(count) IPowerRenameItem* const* items, _In_reads_(count) const BYTE* states, _In_reads_(PREVIEW_PAGE_WORDS) const UINT64* changedBits, _In_ UINT count)
+{
+    std::shared_ptr<PreviewPage> page = std::make_shared<PreviewPage>();
+    page->items.resize(count);
+    for (UINT word = 0; word < PREVIEW_PAGE_WORDS; word++)
+    {
+        page->changedBits[word] = changedBits[word];
+        page->changedCount += _CountBits(changedBits[word]);
+    }
+
+    // Names are appended first and pointed to once the text stops growing
+    std::vector<size_t> originalNameOffsets(count, 0);
+    std::vector<size_t> newNameOffsets(count, SIZE_MAX);
+    for (UINT u = 0; u < count; u++)
+    {
+        PreviewItem& previewItem = page->items[u];
+        previewItem.item = items[u];
+        previewItem.state = states[u];
+
+        CPowerRenameItem* item = CPowerRenameItem::s_FromItem(items[u]);
+        if (item)
+        {
+            _AppendNames(item, page->text, &originalNameOffsets[u], &newNameOffsets[u]);
+            previewItem.id = item->GetId();
+            previewItem.depth = item->GetDepth();
+            continue;
+        }
+
+        items[u]->get_id(&previewItem.id);
+        items[u]->get_depth(&previewItem.depth);
+
+        PWSTR name = nullptr;
+        originalNameOffsets[u] = page->text.length();
+        if (SUCCEEDED(items[u]->get_originalName(&name)))
+        {
+            page->text += name;
+            CoTaskMemFree(name);
+        }
+        page->text += L'\0';
+
+        if (SUCCEEDED(items[u]->get_newName(&name)))
+        {
+            newNameOffsets[u] = page->text.length();
+            page->text += name;
+            page->text += L'\0';
+            CoTaskMemFree(name);
+        }
+    }
+
+    for (UINT u = 0; u < count; u++)
+    {
+        page->items[u].originalName = page->text.c_str() + originalNameOffsets[u];
+        if (newNameOffsets[u] != SIZE_MAX)
+        {
+            page->items[u].newName = page->text.c_str() + newNameOffsets[u];
+        }
+    }
+
+    return page;
+}
+
+CPreviewSnapshot::CPreviewSnapshot(_In_ UINT itemCount, _In_ std::vector<std::shared_ptr<const PreviewPage>>&& pages) :
+    m_itemCount(itemCount),
+    m_pages(std::move(pages))
+{
+    // Pages keep their counts so this is a pass over the pages, not the items
+    m_changedRanks.reserve(m_pages.size() + 1);
+    UINT changedCount = 0;
+    for (const auto& page : m_pages)
+    {
+        m_changedRanks.push_back(changedCount);
+        changedCount += page->changedCount;
+    }
+    m_changedRanks.push_back(changedCount);
+}
+
+UINT CPreviewSnapshot::GetChangedRank(_In_ UINT index) const
+{
+    if (index >= m_itemCount)
+    {
+        return GetChangedItemCount();
+    }
+
+    UINT pageIndex = index / PREVIEW_PAGE_SIZE;
+    UINT offset = index % PREVIEW_PAGE_SIZE;
+    const UINT64* changedBits = m_pages[pageIndex]->changedBits;
+
+    UINT rank = m_changedRanks[pageIndex];
+    for (UINT word = 0; word < offset / 64; word++)
+    {
+        rank += _CountBits(changedBits[word]);
+    }
+
+    // Bits below index in its own word
+    UINT64 mask = (1ull << (offset % 64)) - 1;
+    return rank + _CountBits(changedBits[offset / 64] & mask);
+}
+
+bool CPreviewSnapshot::SelectChanged(_In_ UINT rank, _Out_ UINT* index) const
+{
+    *index = 0;
+    if (rank >= GetChangedItemCount())
+    {
+        return false;
+    }
+
+    // The last page with at most rank changed items before it
+    UINT pageIndex = static_cast<UINT>(std::upper_bound(m_changedRanks.begin(), m_changedRanks.end(), rank) - m_changedRanks.begin()) - 1;
+    const UINT64* changedBits = m_pages[pageIndex]->changedBits;
+
+    rank -= m_changedRanks[pageIndex];
+    for (UINT word = 0; word < PREVIEW_PAGE_WORDS; word++)
+    {
+        UINT count = _CountBits(changedBits[word]);
+        if (rank < count)
+        {
+            *index = pageIndex * PREVIEW_PAGE_SIZE + word * 64 + _SelectBit(changedBits[word], rank);
+            return true;
+        }
+        rank -= count;
+    }
+
+    return false;
+}
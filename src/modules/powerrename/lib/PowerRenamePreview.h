@@ -0,0 +1,85 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "PowerRenameInterfaces.h"
+
+// Number of items in a page of a preview snapshot.  A change to an item copies
+// the page it is on into the next snapshot.
+#define PREVIEW_PAGE_SIZE 512
+
+// Number of 64 bit words in the changed item bits of a page
+#define PREVIEW_PAGE_WORDS (PREVIEW_PAGE_SIZE / 64)
+
+// State bits of a preview item
+#define PREVIEW_ITEM_SELECTED 0x1
+#define PREVIEW_ITEM_SHOULD_RENAME 0x2
+// The new name differs from the original name, whatever the selection
+#define PREVIEW_ITEM_CHANGED 0x4
+
+// What the list view shows for an item
+struct PreviewItem
+{
+    // Not AddRef'd.  The manager keeps its items until it is shut down or
+    // they are removed, which also replaces the snapshot.
+    IPowerRenameItem* item = nullptr;
+    int id = 0;
+    UINT depth = 0;
+    BYTE state = 0;
+    // Point into the text of the page.  newName is null if the item is not
+    // renamed.
+    PCWSTR originalName = nullptr;
+    PCWSTR newName = nullptr;
+};
+
+// Up to PREVIEW_PAGE_SIZE consecutive items and the text of their names.
+// Never changed once made.
+struct PreviewPage
+{
+    std::vector<PreviewItem> items;
+    std::wstring text;
+    // A bit per item with PREVIEW_ITEM_CHANGED and the number of bits set
+    UINT64 changedBits[PREVIEW_PAGE_WORDS] = {};
+    UINT changedCount = 0;
+
+    // Reads count items, states holding their PREVIEW_ITEM_* bits and
+    // changedBits the PREVIEW_PAGE_WORDS words of their changed bits
+    static std::shared_ptr<const PreviewPage> s_Create(_In_reads_(count) IPowerRenameItem* const* items, _In_reads_(count) const BYTE* states, _In_reads_(PREVIEW_PAGE_WORDS) const UINT64* changedBits, _In_ UINT count);
+};
+
+// Immutable copy of the preview published by the manager, read by the list
+// view without locks or allocations.  Consecutive snapshots share the pages
+// that did not change between them.
+//
+// The changed bits of the pages and the number of changed items before each
+// page give rank and select over the changed items, so a view of only those
+// maps between its rows and item indexes without visiting the other items.
+class CPreviewSnapshot
+{
+public:
+    CPreviewSnapshot(_In_ UINT itemCount, _In_ std::vector<std::shared_ptr<const PreviewPage>>&& pages);
+
+    UINT GetItemCount() const { return m_itemCount; }
+    UINT GetChangedItemCount() const { return m_changedRanks.back(); }
+
+    // Number of changed items before index
+    UINT GetChangedRank(_In_ UINT index) const;
+
+    // Index of the changed item with the given rank, or false if there are
+    // not that many changed items
+    bool SelectChanged(_In_ UINT rank, _Out_ UINT* index) const;
+
+    // Null if index is past the items of the snapshot
+    const PreviewItem* GetItem(_In_ UINT index) const
+    {
+        return (index < m_itemCount) ? &m_pages[index / PREVIEW_PAGE_SIZE]->items[index % PREVIEW_PAGE_SIZE] : nullptr;
+    }
+
+    const std::vector<std::shared_ptr<const PreviewPage>>& GetPages() const { return m_pages; }
+
+private:
+    const UINT m_itemCount;
+    const std::vector<std::shared_ptr<const PreviewPage>> m_pages;
+    // Changed items before each page, with the total last
+    std::vector<UINT> m_changedRanks;
+};
@@ -28,6 +28,7 @@ IFACEMETHODIMP CPowerRenameRegEx::QueryInterface(_In_ REFIID riid, _Outptr_ void
 {
     static const QITAB qit[] = {
         QITABENT(CPowerRenameRegEx, IPowerRenameRegEx),
+        QITABENT(CPowerRenameRegEx, IPowerRenameTemplateRegEx),
         { 0 }
     };
     return QISearch(this, qit, riid, ppv);
@@ -95,6 +96,8 @@ IFACEMETHODIMP CPowerRenameRegEx::put_searchTerm(_In_ PCWSTR searchTerm)
             changed = true;
             CoTaskMemFree(m_searchTerm);
             hr = SHStrDup(searchTerm, &m_searchTerm);
+            _UpdateCompiledRegEx();
+            m_literalMatcher.SetSearchTerm(m_searchTerm, (m_flags & CaseSensitive) != 0);
         }
     }
 
@@ -130,6 +133,7 @@ IFACEMETHODIMP CPowerRenameRegEx::put_replaceTerm(_In_ PCWSTR replaceTerm)
             changed = true;
             CoTaskMemFree(m_replaceTerm);
             hr = SHStrDup(replaceTerm, &m_replaceTerm);
+            m_template.Compile(m_replaceTerm, !(m_flags & UseRegularExpressions));
         }
     }
 
@@ -149,9 +153,27 @@ IFACEMETHODIMP CPowerRenameRegEx::get_flags(_Out_ DWORD* flags)
 
 IFACEMETHODIMP CPowerRenameRegEx::put_flags(_In_ DWORD flags)
 {
-    if (m_flags != flags)
+    bool changed = false;
+    // Scope lock
+    {
+        CSRWExclusiveAutoLock lock(&m_lock);
+        if (m_flags != flags)
+        {
+            changed = true;
+            DWORD compileFlags = UseRegularExpressions | CaseSensitive;
+            bool recompile = ((m_flags & compileFlags) != (flags & compileFlags));
+            m_flags = flags;
+            if (recompile)
+            {
+                _UpdateCompiledRegEx();
+                m_literalMatcher.SetSearchTerm(m_searchTerm, (m_flags & CaseSensitive) != 0);
+                m_template.Compile(m_replaceTerm, !(m_flags & UseRegularExpressions));
+            }
+        }
+    }
+
+    if (changed)
     {
-        m_flags = flags;
         _OnFlagsChanged();
     }
     return S_OK;
@@ -177,6 +199,7 @@ CPowerRenameRegEx::CPowerRenameRegEx() :
     // Init to empty strings
     SHStrDup(L"", &m_searchTerm);
     SHStrDup(L"", &m_replaceTerm);
+    m_template.Compile(m_replaceTerm, !(m_flags & UseRegularExpressions));
 }
 
 CPowerRenameRegEx::~CPowerRenameRegEx()
@@ -186,6 +209,33 @@ CPowerRenameRegEx::~CPowerRenameRegEx()
 }
 
 HRESULT CPowerRenameRegEx::Replace(_In_ PCWSTR source, _Outptr_ PWSTR* result)
+{
+    return ReplaceWithCancel(source, nullptr, result);
+}
+
+// Regular expressions are matched under a step budget and a deadline so that a
+// pattern such as (a+)+$ cannot stall the caller on a long name.  Hitting either
+// returns HRESULT_FROM_WIN32(ERROR_TIMEOUT).  Signaling cancelEvent stops the
+// match part way through with HRESULT_FROM_WIN32(ERROR_CANCELLED).
+//
+// There is no item to take a position or a creation time from, so counters
+// give their first value and date and time tokens give nothing.
+HRESULT CPowerRenameRegEx::ReplaceWithCancel(_In_ PCWSTR source, _In_opt_ HANDLE cancelEvent, _Outptr_ PWSTR* result)
+{
+    return _Replace(source, cancelEvent, true, result);
+}
+
+// Counter and date tokens of the replace term come out as placeholders, to be
+// filled in for the item by CPowerRenameTemplate::Expand.  Characters of the
+// name that look like placeholders come out escaped.
+HRESULT CPowerRenameRegEx::ReplaceWithPlaceholders(_In_ PCWSTR source, _In_opt_ HANDLE cancelEvent, _Outptr_ PWSTR* result)
+{
+    return _Replace(source, cancelEvent, false, result);
+}
+
+// The placeholders are expanded under the same lock as the search so that
+// they match the compiled replace term
+HRESULT CPowerRenameRegEx::_Replace(_In_ PCWSTR source, _In_opt_ HANDLE cancelEvent, _In_ bool expand, _Outptr_ PWSTR* result)
 {
     *result = nullptr;
 
@@ -193,52 +243,62 @@ HRESULT CPowerRenameRegEx::Replace(_In_ PCWSTR source, _Outptr_ PWSTR* result)
     HRESULT hr = (source && wcslen(source) > 0 && m_searchTerm && wcslen(m_searchTerm) > 0) ? S_OK : E_INVALIDARG;
     if (SUCCEEDED(hr))
     {
-        wstring res = source;
+        wstring res;
         try
         {
-            // TODO: creating the regex could be costly.  May want to cache this.
-            std::wstring sourceToUse(source);
-            std::wstring searchTerm(m_searchTerm);
-            std::wstring replaceTerm(m_replaceTerm ? wstring(m_replaceTerm) : wstring(L""));
+            size_t sourceLength = wcslen(source);
+            const std::wstring* replaceTerm = &m_template.GetReplaceTerm();
+
+            // Rare enough that the replace term is rebuilt for the item
+            std::wstring itemReplaceTerm;
+            wchar_t placeholderBase = 0;
+            bool escapeResult = m_template.HasTokens() && CPowerRenameTemplate::s_HasReservedCharacters(source, sourceLength);
+            if (escapeResult)
+            {
+                hr = m_template.GetReplaceTermFor(source, sourceLength, itemReplaceTerm, &placeholderBase) ? S_OK : E_FAIL;
+                replaceTerm = &itemReplaceTerm;
+            }
 
-            if (m_flags & UseRegularExpressions)
+            if (FAILED(hr))
             {
-                std::wregex pattern(m_searchTerm, (!(m_flags & CaseSensitive)) ? regex_constants::icase | regex_constants::ECMAScript : regex_constants::ECMAScript);
-                if (m_flags & MatchAllOccurences)
-                {
-                    res = regex_replace(wstring(source), pattern, replaceTerm);
-                }
-                else
+                // No room for the placeholders.  Leave the item as is.
+            }
+            else if (m_flags & UseRegularExpressions)
+            {
+                std::wstring sourceToUse(source);
+
+                // The pattern is compiled when the search term or flags change.  A missing
+                // backend means the search term is not a valid regular expression.
+                hr = m_regExBackend ? S_OK : E_FAIL;
+                if (SUCCEEDED(hr))
                 {
-                    std::wsmatch m;
-                    if (std::regex_search(sourceToUse, m, pattern))
-                    {
-                        res = sourceToUse.replace(m.prefix().length(), m.length(), replaceTerm);
-                    }
+                    CRegExBudget budget(REGEX_MAX_MATCH_STEPS, REGEX_REPLACE_TIMEOUT_MS, cancelEvent);
+                    hr = m_regExBackend->Replace(sourceToUse, *replaceTerm, (m_flags & MatchAllOccurences) != 0, budget, res);
                 }
             }
             else
             {
                 // Simple search and replace
-                size_t pos = 0;
-                do
-                {
-                    pos = _Find(sourceToUse, searchTerm, (!(m_flags & CaseSensitive)), pos);
-                    if (pos != std::string::npos)
-                    {
-                        res = sourceToUse.replace(pos, searchTerm.length(), replaceTerm);
-                        pos += replaceTerm.length();
-                    }
-
-                    if (!(m_flags & MatchAllOccurences))
-                    {
-                        break;
-                    }
-                } while (pos != std::string::npos);
+                m_literalMatcher.Replace(source, sourceLength, replaceTerm->c_str(), replaceTerm->length(), (m_flags & MatchAllOccurences) != 0, res);
+            }
+
+            if (SUCCEEDED(hr) && escapeResult)
+            {
+                m_template.EscapeResult(placeholderBase, res);
+            }
+
+            if (SUCCEEDED(hr) && expand && m_template.HasTokens())
+            {
+                std::wstring expanded;
+                m_template.Expand(res.c_str(), res.length(), 0, nullptr, expanded);
+                res.swap(expanded);
             }
 
-            *result = StrDup(res.c_str());
-            hr = (*result) ? S_OK : E_OUTOFMEMORY;
+            if (SUCCEEDED(hr))
+            {
+                *result = StrDup(res.c_str());
+                hr = (*result) ? S_OK : E_OUTOFMEMORY;
+            }
         }
         catch (regex_error e)
         {
@@ -248,17 +308,17 @@ HRESULT CPowerRenameRegEx::Replace(_In_ PCWSTR source, _Outptr_ PWSTR* result)
     return hr;
 }
 
-size_t CPowerRenameRegEx::_Find(std::wstring data, std::wstring toSearch, bool caseInsensitive, size_t pos)
+// Must be called with m_lock held exclusively
+void CPowerRenameRegEx::_UpdateCompiledRegEx()
 {
-    if (caseInsensitive)
+    m_regExBackend.reset();
+
+    if ((m_flags & UseRegularExpressions) && m_searchTerm && m_searchTerm[0] != L'\0')
     {
-        // Convert to lower
-        std::transform(data.begin(), data.end(), data.begin(), ::towlower);
-        std::transform(toSearch.begin(), toSearch.end(), toSearch.begin(), ::towlower);
+        // Null for an incomplete or invalid pattern (ex: the user is still
+        // typing) so Replace reports the failure.
+        m_regExBackend = CRegExBackend::s_Create(m_searchTerm, (m_flags & CaseSensitive) != 0);
     }
-
-    // Find sub string position in given string starting at position pos
-    return data.find(toSearch, pos);
 }
 
 void CPowerRenameRegEx::_OnSearchTermChanged()
@@ -2,13 +2,29 @@
 #include "stdafx.h"
 #include <vector>
 #include <string>
+#include <regex>
+#include <memory>
 #include "srwlock.h"
+#include "PowerRenameLiteralMatcher.h"
+#include "PowerRenameRegExBackend.h"
+#include "PowerRenameTemplate.h"
 
 #include "PowerRenameInterfaces.h"
 
 #define DEFAULT_FLAGS MatchAllOccurences
 
-class CPowerRenameRegEx : public IPowerRenameRegEx
+// Internal to the library.  The manager fills in the counter and date tokens
+// of the replace term for each item so it searches with their placeholders
+// (see CPowerRenameTemplate) rather than through IPowerRenameRegEx::Replace.
+interface __declspec(uuid("11893399-8DDF-459D-8088-0210C560F156")) IPowerRenameTemplateRegEx : public IUnknown
+{
+public:
+    IFACEMETHOD(ReplaceWithPlaceholders)(_In_ PCWSTR source, _In_opt_ HANDLE cancelEvent, _Outptr_ PWSTR* result) = 0;
+};
+
+class CPowerRenameRegEx :
+    public IPowerRenameRegEx,
+    public IPowerRenameTemplateRegEx
 {
 public:
     // IUnknown
@@ -26,6 +42,10 @@ public:
     IFACEMETHODIMP get_flags(_Out_ DWORD* flags);
     IFACEMETHODIMP put_flags(_In_ DWORD flags);
     IFACEMETHODIMP Replace(_In_ PCWSTR source, _Outptr_ PWSTR* result);
+    IFACEMETHODIMP ReplaceWithCancel(_In_ PCWSTR source, _In_opt_ HANDLE cancelEvent, _Outptr_ PWSTR* result);
+
+    // IPowerRenameTemplateRegEx
+    IFACEMETHODIMP ReplaceWithPlaceholders(_In_ PCWSTR source, _In_opt_ HANDLE cancelEvent, _Outptr_ PWSTR* result);
 
     static HRESULT s_CreateInstance(_Outptr_ IPowerRenameRegEx **renameRegEx);
 
@@ -37,12 +57,22 @@ protected:
     void _OnReplaceTermChanged();
     void _OnFlagsChanged();
 
-    size_t _Find(std::wstring data, std::wstring toSearch, bool caseInsensitive, size_t pos);
+    void _UpdateCompiledRegEx();
+    HRESULT _Replace(_In_ PCWSTR source, _In_opt_ HANDLE cancelEvent, _In_ bool expand, _Outptr_ PWSTR* result);
 
     DWORD m_flags = DEFAULT_FLAGS;
     PWSTR m_searchTerm = nullptr;
     PWSTR m_replaceTerm = nullptr;
 
+    // Compiled form of m_searchTerm.  Rebuilt only when the search term or the
+    // flags that affect compilation change so Replace can share it across items.
+    _Guarded_by_(m_lock) std::unique_ptr<CRegExBackend> m_regExBackend;
+    // Used instead of the regex when UseRegularExpressions is not set
+    _Guarded_by_(m_lock) CPowerRenameLiteralMatcher m_literalMatcher;
+    // m_replaceTerm with its tokens swapped for placeholders, which is what
+    // the search substitutes
+    _Guarded_by_(m_lock) CPowerRenameTemplate m_template;
+
     CSRWLock m_lock;
     CSRWLock m_lockEvents;
 
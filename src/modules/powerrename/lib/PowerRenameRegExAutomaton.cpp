@@ -0,0 +1,1099 @@
+#include "stdafx.h"
+#include "PowerRenameRegExAutomaton.h"
+#include <algorithm>
+#include <memory>
+
+// Limits that keep compiled programs small.  Patterns beyond them are left to
+// std::wregex.
+#define AUTOMATON_MAX_REPEAT 1000
+#define AUTOMATON_MAX_PROGRAM_SIZE 20000
+#define AUTOMATON_UNBOUNDED -1
+
+// Marks a thread stack entry that restores a capture slot instead of visiting an instruction
+#define AUTOMATON_RESTORE_FLAG 0x80000000u
+
+struct CRegExAutomaton::Node
+{
+    enum class Type
+    {
+        Empty,
+        Char,
+        Any,
+        Class,
+        Assert,
+        Group,
+        Concat,
+        Alternate,
+        Repeat
+    };
+
+    Type type = Type::Empty;
+    wchar_t ch = 0;
+    uint32_t classIndex = 0;
+    OpCode assertOp = OpCode::AssertBegin;
+    // Capture group number, 0 for a non capturing group
+    size_t group = 0;
+    int min = 0;
+    int max = 0;
+    bool greedy = true;
+    // True if this node or any of its children is a capture group
+    bool hasCapture = false;
+    std::vector<std::unique_ptr<Node>> children;
+};
+
+struct CRegExAutomaton::ThreadList
+{
+    // Program counter of each thread, in priority order
+    std::vector<uint32_t> pcs;
+    // Capture slots of each thread, stored one thread after the other
+    std::vector<size_t> captures;
+    // Generation in which each instruction was last added to this list
+    std::vector<uint32_t> visited;
+    uint32_t generation = 0;
+    std::vector<std::pair<uint32_t, size_t>> stack;
+
+    void Reset(_In_ size_t programSize)
+    {
+        pcs.clear();
+        captures.clear();
+        if (visited.size() < programSize)
+        {
+            visited.resize(programSize, 0);
+        }
+
+        if (++generation == 0)
+        {
+            std::fill(visited.begin(), visited.end(), 0);
+            generation = 1;
+        }
+    }
+};
+
+// Recursive descent parser for the supported ECMAScript subset.  Every parse
+// method returns nullptr when the pattern is invalid or uses a construct the
+// automaton does not implement.
+class CRegExAutomaton::CParser
+{
+public:
+    CParser(_In_ CRegExAutomaton& automaton, _In_ const std::wstring& pattern) :
+        m_automaton(automaton),
+        m_pattern(pattern)
+    {
+    }
+
+    std::unique_ptr<Node> Parse()
+    {
+        std::unique_ptr<Node> root = _ParseAlternation();
+        if (!root || !_AtEnd())
+        {
+            // Unbalanced ')'
+            return nullptr;
+        }
+        return root;
+    }
+
+    size_t GetGroupCount() const { return m_groupCount; }
+
+private:
+    struct Escape
+    {
+        enum class Kind
+        {
+            Char,
+            Class,
+            NegatedClass,
+            Assert
+        };
+
+        Kind kind = Kind::Char;
+        wchar_t ch = 0;
+        Traits::char_class_type charClass{};
+        OpCode assertOp = OpCode::AssertWordBoundary;
+    };
+
+    bool _AtEnd() const { return m_pos >= m_pattern.length(); }
+    wchar_t _Peek() const { return m_pattern[m_pos]; }
+
+    static bool _IsDigit(_In_ wchar_t c) { return c >= L'0' && c <= L'9'; }
+    static bool _IsAsciiAlphaNumeric(_In_ wchar_t c)
+    {
+        return _IsDigit(c) || (c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z');
+    }
+
+    static int _HexValue(_In_ wchar_t c)
+    {
+        if (_IsDigit(c))
+        {
+            return c - L'0';
+        }
+        if (c >= L'a' && c <= L'f')
+        {
+            return c - L'a' + 10;
+        }
+        if (c >= L'A' && c <= L'F')
+        {
+            return c - L'A' + 10;
+        }
+        return -1;
+    }
+
+    Traits::char_class_type _LookupClass(_In_ const wchar_t* name) const
+    {
+        return m_automaton.m_traits.lookup_classname(name, name + wcslen(name));
+    }
+
+    std::unique_ptr<Node> _NewClassNode(_In_ CharClass&& charClass)
+    {
+        m_automaton._FinishClass(charClass);
+        auto node = std::make_unique<Node>();
+        node->type = Node::Type::Class;
+        node->classIndex = static_cast<uint32_t>(m_automaton.m_classes.size());
+        m_automaton.m_classes.push_back(std::move(charClass));
+        return node;
+    }
+
+    std::unique_ptr<Node> _ParseAlternation()
+    {
+        std::unique_ptr<Node> first = _ParseConcat();
+        if (!first || _AtEnd() || _Peek() != L'|')
+        {
+            return first;
+        }
+
+        auto node = std::make_unique<Node>();
+        node->type = Node::Type::Alternate;
+        node->hasCapture = first->hasCapture;
+        node->children.push_back(std::move(first));
+        while (!_AtEnd() && _Peek() == L'|')
+        {
+            m_pos++;
+            std::unique_ptr<Node> next = _ParseConcat();
+            if (!next)
+            {
+                return nullptr;
+            }
+            node->hasCapture |= next->hasCapture;
+            node->children.push_back(std::move(next));
+        }
+        return node;
+    }
+
+    std::unique_ptr<Node> _ParseConcat()
+    {
+        auto node = std::make_unique<Node>();
+        node->type = Node::Type::Concat;
+        while (!_AtEnd() && _Peek() != L'|' && _Peek() != L')')
+        {
+            std::unique_ptr<Node> next = _ParseRepeat();
+            if (!next)
+            {
+                return nullptr;
+            }
+            node->hasCapture |= next->hasCapture;
+            node->children.push_back(std::move(next));
+        }
+        return node;
+    }
+
+    bool _ParseNumber(_Out_ int& value)
+    {
+        value = 0;
+        size_t start = m_pos;
+        while (!_AtEnd() && _IsDigit(_Peek()))
+        {
+            value = value * 10 + (_Peek() - L'0');
+            if (value > AUTOMATON_MAX_REPEAT)
+            {
+                return false;
+            }
+            m_pos++;
+        }
+        return m_pos > start;
+    }
+
+    static bool _CanMatchEmpty(_In_ const Node* node)
+    {
+        switch (node->type)
+        {
+        case Node::Type::Char:
+        case Node::Type::Any:
+        case Node::Type::Class:
+            return false;
+        case Node::Type::Concat:
+            return std::all_of(node->children.begin(), node->children.end(), [](const auto& child) { return _CanMatchEmpty(child.get()); });
+        case Node::Type::Alternate:
+            return std::any_of(node->children.begin(), node->children.end(), [](const auto& child) { return _CanMatchEmpty(child.get()); });
+        case Node::Type::Group:
+            return _CanMatchEmpty(node->children[0].get());
+        case Node::Type::Repeat:
+            return node->min == 0 || _CanMatchEmpty(node->children[0].get());
+        default:
+            return true;
+        }
+    }
+
+    std::unique_ptr<Node> _ParseRepeat()
+    {
+        std::unique_ptr<Node> atom = _ParseAtom();
+        if (!atom || _AtEnd())
+        {
+            return atom;
+        }
+
+        int min = 0;
+        int max = 0;
+        switch (_Peek())
+        {
+        case L'*':
+            min = 0;
+            max = AUTOMATON_UNBOUNDED;
+            m_pos++;
+            break;
+        case L'+':
+            min = 1;
+            max = AUTOMATON_UNBOUNDED;
+            m_pos++;
+            break;
+        case L'?':
+            min = 0;
+            max = 1;
+            m_pos++;
+            break;
+        case L'{':
+            m_pos++;
+            if (!_ParseNumber(min) || _AtEnd())
+            {
+                return nullptr;
+            }
+            max = min;
+            if (_Peek() == L',')
+            {
+                m_pos++;
+                if (!_AtEnd() && _Peek() == L'}')
+                {
+                    max = AUTOMATON_UNBOUNDED;
+                }
+                else if (!_ParseNumber(max) || max < min)
+                {
+                    return nullptr;
+                }
+            }
+            if (_AtEnd() || _Peek() != L'}')
+            {
+                return nullptr;
+            }
+            m_pos++;
+            break;
+        default:
+            return atom;
+        }
+
+        bool greedy = true;
+        if (!_AtEnd() && _Peek() == L'?')
+        {
+            greedy = false;
+            m_pos++;
+        }
+
+        // A quantified assertion or a second quantifier is an error or an odd
+        // corner of the grammar.  Let std::wregex decide.
+        if (atom->type == Node::Type::Assert ||
+            (!_AtEnd() && (_Peek() == L'*' || _Peek() == L'+' || _Peek() == L'?' || _Peek() == L'{')))
+        {
+            return nullptr;
+        }
+
+        // ECMAScript clears the captures of a group on every iteration, which
+        // the automaton does not model.
+        if (atom->hasCapture && (max == AUTOMATON_UNBOUNDED || max > 1))
+        {
+            return nullptr;
+        }
+
+        // An iteration that matches nothing ends an ECMAScript loop, which
+        // again the automaton does not model.
+        if ((max == AUTOMATON_UNBOUNDED || max > 1) && _CanMatchEmpty(atom.get()))
+        {
+            return nullptr;
+        }
+
+        auto node = std::make_unique<Node>();
+        node->type = Node::Type::Repeat;
+        node->min = min;
+        node->max = max;
+        node->greedy = greedy;
+        node->hasCapture = atom->hasCapture;
+        node->children.push_back(std::move(atom));
+        return node;
+    }
+
+    // Parses the escape sequence following a backslash
+    bool _ParseEscape(_In_ bool inClass, _Out_ Escape& escape)
+    {
+        if (_AtEnd())
+        {
+            return false;
+        }
+
+        wchar_t c = m_pattern[m_pos++];
+        switch (c)
+        {
+        case L'd':
+        case L'w':
+        case L's':
+        case L'D':
+        case L'W':
+        case L'S':
+        {
+            wchar_t name[2] = { static_cast<wchar_t>(c | 0x20), 0 };
+            escape.kind = (c & 0x20) ? Escape::Kind::Class : Escape::Kind::NegatedClass;
+            escape.charClass = _LookupClass(name);
+            return true;
+        }
+        case L'b':
+            if (inClass)
+            {
+                escape.ch = L'\b';
+            }
+            else
+            {
+                escape.kind = Escape::Kind::Assert;
+                escape.assertOp = OpCode::AssertWordBoundary;
+            }
+            return true;
+        case L'B':
+            escape.kind = Escape::Kind::Assert;
+            escape.assertOp = OpCode::AssertNotWordBoundary;
+            return !inClass;
+        case L't':
+            escape.ch = L'\t';
+            return true;
+        case L'n':
+            escape.ch = L'\n';
+            return true;
+        case L'v':
+            escape.ch = L'\v';
+            return true;
+        case L'f':
+            escape.ch = L'\f';
+            return true;
+        case L'r':
+            escape.ch = L'\r';
+            return true;
+        case L'0':
+            escape.ch = 0;
+            return _AtEnd() || !_IsDigit(_Peek());
+        case L'x':
+        case L'u':
+        {
+            size_t digits = (c == L'x') ? 2 : 4;
+            int value = 0;
+            for (size_t i = 0; i < digits; i++)
+            {
+                int digit = _AtEnd() ? -1 : _HexValue(_Peek());
+                if (digit < 0)
+                {
+                    return false;
+                }
+                value = value * 16 + digit;
+                m_pos++;
+            }
+            escape.ch = static_cast<wchar_t>(value);
+            return true;
+        }
+        default:
+            // Backreferences, control escapes and unknown letters are left to
+            // std::wregex.  Any other ASCII character escapes itself.
+            escape.ch = c;
+            return c < 0x80 && !_IsAsciiAlphaNumeric(c);
+        }
+    }
+
+    std::unique_ptr<Node> _ParseAtom()
+    {
+        wchar_t c = _Peek();
+        switch (c)
+        {
+        case L'(':
+        {
+            m_pos++;
+            size_t group = 0;
+            if (!_AtEnd() && _Peek() == L'?')
+            {
+                // Only non capturing groups.  Lookaround is not supported.
+                if (m_pos + 1 >= m_pattern.length() || m_pattern[m_pos + 1] != L':')
+                {
+                    return nullptr;
+                }
+                m_pos += 2;
+            }
+            else
+            {
+                group = ++m_groupCount;
+            }
+
+            std::unique_ptr<Node> child = _ParseAlternation();
+            if (!child || _AtEnd() || _Peek() != L')')
+            {
+                return nullptr;
+            }
+            m_pos++;
+
+            auto node = std::make_unique<Node>();
+            node->type = Node::Type::Group;
+            node->group = group;
+            node->hasCapture = (group != 0) || child->hasCapture;
+            node->children.push_back(std::move(child));
+            return node;
+        }
+        case L'[':
+            return _ParseClass();
+        case L'.':
+        {
+            m_pos++;
+            auto node = std::make_unique<Node>();
+            node->type = Node::Type::Any;
+            return node;
+        }
+        case L'^':
+        case L'$':
+        {
+            m_pos++;
+            auto node = std::make_unique<Node>();
+            node->type = Node::Type::Assert;
+            node->assertOp = (c == L'^') ? OpCode::AssertBegin : OpCode::AssertEnd;
+            return node;
+        }
+        case L'\\':
+        {
+            m_pos++;
+            Escape escape;
+            if (!_ParseEscape(false, escape))
+            {
+                return nullptr;
+            }
+
+            if (escape.kind == Escape::Kind::Class || escape.kind == Escape::Kind::NegatedClass)
+            {
+                CharClass charClass;
+                charClass.negated = (escape.kind == Escape::Kind::NegatedClass);
+                charClass.classes.push_back(escape.charClass);
+                return _NewClassNode(std::move(charClass));
+            }
+
+            auto node = std::make_unique<Node>();
+            if (escape.kind == Escape::Kind::Assert)
+            {
+                node->type = Node::Type::Assert;
+                node->assertOp = escape.assertOp;
+            }
+            else
+            {
+                node->type = Node::Type::Char;
+                node->ch = escape.ch;
+            }
+            return node;
+        }
+        case L'*':
+        case L'+':
+        case L'?':
+        case L'{':
+        case L'}':
+        case L']':
+            return nullptr;
+        default:
+        {
+            m_pos++;
+            auto node = std::make_unique<Node>();
+            node->type = Node::Type::Char;
+            node->ch = c;
+            return node;
+        }
+        }
+    }
+
+    std::unique_ptr<Node> _ParseClass()
+    {
+        // Skip '['
+        m_pos++;
+
+        CharClass charClass;
+        if (!_AtEnd() && _Peek() == L'^')
+        {
+            charClass.negated = true;
+            m_pos++;
+        }
+
+        // An empty class or a leading ']' differs between implementations
+        if (_AtEnd() || _Peek() == L']')
+        {
+            return nullptr;
+        }
+
+        while (true)
+        {
+            if (_AtEnd())
+            {
+                return nullptr;
+            }
+
+            if (_Peek() == L']')
+            {
+                m_pos++;
+                break;
+            }
+
+            if (_Peek() == L'[' && m_pos + 1 < m_pattern.length())
+            {
+                wchar_t next = m_pattern[m_pos + 1];
+                if (next == L':')
+                {
+                    size_t nameEnd = m_pattern.find(L":]", m_pos + 2);
+                    if (nameEnd == std::wstring::npos)
+                    {
+                        return nullptr;
+                    }
+
+                    std::wstring name = m_pattern.substr(m_pos + 2, nameEnd - (m_pos + 2));
+                    Traits::char_class_type namedClass = _LookupClass(name.c_str());
+                    if (namedClass == Traits::char_class_type{})
+                    {
+                        return nullptr;
+                    }
+                    charClass.classes.push_back(namedClass);
+                    m_pos = nameEnd + 2;
+                    continue;
+                }
+                else if (next == L'=' || next == L'.')
+                {
+                    // Equivalence classes and collating elements
+                    return nullptr;
+                }
+            }
+
+            Escape low;
+            if (!_ParseClassAtom(low))
+            {
+                return nullptr;
+            }
+
+            bool isRange = !_AtEnd() && _Peek() == L'-' &&
+                           (m_pos + 1 < m_pattern.length()) && m_pattern[m_pos + 1] != L']';
+            if (low.kind != Escape::Kind::Char)
+            {
+                if (isRange)
+                {
+                    return nullptr;
+                }
+
+                if (low.kind == Escape::Kind::Class)
+                {
+                    charClass.classes.push_back(low.charClass);
+                }
+                else
+                {
+                    charClass.negatedClasses.push_back(low.charClass);
+                }
+                continue;
+            }
+
+            wchar_t high = low.ch;
+            if (isRange)
+            {
+                m_pos++;
+                Escape rangeEnd;
+                if (!_ParseClassAtom(rangeEnd) || rangeEnd.kind != Escape::Kind::Char || rangeEnd.ch < low.ch)
+                {
+                    return nullptr;
+                }
+                high = rangeEnd.ch;
+            }
+            charClass.ranges.emplace_back(low.ch, high);
+        }
+
+        return _NewClassNode(std::move(charClass));
+    }
+
+    bool _ParseClassAtom(_Out_ Escape& atom)
+    {
+        if (_AtEnd())
+        {
+            return false;
+        }
+
+        if (_Peek() == L'\\')
+        {
+            m_pos++;
+            return _ParseEscape(true, atom);
+        }
+
+        atom.kind = Escape::Kind::Char;
+        atom.ch = m_pattern[m_pos++];
+        return true;
+    }
+
+    CRegExAutomaton& m_automaton;
+    const std::wstring& m_pattern;
+    size_t m_pos = 0;
+    size_t m_groupCount = 0;
+};
+
+bool CRegExAutomaton::Compile(_In_ const std::wstring& pattern, _In_ bool caseInsensitive)
+{
+    m_caseInsensitive = caseInsensitive;
+    m_groupCount = 0;
+    m_program.clear();
+    m_classes.clear();
+    m_hasFirstChar = false;
+
+    const wchar_t wordName[] = L"w";
+    m_wordClass = m_traits.lookup_classname(wordName, wordName + 1);
+    for (wchar_t c = 0; c < 128; c++)
+    {
+        m_asciiFold[c] = m_traits.translate_nocase(c);
+        m_asciiWord[c] = m_traits.isctype(c, m_wordClass);
+    }
+
+    CParser parser(*this, pattern);
+    std::unique_ptr<Node> root = parser.Parse();
+    bool supported = (root != nullptr);
+    if (supported)
+    {
+        m_groupCount = parser.GetGroupCount();
+        _AddInstruction(OpCode::Save, 0, 0);
+        supported = _Emit(root.get());
+        _AddInstruction(OpCode::Save, 0, 1);
+        _AddInstruction(OpCode::Match);
+        supported = supported && (m_program.size() <= AUTOMATON_MAX_PROGRAM_SIZE);
+    }
+
+    if (supported)
+    {
+        // Every match must begin with this character.  Used to skip ahead
+        // while no thread is alive.
+        if (m_program[1].op == OpCode::Char)
+        {
+            m_hasFirstChar = true;
+            m_firstChar = m_program[1].ch;
+        }
+    }
+    else
+    {
+        m_groupCount = 0;
+        m_program.clear();
+        m_classes.clear();
+    }
+
+    return supported;
+}
+
+uint32_t CRegExAutomaton::_AddInstruction(_In_ OpCode op, _In_ wchar_t ch, _In_ uint32_t x, _In_ uint32_t y)
+{
+    m_program.push_back({ op, ch, x, y });
+    return static_cast<uint32_t>(m_program.size() - 1);
+}
+
+bool CRegExAutomaton::_Emit(_In_ const Node* node)
+{
+    if (m_program.size() > AUTOMATON_MAX_PROGRAM_SIZE)
+    {
+        return false;
+    }
+
+    switch (node->type)
+    {
+    case Node::Type::Empty:
+        break;
+
+    case Node::Type::Char:
+        _AddInstruction(OpCode::Char, m_caseInsensitive ? _Fold(node->ch) : node->ch);
+        break;
+
+    case Node::Type::Any:
+        _AddInstruction(OpCode::Any);
+        break;
+
+    case Node::Type::Class:
+        _AddInstruction(OpCode::Class, 0, node->classIndex);
+        break;
+
+    case Node::Type::Assert:
+        _AddInstruction(node->assertOp);
+        break;
+
+    case Node::Type::Group:
+        if (node->group != 0)
+        {
+            _AddInstruction(OpCode::Save, 0, static_cast<uint32_t>(2 * node->group));
+        }
+
+        if (!_Emit(node->children[0].get()))
+        {
+            return false;
+        }
+
+        if (node->group != 0)
+        {
+            _AddInstruction(OpCode::Save, 0, static_cast<uint32_t>(2 * node->group + 1));
+        }
+        break;
+
+    case Node::Type::Concat:
+        for (const auto& child : node->children)
+        {
+            if (!_Emit(child.get()))
+            {
+                return false;
+            }
+        }
+        break;
+
+    case Node::Type::Alternate:
+    {
+        // split L1, L2; L1: first; jmp end; L2: split ...; last; end:
+        std::vector<uint32_t> jumps;
+        for (size_t i = 0; i < node->children.size(); i++)
+        {
+            bool last = (i + 1 == node->children.size());
+            uint32_t split = last ? 0 : _AddInstruction(OpCode::Split);
+            if (!_Emit(node->children[i].get()))
+            {
+                return false;
+            }
+
+            if (!last)
+            {
+                jumps.push_back(_AddInstruction(OpCode::Jump));
+                m_program[split].x = split + 1;
+                m_program[split].y = static_cast<uint32_t>(m_program.size());
+            }
+        }
+
+        for (uint32_t jump : jumps)
+        {
+            m_program[jump].x = static_cast<uint32_t>(m_program.size());
+        }
+        break;
+    }
+
+    case Node::Type::Repeat:
+    {
+        const Node* child = node->children[0].get();
+        for (int i = 0; i < node->min; i++)
+        {
+            if (!_Emit(child) || m_program.size() > AUTOMATON_MAX_PROGRAM_SIZE)
+            {
+                return false;
+            }
+        }
+
+        if (node->max == AUTOMATON_UNBOUNDED)
+        {
+            // loop: split body, out; body: child; jmp loop; out:
+            uint32_t loop = _AddInstruction(OpCode::Split);
+            if (!_Emit(child))
+            {
+                return false;
+            }
+            _AddInstruction(OpCode::Jump, 0, loop);
+
+            uint32_t body = loop + 1;
+            uint32_t out = static_cast<uint32_t>(m_program.size());
+            m_program[loop].x = node->greedy ? body : out;
+            m_program[loop].y = node->greedy ? out : body;
+        }
+        else
+        {
+            // Each optional copy may be skipped to the end of the repeat
+            std::vector<uint32_t> splits;
+            for (int i = node->min; i < node->max; i++)
+            {
+                splits.push_back(_AddInstruction(OpCode::Split));
+                if (!_Emit(child) || m_program.size() > AUTOMATON_MAX_PROGRAM_SIZE)
+                {
+                    return false;
+                }
+            }
+
+            uint32_t out = static_cast<uint32_t>(m_program.size());
+            for (uint32_t split : splits)
+            {
+                m_program[split].x = node->greedy ? split + 1 : out;
+                m_program[split].y = node->greedy ? out : split + 1;
+            }
+        }
+        break;
+    }
+    }
+
+    return true;
+}
+
+wchar_t CRegExAutomaton::_Fold(_In_ wchar_t c) const
+{
+    return (c < 128) ? m_asciiFold[c] : m_traits.translate_nocase(c);
+}
+
+wchar_t CRegExAutomaton::_Upper(_In_ wchar_t c) const
+{
+    return std::use_facet<std::ctype<wchar_t>>(m_traits.getloc()).toupper(c);
+}
+
+bool CRegExAutomaton::_IsWord(_In_ wchar_t c) const
+{
+    return (c < 128) ? m_asciiWord[c] : m_traits.isctype(c, m_wordClass);
+}
+
+bool CRegExAutomaton::_IsWordBoundary(_In_reads_(length) const wchar_t* text, _In_ size_t length, _In_ size_t pos) const
+{
+    bool wordBefore = (pos > 0) && _IsWord(text[pos - 1]);
+    bool wordAfter = (pos < length) && _IsWord(text[pos]);
+    return wordBefore != wordAfter;
+}
+
+void CRegExAutomaton::_FinishClass(_Inout_ CharClass& charClass) const
+{
+    charClass.hasAsciiTable = false;
+    charClass.ascii[0] = 0;
+    charClass.ascii[1] = 0;
+    for (wchar_t c = 0; c < 128; c++)
+    {
+        if (_ClassContains(charClass, c))
+        {
+            charClass.ascii[c / 64] |= (1ull << (c % 64));
+        }
+    }
+    charClass.hasAsciiTable = true;
+}
+
+bool CRegExAutomaton::_ClassContains(_In_ const CharClass& charClass, _In_ wchar_t c) const
+{
+    if (c < 128 && charClass.hasAsciiTable)
+    {
+        return (charClass.ascii[c / 64] & (1ull << (c % 64))) != 0;
+    }
+
+    auto inRanges = [&charClass](wchar_t ch) {
+        for (const auto& range : charClass.ranges)
+        {
+            if (ch >= range.first && ch <= range.second)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    bool found = inRanges(c);
+    if (!found && m_caseInsensitive)
+    {
+        found = inRanges(_Fold(c)) || inRanges(_Upper(c));
+    }
+
+    for (size_t i = 0; !found && i < charClass.classes.size(); i++)
+    {
+        found = m_traits.isctype(c, charClass.classes[i]);
+    }
+
+    for (size_t i = 0; !found && i < charClass.negatedClasses.size(); i++)
+    {
+        found = !m_traits.isctype(c, charClass.negatedClasses[i]);
+    }
+
+    return found != charClass.negated;
+}
+
+void CRegExAutomaton::_AddThread(_Inout_ ThreadList& list, _In_ uint32_t pc, _In_reads_(length) const wchar_t* text, _In_ size_t length, _In_ size_t pos, _Inout_ size_t* captures) const
+{
+    // Follows every empty transition from pc in priority order.  Threads that
+    // reach an instruction consuming a character (or Match) are appended to
+    // the list.  Capture slots are updated in place and restored on the way
+    // back so that each thread gets its own copy.
+    size_t captureCount = 2 * (m_groupCount + 1);
+    auto& stack = list.stack;
+    stack.clear();
+    stack.emplace_back(pc, 0);
+    while (!stack.empty())
+    {
+        uint32_t current = stack.back().first;
+        size_t value = stack.back().second;
+        stack.pop_back();
+
+        if (current & AUTOMATON_RESTORE_FLAG)
+        {
+            captures[current & ~AUTOMATON_RESTORE_FLAG] = value;
+            continue;
+        }
+
+        if (list.visited[current] == list.generation)
+        {
+            continue;
+        }
+        list.visited[current] = list.generation;
+
+        const Instruction& instruction = m_program[current];
+        switch (instruction.op)
+        {
+        case OpCode::Jump:
+            stack.emplace_back(instruction.x, 0);
+            break;
+
+        case OpCode::Split:
+            stack.emplace_back(instruction.y, 0);
+            stack.emplace_back(instruction.x, 0);
+            break;
+
+        case OpCode::Save:
+            stack.emplace_back(instruction.x | AUTOMATON_RESTORE_FLAG, captures[instruction.x]);
+            captures[instruction.x] = pos;
+            stack.emplace_back(current + 1, 0);
+            break;
+
+        case OpCode::AssertBegin:
+            if (pos == 0)
+            {
+                stack.emplace_back(current + 1, 0);
+            }
+            break;
+
+        case OpCode::AssertEnd:
+            if (pos == length)
+            {
+                stack.emplace_back(current + 1, 0);
+            }
+            break;
+
+        case OpCode::AssertWordBoundary:
+        case OpCode::AssertNotWordBoundary:
+            if (_IsWordBoundary(text, length, pos) == (instruction.op == OpCode::AssertWordBoundary))
+            {
+                stack.emplace_back(current + 1, 0);
+            }
+            break;
+
+        default:
+            list.pcs.push_back(current);
+            list.captures.insert(list.captures.end(), captures, captures + captureCount);
+            break;
+        }
+    }
+}
+
+bool CRegExAutomaton::Search(_In_reads_(length) const wchar_t* text,
+                             _In_ size_t length,
+                             _In_ size_t start,
+                             _In_ bool notNull,
+                             _Inout_ CRegExBudget& budget,
+                             _Out_ std::vector<size_t>& captures) const
+{
+    size_t captureCount = 2 * (m_groupCount + 1);
+    captures.assign(captureCount, std::wstring::npos);
+    if (m_program.empty() || start > length)
+    {
+        return false;
+    }
+
+    // Reused across searches on the same thread so that a search does not allocate
+    thread_local ThreadList lists[2];
+    thread_local std::vector<size_t> startCaptures;
+    ThreadList* current = &lists[0];
+    ThreadList* next = &lists[1];
+    current->Reset(m_program.size());
+    startCaptures.assign(captureCount, std::wstring::npos);
+
+    bool matched = false;
+    for (size_t pos = start;; pos++)
+    {
+        if (!matched)
+        {
+            if (current->pcs.empty() && m_hasFirstChar)
+            {
+                // Nothing in flight.  Skip to the next possible start.
+                size_t skipFrom = pos;
+                while (pos < length && (m_caseInsensitive ? _Fold(text[pos]) : text[pos]) != m_firstChar)
+                {
+                    pos++;
+                }
+
+                if (pos >= length)
+                {
+                    break;
+                }
+
+                if (pos != skipFrom)
+                {
+                    // Instructions visited at the old position do not apply here
+                    current->Reset(m_program.size());
+                }
+            }
+
+            // A new thread starting here has the lowest priority
+            std::fill(startCaptures.begin(), startCaptures.end(), std::wstring::npos);
+            _AddThread(*current, 0, text, length, pos, startCaptures.data());
+        }
+        else if (current->pcs.empty())
+        {
+            break;
+        }
+
+        // Every thread in flight is advanced once for this character
+        if (!budget.Step(current->pcs.size() + 1))
+        {
+            captures.assign(captureCount, std::wstring::npos);
+            return false;
+        }
+
+        bool atEnd = (pos >= length);
+        wchar_t c = atEnd ? 0 : text[pos];
+        next->Reset(m_program.size());
+        for (size_t i = 0; i < current->pcs.size(); i++)
+        {
+            uint32_t pc = current->pcs[i];
+            const Instruction& instruction = m_program[pc];
+            size_t* threadCaptures = &current->captures[i * captureCount];
+            bool advance = false;
+            switch (instruction.op)
+            {
+            case OpCode::Match:
+                if (notNull && threadCaptures[0] == pos)
+                {
+                    break;
+                }
+
+                // Threads after this one have a lower priority.  Drop them.
+                matched = true;
+                captures.assign(threadCaptures, threadCaptures + captureCount);
+                i = current->pcs.size();
+                break;
+
+            case OpCode::Char:
+                advance = !atEnd && ((m_caseInsensitive ? _Fold(c) : c) == instruction.ch);
+                break;
+
+            case OpCode::Any:
+                advance = !atEnd && c != L'\n' && c != L'\r';
+                break;
+
+            case OpCode::Class:
+                advance = !atEnd && _ClassContains(m_classes[instruction.x], c);
+                break;
+
+            default:
+                break;
+            }
+
+            if (advance)
+            {
+                _AddThread(*next, pc + 1, text, length, pos + 1, threadCaptures);
+            }
+        }
+
+        std::swap(current, next);
+        if (atEnd)
+        {
+            break;
+        }
+    }
+
+    return matched;
+}
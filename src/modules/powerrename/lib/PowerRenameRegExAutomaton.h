@@ -0,0 +1,107 @@
+#pragma once
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <vector>
+#include "PowerRenameRegExBudget.h"
+
+// Linear time regular expression engine for the ECMAScript subset used by
+// PowerRename.  A pattern is compiled into a program for a Pike VM which
+// advances every candidate match one character at a time, so a search costs
+// at most the length of the name times the size of the program and never
+// backtracks.  Matches and captures are the same as std::wregex.
+//
+// Compile returns false for anything the VM cannot express (backreferences,
+// lookaround, captures inside repeated groups) and for invalid patterns.  The
+// caller is expected to fall back to std::wregex in that case.
+class CRegExAutomaton
+{
+public:
+    CRegExAutomaton() = default;
+    ~CRegExAutomaton() = default;
+
+    bool Compile(_In_ const std::wstring& pattern, _In_ bool caseInsensitive);
+
+    size_t GetGroupCount() const { return m_groupCount; }
+
+    // Finds the leftmost match that starts at or after start.  On success
+    // captures holds the begin and end of the match followed by the begin and
+    // end of each group.  Groups that did not participate are set to
+    // std::wstring::npos.  An empty match is rejected if notNull is set.
+    // Returns false without a match once the budget runs out.
+    bool Search(_In_reads_(length) const wchar_t* text,
+                _In_ size_t length,
+                _In_ size_t start,
+                _In_ bool notNull,
+                _Inout_ CRegExBudget& budget,
+                _Out_ std::vector<size_t>& captures) const;
+
+private:
+    typedef std::regex_traits<wchar_t> Traits;
+
+    enum class OpCode : uint8_t
+    {
+        Char,
+        Any,
+        Class,
+        Split,
+        Jump,
+        Save,
+        AssertBegin,
+        AssertEnd,
+        AssertWordBoundary,
+        AssertNotWordBoundary,
+        Match
+    };
+
+    struct Instruction
+    {
+        OpCode op;
+        wchar_t ch;
+        // Jump target, preferred Split target, class index or capture slot
+        uint32_t x;
+        // Second Split target
+        uint32_t y;
+    };
+
+    struct CharClass
+    {
+        bool negated = false;
+        std::vector<std::pair<wchar_t, wchar_t>> ranges;
+        std::vector<Traits::char_class_type> classes;
+        std::vector<Traits::char_class_type> negatedClasses;
+        // Membership of the ASCII code units, negation applied.  Filled in
+        // once the class is complete.
+        bool hasAsciiTable = false;
+        uint64_t ascii[2] = { 0, 0 };
+    };
+
+    struct Node;
+    class CParser;
+
+    bool _Emit(_In_ const Node* node);
+    uint32_t _AddInstruction(_In_ OpCode op, _In_ wchar_t ch = 0, _In_ uint32_t x = 0, _In_ uint32_t y = 0);
+
+    wchar_t _Fold(_In_ wchar_t c) const;
+    wchar_t _Upper(_In_ wchar_t c) const;
+    bool _IsWord(_In_ wchar_t c) const;
+    bool _ClassContains(_In_ const CharClass& charClass, _In_ wchar_t c) const;
+    void _FinishClass(_Inout_ CharClass& charClass) const;
+    bool _IsWordBoundary(_In_reads_(length) const wchar_t* text, _In_ size_t length, _In_ size_t pos) const;
+
+    struct ThreadList;
+    void _AddThread(_Inout_ ThreadList& list, _In_ uint32_t pc, _In_reads_(length) const wchar_t* text, _In_ size_t length, _In_ size_t pos, _Inout_ size_t* captures) const;
+
+    Traits m_traits;
+    bool m_caseInsensitive = false;
+    size_t m_groupCount = 0;
+    std::vector<Instruction> m_program;
+    std::vector<CharClass> m_classes;
+    Traits::char_class_type m_wordClass{};
+    // Case folding and word character lookups for ASCII
+    wchar_t m_asciiFold[128] = {};
+    bool m_asciiWord[128] = {};
+    // Set when every match starts with m_firstChar (folded if case insensitive)
+    bool m_hasFirstChar = false;
+    wchar_t m_firstChar = 0;
+};
@@ -0,0 +1,263 @@
+#include "stdafx.h"
+#include "PowerRenameRegExBackend.h"
+#include <iterator>
+
+std::unique_ptr<CRegExBackend> CRegExBackend::s_Create(_In_ const std::wstring& pattern, _In_ bool caseSensitive)
+{
+    auto automatonBackend = std::make_unique<CAutomatonRegExBackend>();
+    if (automatonBackend->Init(pattern, caseSensitive))
+    {
+        return automatonBackend;
+    }
+
+    auto stdBackend = std::make_unique<CStdRegExBackend>();
+    if (stdBackend->Init(pattern, caseSensitive))
+    {
+        return stdBackend;
+    }
+
+    return nullptr;
+}
+
+bool CStdRegExBackend::Init(_In_ const std::wstring& pattern, _In_ bool caseSensitive)
+{
+    try
+    {
+        m_regex.assign(pattern, caseSensitive ? std::regex_constants::ECMAScript : (std::regex_constants::icase | std::regex_constants::ECMAScript));
+        return true;
+    }
+    catch (const std::regex_error&)
+    {
+        return false;
+    }
+}
+
+namespace
+{
+    // Thrown out of std::regex_search when the budget runs out
+    struct RegExBudgetExceeded
+    {
+    };
+
+    // Bidirectional iterator over a name that charges the budget each time the
+    // matcher reads a character
+    class CBudgetIterator
+    {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = wchar_t;
+        using difference_type = ptrdiff_t;
+        using pointer = const wchar_t*;
+        using reference = const wchar_t&;
+
+        CBudgetIterator() = default;
+        CBudgetIterator(_In_ const wchar_t* position, _In_ CRegExBudget* budget) :
+            m_position(position),
+            m_budget(budget)
+        {
+        }
+
+        reference operator*() const
+        {
+            if (!m_budget->Step())
+            {
+                throw RegExBudgetExceeded();
+            }
+            return *m_position;
+        }
+
+        pointer operator->() const { return &**this; }
+
+        CBudgetIterator& operator++()
+        {
+            ++m_position;
+            return *this;
+        }
+
+        CBudgetIterator operator++(int)
+        {
+            CBudgetIterator previous = *this;
+            ++m_position;
+            return previous;
+        }
+
+        CBudgetIterator& operator--()
+        {
+            --m_position;
+            return *this;
+        }
+
+        CBudgetIterator operator--(int)
+        {
+            CBudgetIterator previous = *this;
+            --m_position;
+            return previous;
+        }
+
+        bool operator==(_In_ const CBudgetIterator& other) const { return m_position == other.m_position; }
+        bool operator!=(_In_ const CBudgetIterator& other) const { return m_position != other.m_position; }
+
+        const wchar_t* get() const { return m_position; }
+
+    private:
+        const wchar_t* m_position = nullptr;
+        CRegExBudget* m_budget = nullptr;
+    };
+}
+
+HRESULT CStdRegExBackend::Replace(_In_ const std::wstring& source, _In_ const std::wstring& replaceTerm, _In_ bool replaceAll, _Inout_ CRegExBudget& budget, _Out_ std::wstring& result) const
+{
+    CBudgetIterator first(source.c_str(), &budget);
+    CBudgetIterator last(source.c_str() + source.length(), &budget);
+    try
+    {
+        if (replaceAll)
+        {
+            // Same as std::regex_replace but with a fresh step budget for every match
+            result.clear();
+            const wchar_t* tail = source.c_str();
+            budget.StartMatch();
+            std::regex_iterator<CBudgetIterator> it(first, last, m_regex);
+            for (std::regex_iterator<CBudgetIterator> end; it != end; budget.StartMatch(), ++it)
+            {
+                result.append(it->prefix().first.get(), it->prefix().second.get());
+                it->format(std::back_inserter(result), replaceTerm.c_str(), replaceTerm.c_str() + replaceTerm.length());
+                tail = (*it)[0].second.get();
+            }
+            result.append(tail, source.c_str() + source.length());
+        }
+        else
+        {
+            result = source;
+            budget.StartMatch();
+            std::match_results<CBudgetIterator> m;
+            if (std::regex_search(first, last, m, m_regex))
+            {
+                result.replace(m.prefix().length(), m.length(), replaceTerm);
+            }
+        }
+    }
+    catch (const RegExBudgetExceeded&)
+    {
+    }
+    catch (const std::regex_error& e)
+    {
+        // The library's own complexity and stack limits are the same failure
+        if (e.code() != std::regex_constants::error_complexity && e.code() != std::regex_constants::error_stack)
+        {
+            throw;
+        }
+        return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+    }
+
+    return budget.GetResult();
+}
+
+bool CAutomatonRegExBackend::Init(_In_ const std::wstring& pattern, _In_ bool caseSensitive)
+{
+    // std::wregex decides whether the pattern is valid so both backends agree on it
+    return m_fallback.Init(pattern, caseSensitive) && m_automaton.Compile(pattern, !caseSensitive);
+}
+
+// The automaton expands $$, $& and $n for an existing group n.  Anything
+// else, including $nn, $` and $', is left to std::regex_replace.
+bool CAutomatonRegExBackend::_CanFormat(_In_ const std::wstring& replaceTerm) const
+{
+    for (size_t i = 0; i < replaceTerm.length(); i++)
+    {
+        if (replaceTerm[i] != L'$')
+        {
+            continue;
+        }
+
+        if (++i >= replaceTerm.length())
+        {
+            return false;
+        }
+
+        wchar_t c = replaceTerm[i];
+        if (c == L'$' || c == L'&')
+        {
+            continue;
+        }
+
+        bool digitFollows = (i + 1 < replaceTerm.length()) && iswdigit(replaceTerm[i + 1]);
+        if (c < L'1' || c > L'9' || static_cast<size_t>(c - L'0') > m_automaton.GetGroupCount() || digitFollows)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CAutomatonRegExBackend::_AppendFormat(_In_ const std::wstring& source, _In_ const std::vector<size_t>& captures, _In_ const std::wstring& replaceTerm, _Inout_ std::wstring& result) const
+{
+    for (size_t i = 0; i < replaceTerm.length(); i++)
+    {
+        wchar_t c = replaceTerm[i];
+        if (c != L'$')
+        {
+            result.push_back(c);
+            continue;
+        }
+
+        c = replaceTerm[++i];
+        if (c == L'$')
+        {
+            result.push_back(L'$');
+            continue;
+        }
+
+        size_t group = (c == L'&') ? 0 : static_cast<size_t>(c - L'0');
+        size_t begin = captures[2 * group];
+        size_t end = captures[2 * group + 1];
+        if (begin != std::wstring::npos && end != std::wstring::npos)
+        {
+            result.append(source, begin, end - begin);
+        }
+    }
+}
+
+HRESULT CAutomatonRegExBackend::Replace(_In_ const std::wstring& source, _In_ const std::wstring& replaceTerm, _In_ bool replaceAll, _Inout_ CRegExBudget& budget, _Out_ std::wstring& result) const
+{
+    std::vector<size_t> captures;
+    if (!replaceAll)
+    {
+        result = source;
+        budget.StartMatch();
+        if (m_automaton.Search(source.c_str(), source.length(), 0, false, budget, captures))
+        {
+            result.replace(captures[0], captures[1] - captures[0], replaceTerm);
+        }
+        return budget.GetResult();
+    }
+
+    if (!_CanFormat(replaceTerm))
+    {
+        return m_fallback.Replace(source, replaceTerm, replaceAll, budget, result);
+    }
+
+    // Same iteration as std::regex_replace: after an empty match the next
+    // match must not be empty, and nothing is searched once the end is reached.
+    result.clear();
+    result.reserve(source.length());
+    size_t pos = 0;
+    bool notNull = false;
+    budget.StartMatch();
+    while (m_automaton.Search(source.c_str(), source.length(), pos, notNull, budget, captures))
+    {
+        result.append(source, pos, captures[0] - pos);
+        _AppendFormat(source, captures, replaceTerm, result);
+        pos = captures[1];
+        if (pos == source.length())
+        {
+            break;
+        }
+        notNull = (captures[0] == captures[1]);
+        budget.StartMatch();
+    }
+    result.append(source, pos, std::wstring::npos);
+
+    return budget.GetResult();
+}
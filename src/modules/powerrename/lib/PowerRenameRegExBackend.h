@@ -0,0 +1,58 @@
+#pragma once
+#include <memory>
+#include <regex>
+#include <string>
+#include "PowerRenameRegExAutomaton.h"
+
+// Regular expression engine used by CPowerRenameRegEx.  Replace follows the
+// CPowerRenameRegEx rules: without replaceAll the first match is replaced by
+// replaceTerm as is, with replaceAll every match is replaced by replaceTerm
+// expanded as an ECMAScript format string ($&, $1...).
+//
+// Replace returns S_OK, or the failure reported by the budget if a match ran
+// out of steps, passed the deadline or was canceled.  The result is undefined
+// on failure.
+class CRegExBackend
+{
+public:
+    virtual ~CRegExBackend() = default;
+
+    virtual HRESULT Replace(_In_ const std::wstring& source, _In_ const std::wstring& replaceTerm, _In_ bool replaceAll, _Inout_ CRegExBudget& budget, _Out_ std::wstring& result) const = 0;
+
+    // Uses the automaton when it supports the pattern and std::wregex
+    // otherwise.  Returns nullptr if the pattern is not valid.
+    static std::unique_ptr<CRegExBackend> s_Create(_In_ const std::wstring& pattern, _In_ bool caseSensitive);
+};
+
+// std::wregex with ECMAScript syntax.  The name is read through an iterator
+// that charges the budget for every character the matcher examines, which
+// lets a backtracking match be abandoned part way through.
+class CStdRegExBackend : public CRegExBackend
+{
+public:
+    // Returns false if the pattern is not valid
+    bool Init(_In_ const std::wstring& pattern, _In_ bool caseSensitive);
+
+    HRESULT Replace(_In_ const std::wstring& source, _In_ const std::wstring& replaceTerm, _In_ bool replaceAll, _Inout_ CRegExBudget& budget, _Out_ std::wstring& result) const override;
+
+private:
+    std::wregex m_regex;
+};
+
+// CRegExAutomaton, with std::wregex kept for replacement formats the
+// automaton does not expand itself
+class CAutomatonRegExBackend : public CRegExBackend
+{
+public:
+    // Returns false if the pattern is not valid or not supported by the automaton
+    bool Init(_In_ const std::wstring& pattern, _In_ bool caseSensitive);
+
+    HRESULT Replace(_In_ const std::wstring& source, _In_ const std::wstring& replaceTerm, _In_ bool replaceAll, _Inout_ CRegExBudget& budget, _Out_ std::wstring& result) const override;
+
+private:
+    bool _CanFormat(_In_ const std::wstring& replaceTerm) const;
+    void _AppendFormat(_In_ const std::wstring& source, _In_ const std::vector<size_t>& captures, _In_ const std::wstring& replaceTerm, _Inout_ std::wstring& result) const;
+
+    CRegExAutomaton m_automaton;
+    CStdRegExBackend m_fallback;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+
+// Steps a single match may take.  A step is one character examined by
+// std::wregex or one thread advanced by the automaton.  Ordinary patterns
+// stay orders of magnitude below this on a MAX_PATH name.
+#define REGEX_MAX_MATCH_STEPS 1000000
+
+// Wall clock time allowed to replace one name, in milliseconds
+#define REGEX_REPLACE_TIMEOUT_MS 250
+
+// Steps between two checks of the clock and the cancel event
+#define REGEX_BUDGET_CHECK_INTERVAL 4096
+
+// Bounds the work done to replace a single name.  Each match gets its own step
+// budget while the deadline and the cancel event cover the whole name.  Once a
+// limit is hit Step keeps failing and GetResult says why:
+//   HRESULT_FROM_WIN32(ERROR_TIMEOUT)    step budget or deadline exceeded
+//   HRESULT_FROM_WIN32(ERROR_CANCELLED)  cancel event signaled
+class CRegExBudget
+{
+public:
+    // No limits
+    CRegExBudget() = default;
+
+    CRegExBudget(_In_ uint64_t maxMatchSteps, _In_ DWORD timeoutMs, _In_opt_ HANDLE cancelEvent) :
+        m_maxMatchSteps(maxMatchSteps),
+        m_deadline(GetTickCount64() + timeoutMs),
+        m_cancelEvent(cancelEvent)
+    {
+    }
+
+    // Resets the step count before each search
+    void StartMatch() { m_matchSteps = 0; }
+
+    // Returns false once a limit has been hit
+    bool Step(_In_ uint64_t steps = 1)
+    {
+        m_matchSteps += steps;
+        m_uncheckedSteps += steps;
+        if (m_matchSteps > m_maxMatchSteps)
+        {
+            m_result = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+        }
+        else if (m_uncheckedSteps >= REGEX_BUDGET_CHECK_INTERVAL)
+        {
+            _Check();
+        }
+        return SUCCEEDED(m_result);
+    }
+
+    HRESULT GetResult() const { return m_result; }
+
+private:
+    void _Check()
+    {
+        m_uncheckedSteps = 0;
+        if (SUCCEEDED(m_result))
+        {
+            if (m_cancelEvent && WaitForSingleObject(m_cancelEvent, 0) == WAIT_OBJECT_0)
+            {
+                m_result = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            }
+            else if (m_deadline != 0 && GetTickCount64() >= m_deadline)
+            {
+                m_result = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+            }
+        }
+    }
+
+    uint64_t m_maxMatchSteps = UINT64_MAX;
+    uint64_t m_matchSteps = 0;
+    uint64_t m_uncheckedSteps = 0;
+    // 0 for no deadline
+    ULONGLONG m_deadline = 0;
+    HANDLE m_cancelEvent = nullptr;
+    HRESULT m_result = S_OK;
+};
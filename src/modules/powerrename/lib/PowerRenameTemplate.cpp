@@ -0,0 +1,421 @@
+#include "stdafx.h"
+#include "PowerRenameTemplate.h"
+
+namespace
+{
+    // Appends value in decimal, zero padded to at least padding digits
+    void _AppendNumber(_In_ LONGLONG value, _In_ UINT padding, _Inout_ std::wstring& buffer)
+    {
+        wchar_t digits[20];
+        size_t count = 0;
+        ULONGLONG magnitude = (value < 0) ? (0ULL - static_cast<ULONGLONG>(value)) : static_cast<ULONGLONG>(value);
+        do
+        {
+            digits[count++] = static_cast<wchar_t>(L'0' + (magnitude % 10));
+            magnitude /= 10;
+        } while (magnitude != 0);
+
+        if (value < 0)
+        {
+            buffer.push_back(L'-');
+        }
+
+        if (padding > count)
+        {
+            buffer.append(padding - count, L'0');
+        }
+
+        while (count > 0)
+        {
+            buffer.push_back(digits[--count]);
+        }
+    }
+
+    // Parses an optionally signed decimal number that fills the whole text
+    bool _ParseNumber(_In_reads_(length) const wchar_t* text, _In_ size_t length, _Out_ LONGLONG* value)
+    {
+        *value = 0;
+        bool negative = (length > 0 && (*text == L'-' || *text == L'+'));
+        size_t i = negative ? 1 : 0;
+        negative = negative && (*text == L'-');
+        if (i == length || length - i > 18)
+        {
+            return false;
+        }
+
+        for (; i < length; i++)
+        {
+            if (text[i] < L'0' || text[i] > L'9')
+            {
+                return false;
+            }
+            *value = *value * 10 + (text[i] - L'0');
+        }
+
+        if (negative)
+        {
+            *value = -*value;
+        }
+        return true;
+    }
+}
+
+void CPowerRenameTemplate::Compile(_In_opt_ PCWSTR replaceTerm, _In_ bool literal)
+{
+    struct DateToken
+    {
+        PCWSTR text;
+        size_t length;
+        TokenType type;
+    };
+
+    // Longer tokens first so that $YYYY is not read as $YY followed by YY
+    static const DateToken dateTokens[] = {
+        { L"YYYY", 4, TOKEN_YEAR },
+        { L"YY", 2, TOKEN_YEAR_SHORT },
+        { L"MM", 2, TOKEN_MONTH },
+        { L"DD", 2, TOKEN_DAY },
+        { L"hh", 2, TOKEN_HOUR },
+        { L"mm", 2, TOKEN_MINUTE },
+        { L"ss", 2, TOKEN_SECOND },
+        { L"fff", 3, TOKEN_MILLISECOND },
+    };
+
+    m_replaceTerm.clear();
+    m_tokens.clear();
+    m_hasCounter = false;
+    m_hasFileTime = false;
+
+    PCWSTR text = replaceTerm ? replaceTerm : L"";
+    size_t length = wcslen(text);
+    m_replaceTerm.reserve(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] == L'$' && i + 1 < length && text[i + 1] == L'$')
+        {
+            // A regular expression search turns it into a single $ where it
+            // expands capture references.  A literal one copies the replace
+            // term as is, so it is turned into a $ here.
+            m_replaceTerm.append(text + i, literal ? 1 : 2);
+            i++;
+            continue;
+        }
+
+        if (text[i] != L'$' || i + 1 == length || m_tokens.size() == TEMPLATE_MAX_TOKENS)
+        {
+            s_AppendEscaped(text + i, 1, m_replaceTerm);
+            continue;
+        }
+
+        Token token;
+        size_t tokenLength = 0;
+        if (text[i + 1] == L'{')
+        {
+            PCWSTR end = wcschr(text + i + 2, L'}');
+            if (end && _ParseCounter(text + i + 2, end - (text + i + 2), token))
+            {
+                tokenLength = (end - (text + i)) + 1;
+                m_hasCounter = true;
+            }
+        }
+        else
+        {
+            for (const auto& dateToken : dateTokens)
+            {
+                if (wcsncmp(text + i + 1, dateToken.text, dateToken.length) == 0)
+                {
+                    token.type = dateToken.type;
+                    tokenLength = dateToken.length + 1;
+                    m_hasFileTime = true;
+                    break;
+                }
+            }
+        }
+
+        if (tokenLength == 0)
+        {
+            m_replaceTerm.push_back(text[i]);
+            continue;
+        }
+
+        m_replaceTerm.push_back(static_cast<wchar_t>(TEMPLATE_PLACEHOLDER_BASE + m_tokens.size()));
+        m_tokens.push_back(token);
+        i += tokenLength - 1;
+    }
+
+    if (m_tokens.empty())
+    {
+        // Nothing to expand so nothing to escape
+        m_replaceTerm.clear();
+        for (size_t i = 0; i < length; i++)
+        {
+            m_replaceTerm.push_back(text[i]);
+            if (literal && text[i] == L'$' && i + 1 < length && text[i + 1] == L'$')
+            {
+                i++;
+            }
+        }
+    }
+}
+
+bool CPowerRenameTemplate::s_HasReservedCharacters(_In_reads_(length) const wchar_t* text, _In_ size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] >= TEMPLATE_PLACEHOLDER_BASE && text[i] <= TEMPLATE_ESCAPE)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CPowerRenameTemplate::s_AppendEscaped(_In_reads_(length) const wchar_t* text, _In_ size_t length, _Inout_ std::wstring& buffer)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] >= TEMPLATE_PLACEHOLDER_BASE && text[i] <= TEMPLATE_ESCAPE)
+        {
+            buffer.push_back(static_cast<wchar_t>(TEMPLATE_ESCAPE));
+        }
+        buffer.push_back(text[i]);
+    }
+}
+
+bool CPowerRenameTemplate::GetReplaceTermFor(_In_reads_(length) const wchar_t* source,
+                                             _In_ size_t length,
+                                             _Out_ std::wstring& replaceTerm,
+                                             _Out_ wchar_t* placeholderBase) const
+{
+    replaceTerm.clear();
+    *placeholderBase = static_cast<wchar_t>(TEMPLATE_PLACEHOLDER_BASE);
+
+    // Private use characters the placeholders must stay clear of
+    std::vector<bool> used(TEMPLATE_PRIVATE_USE_LAST - TEMPLATE_PRIVATE_USE_FIRST + 1);
+    auto markUsed = [&used](wchar_t c) {
+        if (c >= TEMPLATE_PRIVATE_USE_FIRST && c <= TEMPLATE_PRIVATE_USE_LAST)
+        {
+            used[c - TEMPLATE_PRIVATE_USE_FIRST] = true;
+        }
+    };
+
+    for (size_t i = 0; i < length; i++)
+    {
+        markUsed(source[i]);
+    }
+
+    for (size_t i = 0; i < m_replaceTerm.length(); i++)
+    {
+        if (m_replaceTerm[i] == TEMPLATE_ESCAPE && i + 1 < m_replaceTerm.length())
+        {
+            markUsed(m_replaceTerm[++i]);
+        }
+    }
+
+    // First run of unused characters long enough for every placeholder
+    size_t base = 0;
+    size_t freeCount = 0;
+    for (size_t c = 0; c < used.size() && freeCount < m_tokens.size(); c++)
+    {
+        freeCount = used[c] ? 0 : freeCount + 1;
+        base = c + 1 - freeCount;
+    }
+
+    if (freeCount < m_tokens.size())
+    {
+        return false;
+    }
+
+    // The search copies literals as they are, so only placeholders stay encoded
+    *placeholderBase = static_cast<wchar_t>(TEMPLATE_PRIVATE_USE_FIRST + base);
+    replaceTerm.reserve(m_replaceTerm.length());
+    for (size_t i = 0; i < m_replaceTerm.length(); i++)
+    {
+        wchar_t c = m_replaceTerm[i];
+        size_t token = static_cast<size_t>(c) - TEMPLATE_PLACEHOLDER_BASE;
+        if (c == TEMPLATE_ESCAPE && i + 1 < m_replaceTerm.length())
+        {
+            replaceTerm.push_back(m_replaceTerm[++i]);
+        }
+        else if (token < m_tokens.size())
+        {
+            replaceTerm.push_back(static_cast<wchar_t>(*placeholderBase + token));
+        }
+        else
+        {
+            replaceTerm.push_back(c);
+        }
+    }
+    return true;
+}
+
+void CPowerRenameTemplate::EscapeResult(_In_ wchar_t placeholderBase, _Inout_ std::wstring& result) const
+{
+    std::wstring escaped;
+    escaped.reserve(result.length() + 8);
+    for (wchar_t c : result)
+    {
+        size_t token = static_cast<size_t>(c) - placeholderBase;
+        if (token < m_tokens.size())
+        {
+            escaped.push_back(static_cast<wchar_t>(TEMPLATE_PLACEHOLDER_BASE + token));
+        }
+        else
+        {
+            s_AppendEscaped(&c, 1, escaped);
+        }
+    }
+    result.swap(escaped);
+}
+
+// Parses the inside of ${...}: comma separated start, increment and padding
+// values, each at most once.  Any other text makes it a literal.
+bool CPowerRenameTemplate::_ParseCounter(_In_reads_(length) const wchar_t* text, _In_ size_t length, _Out_ Token& token) const
+{
+    token = Token();
+    token.type = TOKEN_COUNTER;
+
+    bool seen[3] = { false, false, false };
+    size_t position = 0;
+    while (position < length)
+    {
+        const wchar_t* part = text + position;
+        const wchar_t* comma = static_cast<const wchar_t*>(wmemchr(part, L',', length - position));
+        size_t partLength = comma ? (comma - part) : (length - position);
+        const wchar_t* equals = static_cast<const wchar_t*>(wmemchr(part, L'=', partLength));
+        if (!equals)
+        {
+            return false;
+        }
+
+        size_t nameLength = equals - part;
+        LONGLONG value = 0;
+        if (!_ParseNumber(equals + 1, partLength - nameLength - 1, &value))
+        {
+            return false;
+        }
+
+        size_t key = 0;
+        if (nameLength == 5 && wcsncmp(part, L"start", 5) == 0)
+        {
+            key = 0;
+            token.start = value;
+        }
+        else if (nameLength == 9 && wcsncmp(part, L"increment", 9) == 0)
+        {
+            key = 1;
+            token.increment = value;
+        }
+        else if (nameLength == 7 && wcsncmp(part, L"padding", 7) == 0 && value >= 0 && value <= TEMPLATE_MAX_PADDING)
+        {
+            key = 2;
+            token.padding = static_cast<UINT>(value);
+        }
+        else
+        {
+            return false;
+        }
+
+        if (seen[key])
+        {
+            return false;
+        }
+        seen[key] = true;
+
+        position += partLength + 1;
+        if (comma && position == length)
+        {
+            // Trailing comma
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CPowerRenameTemplate::Expand(_In_reads_(length) const wchar_t* name,
+                                  _In_ size_t length,
+                                  _In_ ULONG counterIndex,
+                                  _In_opt_ const SYSTEMTIME* fileTime,
+                                  _Inout_ std::wstring& buffer) const
+{
+    const wchar_t* runStart = name;
+    for (size_t i = 0; i < length; i++)
+    {
+        size_t token = static_cast<size_t>(name[i]) - TEMPLATE_PLACEHOLDER_BASE;
+        if (name[i] == TEMPLATE_ESCAPE && i + 1 < length)
+        {
+            // The next character is part of the name
+            buffer.append(runStart, name + i);
+            runStart = name + i + 1;
+            i++;
+        }
+        else if (token < m_tokens.size())
+        {
+            buffer.append(runStart, name + i);
+            _AppendToken(m_tokens[token], counterIndex, fileTime, buffer);
+            runStart = name + i + 1;
+        }
+    }
+    buffer.append(runStart, name + length);
+}
+
+void CPowerRenameTemplate::_AppendToken(_In_ const Token& token, _In_ ULONG counterIndex, _In_opt_ const SYSTEMTIME* fileTime, _Inout_ std::wstring& buffer) const
+{
+    if (token.type == TOKEN_COUNTER)
+    {
+        // Wraps around instead of overflowing for huge start and increment values
+        ULONGLONG value = static_cast<ULONGLONG>(token.start) + static_cast<ULONGLONG>(token.increment) * counterIndex;
+        _AppendNumber(static_cast<LONGLONG>(value), token.padding, buffer);
+        return;
+    }
+
+    if (!fileTime)
+    {
+        return;
+    }
+
+    switch (token.type)
+    {
+    case TOKEN_YEAR:
+        _AppendNumber(fileTime->wYear, 4, buffer);
+        break;
+    case TOKEN_YEAR_SHORT:
+        _AppendNumber(fileTime->wYear % 100, 2, buffer);
+        break;
+    case TOKEN_MONTH:
+        _AppendNumber(fileTime->wMonth, 2, buffer);
+        break;
+    case TOKEN_DAY:
+        _AppendNumber(fileTime->wDay, 2, buffer);
+        break;
+    case TOKEN_HOUR:
+        _AppendNumber(fileTime->wHour, 2, buffer);
+        break;
+    case TOKEN_MINUTE:
+        _AppendNumber(fileTime->wMinute, 2, buffer);
+        break;
+    case TOKEN_SECOND:
+        _AppendNumber(fileTime->wSecond, 2, buffer);
+        break;
+    case TOKEN_MILLISECOND:
+        _AppendNumber(fileTime->wMilliseconds, 3, buffer);
+        break;
+    }
+}
+
+HRESULT CPowerRenameTemplate::s_GetFileTime(_In_ PCWSTR path, _Out_ SYSTEMTIME* fileTime)
+{
+    ZeroMemory(fileTime, sizeof(*fileTime));
+
+    WIN32_FILE_ATTRIBUTE_DATA data = { 0 };
+    FILETIME localTime = { 0 };
+    if (!GetFileAttributesEx(path, GetFileExInfoStandard, &data) ||
+        !FileTimeToLocalFileTime(&data.ftCreationTime, &localTime) ||
+        !FileTimeToSystemTime(&localTime, fileTime))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return S_OK;
+}
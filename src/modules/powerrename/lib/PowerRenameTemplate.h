@@ -0,0 +1,123 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Character standing in for the first token of a template in the replace
+// term given to the search.  Token n uses TEMPLATE_PLACEHOLDER_BASE + n, in
+// the private use area.
+#define TEMPLATE_PLACEHOLDER_BASE 0xE000
+
+// Maximum number of tokens in a template.  Any more are left as typed.
+#define TEMPLATE_MAX_TOKENS 256
+
+// Put before a character of a name from TEMPLATE_PLACEHOLDER_BASE up to and
+// including this one, which file names may contain, so Expand copies it
+// instead of reading it as a token
+#define TEMPLATE_ESCAPE (TEMPLATE_PLACEHOLDER_BASE + TEMPLATE_MAX_TOKENS)
+
+// Private use area, where the search may move the placeholders to for a name
+// with characters that look like them
+#define TEMPLATE_PRIVATE_USE_FIRST 0xE000
+#define TEMPLATE_PRIVATE_USE_LAST 0xF8FF
+
+// Largest padding of a counter.  Longer than any number it can produce.
+#define TEMPLATE_MAX_PADDING 20
+
+// Tokens of the replace term that depend on the item rather than on the match:
+//
+//   ${start=1,increment=2,padding=3}   counter, every part optional: ${} counts
+//                                      0, 1, 2... in the order items are listed
+//   $YYYY $YY $MM $DD                  creation date of the item
+//   $hh $mm $ss $fff                   creation time of the item
+//
+// $$ is a $ that does not start a token, in both search modes.  Capture
+// references ($1, $& ...) are not tokens: the search expands them while it
+// matches.
+//
+// Compile runs when the replace term changes.  It swaps each token for a
+// placeholder character so the search copies it into the new name like any
+// other literal, and Expand then only has to find placeholders to produce the
+// final name.  Neither step formats or parses anything per item.
+//
+// Characters of the name or of the replace term in the placeholder range are
+// escaped with TEMPLATE_ESCAPE.  A name with such characters is searched with
+// the placeholders moved out of its way (GetReplaceTermFor) and the result is
+// escaped (EscapeResult).  None of this happens without tokens, when Expand
+// is not used.
+class CPowerRenameTemplate
+{
+public:
+    CPowerRenameTemplate() = default;
+    ~CPowerRenameTemplate() = default;
+
+    // literal is true for a search without regular expressions, which copies
+    // the replace term as is
+    void Compile(_In_opt_ PCWSTR replaceTerm, _In_ bool literal);
+
+    // Replace term to search with, with a placeholder in place of each token
+    const std::wstring& GetReplaceTerm() const { return m_replaceTerm; }
+
+    bool HasTokens() const { return !m_tokens.empty(); }
+    bool HasCounter() const { return m_hasCounter; }
+    bool HasFileTime() const { return m_hasFileTime; }
+
+    // True if text has characters that must be escaped to be told apart from
+    // placeholders
+    static bool s_HasReservedCharacters(_In_reads_(length) const wchar_t* text, _In_ size_t length);
+    // Appends text to buffer, escaping its reserved characters
+    static void s_AppendEscaped(_In_reads_(length) const wchar_t* text, _In_ size_t length, _Inout_ std::wstring& buffer);
+
+    // Replace term to search source with when it has reserved characters.
+    // The placeholders start at placeholderBase instead, away from every
+    // character of source and of the term.  False if there is no room for
+    // them, which takes thousands of distinct private use characters.
+    bool GetReplaceTermFor(_In_reads_(length) const wchar_t* source,
+                           _In_ size_t length,
+                           _Out_ std::wstring& replaceTerm,
+                           _Out_ wchar_t* placeholderBase) const;
+    // Turns the result of a search with GetReplaceTermFor into what Expand takes
+    void EscapeResult(_In_ wchar_t placeholderBase, _Inout_ std::wstring& result) const;
+
+    // Appends name to buffer with every placeholder replaced by the value of
+    // its token.  counterIndex is the position of the item among the renamed
+    // items.  Date and time tokens are dropped if fileTime is null.
+    void Expand(_In_reads_(length) const wchar_t* name,
+                _In_ size_t length,
+                _In_ ULONG counterIndex,
+                _In_opt_ const SYSTEMTIME* fileTime,
+                _Inout_ std::wstring& buffer) const;
+
+    // Creation time of the item at path in local time, as used by the date and
+    // time tokens
+    static HRESULT s_GetFileTime(_In_ PCWSTR path, _Out_ SYSTEMTIME* fileTime);
+
+private:
+    enum TokenType
+    {
+        TOKEN_COUNTER,
+        TOKEN_YEAR,
+        TOKEN_YEAR_SHORT,
+        TOKEN_MONTH,
+        TOKEN_DAY,
+        TOKEN_HOUR,
+        TOKEN_MINUTE,
+        TOKEN_SECOND,
+        TOKEN_MILLISECOND
+    };
+
+    struct Token
+    {
+        TokenType type = TOKEN_COUNTER;
+        LONGLONG start = 0;
+        LONGLONG increment = 1;
+        UINT padding = 0;
+    };
+
+    bool _ParseCounter(_In_reads_(length) const wchar_t* text, _In_ size_t length, _Out_ Token& token) const;
+    void _AppendToken(_In_ const Token& token, _In_ ULONG counterIndex, _In_opt_ const SYSTEMTIME* fileTime, _Inout_ std::wstring& buffer) const;
+
+    std::wstring m_replaceTerm;
+    std::vector<Token> m_tokens;
+    bool m_hasCounter = false;
+    bool m_hasFileTime = false;
+};
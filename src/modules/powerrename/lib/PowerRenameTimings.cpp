@@ -0,0 +1,118 @@
+#include "stdafx.h"
+#include "PowerRenameTimings.h"
+#include "Helpers.h"
+#include <atomic>
+
+namespace
+{
+    struct PhaseCounters
+    {
+        std::atomic<UINT64> runCount{ 0 };
+        std::atomic<UINT64> itemCount{ 0 };
+        std::atomic<UINT64> totalTicks{ 0 };
+        std::atomic<UINT64> maxTicks{ 0 };
+    };
+
+    PhaseCounters g_phases[RenamePhaseCount];
+
+    const PCWSTR c_phaseNames[RenamePhaseCount] = {
+        L"Enumeration",
+        L"RegEx",
+        L"Notification",
+        L"FileOp",
+    };
+
+    double _TicksToMilliseconds(_In_ UINT64 ticks)
+    {
+        static const LONGLONG frequency = []() {
+            LARGE_INTEGER value;
+            QueryPerformanceFrequency(&value);
+            return value.QuadPart;
+        }();
+        return (static_cast<double>(ticks) * 1000.0) / static_cast<double>(frequency);
+    }
+}
+
+void CRenameTimings::s_Record(_In_ RenamePhase phase, _In_ UINT64 ticks, _In_ UINT itemCount)
+{
+    PhaseCounters& counters = g_phases[phase];
+    counters.runCount++;
+    counters.itemCount += itemCount;
+    counters.totalTicks += ticks;
+
+    UINT64 maxTicks = counters.maxTicks;
+    while (ticks > maxTicks && !counters.maxTicks.compare_exchange_weak(maxTicks, ticks))
+    {
+    }
+}
+
+void CRenameTimings::s_GetTiming(_In_ RenamePhase phase, _Out_ RenamePhaseTiming* timing)
+{
+    const PhaseCounters& counters = g_phases[phase];
+    timing->runCount = counters.runCount;
+    timing->itemCount = counters.itemCount;
+    timing->totalMs = _TicksToMilliseconds(counters.totalTicks);
+    timing->maxMs = _TicksToMilliseconds(counters.maxTicks);
+}
+
+void CRenameTimings::s_Reset()
+{
+    for (auto& counters : g_phases)
+    {
+        counters.runCount = 0;
+        counters.itemCount = 0;
+        counters.totalTicks = 0;
+        counters.maxTicks = 0;
+    }
+}
+
+void CRenameTimings::s_Format(_Out_ std::wstring& text)
+{
+    text = L"Phase              Runs        Items     Total ms       Max ms      ns/item\r\n";
+    for (UINT phase = 0; phase < RenamePhaseCount; phase++)
+    {
+        RenamePhaseTiming timing;
+        s_GetTiming(static_cast<RenamePhase>(phase), &timing);
+        double nsPerItem = (timing.itemCount > 0) ? (timing.totalMs * 1000000.0) / static_cast<double>(timing.itemCount) : 0.0;
+
+        wchar_t line[256] = { 0 };
+        StringCchPrintf(line, ARRAYSIZE(line), L"%-12s %10llu %12llu %12.2f %12.2f %12.1f\r\n", c_phaseNames[phase], timing.runCount, timing.itemCount, timing.totalMs, timing.maxMs, nsPerItem);
+        text += line;
+    }
+}
+
+HRESULT CRenameTimings::s_Write(_In_ PCWSTR path)
+{
+    std::wstring text;
+    s_Format(text);
+
+    HRESULT hr = E_FAIL;
+    int length = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()), nullptr, 0, nullptr, nullptr);
+    if (length > 0)
+    {
+        std::string utf8(length, '\0');
+        WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()), &utf8[0], length, nullptr, nullptr);
+
+        HANDLE file = CreateFile(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        hr = (file != INVALID_HANDLE_VALUE) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+        if (SUCCEEDED(hr))
+        {
+            DWORD written = 0;
+            hr = WriteFile(file, utf8.data(), static_cast<DWORD>(utf8.length()), &written, nullptr) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+            CloseHandle(file);
+        }
+    }
+    return hr;
+}
+
+HRESULT CRenameTimings::s_GetDefaultPath(_Out_ std::wstring& path)
+{
+    path.clear();
+    std::wstring folder;
+    HRESULT hr = GetPowerRenameDataFolder(folder);
+    if (SUCCEEDED(hr))
+    {
+        path = folder + L"\\Timings.txt";
+    }
+    return hr;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+
+// Stages of a PowerRename session that are timed
+enum RenamePhase
+{
+    RenamePhaseEnumeration = 0, // Adding the selected items and their children
+    RenamePhaseRegEx,           // Evaluating the search and replace on the preview worker
+    RenamePhaseNotification,    // Dispatching worker messages on the manager thread
+    RenamePhaseFileOp,          // Renaming the items on the file operation worker
+    RenamePhaseCount
+};
+
+struct RenamePhaseTiming
+{
+    // Number of times the phase ran and the items it handled in total
+    UINT64 runCount = 0;
+    UINT64 itemCount = 0;
+    double totalMs = 0;
+    double maxMs = 0;
+};
+
+// Time spent in each phase since the process started or the last reset, for
+// attaching to bug reports.  Phases are timed with CRenamePhaseTimer, which
+// costs two QueryPerformanceCounter calls and a few interlocked adds so it is
+// left on in release builds.  All methods can be called from any thread.
+class CRenameTimings
+{
+public:
+    static void s_Record(_In_ RenamePhase phase, _In_ UINT64 ticks, _In_ UINT itemCount);
+    static void s_GetTiming(_In_ RenamePhase phase, _Out_ RenamePhaseTiming* timing);
+    static void s_Reset();
+
+    // A table with a row per phase
+    static void s_Format(_Out_ std::wstring& text);
+
+    // Writes the table as UTF-8 text to path, replacing any previous file
+    static HRESULT s_Write(_In_ PCWSTR path);
+
+    // %LOCALAPPDATA%\Microsoft\PowerToys\PowerRename\Timings.txt
+    static HRESULT s_GetDefaultPath(_Out_ std::wstring& path);
+};
+
+// Adds the time from construction to destruction to a phase
+class CRenamePhaseTimer
+{
+public:
+    CRenamePhaseTimer(_In_ RenamePhase phase, _In_ UINT itemCount = 0) :
+        m_phase(phase),
+        m_itemCount(itemCount)
+    {
+        QueryPerformanceCounter(&m_start);
+    }
+
+    ~CRenamePhaseTimer()
+    {
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&end);
+        CRenameTimings::s_Record(m_phase, static_cast<UINT64>(end.QuadPart - m_start.QuadPart), m_itemCount);
+    }
+
+    // For phases that only know their item count once they are done
+    void AddItems(_In_ UINT itemCount) { m_itemCount += itemCount; }
+
+private:
+    CRenamePhaseTimer(const CRenamePhaseTimer&) = delete;
+    CRenamePhaseTimer& operator=(const CRenamePhaseTimer&) = delete;
+
+    const RenamePhase m_phase;
+    UINT m_itemCount;
+    LARGE_INTEGER m_start;
+};
@@ -1,11 +1,17 @@
 #include "stdafx.h"
-#include <commctrl.h>
+#include <algorithm>
+#include <memory>
+#include <string>
 #include "Settings.h"
+#include "srwlock.h"
 #include "PowerRenameInterfaces.h"
+#include "PowerRenameMRU.h"
 
 const wchar_t c_rootRegPath[] = L"Software\\Microsoft\\PowerRename";
-const wchar_t c_mruSearchRegPath[] = L"SearchMRU";
-const wchar_t c_mruReplaceRegPath[] = L"ReplaceMRU";
+// Names of the files with the search and replace terms, and of the registry
+// keys that had them before
+const wchar_t c_mruSearchName[] = L"SearchMRU";
+const wchar_t c_mruReplaceName[] = L"ReplaceMRU";
 
 const wchar_t c_enabled[] = L"Enabled";
 const wchar_t c_showIconOnMenu[] = L"ShowIcon";
@@ -16,6 +22,7 @@ const wchar_t c_flags[] = L"Flags";
 const wchar_t c_searchText[] = L"SearchText";
 const wchar_t c_replaceText[] = L"ReplaceText";
 const wchar_t c_mruEnabled[] = L"MRUEnabled";
+const wchar_t c_previewDelay[] = L"PreviewDelay";
 
 const bool c_enabledDefault = true;
 const bool c_showIconOnMenuDefault = true;
@@ -25,162 +32,432 @@ const bool c_mruEnabledDefault = true;
 
 const DWORD c_maxMRUSizeDefault = 10;
 const DWORD c_flagsDefault = 0;
+const DWORD c_previewDelayDefault = 50;
+const DWORD c_previewDelayMax = 1000;
+
+// Milliseconds a snapshot is kept when the registry key cannot be watched,
+// for instance before anything was ever written to it
+const DWORD c_settingsPollInterval = 1000;
+
+namespace
+{
+    enum DWORDSetting
+    {
+        SETTING_ENABLED,
+        SETTING_SHOW_ICON_ON_MENU,
+        SETTING_EXTENDED_CONTEXT_MENU_ONLY,
+        SETTING_PERSIST_STATE,
+        SETTING_MRU_ENABLED,
+        SETTING_MAX_MRU_SIZE,
+        SETTING_FLAGS,
+        SETTING_PREVIEW_DELAY,
+        DWORD_SETTING_COUNT
+    };
+
+    enum StringSetting
+    {
+        SETTING_SEARCH_TEXT,
+        SETTING_REPLACE_TEXT,
+        STRING_SETTING_COUNT
+    };
+
+    struct DWORDSettingInfo
+    {
+        PCWSTR valueName;
+        DWORD defaultValue;
+    };
+
+    // In the order of DWORDSetting
+    const DWORDSettingInfo c_dwordSettings[] = {
+        { c_enabled, c_enabledDefault },
+        { c_showIconOnMenu, c_showIconOnMenuDefault },
+        { c_extendedContextMenuOnly, c_extendedContextMenuOnlyDefaut },
+        { c_persistState, c_persistStateDefault },
+        { c_mruEnabled, c_mruEnabledDefault },
+        { c_maxMRUSize, c_maxMRUSizeDefault },
+        { c_flags, c_flagsDefault },
+        { c_previewDelay, c_previewDelayDefault },
+    };
+    static_assert(ARRAYSIZE(c_dwordSettings) == DWORD_SETTING_COUNT, "c_dwordSettings must list every DWORDSetting");
+
+    // In the order of StringSetting
+    const PCWSTR c_stringSettings[] = {
+        c_searchText,
+        c_replaceText,
+    };
+    static_assert(ARRAYSIZE(c_stringSettings) == STRING_SETTING_COUNT, "c_stringSettings must list every StringSetting");
+
+    // Value of every setting at one point.  A snapshot is never changed once
+    // published so a reader can keep using it while a newer one replaces it.
+    struct SettingsSnapshot
+    {
+        DWORD dwordValues[DWORD_SETTING_COUNT] = {};
+        std::wstring stringValues[STRING_SETTING_COUNT];
+    };
+
+    struct SettingsCache
+    {
+        CSRWLock lock;
+        _Guarded_by_(lock) std::shared_ptr<const SettingsSnapshot> snapshot;
+        // Open on the settings key and signaled when one of its values
+        // changes.  Both are null if the key cannot be watched, in which case
+        // the snapshot is read again after expireTick.
+        _Guarded_by_(lock) HKEY key = NULL;
+        _Guarded_by_(lock) HANDLE changeEvent = NULL;
+        _Guarded_by_(lock) ULONGLONG expireTick = 0;
+        // Settings set since the last flush.  The snapshot has their values.
+        _Guarded_by_(lock) bool pendingDWORDs[DWORD_SETTING_COUNT] = {};
+        _Guarded_by_(lock) bool pendingStrings[STRING_SETTING_COUNT] = {};
+    };
+
+    SettingsCache& _GetCache()
+    {
+        // Shared by every thread of the process and never freed, so that it
+        // can still be used while the process exits
+        static SettingsCache* cache = new SettingsCache();
+        return *cache;
+    }
+
+    // Must be called with the lock held
+    bool _IsStale(_In_ const SettingsCache& cache)
+    {
+        if (!cache.snapshot)
+        {
+            return true;
+        }
+
+        if (cache.changeEvent)
+        {
+            return WaitForSingleObject(cache.changeEvent, 0) == WAIT_OBJECT_0;
+        }
+
+        return GetTickCount64() >= cache.expireTick;
+    }
+
+    // Must be called with the lock held exclusively.  Asks to be signaled on
+    // the next change to the key, or falls back to polling.
+    void _WatchKey(_Inout_ SettingsCache& cache)
+    {
+        if (!cache.key && RegOpenKeyEx(HKEY_CURRENT_USER, c_rootRegPath, 0, KEY_NOTIFY | KEY_QUERY_VALUE, &cache.key) != ERROR_SUCCESS)
+        {
+            cache.key = NULL;
+        }
+
+        if (cache.key && !cache.changeEvent)
+        {
+            cache.changeEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        }
+
+        if (cache.changeEvent)
+        {
+            ResetEvent(cache.changeEvent);
+        }
+
+        if (!cache.key || !cache.changeEvent ||
+            RegNotifyChangeKeyValue(cache.key, FALSE, REG_NOTIFY_CHANGE_LAST_SET | REG_NOTIFY_THREAD_AGNOSTIC, cache.changeEvent, TRUE) != ERROR_SUCCESS)
+        {
+            if (cache.changeEvent)
+            {
+                CloseHandle(cache.changeEvent);
+                cache.changeEvent = NULL;
+            }
+
+            if (cache.key)
+            {
+                RegCloseKey(cache.key);
+                cache.key = NULL;
+            }
+
+            cache.expireTick = GetTickCount64() + c_settingsPollInterval;
+        }
+    }
+
+    bool _ReadString(_In_ HKEY root, _In_opt_ PCWSTR subKey, _In_ PCWSTR valueName, _Out_ std::wstring& value)
+    {
+        value.clear();
+        DWORD cb = 0;
+        LSTATUS result = RegGetValue(root, subKey, valueName, RRF_RT_REG_SZ, nullptr, nullptr, &cb);
+        if (result == ERROR_SUCCESS && cb > sizeof(wchar_t))
+        {
+            value.resize(cb / sizeof(wchar_t));
+            result = RegGetValue(root, subKey, valueName, RRF_RT_REG_SZ, nullptr, &value[0], &cb);
+            value.resize((result == ERROR_SUCCESS) ? wcslen(value.c_str()) : 0);
+        }
+        return result == ERROR_SUCCESS;
+    }
+
+    // Must be called with the lock held exclusively.  Reads every setting
+    // into a new snapshot, keeping the values set but not yet flushed.
+    void _Reload(_Inout_ SettingsCache& cache)
+    {
+        // Watch before reading so that a change made while reading is not missed
+        _WatchKey(cache);
+
+        HKEY root = cache.key ? cache.key : HKEY_CURRENT_USER;
+        PCWSTR subKey = cache.key ? nullptr : c_rootRegPath;
+        std::shared_ptr<SettingsSnapshot> snapshot = std::make_shared<SettingsSnapshot>();
+        for (UINT i = 0; i < DWORD_SETTING_COUNT; i++)
+        {
+            DWORD value = 0;
+            DWORD cb = sizeof(value);
+            if (cache.pendingDWORDs[i])
+            {
+                value = cache.snapshot->dwordValues[i];
+            }
+            else if (RegGetValue(root, subKey, c_dwordSettings[i].valueName, RRF_RT_REG_DWORD, nullptr, &value, &cb) != ERROR_SUCCESS)
+            {
+                value = c_dwordSettings[i].defaultValue;
+            }
+            snapshot->dwordValues[i] = value;
+        }
+
+        for (UINT i = 0; i < STRING_SETTING_COUNT; i++)
+        {
+            if (cache.pendingStrings[i])
+            {
+                snapshot->stringValues[i] = cache.snapshot->stringValues[i];
+            }
+            else
+            {
+                _ReadString(root, subKey, c_stringSettings[i], snapshot->stringValues[i]);
+            }
+        }
+
+        cache.snapshot = std::move(snapshot);
+    }
+
+    std::shared_ptr<const SettingsSnapshot> _GetSnapshot()
+    {
+        SettingsCache& cache = _GetCache();
+        {
+            CSRWSharedAutoLock lock(&cache.lock);
+            if (!_IsStale(cache))
+            {
+                return cache.snapshot;
+            }
+        }
+
+        CSRWExclusiveAutoLock lock(&cache.lock);
+        if (_IsStale(cache))
+        {
+            _Reload(cache);
+        }
+        return cache.snapshot;
+    }
+
+    DWORD _GetDWORD(_In_ DWORDSetting setting)
+    {
+        return _GetSnapshot()->dwordValues[setting];
+    }
+
+    bool _GetString(_In_ StringSetting setting, __out_ecount(cchBuf) PWSTR text, DWORD cchBuf)
+    {
+        return SUCCEEDED(StringCchCopy(text, cchBuf, _GetSnapshot()->stringValues[setting].c_str()));
+    }
+
+    // Publishes a snapshot with the setting changed by update and queues the
+    // setting for the next flush.  Nothing is queued if the value is the same.
+    template<typename Update>
+    void _Set(_Inout_ bool* pending, _In_ Update update)
+    {
+        SettingsCache& cache = _GetCache();
+        CSRWExclusiveAutoLock lock(&cache.lock);
+        if (_IsStale(cache))
+        {
+            _Reload(cache);
+        }
+
+        std::shared_ptr<SettingsSnapshot> snapshot = std::make_shared<SettingsSnapshot>(*cache.snapshot);
+        if (update(*snapshot))
+        {
+            cache.snapshot = std::move(snapshot);
+            *pending = true;
+        }
+    }
+
+    bool _SetDWORD(_In_ DWORDSetting setting, _In_ DWORD value)
+    {
+        _Set(&_GetCache().pendingDWORDs[setting], [&](SettingsSnapshot& snapshot) {
+            bool changed = (snapshot.dwordValues[setting] != value);
+            snapshot.dwordValues[setting] = value;
+            return changed;
+        });
+        return true;
+    }
+
+    bool _SetString(_In_ StringSetting setting, _In_ PCWSTR value)
+    {
+        _Set(&_GetCache().pendingStrings[setting], [&](SettingsSnapshot& snapshot) {
+            bool changed = (snapshot.stringValues[setting] != value);
+            snapshot.stringValues[setting] = value;
+            return changed;
+        });
+        return true;
+    }
+}
 
 bool CSettings::GetEnabled()
 {
-    return GetRegBoolValue(c_enabled, c_enabledDefault);
+    return _GetDWORD(SETTING_ENABLED) != 0;
 }
 
 bool CSettings::SetEnabled(_In_ bool enabled)
 {
-    return SetRegBoolValue(c_enabled, enabled);
+    return _SetDWORD(SETTING_ENABLED, enabled ? 1 : 0);
 }
 
 bool CSettings::GetShowIconOnMenu()
 {
-    return GetRegBoolValue(c_showIconOnMenu, c_showIconOnMenuDefault);
+    return _GetDWORD(SETTING_SHOW_ICON_ON_MENU) != 0;
 }
 
 bool CSettings::SetShowIconOnMenu(_In_ bool show)
 {
-    return SetRegBoolValue(c_showIconOnMenu, show);
+    return _SetDWORD(SETTING_SHOW_ICON_ON_MENU, show ? 1 : 0);
 }
 
 bool CSettings::GetExtendedContextMenuOnly()
 {
-    return GetRegBoolValue(c_extendedContextMenuOnly, c_extendedContextMenuOnlyDefaut);
+    return _GetDWORD(SETTING_EXTENDED_CONTEXT_MENU_ONLY) != 0;
 }
 
 bool CSettings::SetExtendedContextMenuOnly(_In_ bool extendedOnly)
 {
-    return SetRegBoolValue(c_extendedContextMenuOnly, extendedOnly);
+    return _SetDWORD(SETTING_EXTENDED_CONTEXT_MENU_ONLY, extendedOnly ? 1 : 0);
 }
 
 bool CSettings::GetPersistState()
 {
-    return GetRegBoolValue(c_persistState, c_persistStateDefault);
+    return _GetDWORD(SETTING_PERSIST_STATE) != 0;
 }
 
 bool CSettings::SetPersistState(_In_ bool persistState)
 {
-    return SetRegBoolValue(c_persistState, persistState);
+    return _SetDWORD(SETTING_PERSIST_STATE, persistState ? 1 : 0);
 }
 
 bool CSettings::GetMRUEnabled()
 {
-    return GetRegBoolValue(c_mruEnabled, c_mruEnabledDefault);
+    return _GetDWORD(SETTING_MRU_ENABLED) != 0;
 }
 
 bool CSettings::SetMRUEnabled(_In_ bool enabled)
 {
-    return SetRegBoolValue(c_mruEnabled, enabled);
+    return _SetDWORD(SETTING_MRU_ENABLED, enabled ? 1 : 0);
 }
 
 DWORD CSettings::GetMaxMRUSize()
 {
-    return GetRegDWORDValue(c_maxMRUSize, c_maxMRUSizeDefault);
+    return _GetDWORD(SETTING_MAX_MRU_SIZE);
 }
 
 bool CSettings::SetMaxMRUSize(_In_ DWORD maxMRUSize)
 {
-    return SetRegDWORDValue(c_maxMRUSize, maxMRUSize);
+    return _SetDWORD(SETTING_MAX_MRU_SIZE, maxMRUSize);
 }
 
-DWORD CSettings::GetFlags()
+DWORD CSettings::GetPreviewDelay()
 {
-    return GetRegDWORDValue(c_flags, c_flagsDefault);
+    return (std::min)(_GetDWORD(SETTING_PREVIEW_DELAY), c_previewDelayMax);
 }
 
-bool CSettings::SetFlags(_In_ DWORD flags)
+bool CSettings::SetPreviewDelay(_In_ DWORD delay)
 {
-    return SetRegDWORDValue(c_flags, flags);
+    return _SetDWORD(SETTING_PREVIEW_DELAY, delay);
 }
 
-bool CSettings::GetSearchText(__out_ecount(cchBuf) PWSTR text, DWORD cchBuf)
+DWORD CSettings::GetFlags()
 {
-    return GetRegStringValue(c_searchText, text, cchBuf);
+    return _GetDWORD(SETTING_FLAGS);
 }
 
-bool CSettings::SetSearchText(_In_ PCWSTR text)
+bool CSettings::SetFlags(_In_ DWORD flags)
 {
-    return SetRegStringValue(c_searchText, text);
+    return _SetDWORD(SETTING_FLAGS, flags);
 }
 
-bool CSettings::GetReplaceText(__out_ecount(cchBuf) PWSTR text, DWORD cchBuf)
+bool CSettings::GetSearchText(__out_ecount(cchBuf) PWSTR text, DWORD cchBuf)
 {
-    return GetRegStringValue(c_replaceText, text, cchBuf);
+    return _GetString(SETTING_SEARCH_TEXT, text, cchBuf);
 }
 
-bool CSettings::SetReplaceText(_In_ PCWSTR text)
+bool CSettings::SetSearchText(_In_ PCWSTR text)
 {
-    return SetRegStringValue(c_replaceText, text);
+    return _SetString(SETTING_SEARCH_TEXT, text);
 }
 
-bool CSettings::SetRegBoolValue(_In_ PCWSTR valueName, _In_ bool value)
+bool CSettings::GetReplaceText(__out_ecount(cchBuf) PWSTR text, DWORD cchBuf)
 {
-    DWORD dwValue = value ? 1 : 0;
-    return SetRegDWORDValue(valueName, dwValue);
+    return _GetString(SETTING_REPLACE_TEXT, text, cchBuf);
 }
 
-bool CSettings::GetRegBoolValue(_In_ PCWSTR valueName, _In_ bool defaultValue)
+bool CSettings::SetReplaceText(_In_ PCWSTR text)
 {
-    DWORD value = GetRegDWORDValue(valueName, (defaultValue == 0) ? false : true);
-    return (value == 0) ? false : true;
+    return _SetString(SETTING_REPLACE_TEXT, text);
 }
 
-bool CSettings::SetRegDWORDValue(_In_ PCWSTR valueName, _In_ DWORD value)
+bool CSettings::Flush()
 {
-    return (SUCCEEDED(HRESULT_FROM_WIN32(SHSetValue(HKEY_CURRENT_USER, c_rootRegPath, valueName, REG_DWORD, &value, sizeof(value)))));
-}
+    SettingsCache& cache = _GetCache();
+    CSRWExclusiveAutoLock lock(&cache.lock);
 
-DWORD CSettings::GetRegDWORDValue(_In_ PCWSTR valueName, _In_ DWORD defaultValue)
-{
-    DWORD retVal = defaultValue;
-    DWORD type = REG_DWORD;
-    DWORD dwEnabled = 0;
-    DWORD cb = sizeof(dwEnabled);
-    if (SHGetValue(HKEY_CURRENT_USER, c_rootRegPath, valueName, &type, &dwEnabled, &cb) == ERROR_SUCCESS)
+    bool anyPending = false;
+    for (bool pending : cache.pendingDWORDs)
+    {
+        anyPending = anyPending || pending;
+    }
+    for (bool pending : cache.pendingStrings)
     {
-        retVal = dwEnabled;
+        anyPending = anyPending || pending;
     }
 
-    return retVal;
-}
+    if (!anyPending)
+    {
+        return true;
+    }
 
-bool CSettings::SetRegStringValue(_In_ PCWSTR valueName, _In_ PCWSTR value)
-{
-    ULONG cb = (DWORD)((wcslen(value) + 1) * sizeof(*value));
-    return (SUCCEEDED(HRESULT_FROM_WIN32(SHSetValue(HKEY_CURRENT_USER, c_rootRegPath, valueName, REG_SZ, (const BYTE*)value, cb))));
-}
+    HKEY key = NULL;
+    if (RegCreateKeyEx(HKEY_CURRENT_USER, c_rootRegPath, 0, nullptr, 0, KEY_SET_VALUE, nullptr, &key, nullptr) != ERROR_SUCCESS)
+    {
+        return false;
+    }
 
-bool CSettings::GetRegStringValue(_In_ PCWSTR valueName, __out_ecount(cchBuf) PWSTR value, DWORD cchBuf)
-{
-    if (cchBuf > 0)
+    // Settings that fail to be written stay queued for the next flush
+    bool succeeded = true;
+    for (UINT i = 0; i < DWORD_SETTING_COUNT; i++)
     {
-        value[0] = L'\0';
+        if (cache.pendingDWORDs[i])
+        {
+            DWORD value = cache.snapshot->dwordValues[i];
+            bool written = (RegSetValueEx(key, c_dwordSettings[i].valueName, 0, REG_DWORD, reinterpret_cast<const BYTE*>(&value), sizeof(value)) == ERROR_SUCCESS);
+            cache.pendingDWORDs[i] = !written;
+            succeeded = succeeded && written;
+        }
     }
 
-    DWORD type = REG_SZ;
-    ULONG cb = cchBuf * sizeof(*value);
-    return (SUCCEEDED(HRESULT_FROM_WIN32(SHGetValue(HKEY_CURRENT_USER, c_rootRegPath, valueName, &type, value, &cb) == ERROR_SUCCESS)));
-}
+    for (UINT i = 0; i < STRING_SETTING_COUNT; i++)
+    {
+        if (cache.pendingStrings[i])
+        {
+            const std::wstring& value = cache.snapshot->stringValues[i];
+            DWORD cb = static_cast<DWORD>((value.length() + 1) * sizeof(wchar_t));
+            bool written = (RegSetValueEx(key, c_stringSettings[i], 0, REG_SZ, reinterpret_cast<const BYTE*>(value.c_str()), cb) == ERROR_SUCCESS);
+            cache.pendingStrings[i] = !written;
+            succeeded = succeeded && written;
+        }
+    }
 
+    RegCloseKey(key);
 
-typedef int (CALLBACK* MRUCMPPROC)(LPCWSTR, LPCWSTR);
+    if (!cache.changeEvent)
+    {
+        // The key may have just been created, so try watching it now
+        cache.expireTick = 0;
+    }
 
-typedef struct {
-    DWORD      cbSize;
-    UINT       uMax;
-    UINT       fFlags;
-    HKEY       hKey;
-    LPCTSTR    lpszSubKey;
-    MRUCMPPROC lpfnCompare;
-} MRUINFO;
+    return succeeded;
+}
 
-typedef HANDLE (*CreateMRUListFn)(MRUINFO* pmi);
-typedef int (*AddMRUStringFn)(HANDLE hMRU, LPCWSTR data);
-typedef int (*EnumMRUListFn)(HANDLE hMRU, int nItem, void* lpData, UINT uLen);
-typedef int (*FreeMRUListFn)(HANDLE hMRU);
 
 class CRenameMRU :
     public IEnumString,
@@ -194,72 +471,66 @@ public:
 
     // IEnumString
     IFACEMETHODIMP Next(__in ULONG celt, __out_ecount_part(celt, *pceltFetched) LPOLESTR* rgelt, __out_opt ULONG* pceltFetched);
-    IFACEMETHODIMP Skip(__in ULONG) { return E_NOTIMPL; }
+    IFACEMETHODIMP Skip(__in ULONG celt);
     IFACEMETHODIMP Reset();
-    IFACEMETHODIMP Clone(__deref_out IEnumString** ppenum) { *ppenum = nullptr;  return E_NOTIMPL; }
+    IFACEMETHODIMP Clone(__deref_out IEnumString** ppenum);
 
     // IPowerRenameMRU
     IFACEMETHODIMP AddMRUString(_In_ PCWSTR entry);
+    IFACEMETHODIMP SetPrefix(_In_ PCWSTR prefix);
 
-    static HRESULT CreateInstance(_In_ PCWSTR regPathMRU, _In_ ULONG maxMRUSize, _Outptr_ IUnknown** ppUnk);
+    static HRESULT CreateInstance(_In_ PCWSTR name, _In_ ULONG maxMRUSize, _Outptr_ IUnknown** ppUnk);
 
 private:
-    CRenameMRU();
-    ~CRenameMRU();
-
-    HRESULT _Initialize(_In_ PCWSTR regPathMRU, __in ULONG maxMRUSize);
-    HRESULT _CreateMRUList(_In_ MRUINFO* pmi);
-    int _AddMRUString(_In_ PCWSTR data);
-    int _EnumMRUList(_In_ int nItem, _Out_ void* lpData, _In_ UINT uLen);
-    void _FreeMRUList();
-
-    long   m_refCount = 0;
-    HKEY   m_hKey = NULL;
-    ULONG  m_maxMRUSize = 0;
-    ULONG  m_mruIndex = 0;
-    ULONG  m_mruSize = 0;
-    HANDLE m_mruHandle = NULL;
-    HMODULE m_hComctl32Dll = NULL;
-    PWSTR  m_regPath = nullptr;
+    CRenameMRU(_In_ std::shared_ptr<CRenameMRUStore> store, _In_ ULONG maxMRUSize);
+    ~CRenameMRU() = default;
+
+    void _FindSuggestions();
+    static void _ImportRegistryMRU(_In_ PCWSTR name, _In_ CRenameMRUStore* store);
+
+    long m_refCount = 0;
+    // Number of suggestions enumerated
+    ULONG m_maxMRUSize = 0;
+    std::shared_ptr<CRenameMRUStore> m_store;
+
+    CSRWLock m_lock;
+    _Guarded_by_(m_lock) std::wstring m_prefix;
+    _Guarded_by_(m_lock) bool m_found = false;
+    _Guarded_by_(m_lock) std::vector<std::wstring> m_suggestions;
+    _Guarded_by_(m_lock) size_t m_index = 0;
 };
 
-CRenameMRU::CRenameMRU() :
-    m_refCount(1)
+CRenameMRU::CRenameMRU(_In_ std::shared_ptr<CRenameMRUStore> store, _In_ ULONG maxMRUSize) :
+    m_refCount(1),
+    m_maxMRUSize(maxMRUSize),
+    m_store(std::move(store))
 {}
 
-CRenameMRU::~CRenameMRU()
+// The store is only read when the first suggestions are needed, which is
+// when the user starts typing, so opening the window does not wait for it.
+HRESULT CRenameMRU::CreateInstance(_In_ PCWSTR name, _In_ ULONG maxMRUSize, _Outptr_ IUnknown** ppUnk)
 {
-    if (m_hKey)
-    {
-        RegCloseKey(m_hKey);
-    }
-
-    _FreeMRUList();
-
-    if (m_hComctl32Dll)
+    *ppUnk = nullptr;
+    HRESULT hr = (name && maxMRUSize > 0) ? S_OK : E_FAIL;
+    std::wstring path;
+    if (SUCCEEDED(hr))
     {
-        FreeLibrary(m_hComctl32Dll);
+        hr = CRenameMRUStore::s_GetDefaultPath(name, path);
     }
 
-    CoTaskMemFree(m_regPath);
-}
-
-HRESULT CRenameMRU::CreateInstance(_In_ PCWSTR regPathMRU, _In_ ULONG maxMRUSize, _Outptr_ IUnknown** ppUnk)
-{
-    *ppUnk = nullptr;
-    HRESULT hr = (regPathMRU && maxMRUSize > 0) ? S_OK : E_FAIL;
     if (SUCCEEDED(hr))
     {
-        CRenameMRU* renameMRU = new CRenameMRU();
+        std::shared_ptr<CRenameMRUStore> store = std::make_shared<CRenameMRUStore>(path);
+        if (GetFileAttributes(path.c_str()) == INVALID_FILE_ATTRIBUTES)
+        {
+            _ImportRegistryMRU(name, store.get());
+        }
+
+        CRenameMRU* renameMRU = new CRenameMRU(std::move(store), maxMRUSize);
         hr = renameMRU ? S_OK : E_OUTOFMEMORY;
         if (SUCCEEDED(hr))
         {
-            hr = renameMRU->_Initialize(regPathMRU, maxMRUSize);
-            if (SUCCEEDED(hr))
-            {
-                hr = renameMRU->QueryInterface(IID_PPV_ARGS(ppUnk));
-            }
-
+            hr = renameMRU->QueryInterface(IID_PPV_ARGS(ppUnk));
             renameMRU->Release();
         }
     }
@@ -294,57 +565,16 @@ IFACEMETHODIMP CRenameMRU::QueryInterface(_In_ REFIID riid, _Outptr_ void** ppv)
     return QISearch(this, qit, riid, ppv);
 }
 
-HRESULT CRenameMRU::_Initialize(_In_ PCWSTR regPathMRU, __in ULONG maxMRUSize)
-{
-    m_maxMRUSize = maxMRUSize;
-
-    wchar_t regPath[MAX_PATH] = { 0 };
-    HRESULT hr = StringCchPrintf(regPath, ARRAYSIZE(regPath), L"%s\\%s", c_rootRegPath, regPathMRU);
-    if (SUCCEEDED(hr))
-    {
-        hr = SHStrDup(regPathMRU, &m_regPath);
-
-        if (SUCCEEDED(hr))
-        {
-            MRUINFO mi = {
-                sizeof(MRUINFO),
-                maxMRUSize,
-                0,
-                HKEY_CURRENT_USER,
-                regPath,
-                nullptr
-            };
-
-            hr = _CreateMRUList(&mi);
-            if (SUCCEEDED(hr))
-            {
-                m_mruSize = _EnumMRUList(-1, NULL, 0);
-            }
-            else
-            {
-                hr = E_FAIL;
-            }
-        }
-    }
-
-    return hr;
-}
-
 // IEnumString
 IFACEMETHODIMP CRenameMRU::Reset()
 {
-    m_mruIndex = 0;
+    CSRWExclusiveAutoLock lock(&m_lock);
+    _FindSuggestions();
     return S_OK;
 }
 
-#define MAX_ENTRY_STRING 1024
-
 IFACEMETHODIMP CRenameMRU::Next(__in ULONG celt, __out_ecount_part(celt, *pceltFetched) LPOLESTR* rgelt, __out_opt ULONG* pceltFetched)
 {
-    HRESULT hr = S_OK;
-    WCHAR mruEntry[MAX_ENTRY_STRING];
-    mruEntry[0] = L'\0';
-
     if (pceltFetched)
     {
         *pceltFetched = 0;
@@ -360,122 +590,148 @@ IFACEMETHODIMP CRenameMRU::Next(__in ULONG celt, __out_ecount_part(celt, *pceltF
         return S_FALSE;
     }
 
-    hr = S_FALSE;
-    if (m_mruIndex <= m_mruSize && _EnumMRUList(m_mruIndex++, (void*)mruEntry, ARRAYSIZE(mruEntry)) > 0)
+    CSRWExclusiveAutoLock lock(&m_lock);
+    if (!m_found)
     {
-        hr = SHStrDup(mruEntry, rgelt);
-        if (SUCCEEDED(hr) && pceltFetched != nullptr)
+        _FindSuggestions();
+    }
+
+    HRESULT hr = S_OK;
+    ULONG fetched = 0;
+    while (fetched < celt && m_index < m_suggestions.size())
+    {
+        hr = SHStrDup(m_suggestions[m_index].c_str(), &rgelt[fetched]);
+        if (FAILED(hr))
         {
-            *pceltFetched = 1;
+            break;
         }
+        fetched++;
+        m_index++;
     }
 
-    return hr;
-}
-
-IFACEMETHODIMP CRenameMRU::AddMRUString(_In_ PCWSTR entry)
-{
-    return (_AddMRUString(entry) < 0) ? E_FAIL : S_OK;
-}
-
-HRESULT CRenameMRU::_CreateMRUList(_In_ MRUINFO* pmi)
-{
-    if (m_mruHandle != NULL)
+    if (FAILED(hr))
     {
-        _FreeMRUList();
+        // Nothing is returned on failure
+        for (ULONG i = 0; i < fetched; i++)
+        {
+            CoTaskMemFree(rgelt[i]);
+            rgelt[i] = nullptr;
+        }
+        m_index -= fetched;
+        return hr;
     }
 
-    if (m_hComctl32Dll == NULL)
+    if (pceltFetched)
     {
-        m_hComctl32Dll = LoadLibraryEx(L"comctl32.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
+        *pceltFetched = fetched;
     }
 
-    if (m_hComctl32Dll != nullptr)
+    return (fetched == celt) ? S_OK : S_FALSE;
+}
+
+IFACEMETHODIMP CRenameMRU::Skip(__in ULONG celt)
+{
+    CSRWExclusiveAutoLock lock(&m_lock);
+    if (!m_found)
     {
-        CreateMRUListFn pfnCreateMRUList = reinterpret_cast<CreateMRUListFn>(GetProcAddress(m_hComctl32Dll, (LPCSTR)MAKEINTRESOURCE(400)));
-        if (pfnCreateMRUList != nullptr)
-        {
-            m_mruHandle = pfnCreateMRUList(pmi);
-        }
+        _FindSuggestions();
     }
 
-    return (m_mruHandle != NULL) ? S_OK : E_FAIL;
+    size_t remaining = m_suggestions.size() - m_index;
+    m_index += (std::min)(static_cast<size_t>(celt), remaining);
+    return (celt <= remaining) ? S_OK : S_FALSE;
 }
 
-int CRenameMRU::_AddMRUString(_In_ PCWSTR data)
+IFACEMETHODIMP CRenameMRU::Clone(__deref_out IEnumString** ppenum)
 {
-    int retVal = -1;
-    if (m_mruHandle != NULL)
+    *ppenum = nullptr;
+    CRenameMRU* renameMRU = new CRenameMRU(m_store, m_maxMRUSize);
+    HRESULT hr = renameMRU ? S_OK : E_OUTOFMEMORY;
+    if (SUCCEEDED(hr))
     {
-        if (m_hComctl32Dll == NULL)
         {
-            m_hComctl32Dll = LoadLibraryEx(L"comctl32.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
+            CSRWSharedAutoLock lock(&m_lock);
+            renameMRU->m_prefix = m_prefix;
+            renameMRU->m_found = m_found;
+            renameMRU->m_suggestions = m_suggestions;
+            renameMRU->m_index = m_index;
         }
 
-        if (m_hComctl32Dll != nullptr)
-        {
-            AddMRUStringFn pfnAddMRUString = reinterpret_cast<AddMRUStringFn>(GetProcAddress(m_hComctl32Dll, (LPCSTR)MAKEINTRESOURCE(401)));
-            if (pfnAddMRUString != nullptr)
-            {
-                retVal = pfnAddMRUString(m_mruHandle, data);
-            }
-        }
+        hr = renameMRU->QueryInterface(IID_PPV_ARGS(ppenum));
+        renameMRU->Release();
     }
 
-    return retVal;
+    return hr;
 }
 
-int CRenameMRU::_EnumMRUList(_In_ int nItem, _Out_ void* lpData, _In_ UINT uLen)
+// IPowerRenameMRU
+IFACEMETHODIMP CRenameMRU::AddMRUString(_In_ PCWSTR entry)
 {
-    int retVal = -1;
-    if (m_mruHandle != NULL)
-    {
-        if (m_hComctl32Dll == NULL)
-        {
-            m_hComctl32Dll = LoadLibraryEx(L"comctl32.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
-        }
+    m_store->Add(entry);
+    return m_store->Save();
+}
 
-        if (m_hComctl32Dll != nullptr)
-        {
-            EnumMRUListFn pfnEnumMRUList = reinterpret_cast<EnumMRUListFn>(GetProcAddress(m_hComctl32Dll, (LPCSTR)MAKEINTRESOURCE(403)));
-            if (pfnEnumMRUList != nullptr)
-            {
-                retVal = pfnEnumMRUList(m_mruHandle, nItem, lpData, uLen);
-            }
-        }
-    }
+IFACEMETHODIMP CRenameMRU::SetPrefix(_In_ PCWSTR prefix)
+{
+    CSRWExclusiveAutoLock lock(&m_lock);
+    m_prefix = prefix;
+    return S_OK;
+}
 
-    return retVal;
+// Must be called with m_lock held exclusively
+void CRenameMRU::_FindSuggestions()
+{
+    m_store->Find(m_prefix, m_maxMRUSize, m_suggestions);
+    m_found = true;
+    m_index = 0;
 }
 
-void CRenameMRU::_FreeMRUList()
+// Moves the list kept in the registry by earlier versions into the store.  The
+// MRUList value has a letter per string, most recent first, and each string is
+// a value named after its letter.
+void CRenameMRU::_ImportRegistryMRU(_In_ PCWSTR name, _In_ CRenameMRUStore* store)
 {
-    if (m_mruHandle != NULL)
+    wchar_t regPath[MAX_PATH] = { 0 };
+    if (FAILED(StringCchPrintf(regPath, ARRAYSIZE(regPath), L"%s\\%s", c_rootRegPath, name)))
     {
-        if (m_hComctl32Dll == NULL)
-        {
-            m_hComctl32Dll = LoadLibraryEx(L"comctl32.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
-        }
+        return;
+    }
 
-        if (m_hComctl32Dll != nullptr)
+    HKEY hKey = NULL;
+    if (RegOpenKeyEx(HKEY_CURRENT_USER, regPath, 0, KEY_READ, &hKey) != ERROR_SUCCESS)
+    {
+        return;
+    }
+
+    wchar_t order[64] = { 0 };
+    DWORD cb = sizeof(order) - sizeof(order[0]);
+    if (RegGetValue(hKey, nullptr, L"MRUList", RRF_RT_REG_SZ, nullptr, order, &cb) == ERROR_SUCCESS)
+    {
+        for (size_t i = wcslen(order); i > 0; i--)
         {
-            FreeMRUListFn pfnFreeMRUList = reinterpret_cast<FreeMRUListFn>(GetProcAddress(m_hComctl32Dll, (LPCSTR)MAKEINTRESOURCE(152)));
-            if (pfnFreeMRUList != nullptr)
+            wchar_t valueName[2] = { order[i - 1], L'\0' };
+            wchar_t entry[RENAME_MRU_MAX_TERM_LENGTH + 1] = { 0 };
+            cb = sizeof(entry);
+            if (RegGetValue(hKey, nullptr, valueName, RRF_RT_REG_SZ, nullptr, entry, &cb) == ERROR_SUCCESS)
             {
-                pfnFreeMRUList(m_mruHandle);
+                store->Add(entry);
             }
-            
         }
-        m_mruHandle = NULL;
+    }
+    RegCloseKey(hKey);
+
+    if (SUCCEEDED(store->Save()))
+    {
+        SHDeleteKey(HKEY_CURRENT_USER, regPath);
     }
 }
 
 HRESULT CRenameMRUSearch_CreateInstance(_Outptr_ IUnknown** ppUnk)
 {
-    return CRenameMRU::CreateInstance(c_mruSearchRegPath, CSettings::GetMaxMRUSize(), ppUnk);
+    return CRenameMRU::CreateInstance(c_mruSearchName, CSettings::GetMaxMRUSize(), ppUnk);
 }
 
 HRESULT CRenameMRUReplace_CreateInstance(_Outptr_ IUnknown** ppUnk)
 {
-    return CRenameMRU::CreateInstance(c_mruReplaceRegPath, CSettings::GetMaxMRUSize(), ppUnk);
+    return CRenameMRU::CreateInstance(c_mruReplaceName, CSettings::GetMaxMRUSize(), ppUnk);
 }
@@ -1,5 +1,10 @@
 #pragma once
 
+// The settings are read from the registry into a snapshot shared by every
+// thread, and read again only once the registry key signals a change (or
+// after a short while if it cannot be watched).  Set updates the snapshot
+// right away but only writes to the registry on Flush, so a batch of settings
+// is written at once.
 class CSettings
 {
 public:
@@ -18,9 +23,14 @@ public:
     static bool GetMRUEnabled();
     static bool SetMRUEnabled(_In_ bool enabled);
 
+    // Number of earlier search and replace terms suggested as the user types
     static DWORD GetMaxMRUSize();
     static bool SetMaxMRUSize(_In_ DWORD maxMRUSize);
 
+    // Milliseconds the preview waits for typing to pause before it is updated
+    static DWORD GetPreviewDelay();
+    static bool SetPreviewDelay(_In_ DWORD delay);
+
     static DWORD GetFlags();
     static bool SetFlags(_In_ DWORD flags);
 
@@ -30,13 +40,8 @@ public:
     static bool GetReplaceText(__out_ecount(cchBuf) PWSTR text, DWORD cchBuf);
     static bool SetReplaceText(_In_ PCWSTR text);
 
-private:
-    static bool GetRegBoolValue(_In_ PCWSTR valueName, _In_ bool defaultValue);
-    static bool SetRegBoolValue(_In_ PCWSTR valueName, _In_ bool value);
-    static bool SetRegDWORDValue(_In_ PCWSTR valueName, _In_ DWORD value);
-    static DWORD GetRegDWORDValue(_In_ PCWSTR valueName, _In_ DWORD defaultValue);
-    static bool SetRegStringValue(_In_ PCWSTR valueName, _In_ PCWSTR value);
-    static bool GetRegStringValue(_In_ PCWSTR valueName, __out_ecount(cchBuf) PWSTR value, DWORD cchBuf);
+    // Writes the settings set since the last flush to the registry
+    static bool Flush();
 };
 
 HRESULT CRenameMRUSearch_CreateInstance(_Outptr_ IUnknown** ppUnk);
@@ -7,6 +7,7 @@
 #include <PowerRenameItem.h>
 #include <PowerRenameUI.h>
 #include <PowerRenameManager.h>
+#include <PowerRenameTimings.h>
 #include <Shobjidl.h>
 #include <common.h>
 
@@ -24,6 +25,27 @@ static const CLSID CLSID_PowerRenameMenu = __uuidof(Foo);
 
 DEFINE_GUID(BHID_DataObject, 0xb8c0bd9f, 0xed24, 0x455c, 0x83, 0xe6, 0xd5, 0x39, 0xc, 0x4f, 0xe8, 0xc4);
 
+// Path given with --timings <path>, or empty
+std::wstring GetTimingsPath()
+{
+    std::wstring path;
+    int argc = 0;
+    PWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (argv)
+    {
+        for (int i = 1; i + 1 < argc; i++)
+        {
+            if (wcscmp(argv[i], L"--timings") == 0)
+            {
+                path = argv[i + 1];
+                break;
+            }
+        }
+        LocalFree(argv);
+    }
+    return path;
+}
+
 int APIENTRY wWinMain(
     _In_ HINSTANCE hInstance,
     _In_opt_ HINSTANCE hPrevInstance,
@@ -55,6 +77,18 @@ int APIENTRY wWinMain(
 
                         // Need to call shutdown to break circular dependencies
                         spsrm->Shutdown();
+
+                        // Time spent in each phase, written to the path given
+                        // with --timings or to Timings.txt for bug reports
+                        std::wstring timingsPath = GetTimingsPath();
+                        if (timingsPath.empty())
+                        {
+                            CRenameTimings::s_GetDefaultPath(timingsPath);
+                        }
+                        if (!timingsPath.empty())
+                        {
+                            CRenameTimings::s_Write(timingsPath.c_str());
+                        }
                     }
                 }
             }
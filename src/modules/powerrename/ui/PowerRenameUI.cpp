@@ -5,6 +5,8 @@
 #include <Shlobj.h>
 #include <helpers.h>
 #include <settings.h>
+#include <PowerRenameJournal.h>
+#include <PowerRenamePreview.h>
 #include <windowsx.h>
 
 extern HINSTANCE g_hInst;
@@ -62,6 +64,7 @@ RepositionMap g_repositionMap[] = {
     { IDC_EDIT_SEARCHFOR, Reposition_Width },
     { IDC_EDIT_REPLACEWITH, Reposition_Width },
     { IDC_LIST_PREVIEW, Reposition_Width | Reposition_Height },
+    { ID_UNDO, Reposition_X },
     { IDC_STATUS_MESSAGE, Reposition_Y },
     { ID_RENAME, Reposition_X | Reposition_Y },
     { ID_ABOUT, Reposition_X | Reposition_Y },
@@ -162,26 +165,43 @@ IFACEMETHODIMP CPowerRenameUI::OnItemAdded(_In_ IPowerRenameItem*)
     return S_OK;
 }
 
-IFACEMETHODIMP CPowerRenameUI::OnUpdate(_In_ IPowerRenameItem*)
+IFACEMETHODIMP CPowerRenameUI::OnUpdateRange(_In_ UINT firstIndex, _In_ UINT lastIndex)
 {
-    UINT itemCount = 0;
+    // Only rows on screen need to be repainted now.  Other rows request their
+    // display info again when they are scrolled into view.
     if (m_spsrm)
     {
-        m_spsrm->GetItemCount(&itemCount);
+        m_listview.RedrawVisibleItems(m_spsrm, firstIndex, lastIndex);
     }
-    m_listview.RedrawItems(0, itemCount);
     _UpdateCounts();
     return S_OK;
 }
 
-IFACEMETHODIMP CPowerRenameUI::OnError(_In_ IPowerRenameItem*)
+IFACEMETHODIMP CPowerRenameUI::OnItemsAdded(_In_ UINT, _In_ UINT)
 {
+    if (m_spsrm)
+    {
+        m_listview.SetItemCount(m_spsrm);
+    }
+    _UpdateCounts();
+    return S_OK;
+}
+
+IFACEMETHODIMP CPowerRenameUI::OnError(_In_ IPowerRenameItem*, _In_ HRESULT hr)
+{
+    if (m_renaming)
+    {
+        // The first failure is shown with the count
+        if (m_renameErrorCount++ == 0)
+        {
+            m_renameError = hr;
+        }
+    }
     return S_OK;
 }
 
 IFACEMETHODIMP CPowerRenameUI::OnRegExStarted(_In_ DWORD threadId)
 {
-    m_disableCountUpdate = true;
     m_currentRegExId = threadId;
     _UpdateCounts();
     return S_OK;
@@ -191,7 +211,6 @@ IFACEMETHODIMP CPowerRenameUI::OnRegExCanceled(_In_ DWORD threadId)
 {
     if (m_currentRegExId == threadId)
     {
-        m_disableCountUpdate = false;
         _UpdateCounts();
     }
 
@@ -203,7 +222,6 @@ IFACEMETHODIMP CPowerRenameUI::OnRegExCompleted(_In_ DWORD threadId)
     // Enable list view
     if (m_currentRegExId == threadId)
     {
-        m_disableCountUpdate = false;
         _UpdateCounts();
     }
     return S_OK;
@@ -211,21 +229,79 @@ IFACEMETHODIMP CPowerRenameUI::OnRegExCompleted(_In_ DWORD threadId)
 
 IFACEMETHODIMP CPowerRenameUI::OnRenameStarted()
 {
+    m_renaming = true;
+    m_renameErrorCount = 0;
+    m_renameError = S_OK;
+
     // Disable controls
     EnableWindow(m_hwnd, FALSE);
     return S_OK;
 }
 
+IFACEMETHODIMP CPowerRenameUI::OnRenameProgress(_In_ UINT completedCount, _In_ UINT totalCount)
+{
+    wchar_t progressLabelFormat[100] = { 0 };
+    LoadString(g_hInst, IDS_RENAMEPROGRESSFMT, progressLabelFormat, ARRAYSIZE(progressLabelFormat));
+
+    wchar_t progressLabel[100] = { 0 };
+    StringCchPrintf(progressLabel, ARRAYSIZE(progressLabel), progressLabelFormat, completedCount, totalCount);
+    SetDlgItemText(m_hwnd, IDC_STATUS_MESSAGE, progressLabel);
+    return S_OK;
+}
+
 IFACEMETHODIMP CPowerRenameUI::OnRenameCompleted()
 {
+    m_renaming = false;
+
     // Enable controls
     EnableWindow(m_hwnd, TRUE);
 
+    if (m_renameErrorCount > 0)
+    {
+        // Keep the window open so the user sees that some items were not renamed.
+        // The list no longer matches the files so renaming again is not allowed.
+        wchar_t errorsLabelFormat[100] = { 0 };
+        LoadString(g_hInst, IDS_RENAMEERRORSFMT, errorsLabelFormat, ARRAYSIZE(errorsLabelFormat));
+
+        wchar_t errorsLabel[100] = { 0 };
+        StringCchPrintf(errorsLabel, ARRAYSIZE(errorsLabel), errorsLabelFormat, m_renameErrorCount, m_renameError);
+        SetDlgItemText(m_hwnd, IDC_STATUS_MESSAGE, errorsLabel);
+        EnableWindow(GetDlgItem(m_hwnd, ID_RENAME), FALSE);
+        return S_OK;
+    }
+
     // Close the window
     PostMessage(m_hwnd, WM_CLOSE, (WPARAM)0, (LPARAM)0);
     return S_OK;
 }
 
+IFACEMETHODIMP CPowerRenameUI::OnEnumerationCompleted()
+{
+    m_enumerating = false;
+    EnableWindow(GetDlgItem(m_hwnd, ID_RENAME), (m_renamingCount > 0));
+
+    if (FAILED(m_enumerationError))
+    {
+        // Items may be missing from the list, so say so instead of the counts
+        wchar_t errorLabelFormat[100] = { 0 };
+        LoadString(g_hInst, IDS_ENUMERRORFMT, errorLabelFormat, ARRAYSIZE(errorLabelFormat));
+
+        wchar_t errorLabel[100] = { 0 };
+        StringCchPrintf(errorLabel, ARRAYSIZE(errorLabel), errorLabelFormat, m_enumerationError);
+        SetDlgItemText(m_hwnd, IDC_STATUS_MESSAGE, errorLabel);
+    }
+    return S_OK;
+}
+
+IFACEMETHODIMP CPowerRenameUI::OnEnumerationError(_In_ HRESULT hr)
+{
+    if (SUCCEEDED(m_enumerationError))
+    {
+        m_enumerationError = hr;
+    }
+    return S_OK;
+}
+
 // IDropTarget
 IFACEMETHODIMP CPowerRenameUI::DragEnter(_In_ IDataObject* pdtobj, DWORD /* grfKeyState */, POINTL pt, _Inout_ DWORD* pdwEffect)
 {
@@ -366,18 +442,14 @@ void CPowerRenameUI::_Cleanup()
 
 void CPowerRenameUI::_EnumerateItems(_In_ IUnknown* pdtobj)
 {
-    // Enumerate the data object and popuplate the manager
-    if (m_spsrm)
+    // Enumerate the data object and popuplate the manager.  Items are added in
+    // the background and reported with OnItemsAdded so the dialog stays usable.
+    if (m_spsrm && SUCCEEDED(m_spsrm->StartEnumeration(pdtobj)))
     {
-        m_disableCountUpdate = true;
-        EnumerateDataObject(pdtobj, m_spsrm);
-        m_disableCountUpdate = false;
-
-        UINT itemCount = 0;
-        m_spsrm->GetItemCount(&itemCount);
-        m_listview.SetItemCount(itemCount);
-
-        _UpdateCounts();
+        // Renaming waits until every item is known
+        m_enumerating = true;
+        m_enumerationError = S_OK;
+        EnableWindow(GetDlgItem(m_hwnd, ID_RENAME), FALSE);
     }
 }
 
@@ -445,6 +517,8 @@ HRESULT CPowerRenameUI::_WriteSettings()
                 spReplaceMRU->AddMRUString(buffer);
             }
         }
+
+        CSettings::Flush();
     }
 
     return S_OK;
@@ -488,6 +562,43 @@ void CPowerRenameUI::_OnRename()
     _WriteSettings();
 }
 
+void CPowerRenameUI::_OnUndo()
+{
+    std::wstring journalPath;
+    UINT failedCount = 0;
+    HRESULT hr = CRenameJournal::s_GetDefaultPath(journalPath);
+    if (SUCCEEDED(hr))
+    {
+        // Disable controls while the items are renamed back
+        EnableWindow(m_hwnd, FALSE);
+        hr = CRenameJournal::s_Undo(journalPath.c_str(), &failedCount);
+        EnableWindow(m_hwnd, TRUE);
+    }
+
+    wchar_t labelFormat[100] = { 0 };
+    wchar_t label[100] = { 0 };
+    if (FAILED(hr))
+    {
+        LoadString(g_hInst, IDS_UNDOERRORFMT, labelFormat, ARRAYSIZE(labelFormat));
+        StringCchPrintf(label, ARRAYSIZE(label), labelFormat, hr);
+    }
+    else if (failedCount > 0)
+    {
+        LoadString(g_hInst, IDS_UNDOERRORSFMT, labelFormat, ARRAYSIZE(labelFormat));
+        StringCchPrintf(label, ARRAYSIZE(label), labelFormat, failedCount);
+    }
+    else
+    {
+        LoadString(g_hInst, IDS_UNDONE, label, ARRAYSIZE(label));
+    }
+    SetDlgItemText(m_hwnd, IDC_STATUS_MESSAGE, label);
+
+    // The listed items may be the ones that were renamed back, so the list
+    // no longer matches the files and renaming again is not allowed
+    EnableWindow(GetDlgItem(m_hwnd, ID_RENAME), FALSE);
+    EnableWindow(GetDlgItem(m_hwnd, ID_UNDO), !journalPath.empty() && CRenameJournal::s_CanUndo(journalPath.c_str()));
+}
+
 void CPowerRenameUI::_OnAbout()
 {
     // Launch github page
@@ -626,6 +737,10 @@ void CPowerRenameUI::_OnInitDlg()
     // there are tiems to be renamed
     EnableWindow(GetDlgItem(m_hwnd, ID_RENAME), FALSE);
 
+    // The journal of the last rename is kept until it is undone
+    std::wstring journalPath;
+    EnableWindow(GetDlgItem(m_hwnd, ID_UNDO), SUCCEEDED(CRenameJournal::s_GetDefaultPath(journalPath)) && CRenameJournal::s_CanUndo(journalPath.c_str()));
+
     // Update UI elements that depend on number of items selected or to be renamed
     _UpdateCounts();
 
@@ -649,11 +764,16 @@ void CPowerRenameUI::_OnCommand(_In_ WPARAM wParam, _In_ LPARAM lParam)
         _OnAbout();
         break;
 
+    case ID_UNDO:
+        _OnUndo();
+        break;
+
     case IDC_EDIT_REPLACEWITH:
     case IDC_EDIT_SEARCHFOR:
         if (GET_WM_COMMAND_CMD(wParam, lParam) == EN_CHANGE)
         {
             _OnSearchReplaceChanged();
+            _UpdateAutoComplete(LOWORD(wParam));
         }
         break;
 
@@ -672,6 +792,13 @@ void CPowerRenameUI::_OnCommand(_In_ WPARAM wParam, _In_ LPARAM lParam)
             _GetFlagsFromCheckboxes();
         }
         break;
+
+    case IDC_CHECK_SHOWCHANGEDONLY:
+        if (BN_CLICKED == HIWORD(wParam) && m_spsrm)
+        {
+            m_listview.SetShowChangedOnly(m_spsrm, Button_GetCheck(GetDlgItem(m_hwnd, IDC_CHECK_SHOWCHANGEDONLY)) == BST_CHECKED);
+        }
+        break;
     }
 }
 
@@ -836,6 +963,26 @@ void CPowerRenameUI::_OnSearchReplaceChanged()
     }
 }
 
+// Has the autocomplete of the edit control enumerate the terms that start with
+// its text, which the MRU looks up by prefix, rather than every term
+void CPowerRenameUI::_UpdateAutoComplete(_In_ DWORD id)
+{
+    IAutoComplete2* autoComplete = (id == IDC_EDIT_SEARCHFOR) ? m_spSearchAC.p : m_spReplaceAC.p;
+    IUnknown* autoCompleteList = (id == IDC_EDIT_SEARCHFOR) ? m_spSearchACL.p : m_spReplaceACL.p;
+    CComPtr<IPowerRenameMRU> spMRU;
+    CComPtr<IAutoCompleteDropDown> spDropDown;
+    if (autoComplete && autoCompleteList &&
+        SUCCEEDED(autoCompleteList->QueryInterface(IID_PPV_ARGS(&spMRU))) &&
+        SUCCEEDED(autoComplete->QueryInterface(IID_PPV_ARGS(&spDropDown))))
+    {
+        wchar_t buffer[MAX_INPUT_STRING_LEN];
+        buffer[0] = L'\0';
+        GetDlgItemText(m_hwnd, id, buffer, ARRAYSIZE(buffer));
+        spMRU->SetPrefix(buffer);
+        spDropDown->ResetEnumerator();
+    }
+}
+
 DWORD CPowerRenameUI::_GetFlagsFromCheckboxes()
 {
     DWORD flags = 0;
@@ -884,13 +1031,8 @@ void CPowerRenameUI::_ValidateFlagCheckbox(_In_ DWORD checkBoxId)
 
 void CPowerRenameUI::_UpdateCounts()
 {
-    // This method is CPU intensive.  We disable it during certain operations
-    // for performance reasons.
-    if (m_disableCountUpdate)
-    {
-        return;
-    }
-
+    // The manager keeps the counts up to date so this is cheap enough to call
+    // as every batch of items is added or evaluated
     UINT selectedCount = 0;
     UINT renamingCount = 0;
     if (m_spsrm)
@@ -914,7 +1056,7 @@ void CPowerRenameUI::_UpdateCounts()
         SetDlgItemText(m_hwnd, IDC_STATUS_MESSAGE, countsLabel);
 
         // Update Rename button state
-        EnableWindow(GetDlgItem(m_hwnd, ID_RENAME), (renamingCount > 0));
+        EnableWindow(GetDlgItem(m_hwnd, ID_RENAME), (renamingCount > 0) && !m_enumerating);
     }
 }
 
@@ -952,29 +1094,28 @@ void CPowerRenameListView::ToggleAll(_In_ IPowerRenameManager* psrm, _In_ bool s
 {
     if (m_hwndLV)
     {
-        UINT itemCount = 0;
-        psrm->GetItemCount(&itemCount);
-        for (UINT i = 0; i < itemCount; i++)
-        {
-            CComPtr<IPowerRenameItem> spItem;
-            if (SUCCEEDED(psrm->GetItemByIndex(i, &spItem)))
-            {
-                spItem->put_selected(selected);
-            }
-        }
+        psrm->SetAllItemsSelected(selected);
 
-        RedrawItems(0, itemCount);
+        // Only the rows shown, which are fewer than the items when only
+        // renamed items are shown
+        const CPreviewSnapshot* snapshot = nullptr;
+        UINT rowCount = SUCCEEDED(psrm->GetPreviewSnapshot(&snapshot)) ? _GetRowCount(snapshot) : 0;
+        RedrawItems(0, static_cast<int>(rowCount));
     }
 }
 
 void CPowerRenameListView::ToggleItem(_In_ IPowerRenameManager* psrm, _In_ int item)
 {
+    const CPreviewSnapshot* snapshot = nullptr;
+    UINT index = 0;
     CComPtr<IPowerRenameItem> spItem;
-    if (SUCCEEDED(psrm->GetItemByIndex(item, &spItem)))
+    if (SUCCEEDED(psrm->GetPreviewSnapshot(&snapshot)) &&
+        _GetItemIndex(snapshot, item, &index) &&
+        SUCCEEDED(psrm->GetItemByIndex(index, &spItem)))
     {
         bool selected = false;
         spItem->get_selected(&selected);
-        spItem->put_selected(!selected);
+        psrm->SetItemSelected(index, !selected);
 
         RedrawItems(item, item);
     }
@@ -1013,11 +1154,15 @@ void CPowerRenameListView::UpdateItemCheckState(_In_ IPowerRenameManager* psrm,
 {
     if (psrm && m_hwndLV && (iItem > -1))
     {
+        const CPreviewSnapshot* snapshot = nullptr;
+        UINT index = 0;
         CComPtr<IPowerRenameItem> spItem;
-        if (SUCCEEDED(psrm->GetItemByIndex(iItem, &spItem)))
+        if (SUCCEEDED(psrm->GetPreviewSnapshot(&snapshot)) &&
+            _GetItemIndex(snapshot, iItem, &index) &&
+            SUCCEEDED(psrm->GetItemByIndex(index, &spItem)))
         {
             bool checked = ListView_GetCheckState(m_hwndLV, iItem);
-            spItem->put_selected(checked);
+            psrm->SetItemSelected(index, checked);
 
             UINT uSelected = (checked) ? LVIS_SELECTED : 0;
             ListView_SetItemState(m_hwndLV, iItem, uSelected, LVIS_SELECTED);
@@ -1041,76 +1186,67 @@ void CPowerRenameListView::UpdateItemCheckState(_In_ IPowerRenameManager* psrm,
 
 void CPowerRenameListView::GetDisplayInfo(_In_ IPowerRenameManager* psrm, _Inout_ LV_DISPINFO* plvdi)
 {
-    UINT count = 0;
-    psrm->GetItemCount(&count);
-    if (plvdi->item.iItem < 0 || plvdi->item.iItem > static_cast<int>(count))
+    // Read from the preview snapshot, which takes no lock and copies nothing
+    // but the text the list view asks for
+    const CPreviewSnapshot* snapshot = nullptr;
+    const PreviewItem* previewItem = nullptr;
+    UINT index = 0;
+    if (SUCCEEDED(psrm->GetPreviewSnapshot(&snapshot)) && _GetItemIndex(snapshot, plvdi->item.iItem, &index))
+    {
+        previewItem = snapshot->GetItem(index);
+    }
+
+    if (!previewItem)
     {
         // Invalid index
         return;
     }
 
-    CComPtr<IPowerRenameItem> renameItem;
-    if (SUCCEEDED(psrm->GetItemByIndex((int)plvdi->item.iItem, &renameItem)))
+    if (plvdi->item.mask & LVIF_IMAGE)
     {
-        if (plvdi->item.mask & LVIF_IMAGE)
-        {
-            renameItem->get_iconIndex(&plvdi->item.iImage);
-        }
+        // Looked up on first use and kept by the item
+        previewItem->item->get_iconIndex(&plvdi->item.iImage);
+    }
 
-        if (plvdi->item.mask & LVIF_STATE)
-        {
-            plvdi->item.stateMask = LVIS_STATEIMAGEMASK;
+    if (plvdi->item.mask & LVIF_STATE)
+    {
+        plvdi->item.stateMask = LVIS_STATEIMAGEMASK;
 
-            bool isSelected = false;
-            renameItem->get_selected(&isSelected);
-            if (isSelected)
-            {
-                // Turn check box on
-                plvdi->item.state = INDEXTOSTATEIMAGEMASK(2);
-            }
-            else
-            {
-                // Turn check box off
-                plvdi->item.state = INDEXTOSTATEIMAGEMASK(1);
-            }
+        if (previewItem->state & PREVIEW_ITEM_SELECTED)
+        {
+            // Turn check box on
+            plvdi->item.state = INDEXTOSTATEIMAGEMASK(2);
         }
-
-        if (plvdi->item.mask & LVIF_PARAM)
+        else
         {
-            int id = 0;
-            renameItem->get_id(&id);
-            plvdi->item.lParam = static_cast<LPARAM>(id);
+            // Turn check box off
+            plvdi->item.state = INDEXTOSTATEIMAGEMASK(1);
         }
+    }
+
+    if (plvdi->item.mask & LVIF_PARAM)
+    {
+        plvdi->item.lParam = static_cast<LPARAM>(previewItem->id);
+    }
 
-        if (plvdi->item.mask & LVIF_INDENT)
+    if (plvdi->item.mask & LVIF_INDENT)
+    {
+        plvdi->item.iIndent = static_cast<int>(previewItem->depth);
+    }
+
+    if (plvdi->item.mask & LVIF_TEXT)
+    {
+        PCWSTR subItemText = nullptr;
+        if (plvdi->item.iSubItem == COL_ORIGINAL_NAME)
         {
-            UINT depth = 0;
-            renameItem->get_depth(&depth);
-            plvdi->item.iIndent = static_cast<int>(depth);
+            subItemText = previewItem->originalName;
         }
-
-        if (plvdi->item.mask & LVIF_TEXT)
+        else if (plvdi->item.iSubItem == COL_NEW_NAME && (previewItem->state & PREVIEW_ITEM_SHOULD_RENAME))
         {
-            PWSTR subItemText = nullptr;
-            if (plvdi->item.iSubItem == COL_ORIGINAL_NAME)
-            {
-                renameItem->get_originalName(&subItemText);
-            }
-            else if (plvdi->item.iSubItem == COL_NEW_NAME)
-            {
-                DWORD flags = 0;
-                psrm->get_flags(&flags);
-                bool shouldRename = false;
-                if (SUCCEEDED(renameItem->ShouldRenameItem(flags, &shouldRename)) && shouldRename)
-                {
-                    renameItem->get_newName(&subItemText);
-                }
-            }
-
-            StringCchCopy(plvdi->item.pszText, plvdi->item.cchTextMax, subItemText ? subItemText : L"");
-            CoTaskMemFree(subItemText);
-            subItemText = nullptr;
+            subItemText = previewItem->newName;
         }
+
+        StringCchCopy(plvdi->item.pszText, plvdi->item.cchTextMax, subItemText ? subItemText : L"");
     }
 }
 
@@ -1127,9 +1263,85 @@ void CPowerRenameListView::RedrawItems(_In_ int first, _In_ int last)
     ListView_RedrawItems(m_hwndLV, first, last);
 }
 
-void CPowerRenameListView::SetItemCount(_In_ UINT itemCount)
+void CPowerRenameListView::RedrawVisibleItems(_In_ IPowerRenameManager* psrm, _In_ UINT firstIndex, _In_ UINT lastIndex)
+{
+    int first = static_cast<int>(firstIndex);
+    int last = static_cast<int>(lastIndex);
+    if (m_showChangedOnly)
+    {
+        // Items that started or stopped being changed move the rows after
+        // them, so every visible row from the first item in the range is
+        // repainted.  Finding it is a rank query, whatever the item count.
+        const CPreviewSnapshot* snapshot = nullptr;
+        if (FAILED(psrm->GetPreviewSnapshot(&snapshot)))
+        {
+            return;
+        }
+
+        UINT rowCount = _GetRowCount(snapshot);
+        if (static_cast<UINT>(ListView_GetItemCount(m_hwndLV)) != rowCount)
+        {
+            ListView_SetItemCountEx(m_hwndLV, rowCount, LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
+        }
+        first = static_cast<int>(snapshot->GetChangedRank(firstIndex));
+        last = INT_MAX;
+    }
+
+    int topIndex = ListView_GetTopIndex(m_hwndLV);
+    // Include the partially visible row at the bottom of the list view
+    int bottomIndex = topIndex + ListView_GetCountPerPage(m_hwndLV);
+
+    first = max(first, topIndex);
+    last = min(last, bottomIndex);
+    if (first <= last)
+    {
+        ListView_RedrawItems(m_hwndLV, first, last);
+    }
+}
+
+void CPowerRenameListView::SetItemCount(_In_ IPowerRenameManager* psrm)
+{
+    const CPreviewSnapshot* snapshot = nullptr;
+    if (SUCCEEDED(psrm->GetPreviewSnapshot(&snapshot)))
+    {
+        // Keep the scroll position and only repaint visible rows as items are added
+        ListView_SetItemCountEx(m_hwndLV, _GetRowCount(snapshot), LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
+    }
+}
+
+void CPowerRenameListView::SetShowChangedOnly(_In_ IPowerRenameManager* psrm, _In_ bool showChangedOnly)
+{
+    m_showChangedOnly = showChangedOnly;
+
+    // Rows now stand for other items so all of them are repainted
+    const CPreviewSnapshot* snapshot = nullptr;
+    UINT rowCount = SUCCEEDED(psrm->GetPreviewSnapshot(&snapshot)) ? _GetRowCount(snapshot) : 0;
+    ListView_SetItemCountEx(m_hwndLV, rowCount, 0);
+    RedrawItems(0, static_cast<int>(rowCount));
+}
+
+// Index of the item shown on row.  With only changed items shown this is a
+// select query over the changed items of the snapshot.
+bool CPowerRenameListView::_GetItemIndex(_In_ const CPreviewSnapshot* snapshot, _In_ int row, _Out_ UINT* index)
+{
+    *index = 0;
+    if (row < 0)
+    {
+        return false;
+    }
+
+    if (m_showChangedOnly)
+    {
+        return snapshot->SelectChanged(static_cast<UINT>(row), index);
+    }
+
+    *index = static_cast<UINT>(row);
+    return *index < snapshot->GetItemCount();
+}
+
+UINT CPowerRenameListView::_GetRowCount(_In_ const CPreviewSnapshot* snapshot)
 {
-    ListView_SetItemCount(m_hwndLV, itemCount);
+    return m_showChangedOnly ? snapshot->GetChangedItemCount() : snapshot->GetItemCount();
 }
 
 void CPowerRenameListView::_UpdateColumns()
@@ -16,7 +16,11 @@ public:
     void ToggleItem(_In_ IPowerRenameManager* psrm, _In_ int item);
     void UpdateItemCheckState(_In_ IPowerRenameManager* psrm, _In_ int iItem);
     void RedrawItems(_In_ int first, _In_ int last);
-    void SetItemCount(_In_ UINT itemCount);
+    void RedrawVisibleItems(_In_ IPowerRenameManager* psrm, _In_ UINT firstIndex, _In_ UINT lastIndex);
+    void SetItemCount(_In_ IPowerRenameManager* psrm);
+    // Shows a row per item, or with showChangedOnly only a row per item whose
+    // new name differs from its original name
+    void SetShowChangedOnly(_In_ IPowerRenameManager* psrm, _In_ bool showChangedOnly);
     void OnKeyDown(_In_ IPowerRenameManager* psrm, _In_ LV_KEYDOWN* lvKeyDown);
     void OnClickList(_In_ IPowerRenameManager* psrm, NM_LISTVIEW* pnmListView);
     void GetDisplayInfo(_In_ IPowerRenameManager* psrm, _Inout_ LV_DISPINFO* plvdi);
@@ -27,8 +31,11 @@ private:
     void _UpdateColumns();
     void _UpdateColumnSizes();
     void _UpdateHeaderCheckState(_In_ bool check);
+    bool _GetItemIndex(_In_ const CPreviewSnapshot* snapshot, _In_ int row, _Out_ UINT* index);
+    UINT _GetRowCount(_In_ const CPreviewSnapshot* snapshot);
 
     HWND m_hwndLV = nullptr;
+    bool m_showChangedOnly = false;
 };
 
 class CPowerRenameUI :
@@ -60,13 +67,17 @@ public:
 
     // IPowerRenameManagerEvents
     IFACEMETHODIMP OnItemAdded(_In_ IPowerRenameItem* renameItem);
-    IFACEMETHODIMP OnUpdate(_In_ IPowerRenameItem* renameItem);
-    IFACEMETHODIMP OnError(_In_ IPowerRenameItem* renameItem);
+    IFACEMETHODIMP OnUpdateRange(_In_ UINT firstIndex, _In_ UINT lastIndex);
+    IFACEMETHODIMP OnItemsAdded(_In_ UINT firstIndex, _In_ UINT lastIndex);
+    IFACEMETHODIMP OnError(_In_ IPowerRenameItem* renameItem, _In_ HRESULT hr);
     IFACEMETHODIMP OnRegExStarted(_In_ DWORD threadId);
     IFACEMETHODIMP OnRegExCanceled(_In_ DWORD threadId);
     IFACEMETHODIMP OnRegExCompleted(_In_ DWORD threadId);
     IFACEMETHODIMP OnRenameStarted();
+    IFACEMETHODIMP OnRenameProgress(_In_ UINT completedCount, _In_ UINT totalCount);
     IFACEMETHODIMP OnRenameCompleted();
+    IFACEMETHODIMP OnEnumerationCompleted();
+    IFACEMETHODIMP OnEnumerationError(_In_ HRESULT hr);
 
     // IDropTarget
     IFACEMETHODIMP DragEnter(_In_ IDataObject* pdtobj, DWORD grfKeyState, POINTL pt, _Inout_ DWORD* pdwEffect);
@@ -110,10 +121,12 @@ private:
     void _OnGetMinMaxInfo(_In_ LPARAM lParam);
     void _OnInitDlg();
     void _OnRename();
+    void _OnUndo();
     void _OnAbout();
     void _OnCloseDlg();
     void _OnDestroyDlg();
     void _OnSearchReplaceChanged();
+    void _UpdateAutoComplete(_In_ DWORD id);
     void _MoveControl(_In_ DWORD id, _In_ DWORD repositionFlags, _In_ int xDelta, _In_ int yDelta);
 
     HRESULT _ReadSettings();
@@ -129,7 +142,10 @@ private:
     long m_refCount = 0;
     bool m_initialized = false;
     bool m_enableDragDrop = false;
-    bool m_disableCountUpdate = false;
+    // Set while the manager is still adding items from a data object
+    bool m_enumerating = false;
+    // Set while the manager renames the items
+    bool m_renaming = false;
     bool m_modeless = true;
     HWND m_hwnd = nullptr;
     HWND m_hwndLV = nullptr;
@@ -138,6 +154,10 @@ private:
     DWORD m_currentRegExId = 0;
     UINT m_selectedCount = 0;
     UINT m_renamingCount = 0;
+    UINT m_renameErrorCount = 0;
+    HRESULT m_renameError = S_OK;
+    // First failure to read the items being enumerated
+    HRESULT m_enumerationError = S_OK;
     int m_initialWidth = 0;
     int m_initialHeight = 0;
     int m_lastWidth = 0;
@@ -18,15 +18,7 @@ HRESULT CMockPowerRenameItem::CreateInstance(_In_opt_ PCWSTR path, _In_opt_ PCWS
 
 void CMockPowerRenameItem::Init(_In_opt_ PCWSTR path, _In_opt_ PCWSTR originalName, _In_ UINT depth, _In_ bool isFolder)
 {
-    if (path != nullptr)
-    {
-        SHStrDup(path, &m_path);
-    }
-
-    if (originalName != nullptr)
-    {
-        SHStrDup(originalName, &m_originalName);
-    }
+    _InitNames(path, originalName);
 
     m_depth = depth;
     m_isFolder = isFolder;
@@ -35,15 +35,27 @@ IFACEMETHODIMP CMockPowerRenameManagerEvents::OnItemAdded(_In_ IPowerRenameItem*
     return S_OK;
 }
 
-IFACEMETHODIMP CMockPowerRenameManagerEvents::OnUpdate(_In_ IPowerRenameItem* pItem)
+IFACEMETHODIMP CMockPowerRenameManagerEvents::OnUpdateRange(_In_ UINT firstIndex, _In_ UINT lastIndex)
 {
-    m_itemUpdated = pItem;
+    m_updateRangeCount++;
+    m_updateRangeFirst = min(m_updateRangeFirst, firstIndex);
+    m_updateRangeLast = max(m_updateRangeLast, lastIndex);
     return S_OK;
 }
 
-IFACEMETHODIMP CMockPowerRenameManagerEvents::OnError(_In_ IPowerRenameItem* pItem)
+IFACEMETHODIMP CMockPowerRenameManagerEvents::OnItemsAdded(_In_ UINT firstIndex, _In_ UINT lastIndex)
+{
+    m_itemsAddedCount += lastIndex - firstIndex + 1;
+    m_itemsAddedFirst = min(m_itemsAddedFirst, firstIndex);
+    m_itemsAddedLast = max(m_itemsAddedLast, lastIndex);
+    return S_OK;
+}
+
+IFACEMETHODIMP CMockPowerRenameManagerEvents::OnError(_In_ IPowerRenameItem* pItem, _In_ HRESULT hr)
 {
     m_itemError = pItem;
+    m_itemErrorResult = hr;
+    m_errorCount++;
     return S_OK;
 }
 
@@ -71,12 +83,31 @@ IFACEMETHODIMP CMockPowerRenameManagerEvents::OnRenameStarted()
     return S_OK;
 }
 
+IFACEMETHODIMP CMockPowerRenameManagerEvents::OnRenameProgress(_In_ UINT completedCount, _In_ UINT totalCount)
+{
+    m_renameProgressCompleted = completedCount;
+    m_renameProgressTotal = totalCount;
+    return S_OK;
+}
+
 IFACEMETHODIMP CMockPowerRenameManagerEvents::OnRenameCompleted()
 {
     m_renameCompleted = true;
     return S_OK;
 }
 
+IFACEMETHODIMP CMockPowerRenameManagerEvents::OnEnumerationCompleted()
+{
+    m_enumerationCompleted = true;
+    return S_OK;
+}
+
+IFACEMETHODIMP CMockPowerRenameManagerEvents::OnEnumerationError(_In_ HRESULT hr)
+{
+    m_enumerationError = hr;
+    return S_OK;
+}
+
 HRESULT CMockPowerRenameManagerEvents::s_CreateInstance(_In_ IPowerRenameManager* psrm, _Outptr_ IPowerRenameUI** ppsrui)
 {
     *ppsrui = nullptr;
@@ -19,13 +19,17 @@ public:
 
     // IPowerRenameManagerEvents
     IFACEMETHODIMP OnItemAdded(_In_ IPowerRenameItem* renameItem);
-    IFACEMETHODIMP OnUpdate(_In_ IPowerRenameItem* renameItem);
-    IFACEMETHODIMP OnError(_In_ IPowerRenameItem* renameItem);
+    IFACEMETHODIMP OnUpdateRange(_In_ UINT firstIndex, _In_ UINT lastIndex);
+    IFACEMETHODIMP OnItemsAdded(_In_ UINT firstIndex, _In_ UINT lastIndex);
+    IFACEMETHODIMP OnError(_In_ IPowerRenameItem* renameItem, _In_ HRESULT hr);
     IFACEMETHODIMP OnRegExStarted(_In_ DWORD threadId);
     IFACEMETHODIMP OnRegExCanceled(_In_ DWORD threadId);
     IFACEMETHODIMP OnRegExCompleted(_In_ DWORD threadId);
     IFACEMETHODIMP OnRenameStarted();
+    IFACEMETHODIMP OnRenameProgress(_In_ UINT completedCount, _In_ UINT totalCount);
     IFACEMETHODIMP OnRenameCompleted();
+    IFACEMETHODIMP OnEnumerationCompleted();
+    IFACEMETHODIMP OnEnumerationError(_In_ HRESULT hr);
 
     static HRESULT s_CreateInstance(_In_ IPowerRenameManager* psrm, _Outptr_ IPowerRenameUI** ppsrui);
 
@@ -34,12 +38,23 @@ public:
     }
 
     CComPtr<IPowerRenameItem> m_itemAdded;
-    CComPtr<IPowerRenameItem> m_itemUpdated;
     CComPtr<IPowerRenameItem> m_itemError;
+    HRESULT m_itemErrorResult = S_OK;
+    UINT m_errorCount = 0;
+    UINT m_updateRangeCount = 0;
+    UINT m_updateRangeFirst = UINT_MAX;
+    UINT m_updateRangeLast = 0;
+    UINT m_itemsAddedCount = 0;
+    UINT m_itemsAddedFirst = UINT_MAX;
+    UINT m_itemsAddedLast = 0;
     bool m_regExStarted = false;
     bool m_regExCanceled = false;
     bool m_regExCompleted = false;
     bool m_renameStarted = false;
+    UINT m_renameProgressCompleted = 0;
+    UINT m_renameProgressTotal = 0;
     bool m_renameCompleted = false;
+    bool m_enumerationCompleted = false;
+    HRESULT m_enumerationError = S_OK;
     long m_refCount = 0;
 };
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include <PowerRenameExecutor.h>
+#include "TestFileHelper.h"
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace PowerRenameExecutorTests
+{
+    // Records the renames in the order they happen without touching the disk
+    class CRecordingRenameBackend : public CRenameBackend
+    {
+    public:
+        CRecordingRenameBackend(_In_ std::vector<std::wstring>* renamedPaths, _In_ std::mutex* lock, _In_ std::wstring failPath = std::wstring()) :
+            m_renamedPaths(renamedPaths),
+            m_lock(lock),
+            m_failPath(std::move(failPath))
+        {
+        }
+
+        HRESULT Rename(_In_ const std::wstring& path, _In_ const std::wstring&) override
+        {
+            if (path == m_failPath)
+            {
+                return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+            }
+
+            std::lock_guard<std::mutex> guard(*m_lock);
+            m_renamedPaths->push_back(path);
+            return S_OK;
+        }
+
+        bool Exists(_In_ const std::wstring&) override
+        {
+            return false;
+        }
+
+    private:
+        std::vector<std::wstring>* m_renamedPaths;
+        std::mutex* m_lock;
+        std::wstring m_failPath;
+    };
+
+    TEST_CLASS(ExecutorTests)
+    {
+    public:
+        TEST_METHOD(VerifyPlanOrdersChainsAndCycles)
+        {
+            std::vector<std::wstring> names = { L"a", L"b", L"c", L"x", L"y" };
+            std::vector<std::wstring> newNames = { L"b", L"c", L"d", L"Y", L"x" };
+            RenamePlan plan;
+            PlanFolderRenames(names, newNames, [](_In_ const std::wstring&) { return false; }, plan);
+
+            // The end of the chain goes first and the cycle is broken by staging x
+            Assert::IsTrue(plan.conflicts.empty());
+            Assert::IsTrue(plan.steps.size() == 6);
+            size_t expectedRenames[] = { 2, 1, 0, 3, 4, 3 };
+            RenamePlanStepType expectedTypes[] = { PLAN_STEP_RENAME, PLAN_STEP_RENAME, PLAN_STEP_RENAME, PLAN_STEP_STAGE, PLAN_STEP_RENAME, PLAN_STEP_UNSTAGE };
+            for (size_t i = 0; i < plan.steps.size(); i++)
+            {
+                Assert::IsTrue(plan.steps[i].rename == expectedRenames[i]);
+                Assert::IsTrue(plan.steps[i].type == expectedTypes[i]);
+            }
+        }
+
+        TEST_METHOD(VerifyPlanReportsConflicts)
+        {
+            std::vector<std::wstring> names = { L"a", L"b", L"d", L"f", L"g", L"h" };
+            std::vector<std::wstring> newNames = { L"c", L"C", L"e", L"d", L"G", L"g" };
+            RenamePlan plan;
+            PlanFolderRenames(names, newNames, [](_In_ const std::wstring& name) { return name == L"e"; }, plan);
+
+            // b has the same new name as a, e exists, f waits for d which keeps its
+            // name and g only changes case so h cannot have its name
+            size_t expectedConflicts[] = { 1, 2, 3, 5 };
+            Assert::IsTrue(plan.conflicts.size() == ARRAYSIZE(expectedConflicts));
+            for (size_t i = 0; i < plan.conflicts.size(); i++)
+            {
+                Assert::IsTrue(plan.conflicts[i].first == expectedConflicts[i]);
+                Assert::IsTrue(plan.conflicts[i].second == HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS));
+            }
+
+            Assert::IsTrue(plan.steps.size() == 2);
+            Assert::IsTrue(plan.steps[0].rename == 0 && plan.steps[0].type == PLAN_STEP_RENAME);
+            Assert::IsTrue(plan.steps[1].rename == 4 && plan.steps[1].type == PLAN_STEP_RENAME);
+        }
+
+        TEST_METHOD(VerifySwapOnDisk)
+        {
+            CTestFileHelper testFileHelper;
+            PCWSTR names[] = { L"a.txt", L"b.txt", L"c.txt" };
+            for (PCWSTR name : names)
+            {
+                std::wofstream file(testFileHelper.GetFullPath(name));
+                file << name;
+            }
+
+            HRESULT results[ARRAYSIZE(names)] = { E_FAIL, E_FAIL, E_FAIL };
+            CRenameExecutor executor(CRenameBackend::s_Create(), [&](_In_ UINT index, _In_ HRESULT result) {
+                results[index] = result;
+            });
+            executor.Add(0, testFileHelper.GetFullPath(L"a.txt").c_str(), L"b.txt");
+            executor.Add(1, testFileHelper.GetFullPath(L"b.txt").c_str(), L"c.txt");
+            executor.Add(2, testFileHelper.GetFullPath(L"c.txt").c_str(), L"a.txt");
+            executor.Run();
+
+            for (UINT u = 0; u < ARRAYSIZE(names); u++)
+            {
+                Assert::IsTrue(results[u] == S_OK);
+                std::wifstream file(testFileHelper.GetFullPath(names[(u + 1) % ARRAYSIZE(names)]));
+                std::wstring content;
+                file >> content;
+                Assert::IsTrue(content == names[u]);
+            }
+
+            // Nothing is left under a temporary name
+            std::filesystem::directory_iterator entries(testFileHelper.GetTempDirectory());
+            Assert::IsTrue(std::distance(begin(entries), end(entries)) == ARRAYSIZE(names));
+        }
+
+        TEST_METHOD(VerifyChildrenRenamedBeforeParents)
+        {
+            PCWSTR paths[] = {
+                L"C:\\root\\a",
+                L"C:\\root\\a\\b",
+                L"C:\\root\\a\\b\\file1.txt",
+                L"C:\\root\\a\\file2.txt",
+                L"C:\\root\\a\\B\\file3.txt",
+                L"C:\\root\\c",
+                L"C:\\root\\c\\d\\e\\file4.txt",
+                L"C:\\other\\file5.txt",
+            };
+
+            std::vector<std::wstring> renamedPaths;
+            std::mutex lock;
+            std::map<UINT, HRESULT> results;
+            CRenameExecutor executor(std::make_unique<CRecordingRenameBackend>(&renamedPaths, &lock), [&](_In_ UINT index, _In_ HRESULT result) {
+                std::lock_guard<std::mutex> guard(lock);
+                results.emplace(index, result);
+            });
+
+            for (UINT u = 0; u < ARRAYSIZE(paths); u++)
+            {
+                executor.Add(u, paths[u], L"renamed");
+            }
+            Assert::IsTrue(static_cast<UINT>(ARRAYSIZE(paths)) == executor.GetCount());
+
+            executor.Run();
+
+            Assert::IsTrue(ARRAYSIZE(paths) == results.size());
+            for (const auto& result : results)
+            {
+                Assert::IsTrue(S_OK == result.second);
+            }
+
+            // Every item below a folder is renamed before the folder.  Folders
+            // only differing by case are the same folder.
+            Assert::IsTrue(ARRAYSIZE(paths) == renamedPaths.size());
+            for (size_t i = 0; i < renamedPaths.size(); i++)
+            {
+                std::wstring prefix = renamedPaths[i] + L"\\";
+                for (size_t j = i + 1; j < renamedPaths.size(); j++)
+                {
+                    Assert::IsTrue(_wcsnicmp(renamedPaths[j].c_str(), prefix.c_str(), prefix.length()) != 0);
+                }
+            }
+        }
+
+        TEST_METHOD(VerifyFailuresReported)
+        {
+            std::vector<std::wstring> renamedPaths;
+            std::mutex lock;
+            std::map<UINT, HRESULT> results;
+            CRenameExecutor executor(std::make_unique<CRecordingRenameBackend>(&renamedPaths, &lock, L"C:\\root\\a\\file1.txt"), [&](_In_ UINT index, _In_ HRESULT result) {
+                std::lock_guard<std::mutex> guard(lock);
+                results[index] = result;
+            });
+
+            executor.Add(0, L"C:\\root\\a", L"b");
+            executor.Add(1, L"C:\\root\\a\\file1.txt", L"file3.txt");
+            executor.Add(2, L"C:\\root\\a\\file2.txt", L"file4.txt");
+            executor.Run();
+
+            // A failure does not stop the other items or the folder above them
+            Assert::IsTrue(static_cast<size_t>(3) == results.size());
+            Assert::IsTrue(S_OK == results[0]);
+            Assert::IsTrue(HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) == results[1]);
+            Assert::IsTrue(S_OK == results[2]);
+            Assert::IsTrue(static_cast<size_t>(2) == renamedPaths.size());
+            Assert::IsTrue(renamedPaths.back() == L"C:\\root\\a");
+        }
+
+        TEST_METHOD(VerifyInvalidNamesRejected)
+        {
+            PCWSTR newNames[] = { L"..\\x", L"sub\\x", L"C:\\x", L"a/b", L"", L".", L"..", L"x?", L"valid.txt" };
+
+            std::vector<std::wstring> renamedPaths;
+            std::mutex lock;
+            std::map<UINT, HRESULT> results;
+            CRenameExecutor executor(std::make_unique<CRecordingRenameBackend>(&renamedPaths, &lock), [&](_In_ UINT index, _In_ HRESULT result) {
+                std::lock_guard<std::mutex> guard(lock);
+                results[index] = result;
+            });
+
+            for (UINT u = 0; u < ARRAYSIZE(newNames); u++)
+            {
+                executor.Add(u, L"C:\\root\\file" + std::to_wstring(u) + L".txt", newNames[u]);
+            }
+            executor.Run();
+
+            // Only the valid name is renamed, none of the others leave the folder
+            Assert::IsTrue(ARRAYSIZE(newNames) == results.size());
+            for (UINT u = 0; u + 1 < ARRAYSIZE(newNames); u++)
+            {
+                Assert::IsTrue(HRESULT_FROM_WIN32(ERROR_INVALID_NAME) == results[u]);
+            }
+            Assert::IsTrue(S_OK == results[ARRAYSIZE(newNames) - 1]);
+            Assert::IsTrue(static_cast<size_t>(1) == renamedPaths.size());
+            Assert::IsTrue(renamedPaths[0] == L"C:\\root\\file8.txt");
+        }
+
+        TEST_METHOD(VerifyNestedRenameOnDisk)
+        {
+            CTestFileHelper testFileHelper;
+            Assert::IsTrue(testFileHelper.AddFolder(L"foo"));
+            Assert::IsTrue(testFileHelper.AddFolder(L"foo\\foo1"));
+            Assert::IsTrue(testFileHelper.AddFile(L"foo\\foo1\\foo.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"foo\\foo2.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"foo3.txt"));
+
+            PCWSTR originalNames[] = { L"foo", L"foo\\foo1", L"foo\\foo1\\foo.txt", L"foo\\foo2.txt", L"foo3.txt" };
+            PCWSTR newNames[] = { L"bar", L"bar1", L"bar.txt", L"bar2.txt", L"bar3.txt" };
+
+            std::atomic<UINT> errorCount{ 0 };
+            CRenameExecutor executor(CRenameBackend::s_Create(), [&](_In_ UINT, _In_ HRESULT result) {
+                if (FAILED(result))
+                {
+                    errorCount++;
+                }
+            });
+
+            for (UINT u = 0; u < ARRAYSIZE(originalNames); u++)
+            {
+                executor.Add(u, testFileHelper.GetFullPath(originalNames[u]).c_str(), newNames[u]);
+            }
+            executor.Run();
+
+            Assert::IsTrue(errorCount == 0);
+            Assert::IsFalse(testFileHelper.PathExists(L"foo"));
+            Assert::IsTrue(testFileHelper.PathExists(L"bar\\bar1\\bar.txt"));
+            Assert::IsTrue(testFileHelper.PathExists(L"bar\\bar2.txt"));
+            Assert::IsTrue(testFileHelper.PathExists(L"bar3.txt"));
+        }
+
+        TEST_METHOD(VerifyExistingItemNotReplaced)
+        {
+            CTestFileHelper testFileHelper;
+            Assert::IsTrue(testFileHelper.AddFile(L"foo.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"bar.txt"));
+
+            HRESULT renameResult = S_OK;
+            CRenameExecutor executor(CRenameBackend::s_Create(), [&](_In_ UINT, _In_ HRESULT result) {
+                renameResult = result;
+            });
+            executor.Add(0, testFileHelper.GetFullPath(L"foo.txt").c_str(), L"bar.txt");
+            executor.Run();
+
+            Assert::IsTrue(HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS) == renameResult);
+            Assert::IsTrue(testFileHelper.PathExists(L"foo.txt"));
+            Assert::IsTrue(testFileHelper.PathExists(L"bar.txt"));
+        }
+    };
+}
@@ -0,0 +1,234 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include <PowerRenameExecutor.h>
+#include <PowerRenameJournal.h>
+#include "TestFileHelper.h"
+#include <fstream>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace PowerRenameJournalTests
+{
+    void WriteContent(_In_ CTestFileHelper& testFileHelper, _In_ PCWSTR name)
+    {
+        std::wofstream file(testFileHelper.GetFullPath(name));
+        file << name;
+    }
+
+    std::wstring ReadContent(_In_ CTestFileHelper& testFileHelper, _In_ PCWSTR name)
+    {
+        std::wifstream file(testFileHelper.GetFullPath(name));
+        std::wstring content;
+        file >> content;
+        return content;
+    }
+
+    TEST_CLASS(JournalTests)
+    {
+    public:
+        TEST_METHOD(VerifyUndoAndRedoOnDisk)
+        {
+            CTestFileHelper testFileHelper;
+            CTestFileHelper journalFolder;
+            std::wstring journalPath = journalFolder.GetFullPath(L"journal.bin");
+            Assert::IsTrue(testFileHelper.AddFolder(L"foo"));
+            Assert::IsTrue(testFileHelper.AddFolder(L"foo\\foo1"));
+            Assert::IsTrue(testFileHelper.AddFile(L"foo\\foo1\\foo.txt"));
+            WriteContent(testFileHelper, L"a.txt");
+            WriteContent(testFileHelper, L"b.txt");
+
+            // Nested folders and a swap, which goes through a temporary name
+            PCWSTR originalNames[] = { L"foo", L"foo\\foo1", L"foo\\foo1\\foo.txt", L"a.txt", L"b.txt" };
+            PCWSTR newNames[] = { L"bar", L"bar1", L"bar.txt", L"b.txt", L"a.txt" };
+            {
+                CRenameJournal journal;
+                Assert::IsTrue(journal.Create(journalPath.c_str()) == S_OK);
+
+                UINT errorCount = 0;
+                CRenameExecutor executor(CRenameBackend::s_Create(), [&](_In_ UINT, _In_ HRESULT result) {
+                    if (FAILED(result))
+                    {
+                        InterlockedIncrement(&errorCount);
+                    }
+                });
+                executor.SetJournal(&journal);
+                for (UINT u = 0; u < ARRAYSIZE(originalNames); u++)
+                {
+                    executor.Add(u, testFileHelper.GetFullPath(originalNames[u]).c_str(), newNames[u]);
+                }
+                executor.Run();
+
+                Assert::IsTrue(errorCount == 0);
+                Assert::IsTrue(journal.GetStepCount() == 6);
+                Assert::IsTrue(journal.GetDoneCount() == 6);
+            }
+
+            CRenameJournal journal;
+            Assert::IsTrue(journal.Open(journalPath.c_str()) == S_OK);
+            Assert::IsTrue(journal.GetDoneCount() == 6);
+
+            std::unique_ptr<CRenameBackend> backend = CRenameBackend::s_Create();
+            UINT failedCount = 1;
+            Assert::IsTrue(journal.Replay(true, backend.get(), &failedCount) == S_OK);
+            Assert::IsTrue(failedCount == 0);
+            Assert::IsTrue(journal.GetDoneCount() == 0);
+            Assert::IsTrue(testFileHelper.PathExists(L"foo\\foo1\\foo.txt"));
+            Assert::IsFalse(testFileHelper.PathExists(L"bar"));
+            Assert::IsTrue(ReadContent(testFileHelper, L"a.txt") == L"a.txt");
+            Assert::IsTrue(ReadContent(testFileHelper, L"b.txt") == L"b.txt");
+
+            failedCount = 1;
+            Assert::IsTrue(journal.Replay(false, backend.get(), &failedCount) == S_OK);
+            Assert::IsTrue(failedCount == 0);
+            Assert::IsTrue(journal.GetDoneCount() == 6);
+            Assert::IsTrue(testFileHelper.PathExists(L"bar\\bar1\\bar.txt"));
+            Assert::IsFalse(testFileHelper.PathExists(L"foo"));
+            Assert::IsTrue(ReadContent(testFileHelper, L"a.txt") == L"b.txt");
+            Assert::IsTrue(ReadContent(testFileHelper, L"b.txt") == L"a.txt");
+
+            // Nothing is left under a temporary name
+            std::filesystem::directory_iterator entries(testFileHelper.GetTempDirectory());
+            Assert::IsTrue(std::distance(begin(entries), end(entries)) == 3);
+        }
+
+        TEST_METHOD(VerifyUndoLastRename)
+        {
+            CTestFileHelper testFileHelper;
+            CTestFileHelper journalFolder;
+            std::wstring journalPath = journalFolder.GetFullPath(L"journal.bin");
+            Assert::IsTrue(testFileHelper.AddFile(L"foo.txt"));
+            Assert::IsFalse(CRenameJournal::s_CanUndo(journalPath.c_str()));
+            {
+                CRenameJournal journal;
+                Assert::IsTrue(journal.Create(journalPath.c_str()) == S_OK);
+                CRenameExecutor executor(CRenameBackend::s_Create(), [](_In_ UINT, _In_ HRESULT) {});
+                executor.SetJournal(&journal);
+                executor.Add(0, testFileHelper.GetFullPath(L"foo.txt").c_str(), L"bar.txt");
+                executor.Run();
+            }
+            Assert::IsTrue(testFileHelper.PathExists(L"bar.txt"));
+            Assert::IsTrue(CRenameJournal::s_CanUndo(journalPath.c_str()));
+
+            // The journal is gone once the batch is undone so it cannot be undone twice
+            UINT failedCount = 1;
+            Assert::IsTrue(CRenameJournal::s_Undo(journalPath.c_str(), &failedCount) == S_OK);
+            Assert::IsTrue(failedCount == 0);
+            Assert::IsTrue(testFileHelper.PathExists(L"foo.txt"));
+            Assert::IsFalse(testFileHelper.PathExists(L"bar.txt"));
+            Assert::IsFalse(CRenameJournal::s_CanUndo(journalPath.c_str()));
+            Assert::IsTrue(FAILED(CRenameJournal::s_Undo(journalPath.c_str(), &failedCount)));
+        }
+
+        TEST_METHOD(VerifyResumeAfterCrash)
+        {
+            CTestFileHelper testFileHelper;
+            CTestFileHelper journalFolder;
+            std::wstring journalPath = journalFolder.GetFullPath(L"journal.bin");
+            Assert::IsTrue(testFileHelper.AddFile(L"one.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"two.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"three.txt"));
+
+            // The first rename was recorded, the second happened but its record
+            // was lost and the third never ran
+            {
+                CRenameJournal journal;
+                Assert::IsTrue(journal.Create(journalPath.c_str()) == S_OK);
+                UINT folderId = journal.AddFolder(testFileHelper.GetTempDirectory().wstring() + L"\\");
+                UINT firstStep = journal.AddStep(folderId, L"one.txt", L"1.txt");
+                journal.AddStep(folderId, L"two.txt", L"2.txt");
+                journal.AddStep(folderId, L"three.txt", L"3.txt");
+                journal.Commit(firstStep);
+            }
+            std::filesystem::rename(testFileHelper.GetFullPath(L"one.txt"), testFileHelper.GetFullPath(L"1.txt"));
+            std::filesystem::rename(testFileHelper.GetFullPath(L"two.txt"), testFileHelper.GetFullPath(L"2.txt"));
+
+            CRenameJournal journal;
+            Assert::IsTrue(journal.Open(journalPath.c_str()) == S_OK);
+            Assert::IsTrue(journal.GetStepCount() == 3);
+            Assert::IsTrue(journal.GetDoneCount() == 1);
+
+            std::unique_ptr<CRenameBackend> backend = CRenameBackend::s_Create();
+            UINT failedCount = 1;
+            Assert::IsTrue(journal.Replay(false, backend.get(), &failedCount) == S_OK);
+            Assert::IsTrue(failedCount == 0);
+            Assert::IsTrue(journal.GetDoneCount() == 3);
+            Assert::IsTrue(testFileHelper.PathExists(L"1.txt"));
+            Assert::IsTrue(testFileHelper.PathExists(L"2.txt"));
+            Assert::IsTrue(testFileHelper.PathExists(L"3.txt"));
+        }
+
+        TEST_METHOD(VerifyUndoAfterLostDoneRecords)
+        {
+            CTestFileHelper testFileHelper;
+            CTestFileHelper journalFolder;
+            std::wstring journalPath = journalFolder.GetFullPath(L"journal.bin");
+            Assert::IsTrue(testFileHelper.AddFile(L"one.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"two.txt"));
+            {
+                CRenameJournal journal;
+                Assert::IsTrue(journal.Create(journalPath.c_str()) == S_OK);
+                CRenameExecutor executor(CRenameBackend::s_Create(), [](_In_ UINT, _In_ HRESULT) {});
+                executor.SetJournal(&journal);
+                executor.Add(0, testFileHelper.GetFullPath(L"one.txt").c_str(), L"1.txt");
+                executor.Add(1, testFileHelper.GetFullPath(L"two.txt").c_str(), L"2.txt");
+                executor.Run();
+            }
+
+            // The renames happened but a crash lost their done records, which
+            // come last and are a type byte and a step id each
+            std::filesystem::resize_file(journalPath, std::filesystem::file_size(journalPath) - 2 * (sizeof(BYTE) + sizeof(UINT32)));
+            {
+                CRenameJournal journal;
+                Assert::IsTrue(journal.Open(journalPath.c_str()) == S_OK);
+                Assert::IsTrue(journal.GetStepCount() == 2);
+                Assert::IsTrue(journal.GetDoneCount() == 0);
+            }
+
+            UINT failedCount = 1;
+            Assert::IsTrue(CRenameJournal::s_Undo(journalPath.c_str(), &failedCount) == S_OK);
+            Assert::IsTrue(failedCount == 0);
+            Assert::IsTrue(testFileHelper.PathExists(L"one.txt"));
+            Assert::IsTrue(testFileHelper.PathExists(L"two.txt"));
+            Assert::IsFalse(testFileHelper.PathExists(L"1.txt"));
+            Assert::IsFalse(testFileHelper.PathExists(L"2.txt"));
+        }
+
+        TEST_METHOD(VerifyTruncatedJournal)
+        {
+            CTestFileHelper journalFolder;
+            std::wstring journalPath = journalFolder.GetFullPath(L"journal.bin");
+            {
+                CRenameJournal journal;
+                Assert::IsTrue(journal.Create(journalPath.c_str()) == S_OK);
+                UINT folderId = journal.AddFolder(L"C:\\root\\");
+                journal.AddStep(folderId, L"a", L"b");
+                journal.AddStep(folderId, L"c", L"d");
+                journal.Commit(0);
+            }
+
+            // Cut the done record short as a crash in the middle of a write would
+            std::filesystem::resize_file(journalPath, std::filesystem::file_size(journalPath) - 2);
+            {
+                CRenameJournal journal;
+                Assert::IsTrue(journal.Open(journalPath.c_str()) == S_OK);
+                Assert::IsTrue(journal.GetStepCount() == 2);
+                Assert::IsTrue(journal.GetDoneCount() == 0);
+                journal.Commit(1);
+            }
+
+            // The partial record was dropped so the new one can be read back
+            CRenameJournal journal;
+            Assert::IsTrue(journal.Open(journalPath.c_str()) == S_OK);
+            Assert::IsTrue(journal.GetStepCount() == 2);
+            Assert::IsTrue(journal.GetDoneCount() == 1);
+
+            // Anything that is not a journal is rejected
+            {
+                std::ofstream file(journalFolder.GetFullPath(L"other.bin"), std::ios::binary);
+                file << "not a journal";
+            }
+            CRenameJournal other;
+            Assert::IsTrue(FAILED(other.Open(journalFolder.GetFullPath(L"other.bin").c_str())));
+        }
+    };
+}
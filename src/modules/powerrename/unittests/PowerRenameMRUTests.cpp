@@ -0,0 +1,152 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include <PowerRenameMRU.h>
+#include "TestFileHelper.h"
+#include <fstream>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace PowerRenameMRUTests
+{
+    TEST_CLASS(MRUTests)
+    {
+    public:
+        TEST_METHOD(VerifyRanking)
+        {
+            CTestFileHelper folder;
+            CRenameMRUStore store(folder.GetFullPath(L"mru.bin"));
+
+            // Used most often
+            for (int i = 0; i < 5; i++)
+            {
+                store.Add(L"often");
+            }
+            store.Add(L"once");
+            // Used once but more recently than once
+            store.Add(L"recent");
+
+            std::vector<std::wstring> results;
+            store.Find(L"", 10, results);
+            Assert::IsTrue(results.size() == 3);
+            Assert::IsTrue(results[0] == L"often");
+            Assert::IsTrue(results[1] == L"recent");
+            Assert::IsTrue(results[2] == L"once");
+
+            // Uses fade so a term used many times long ago ends up below one
+            // that is used now and then
+            for (int i = 0; i < RENAME_MRU_HALF_LIFE * 8; i++)
+            {
+                store.Add(L"other");
+                if (i % 16 == 0)
+                {
+                    store.Add(L"once");
+                }
+            }
+            store.Find(L"o", 10, results);
+            Assert::IsTrue(results.size() == 3);
+            Assert::IsTrue(results[0] == L"other");
+            Assert::IsTrue(results[1] == L"once");
+            Assert::IsTrue(results[2] == L"often");
+        }
+
+        TEST_METHOD(VerifyPrefixLookup)
+        {
+            CTestFileHelper folder;
+            CRenameMRUStore store(folder.GetFullPath(L"mru.bin"));
+            store.Add(L"IMG_");
+            store.Add(L"img_(\\d+)");
+            store.Add(L"Holiday");
+            store.Add(L"image");
+
+            std::vector<std::wstring> results;
+            store.Find(L"Im", 10, results);
+            Assert::IsTrue(results.size() == 3);
+            Assert::IsTrue(results[0] == L"image");
+
+            store.Find(L"IMG_", 10, results);
+            Assert::IsTrue(results.size() == 2);
+
+            store.Find(L"img_(", 1, results);
+            Assert::IsTrue(results.size() == 1);
+            Assert::IsTrue(results[0] == L"img_(\\d+)");
+
+            store.Find(L"x", 10, results);
+            Assert::IsTrue(results.empty());
+
+            // Enough terms under a prefix that the trie keeps them ranked
+            for (int i = 0; i < RENAME_MRU_SCAN_LIMIT * 4; i++)
+            {
+                store.Add(L"pic" + std::to_wstring(i));
+            }
+            store.Add(L"pic7");
+            store.Find(L"pic", 5, results);
+            Assert::IsTrue(results.size() == 5);
+            Assert::IsTrue(results[0] == L"pic7");
+            Assert::IsTrue(results[1] == L"pic" + std::to_wstring(RENAME_MRU_SCAN_LIMIT * 4 - 1));
+
+            store.Find(L"pic1", 100, results);
+            Assert::IsTrue(results.size() == 100);
+            Assert::IsTrue(results[0] == L"pic199");
+        }
+
+        TEST_METHOD(VerifyCapacity)
+        {
+            CTestFileHelper folder;
+            CRenameMRUStore store(folder.GetFullPath(L"mru.bin"), 3);
+            store.Add(L"a");
+            store.Add(L"a");
+            store.Add(L"b");
+            store.Add(L"c");
+            store.Add(L"d");
+
+            // b ranked lowest and made room for d
+            std::vector<std::wstring> results;
+            store.Find(L"", 10, results);
+            Assert::IsTrue(store.GetCount() == 3);
+            Assert::IsTrue(results.size() == 3);
+            Assert::IsTrue(results[0] == L"a");
+            Assert::IsTrue(results[1] == L"d");
+            Assert::IsTrue(results[2] == L"c");
+        }
+
+        TEST_METHOD(VerifySaveAndLoad)
+        {
+            CTestFileHelper folder;
+            std::wstring path = folder.GetFullPath(L"mru.bin");
+            {
+                CRenameMRUStore store(path);
+                for (int i = 0; i < 1000; i++)
+                {
+                    store.Add(L"term" + std::to_wstring(i % 300));
+                }
+                Assert::IsTrue(store.Save() == S_OK);
+                Assert::IsTrue(store.Save() == S_FALSE);
+            }
+
+            std::vector<std::wstring> expected;
+            {
+                CRenameMRUStore store(path);
+                Assert::IsTrue(store.GetCount() == 300);
+                store.Find(L"term2", 20, expected);
+                Assert::IsTrue(expected.size() == 20);
+                Assert::IsTrue(expected[0] == L"term29");
+            }
+
+            // The ranking carries on from where it was
+            CRenameMRUStore store(path);
+            store.Add(L"term250");
+            std::vector<std::wstring> results;
+            store.Find(L"term2", 20, results);
+            Assert::IsTrue(results[0] == L"term250");
+            Assert::IsTrue(std::equal(results.begin() + 1, results.end(), expected.begin()));
+
+            // Anything that is not an MRU file leaves the list empty
+            {
+                std::ofstream file(folder.GetFullPath(L"other.bin"), std::ios::binary);
+                file << "not an MRU file";
+            }
+            CRenameMRUStore other(folder.GetFullPath(L"other.bin"));
+            Assert::IsTrue(other.GetCount() == 0);
+        }
+    };
+}
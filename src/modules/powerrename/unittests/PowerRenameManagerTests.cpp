@@ -3,9 +3,15 @@
 #include <PowerRenameInterfaces.h>
 #include <PowerRenameManager.h>
 #include <PowerRenameItem.h>
+#include <PowerRenamePreview.h>
+#include <PowerRenameTemplate.h>
 #include "MockPowerRenameItem.h"
 #include "MockPowerRenameManagerEvents.h"
 #include "TestFileHelper.h"
+#include <Helpers.h>
+#include <fstream>
+#include <thread>
+#include <vector>
 
 #define DEFAULT_FLAGS MatchAllOccurences
 
@@ -102,6 +108,52 @@ namespace PowerRenameManagerTests
 
             mockMgrEvents->Release();
         }
+
+        // Advises mock events on mgr.  The caller releases them once done.
+        CMockPowerRenameManagerEvents* AdviseMockEvents(_In_ IPowerRenameManager* mgr)
+        {
+            CMockPowerRenameManagerEvents* mockMgrEvents = new CMockPowerRenameManagerEvents();
+            CComPtr<IPowerRenameManagerEvents> mgrEvents;
+            Assert::IsTrue(mockMgrEvents->QueryInterface(IID_PPV_ARGS(&mgrEvents)) == S_OK);
+            DWORD cookie = 0;
+            Assert::IsTrue(mgr->Advise(mgrEvents, &cookie) == S_OK);
+            return mockMgrEvents;
+        }
+
+        // Adds itemCount items named foo0.txt, foo1.txt and so on in one batch
+        void AddNumberedItems(_In_ IPowerRenameManager* mgr, _In_ UINT itemCount)
+        {
+            std::vector<CComPtr<IPowerRenameItem>> items;
+            std::vector<IPowerRenameItem*> addedItems;
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                std::wstring name = L"foo" + std::to_wstring(i) + L".txt";
+                CComPtr<IPowerRenameItem> item;
+                CMockPowerRenameItem::CreateInstance(name.c_str(), name.c_str(), 0, false, &item);
+                items.push_back(item);
+                addedItems.push_back(item);
+            }
+            Assert::IsTrue(mgr->AddItems(addedItems.data(), itemCount) == S_OK);
+        }
+
+        // Pumps the manager's message window until done returns true or five
+        // seconds pass
+        template<typename Done>
+        void PumpMessagesUntil(_In_ Done done)
+        {
+            ULONGLONG timeout = GetTickCount64() + 5000;
+            while (!done() && GetTickCount64() < timeout)
+            {
+                MSG msg;
+                while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+                {
+                    TranslateMessage(&msg);
+                    DispatchMessage(&msg);
+                }
+                Sleep(10);
+            }
+        }
+
         TEST_METHOD(CreateTest)
         {
             CComPtr<IPowerRenameManager> mgr;
@@ -125,6 +177,741 @@ namespace PowerRenameManagerTests
             Assert::IsTrue(mgr->Shutdown() == S_OK);
         }
 
+        TEST_METHOD(VerifyItemLookupByIndexAndId)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+
+            const UINT itemCount = 100;
+            int ids[itemCount] = { 0 };
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                CComPtr<IPowerRenameItem> item;
+                CMockPowerRenameItem::CreateInstance(L"foo", L"foo", 0, false, &item);
+                Assert::IsTrue(item->get_id(&ids[i]) == S_OK);
+                Assert::IsTrue(mgr->AddItem(item) == S_OK);
+                // Adding the same item twice must fail
+                Assert::IsTrue(mgr->AddItem(item) != S_OK);
+            }
+
+            UINT count = 0;
+            Assert::IsTrue(mgr->GetItemCount(&count) == S_OK);
+            Assert::IsTrue(count == itemCount);
+
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                CComPtr<IPowerRenameItem> itemByIndex;
+                Assert::IsTrue(mgr->GetItemByIndex(i, &itemByIndex) == S_OK);
+                CComPtr<IPowerRenameItem> itemById;
+                Assert::IsTrue(mgr->GetItemById(ids[i], &itemById) == S_OK);
+                Assert::IsTrue(itemByIndex == itemById);
+            }
+
+            CComPtr<IPowerRenameItem> invalidItem;
+            Assert::IsTrue(mgr->GetItemByIndex(itemCount, &invalidItem) != S_OK);
+            Assert::IsTrue(invalidItem == nullptr);
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+        }
+
+        TEST_METHOD(VerifyItemPathsAndExtensionOffsets)
+        {
+            CTestFileHelper testFileHelper;
+            struct
+            {
+                PCWSTR name;
+                UINT extensionOffset;
+            } files[] = {
+                { L"foo.txt", 3 },
+                { L"archive.tar.gz", 11 },
+                { L".gitignore", 10 },
+                { L"noextension", 11 },
+            };
+
+            CComPtr<IPowerRenameItemFactory> factory;
+            Assert::IsTrue(CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&factory)) == S_OK);
+            for (const auto& file : files)
+            {
+                Assert::IsTrue(testFileHelper.AddFile(file.name));
+                CComPtr<IShellItem> shellItem;
+                Assert::IsTrue(SHCreateItemFromParsingName(testFileHelper.GetFullPath(file.name).c_str(), nullptr, IID_PPV_ARGS(&shellItem)) == S_OK);
+                CComPtr<IPowerRenameItem> item;
+                Assert::IsTrue(factory->Create(shellItem, &item) == S_OK);
+
+                // The path is rebuilt from the shared parent folder and the name
+                PWSTR expectedPath = nullptr;
+                Assert::IsTrue(shellItem->GetDisplayName(SIGDN_FILESYSPATH, &expectedPath) == S_OK);
+                PWSTR path = nullptr;
+                Assert::IsTrue(item->get_path(&path) == S_OK);
+                Assert::AreEqual(expectedPath, path);
+                CoTaskMemFree(path);
+                CoTaskMemFree(expectedPath);
+
+                PWSTR originalName = nullptr;
+                Assert::IsTrue(item->get_originalName(&originalName) == S_OK);
+                Assert::AreEqual(file.name, originalName);
+                CoTaskMemFree(originalName);
+
+                UINT extensionOffset = 0;
+                Assert::IsTrue(item->get_extensionOffset(&extensionOffset) == S_OK);
+                Assert::IsTrue(extensionOffset == file.extensionOffset);
+            }
+        }
+
+        TEST_METHOD(VerifyItemFastPath)
+        {
+            CComPtr<IPowerRenameItem> spItem;
+            Assert::IsTrue(CMockPowerRenameItem::CreateInstance(L"C:\\foo\\bar.txt", L"bar.txt", 1, false, &spItem) == S_OK);
+            CPowerRenameItem* item = CPowerRenameItem::s_FromItem(spItem);
+            Assert::IsNotNull(item);
+            Assert::IsTrue(item->GetOriginalName() == L"bar.txt");
+            Assert::IsTrue(item->GetExtensionOffset() == 3);
+            Assert::IsTrue(item->GetDepth() == 1);
+
+            // No new name yet
+            std::wstring_view newName;
+            std::wstring text;
+            Assert::IsFalse(item->GetNewName(&newName));
+            Assert::IsFalse(item->AppendNewName(text));
+            Assert::IsFalse(item->ShouldRename(0));
+
+            Assert::IsTrue(spItem->put_newName(L"baz.txt") == S_OK);
+            Assert::IsTrue(item->GetNewName(&newName));
+            Assert::IsTrue(newName == L"baz.txt");
+            Assert::IsTrue(item->ShouldRename(0));
+            Assert::IsFalse(item->ShouldRename(PowerRenameFlags::ExcludeSubfolders));
+            Assert::IsTrue(item->SetNewName(L"qux.txt", 7) == S_OK);
+            Assert::IsTrue(item->AppendNewName(text));
+            Assert::IsTrue(text == L"qux.txt");
+
+            // The original name is not a change
+            Assert::IsTrue(item->SetNewName(L"bar.txt", 7) == S_OK);
+            Assert::IsFalse(item->HasChangedName());
+            Assert::IsTrue(spItem->Reset() == S_OK);
+            Assert::IsFalse(item->GetNewName(&newName));
+
+            // The COM getters see what the fast path sets and the other way around
+            item->SetSelected(false);
+            bool selected = true;
+            Assert::IsTrue(spItem->get_selected(&selected) == S_OK);
+            Assert::IsFalse(selected);
+            Assert::IsTrue(spItem->put_selected(true) == S_OK);
+            Assert::IsTrue(item->IsSelected());
+        }
+
+        TEST_METHOD(VerifyItemFileTimeCached)
+        {
+            CTestFileHelper testFileHelper;
+            Assert::IsTrue(testFileHelper.AddFile(L"foo.txt"));
+            std::wstring path = testFileHelper.GetFullPath(L"foo.txt");
+
+            CComPtr<IPowerRenameItemFactory> factory;
+            Assert::IsTrue(CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&factory)) == S_OK);
+            CComPtr<IPowerRenameItem> spItem;
+            Assert::IsTrue(factory->CreateFromPath(path.c_str(), false, nullptr, &spItem) == S_OK);
+            CPowerRenameItem* item = CPowerRenameItem::s_FromItem(spItem);
+            Assert::IsNotNull(item);
+
+            SYSTEMTIME expected = { 0 };
+            SYSTEMTIME fileTime = { 0 };
+            Assert::IsTrue(CPowerRenameTemplate::s_GetFileTime(path.c_str(), &expected) == S_OK);
+            Assert::IsTrue(item->GetFileTime(&fileTime) == S_OK);
+            Assert::IsTrue(memcmp(&expected, &fileTime, sizeof(fileTime)) == 0);
+
+            // Read once, so the time outlives the file
+            Assert::IsTrue(DeleteFile(path.c_str()) != FALSE);
+            ZeroMemory(&fileTime, sizeof(fileTime));
+            Assert::IsTrue(item->GetFileTime(&fileTime) == S_OK);
+            Assert::IsTrue(memcmp(&expected, &fileTime, sizeof(fileTime)) == 0);
+        }
+
+        TEST_METHOD(VerifyEnumerateItemsOrderAcrossChunks)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+
+            // Enough items to be split across several regex worker chunks.  Every third
+            // item does not match so the enumeration counter must skip it.
+            const UINT itemCount = 2000;
+            std::vector<CComPtr<IPowerRenameItem>> items;
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                std::wstring name = ((i % 3) == 0 ? L"baz" : L"foo") + std::to_wstring(i) + L".txt";
+                CComPtr<IPowerRenameItem> item;
+                CMockPowerRenameItem::CreateInstance(name.c_str(), name.c_str(), 0, false, &item);
+                Assert::IsTrue(mgr->AddItem(item) == S_OK);
+                items.push_back(item);
+            }
+
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS | EnumerateItems);
+            renRegEx->put_searchTerm(L"foo");
+            renRegEx->put_replaceTerm(L"bar");
+
+            Sleep(1000);
+
+            unsigned long expectedEnumIndex = 1;
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                PWSTR newName = nullptr;
+                if ((i % 3) == 0)
+                {
+                    Assert::IsTrue(items[i]->get_newName(&newName) != S_OK);
+                }
+                else
+                {
+                    std::wstring expected = L"bar" + std::to_wstring(i) + L" (" + std::to_wstring(expectedEnumIndex) + L").txt";
+                    Assert::IsTrue(items[i]->get_newName(&newName) == S_OK);
+                    Assert::AreEqual(expected.c_str(), newName);
+                    expectedEnumIndex++;
+                }
+                CoTaskMemFree(newName);
+            }
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+        }
+
+        TEST_METHOD(VerifyCounterTemplateAcrossChunks)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+
+            // A counter numbers the renamed items in order without the
+            // EnumerateItems flag
+            const UINT itemCount = 2000;
+            std::vector<CComPtr<IPowerRenameItem>> items;
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                std::wstring name = ((i % 3) == 0 ? L"baz" : L"foo") + std::to_wstring(i) + L".txt";
+                CComPtr<IPowerRenameItem> item;
+                CMockPowerRenameItem::CreateInstance(name.c_str(), name.c_str(), 0, false, &item);
+                Assert::IsTrue(mgr->AddItem(item) == S_OK);
+                items.push_back(item);
+            }
+
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS);
+            renRegEx->put_searchTerm(L"foo");
+            renRegEx->put_replaceTerm(L"bar${start=1,padding=4}_");
+
+            Sleep(1000);
+
+            UINT expectedCounter = 1;
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                PWSTR newName = nullptr;
+                if ((i % 3) == 0)
+                {
+                    Assert::IsTrue(items[i]->get_newName(&newName) != S_OK);
+                }
+                else
+                {
+                    std::wstring counter = std::to_wstring(expectedCounter);
+                    std::wstring expected = L"bar" + std::wstring(4 - counter.length(), L'0') + counter + L"_" + std::to_wstring(i) + L".txt";
+                    Assert::IsTrue(items[i]->get_newName(&newName) == S_OK);
+                    Assert::AreEqual(expected.c_str(), newName);
+                    expectedCounter++;
+                }
+                CoTaskMemFree(newName);
+            }
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+        }
+
+        TEST_METHOD(VerifySelectedAndRenameCounts)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+
+            const UINT itemCount = 10;
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                // Even items match the search term below
+                std::wstring name = ((i % 2) == 0 ? L"foo" : L"baz") + std::to_wstring(i) + L".txt";
+                CComPtr<IPowerRenameItem> item;
+                CMockPowerRenameItem::CreateInstance(name.c_str(), name.c_str(), 0, false, &item);
+                Assert::IsTrue(mgr->AddItem(item) == S_OK);
+            }
+
+            UINT selectedCount = 0;
+            UINT renameCount = 0;
+            Assert::IsTrue(mgr->GetSelectedItemCount(&selectedCount) == S_OK);
+            Assert::IsTrue(mgr->GetRenameItemCount(&renameCount) == S_OK);
+            Assert::IsTrue(selectedCount == itemCount);
+            Assert::IsTrue(renameCount == 0);
+
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS);
+            renRegEx->put_searchTerm(L"foo");
+            renRegEx->put_replaceTerm(L"bar");
+
+            Sleep(1000);
+
+            Assert::IsTrue(mgr->GetRenameItemCount(&renameCount) == S_OK);
+            Assert::IsTrue(renameCount == itemCount / 2);
+
+            // Deselecting a matching item removes it from both counts
+            Assert::IsTrue(mgr->SetItemSelected(0, false) == S_OK);
+            Assert::IsTrue(mgr->GetSelectedItemCount(&selectedCount) == S_OK);
+            Assert::IsTrue(mgr->GetRenameItemCount(&renameCount) == S_OK);
+            Assert::IsTrue(selectedCount == itemCount - 1);
+            Assert::IsTrue(renameCount == itemCount / 2 - 1);
+
+            Assert::IsTrue(mgr->SetAllItemsSelected(false) == S_OK);
+            Assert::IsTrue(mgr->GetSelectedItemCount(&selectedCount) == S_OK);
+            Assert::IsTrue(mgr->GetRenameItemCount(&renameCount) == S_OK);
+            Assert::IsTrue(selectedCount == 0);
+            Assert::IsTrue(renameCount == 0);
+
+            Assert::IsTrue(mgr->SetAllItemsSelected(true) == S_OK);
+            Assert::IsTrue(mgr->GetSelectedItemCount(&selectedCount) == S_OK);
+            Assert::IsTrue(mgr->GetRenameItemCount(&renameCount) == S_OK);
+            Assert::IsTrue(selectedCount == itemCount);
+            Assert::IsTrue(renameCount == itemCount / 2);
+
+            Assert::IsTrue(mgr->SetItemSelected(itemCount, false) != S_OK);
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+        }
+
+        TEST_METHOD(VerifyRapidEditsUseLatestSearchTerm)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+
+            const UINT itemCount = 2000;
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                std::wstring name = L"foo" + std::to_wstring(i) + L".txt";
+                CComPtr<IPowerRenameItem> item;
+                CMockPowerRenameItem::CreateInstance(name.c_str(), name.c_str(), 0, false, &item);
+                mgr->AddItem(item);
+            }
+
+            // Typing faster than the preview is evaluated.  Only the last
+            // search and replace may be reflected in the new names.
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS);
+            for (UINT i = 0; i < 50; i++)
+            {
+                renRegEx->put_searchTerm(std::to_wstring(i).c_str());
+                renRegEx->put_replaceTerm(L"x");
+            }
+            renRegEx->put_searchTerm(L"foo");
+            renRegEx->put_replaceTerm(L"bar");
+
+            auto countLatestNames = [&]() {
+                UINT count = 0;
+                for (UINT i = 0; i < itemCount; i++)
+                {
+                    CComPtr<IPowerRenameItem> item;
+                    PWSTR newName = nullptr;
+                    if (SUCCEEDED(mgr->GetItemByIndex(i, &item)) && SUCCEEDED(item->get_newName(&newName)))
+                    {
+                        std::wstring expected = L"bar" + std::to_wstring(i) + L".txt";
+                        count += (expected == newName) ? 1 : 0;
+                        CoTaskMemFree(newName);
+                    }
+                }
+                return count;
+            };
+
+            UINT latestCount = 0;
+            ULONGLONG timeout = GetTickCount64() + 5000;
+            while (latestCount < itemCount && GetTickCount64() < timeout)
+            {
+                Sleep(10);
+                latestCount = countLatestNames();
+            }
+            Assert::IsTrue(latestCount == itemCount);
+
+            UINT renameCount = 0;
+            Assert::IsTrue(mgr->GetRenameItemCount(&renameCount) == S_OK);
+            Assert::IsTrue(renameCount == itemCount);
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+        }
+
+        TEST_METHOD(VerifyUpdateRangeEventsCoalesced)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+            CMockPowerRenameManagerEvents* mockMgrEvents = AdviseMockEvents(mgr);
+
+            const UINT itemCount = 2000;
+            AddNumberedItems(mgr, itemCount);
+
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS);
+            renRegEx->put_searchTerm(L"foo");
+            renRegEx->put_replaceTerm(L"bar");
+
+            // Wait until the worker reports completion
+            PumpMessagesUntil([&]() { return mockMgrEvents->m_regExCompleted; });
+
+            // Every item changed but the changes arrive as a few ranges
+            Assert::IsTrue(mockMgrEvents->m_regExCompleted);
+            Assert::IsTrue(mockMgrEvents->m_updateRangeCount > 0);
+            Assert::IsTrue(mockMgrEvents->m_updateRangeCount < itemCount);
+            Assert::IsTrue(mockMgrEvents->m_updateRangeFirst == 0);
+            Assert::IsTrue(mockMgrEvents->m_updateRangeLast == itemCount - 1);
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+
+            mockMgrEvents->Release();
+        }
+
+        TEST_METHOD(VerifyPreviewSnapshot)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+            CMockPowerRenameManagerEvents* mockMgrEvents = AdviseMockEvents(mgr);
+
+            const UINT itemCount = 2000;
+            AddNumberedItems(mgr, itemCount);
+
+            const CPreviewSnapshot* snapshot = nullptr;
+            Assert::IsTrue(mgr->GetPreviewSnapshot(&snapshot) == S_OK);
+            Assert::IsTrue(snapshot->GetItemCount() == itemCount);
+            Assert::IsTrue(snapshot->GetItem(itemCount) == nullptr);
+            Assert::IsTrue(snapshot->GetItem(7)->newName == nullptr);
+
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS);
+            renRegEx->put_searchTerm(L"foo");
+            renRegEx->put_replaceTerm(L"bar");
+
+            PumpMessagesUntil([&]() { return mockMgrEvents->m_regExCompleted; });
+            Assert::IsTrue(mockMgrEvents->m_regExCompleted);
+
+            Assert::IsTrue(mgr->GetPreviewSnapshot(&snapshot) == S_OK);
+            for (UINT i = 0; i < itemCount; i++)
+            {
+                const PreviewItem* previewItem = snapshot->GetItem(i);
+                Assert::IsTrue(previewItem != nullptr);
+                Assert::IsTrue(previewItem->state == (PREVIEW_ITEM_SELECTED | PREVIEW_ITEM_SHOULD_RENAME | PREVIEW_ITEM_CHANGED));
+                Assert::IsTrue(std::wstring(previewItem->originalName) == L"foo" + std::to_wstring(i) + L".txt");
+                Assert::IsTrue(std::wstring(previewItem->newName) == L"bar" + std::to_wstring(i) + L".txt");
+            }
+
+            // Unchecking an item only makes its page again.  The old snapshot
+            // is deleted by the change but its pages are shared.
+            auto pages = snapshot->GetPages();
+            Assert::IsTrue(mgr->SetItemSelected(PREVIEW_PAGE_SIZE + 1, false) == S_OK);
+            Assert::IsTrue(mgr->GetPreviewSnapshot(&snapshot) == S_OK);
+            Assert::IsTrue(snapshot->GetItem(PREVIEW_PAGE_SIZE + 1)->state == PREVIEW_ITEM_CHANGED);
+            Assert::IsTrue(pages[1]->items[1].state & PREVIEW_ITEM_SELECTED);
+            Assert::IsTrue(snapshot->GetPages()[0] == pages[0]);
+            Assert::IsTrue(snapshot->GetPages()[1] != pages[1]);
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+
+            mockMgrEvents->Release();
+        }
+
+        TEST_METHOD(VerifyItemBatchesContinueEnumeration)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS | EnumerateItems);
+            renRegEx->put_searchTerm(L"foo");
+            renRegEx->put_replaceTerm(L"bar");
+
+            // Every third item does not match so the enumeration counter must
+            // skip it, including across the batches
+            const UINT batchCount = 3;
+            const UINT batchSize = 1000;
+            unsigned long expectedEnumIndex = 1;
+            for (UINT batch = 0; batch < batchCount; batch++)
+            {
+                std::vector<CComPtr<IPowerRenameItem>> items;
+                std::vector<IPowerRenameItem*> addedItems;
+                for (UINT i = 0; i < batchSize; i++)
+                {
+                    std::wstring name = ((i % 3) == 0 ? L"baz" : L"foo") + std::to_wstring(i) + L".txt";
+                    CComPtr<IPowerRenameItem> item;
+                    CMockPowerRenameItem::CreateInstance(name.c_str(), name.c_str(), 0, false, &item);
+                    items.push_back(item);
+                    addedItems.push_back(item);
+                }
+
+                Assert::IsTrue(mgr->AddItems(addedItems.data(), batchSize) == S_OK);
+                Assert::IsTrue(mgr->WaitForPreview() == S_OK);
+
+                const CPreviewSnapshot* snapshot = nullptr;
+                Assert::IsTrue(mgr->GetPreviewSnapshot(&snapshot) == S_OK);
+                Assert::IsTrue(snapshot->GetItemCount() == batchSize);
+                for (UINT i = 0; i < batchSize; i++)
+                {
+                    const PreviewItem* previewItem = snapshot->GetItem(i);
+                    if ((i % 3) == 0)
+                    {
+                        Assert::IsTrue(previewItem->newName == nullptr);
+                    }
+                    else
+                    {
+                        std::wstring expected = L"bar" + std::to_wstring(i) + L" (" + std::to_wstring(expectedEnumIndex) + L").txt";
+                        Assert::AreEqual(expected.c_str(), previewItem->newName);
+                        expectedEnumIndex++;
+                    }
+                }
+
+                Assert::IsTrue(mgr->RemoveAllItems() == S_OK);
+                UINT itemCount = 0;
+                Assert::IsTrue(mgr->GetItemCount(&itemCount) == S_OK);
+                Assert::IsTrue(itemCount == 0);
+            }
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+        }
+
+        TEST_METHOD(VerifyChangedItemsRankSelect)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+            CMockPowerRenameManagerEvents* mockMgrEvents = AdviseMockEvents(mgr);
+
+            const UINT itemCount = 2000;
+            AddNumberedItems(mgr, itemCount);
+
+            const CPreviewSnapshot* snapshot = nullptr;
+            Assert::IsTrue(mgr->GetPreviewSnapshot(&snapshot) == S_OK);
+            Assert::IsTrue(snapshot->GetChangedItemCount() == 0);
+
+            // Only the names ending in 7 change, one item in ten across all pages
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS);
+            renRegEx->put_searchTerm(L"7.txt");
+            renRegEx->put_replaceTerm(L"7.log");
+
+            PumpMessagesUntil([&]() { return mockMgrEvents->m_regExCompleted; });
+            Assert::IsTrue(mockMgrEvents->m_regExCompleted);
+
+            Assert::IsTrue(mgr->GetPreviewSnapshot(&snapshot) == S_OK);
+            const UINT changedCount = itemCount / 10;
+            Assert::IsTrue(snapshot->GetChangedItemCount() == changedCount);
+            for (UINT rank = 0; rank < changedCount; rank++)
+            {
+                UINT index = 0;
+                Assert::IsTrue(snapshot->SelectChanged(rank, &index));
+                Assert::IsTrue(index == rank * 10 + 7);
+                Assert::IsTrue(snapshot->GetChangedRank(index) == rank);
+                Assert::IsTrue(snapshot->GetChangedRank(index + 1) == rank + 1);
+            }
+            UINT index = 0;
+            Assert::IsFalse(snapshot->SelectChanged(changedCount, &index));
+            Assert::IsTrue(snapshot->GetChangedRank(itemCount) == changedCount);
+
+            // Unchecking an item does not change its name
+            Assert::IsTrue(mgr->SetItemSelected(7, false) == S_OK);
+            Assert::IsTrue(mgr->GetPreviewSnapshot(&snapshot) == S_OK);
+            Assert::IsTrue(snapshot->GetChangedItemCount() == changedCount);
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+
+            mockMgrEvents->Release();
+        }
+
+        TEST_METHOD(VerifyRegExTimeoutReportsError)
+        {
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+            CMockPowerRenameManagerEvents* mockMgrEvents = AdviseMockEvents(mgr);
+
+            // Backtracks exponentially on the first name, matches the second quickly
+            PCWSTR names[] = { L"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab", L"baa" };
+            for (PCWSTR name : names)
+            {
+                CComPtr<IPowerRenameItem> item;
+                CMockPowerRenameItem::CreateInstance(name, name, 0, false, &item);
+                Assert::IsTrue(mgr->AddItem(item) == S_OK);
+            }
+
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(MatchAllOccurences | UseRegularExpressions);
+            renRegEx->put_searchTerm(L"(a+)+$");
+            renRegEx->put_replaceTerm(L"X");
+
+            CComPtr<IPowerRenameItem> item;
+            Assert::IsTrue(mgr->GetItemByIndex(1, &item) == S_OK);
+            PWSTR newName = nullptr;
+            PumpMessagesUntil([&]() { return mockMgrEvents->m_itemError != nullptr && SUCCEEDED(item->get_newName(&newName)); });
+
+            // The item that ran out of time is reported and the rest are still evaluated
+            Assert::IsTrue(newName != nullptr);
+            Assert::AreEqual(L"bX", newName);
+            CoTaskMemFree(newName);
+
+            item = nullptr;
+            Assert::IsTrue(mgr->GetItemByIndex(0, &item) == S_OK);
+            Assert::IsTrue(mockMgrEvents->m_itemError == item);
+            Assert::IsTrue(mockMgrEvents->m_itemErrorResult == HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+            newName = nullptr;
+            Assert::IsTrue(item->get_newName(&newName) != S_OK);
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+
+            mockMgrEvents->Release();
+        }
+
+        TEST_METHOD(VerifyEnumerationAddsItemsInBackground)
+        {
+            CTestFileHelper testFileHelper;
+            Assert::IsTrue(testFileHelper.AddFile(L"foo1.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"foo2.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"bar.txt"));
+            Assert::IsTrue(testFileHelper.AddFolder(L"sub"));
+            Assert::IsTrue(testFileHelper.AddFile(L"sub\\foo3.txt"));
+
+            CComPtr<IShellItem> folder;
+            Assert::IsTrue(SHCreateItemFromParsingName(testFileHelper.GetTempDirectory().c_str(), nullptr, IID_PPV_ARGS(&folder)) == S_OK);
+            CComPtr<IShellItemArray> dataSource;
+            Assert::IsTrue(SHCreateShellItemArrayFromShellItem(folder, IID_PPV_ARGS(&dataSource)) == S_OK);
+
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+            CComPtr<IPowerRenameItemFactory> factory;
+            Assert::IsTrue(CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&factory)) == S_OK);
+            Assert::IsTrue(mgr->put_renameItemFactory(factory) == S_OK);
+            CMockPowerRenameManagerEvents* mockMgrEvents = AdviseMockEvents(mgr);
+
+            // The search term is set first so the preview has to follow the items as they arrive
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS);
+            renRegEx->put_searchTerm(L"foo");
+            renRegEx->put_replaceTerm(L"bar");
+
+            Assert::IsTrue(mgr->StartEnumeration(dataSource) == S_OK);
+
+            // Wait until every item is added and evaluated
+            UINT renameCount = 0;
+            PumpMessagesUntil([&]() {
+                mgr->GetRenameItemCount(&renameCount);
+                return mockMgrEvents->m_enumerationCompleted && renameCount >= 3;
+            });
+
+            // The folder itself and the five items in it
+            UINT itemCount = 0;
+            Assert::IsTrue(mgr->GetItemCount(&itemCount) == S_OK);
+            Assert::IsTrue(mockMgrEvents->m_enumerationCompleted);
+            Assert::IsTrue(itemCount == 6);
+            Assert::IsTrue(mockMgrEvents->m_itemsAddedCount == itemCount);
+            Assert::IsTrue(mockMgrEvents->m_itemsAddedFirst == 0);
+            Assert::IsTrue(mockMgrEvents->m_itemsAddedLast == itemCount - 1);
+            Assert::IsTrue(renameCount == 3);
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+
+            mockMgrEvents->Release();
+        }
+
+        TEST_METHOD(VerifyManifestImportReportsError)
+        {
+            // The second line is not UTF-8
+            CTestFileHelper testFileHelper;
+            {
+                std::ofstream file(testFileHelper.GetFullPath(L"manifest.txt"), std::ios::binary);
+                file << "C:\\Items\\foo1.txt\n"
+                        "C:\\Items\\\xFF\xFE.txt\n";
+            }
+
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+            CComPtr<IPowerRenameItemFactory> factory;
+            Assert::IsTrue(CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&factory)) == S_OK);
+            Assert::IsTrue(mgr->put_renameItemFactory(factory) == S_OK);
+            CMockPowerRenameManagerEvents* mockMgrEvents = AdviseMockEvents(mgr);
+
+            Assert::IsTrue(mgr->StartManifestImport(testFileHelper.GetFullPath(L"manifest.txt").c_str()) == S_OK);
+            PumpMessagesUntil([&]() { return mockMgrEvents->m_enumerationCompleted; });
+
+            // Reported before the completion
+            Assert::IsTrue(mockMgrEvents->m_enumerationCompleted);
+            Assert::IsTrue(FAILED(mockMgrEvents->m_enumerationError));
+
+            // A missing manifest fails on the worker too
+            mockMgrEvents->m_enumerationCompleted = false;
+            mockMgrEvents->m_enumerationError = S_OK;
+            Assert::IsTrue(mgr->StartManifestImport(testFileHelper.GetFullPath(L"missing.txt").c_str()) == S_OK);
+            PumpMessagesUntil([&]() { return mockMgrEvents->m_enumerationCompleted; });
+            Assert::IsTrue(FAILED(mockMgrEvents->m_enumerationError));
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+
+            mockMgrEvents->Release();
+        }
+
+        TEST_METHOD(VerifyParallelEnumerationMatchesSerial)
+        {
+            CTestFileHelper testFileHelper;
+            Assert::IsTrue(testFileHelper.AddFile(L"top.txt"));
+            for (PCWSTR folder : { L"a", L"b", L"c" })
+            {
+                std::wstring path(folder);
+                Assert::IsTrue(testFileHelper.AddFolder(path));
+                Assert::IsTrue(testFileHelper.AddFile(path + L"\\one.txt"));
+                Assert::IsTrue(testFileHelper.AddFile(path + L"\\two.txt"));
+                Assert::IsTrue(testFileHelper.AddFolder(path + L"\\deep"));
+                Assert::IsTrue(testFileHelper.AddFile(path + L"\\deep\\three.txt"));
+            }
+
+            // The parallel walk hands shell items to the thread pool so it
+            // runs in the multithreaded apartment
+            std::vector<std::pair<std::wstring, UINT>> serialItems;
+            std::vector<std::pair<std::wstring, UINT>> parallelItems;
+            HRESULT serialResult = E_FAIL;
+            HRESULT parallelResult = E_FAIL;
+            std::thread walkThread([&]() {
+                if (SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED)))
+                {
+                    CComPtr<IShellItem> folder;
+                    CComPtr<IShellItemArray> dataSource;
+                    CComPtr<IPowerRenameItemFactory> factory;
+                    if (SUCCEEDED(SHCreateItemFromParsingName(testFileHelper.GetTempDirectory().c_str(), nullptr, IID_PPV_ARGS(&folder))) &&
+                        SUCCEEDED(SHCreateShellItemArrayFromShellItem(folder, IID_PPV_ARGS(&dataSource))) &&
+                        SUCCEEDED(CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&factory))))
+                    {
+                        auto collect = [](std::vector<std::pair<std::wstring, UINT>>& found) {
+                            return [&found](std::vector<CComPtr<IPowerRenameItem>>& items) {
+                                for (IPowerRenameItem* item : items)
+                                {
+                                    PWSTR originalName = nullptr;
+                                    UINT depth = 0;
+                                    item->get_originalName(&originalName);
+                                    item->get_depth(&depth);
+                                    found.emplace_back(originalName ? originalName : L"", depth);
+                                    CoTaskMemFree(originalName);
+                                }
+                                return S_OK;
+                            };
+                        };
+                        serialResult = EnumerateShellItems(dataSource, factory, nullptr, collect(serialItems));
+                        parallelResult = EnumerateShellItemsParallel(dataSource, factory, nullptr, collect(parallelItems));
+                    }
+                    CoUninitialize();
+                }
+            });
+            walkThread.join();
+
+            // The folder itself, the file next to the folders and five items per folder
+            Assert::IsTrue(serialResult == S_OK);
+            Assert::IsTrue(parallelResult == S_OK);
+            Assert::IsTrue(serialItems.size() == 17);
+            Assert::IsTrue(parallelItems == serialItems);
+        }
+
         TEST_METHOD(VerifyRenameManagerEvents)
         {
             CComPtr<IPowerRenameManager> mgr;
@@ -229,5 +1016,57 @@ namespace PowerRenameManagerTests
 
             RenameHelper(renamePairs, ARRAYSIZE(renamePairs), L"foo", L"bar", DEFAULT_FLAGS | ExcludeSubfolders);
         }
+
+        TEST_METHOD(VerifyRenameProgressAndErrors)
+        {
+            // An item whose new name is taken fails without stopping the others
+            CTestFileHelper testFileHelper;
+            Assert::IsTrue(testFileHelper.AddFile(L"foo1.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"foo2.txt"));
+            Assert::IsTrue(testFileHelper.AddFile(L"bar1.txt"));
+
+            CComPtr<IPowerRenameManager> mgr;
+            Assert::IsTrue(CPowerRenameManager::s_CreateInstance(&mgr) == S_OK);
+            CMockPowerRenameManagerEvents* mockMgrEvents = AdviseMockEvents(mgr);
+
+            PCWSTR names[] = { L"foo1.txt", L"foo2.txt" };
+            for (PCWSTR name : names)
+            {
+                CComPtr<IPowerRenameItem> item;
+                CMockPowerRenameItem::CreateInstance(testFileHelper.GetFullPath(name).c_str(), name, 0, false, &item);
+                mgr->AddItem(item);
+            }
+
+            CComPtr<IPowerRenameRegEx> renRegEx;
+            Assert::IsTrue(mgr->get_renameRegEx(&renRegEx) == S_OK);
+            renRegEx->put_flags(DEFAULT_FLAGS);
+            renRegEx->put_searchTerm(L"foo");
+            renRegEx->put_replaceTerm(L"bar");
+
+            Sleep(1000);
+
+            Assert::IsTrue(mgr->Rename(0) == S_OK);
+
+            // Progress and errors are delivered before the completion
+            Assert::IsTrue(mockMgrEvents->m_renameCompleted);
+            Assert::IsTrue(mockMgrEvents->m_errorCount == 1);
+            Assert::IsTrue(mockMgrEvents->m_itemError != nullptr);
+            Assert::IsTrue(mockMgrEvents->m_itemErrorResult == HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS));
+            PWSTR errorName = nullptr;
+            Assert::IsTrue(mockMgrEvents->m_itemError->get_originalName(&errorName) == S_OK);
+            Assert::IsTrue(wcscmp(errorName, L"foo1.txt") == 0);
+            CoTaskMemFree(errorName);
+            Assert::IsTrue(mockMgrEvents->m_renameProgressCompleted == 2);
+            Assert::IsTrue(mockMgrEvents->m_renameProgressTotal == 2);
+
+            Assert::IsTrue(testFileHelper.PathExists(L"foo1.txt"));
+            Assert::IsTrue(testFileHelper.PathExists(L"bar1.txt"));
+            Assert::IsTrue(testFileHelper.PathExists(L"bar2.txt"));
+            Assert::IsFalse(testFileHelper.PathExists(L"foo2.txt"));
+
+            Assert::IsTrue(mgr->Shutdown() == S_OK);
+
+            mockMgrEvents->Release();
+        }
     };
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include <PowerRenameItem.h>
+#include <PowerRenameManifest.h>
+#include "TestFileHelper.h"
+#include <fstream>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace PowerRenameManifestTests
+{
+    void WriteManifest(_In_ CTestFileHelper& testFileHelper, _In_ PCWSTR name, _In_ const std::string& content)
+    {
+        std::ofstream file(testFileHelper.GetFullPath(name), std::ios::binary);
+        file << content;
+    }
+
+    HRESULT Import(_In_ CTestFileHelper& testFileHelper, _In_ PCWSTR name, _Inout_ std::vector<CComPtr<IPowerRenameItem>>& items)
+    {
+        CComPtr<IPowerRenameItemFactory> spItemFactory;
+        HRESULT hr = CPowerRenameItem::s_CreateInstance(nullptr, IID_PPV_ARGS(&spItemFactory));
+        if (SUCCEEDED(hr))
+        {
+            hr = ImportManifest(testFileHelper.GetFullPath(name).c_str(), spItemFactory, nullptr, [&items](std::vector<CComPtr<IPowerRenameItem>>& added) {
+                items.insert(items.end(), added.begin(), added.end());
+                return S_OK;
+            });
+        }
+        return hr;
+    }
+
+    std::wstring GetPath(_In_ IPowerRenameItem* item)
+    {
+        std::wstring result;
+        PWSTR path = nullptr;
+        if (SUCCEEDED(item->get_path(&path)))
+        {
+            result = path;
+            CoTaskMemFree(path);
+        }
+        return result;
+    }
+
+    TEST_CLASS(ManifestTests)
+    {
+    public:
+        TEST_METHOD(VerifyImport)
+        {
+            CTestFileHelper testFileHelper;
+            WriteManifest(testFileHelper, L"manifest.txt",
+                "\xEF\xBB\xBF"
+                "C:\\Photos\\IMG_0001.JPG\r\n"
+                "\r\n"
+                "C:\\Photos\\IMG_0002.JPG\tBeach.jpg\r\n"
+                "C:\\Photos\\Raw\\\n"
+                "C:\\Photos\\\xC3\xA9t\xC3\xA9.png");
+
+            std::vector<CComPtr<IPowerRenameItem>> items;
+            Assert::IsTrue(Import(testFileHelper, L"manifest.txt", items) == S_OK);
+            Assert::IsTrue(items.size() == 4);
+
+            Assert::IsTrue(GetPath(items[0]) == L"C:\\Photos\\IMG_0001.JPG");
+            Assert::IsTrue(GetPath(items[1]) == L"C:\\Photos\\IMG_0002.JPG");
+            Assert::IsTrue(GetPath(items[2]) == L"C:\\Photos\\Raw");
+            Assert::IsTrue(GetPath(items[3]) == L"C:\\Photos\\\u00E9t\u00E9.png");
+
+            CPowerRenameItem* item = CPowerRenameItem::s_FromItem(items[0]);
+            Assert::IsTrue(item != nullptr);
+            Assert::IsTrue(!item->IsFolder() && item->GetMappedName().empty());
+            Assert::IsTrue(item->GetOriginalName() == L"IMG_0001.JPG");
+
+            item = CPowerRenameItem::s_FromItem(items[1]);
+            Assert::IsTrue(item->GetMappedName() == L"Beach.jpg");
+
+            item = CPowerRenameItem::s_FromItem(items[2]);
+            Assert::IsTrue(item->IsFolder() && item->GetOriginalName() == L"Raw");
+        }
+
+        TEST_METHOD(VerifyImportLargeManifestInOrder)
+        {
+            // Spans several chunks so they are parsed in parallel
+            const UINT count = 100000;
+            std::string content;
+            for (UINT i = 0; i < count; i++)
+            {
+                content += "C:\\Items\\Item" + std::to_string(i) + ".txt\n";
+            }
+
+            CTestFileHelper testFileHelper;
+            WriteManifest(testFileHelper, L"manifest.txt", content);
+
+            std::vector<CComPtr<IPowerRenameItem>> items;
+            Assert::IsTrue(Import(testFileHelper, L"manifest.txt", items) == S_OK);
+            Assert::IsTrue(items.size() == count);
+            for (UINT i = 0; i < count; i += 997)
+            {
+                Assert::IsTrue(GetPath(items[i]) == L"C:\\Items\\Item" + std::to_wstring(i) + L".txt");
+            }
+        }
+
+        TEST_METHOD(VerifyImportErrors)
+        {
+            CTestFileHelper testFileHelper;
+            std::vector<CComPtr<IPowerRenameItem>> items;
+            Assert::IsTrue(FAILED(Import(testFileHelper, L"missing.txt", items)));
+
+            WriteManifest(testFileHelper, L"empty.txt", "");
+            Assert::IsTrue(Import(testFileHelper, L"empty.txt", items) == S_OK);
+            Assert::IsTrue(items.empty());
+
+            // Not UTF-8
+            WriteManifest(testFileHelper, L"invalid.txt", "C:\\Items\\\xFF\xFE.txt\n");
+            Assert::IsTrue(FAILED(Import(testFileHelper, L"invalid.txt", items)));
+            Assert::IsTrue(items.empty());
+        }
+    };
+}
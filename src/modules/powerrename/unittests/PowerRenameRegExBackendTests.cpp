@@ -0,0 +1,193 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include <PowerRenameRegExBackend.h>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace PowerRenameRegExBackendTests
+{
+    // The automaton must produce exactly what std::wregex produces.  Every
+    // pattern below is run against every input with every replace term, with
+    // and without replace all, through both backends.
+    static PCWSTR s_patterns[] = {
+        L"foo",
+        L"a",
+        L".*",
+        L".+",
+        L".*?",
+        L"a*",
+        L"a*?",
+        L"a+?b",
+        L"^a",
+        L"a$",
+        L"^$",
+        L"\\bfoo\\b",
+        L"\\Bo",
+        L"(\\w+)\\.(\\w+)",
+        L"(\\d{2,4})",
+        L"[a-c]+",
+        L"[^a-z]+",
+        L"[\\d.]+",
+        L"[[:alpha:]]+",
+        L"(?:ab|a)(c?)",
+        L"(a|ab)(c|bcd)",
+        L"x?",
+        L"o{2}",
+        L"o{1,}",
+        L"\\s+",
+        L"\\.",
+        L"(foo)?bar",
+        L"IMG_(\\d+)",
+    };
+
+    static PCWSTR s_inputs[] = {
+        L"foo",
+        L"foobar",
+        L"FooBAR",
+        L"foo.txt",
+        L"foo bar foo",
+        L"aaaaaa",
+        L"abcd",
+        L"abcbcd",
+        L"IMG_2019_0001.JPG",
+        L"a.b.c",
+        L"x",
+        L"  spaced  name  ",
+        L"12.5.2020",
+    };
+
+    static PCWSTR s_replaceTerms[] = {
+        L"",
+        L"X",
+        L"[$&]",
+        L"<$1>",
+        L"$2-$1",
+        L"$$",
+        L"$`|$'",
+    };
+
+    static void VerifyPattern(_In_ PCWSTR pattern, _In_ bool caseSensitive)
+    {
+        CStdRegExBackend stdBackend;
+        Assert::IsTrue(stdBackend.Init(pattern, caseSensitive));
+
+        CAutomatonRegExBackend automatonBackend;
+        Assert::IsTrue(automatonBackend.Init(pattern, caseSensitive));
+
+        for (PCWSTR input : s_inputs)
+        {
+            for (PCWSTR replaceTerm : s_replaceTerms)
+            {
+                for (bool replaceAll : { false, true })
+                {
+                    std::wstring expected;
+                    std::wstring actual;
+                    CRegExBudget budget;
+                    Assert::IsTrue(stdBackend.Replace(input, replaceTerm, replaceAll, budget, expected) == S_OK);
+                    Assert::IsTrue(automatonBackend.Replace(input, replaceTerm, replaceAll, budget, actual) == S_OK);
+                    Assert::AreEqual(expected, actual);
+                }
+            }
+        }
+    }
+
+    TEST_CLASS(SimpleTests)
+    {
+    public:
+        TEST_METHOD(VerifyAutomatonMatchesStdCaseSensitive)
+        {
+            for (PCWSTR pattern : s_patterns)
+            {
+                VerifyPattern(pattern, true);
+            }
+        }
+
+        TEST_METHOD(VerifyAutomatonMatchesStdCaseInsensitive)
+        {
+            for (PCWSTR pattern : s_patterns)
+            {
+                VerifyPattern(pattern, false);
+            }
+        }
+
+        TEST_METHOD(VerifyUnsupportedPatternsFallBack)
+        {
+            // Valid ECMAScript that the automaton leaves to std::wregex
+            PCWSTR patterns[] = { L"(a)\\1", L"a(?=b)", L"a(?!b)", L"(a|b)*", L"(?:a*)*" };
+            for (PCWSTR pattern : patterns)
+            {
+                CAutomatonRegExBackend automatonBackend;
+                Assert::IsFalse(automatonBackend.Init(pattern, true));
+
+                std::unique_ptr<CRegExBackend> backend = CRegExBackend::s_Create(pattern, true);
+                Assert::IsTrue(backend != nullptr);
+            }
+
+            std::unique_ptr<CRegExBackend> backend = CRegExBackend::s_Create(L"(\\w)\\1", true);
+            std::wstring result;
+            CRegExBudget budget;
+            Assert::IsTrue(backend->Replace(L"foobar", L"-", true, budget, result) == S_OK);
+            Assert::AreEqual(std::wstring(L"f-bar"), result);
+        }
+
+        TEST_METHOD(VerifyInvalidPatternRejected)
+        {
+            PCWSTR patterns[] = { L"[", L"(", L"a{2,1}", L"*" };
+            for (PCWSTR pattern : patterns)
+            {
+                Assert::IsTrue(CRegExBackend::s_Create(pattern, true) == nullptr);
+            }
+        }
+
+        TEST_METHOD(VerifyNoBacktracking)
+        {
+            // Exponential for a backtracking engine, linear for the automaton
+            CAutomatonRegExBackend automatonBackend;
+            Assert::IsTrue(automatonBackend.Init(L"(?:a|aa)+b", true));
+
+            std::wstring source(5000, L'a');
+            std::wstring result;
+            CRegExBudget budget(REGEX_MAX_MATCH_STEPS, REGEX_REPLACE_TIMEOUT_MS, nullptr);
+            Assert::IsTrue(automatonBackend.Replace(source, L"x", true, budget, result) == S_OK);
+            Assert::AreEqual(source, result);
+        }
+
+        TEST_METHOD(VerifyBudgetStopsBacktracking)
+        {
+            // Captures inside a repeated group are left to std::wregex, which
+            // backtracks exponentially on this input
+            std::unique_ptr<CRegExBackend> backend = CRegExBackend::s_Create(L"(a+)+$", true);
+            Assert::IsTrue(backend != nullptr);
+
+            std::wstring source(64, L'a');
+            source += L'b';
+            std::wstring result;
+            CRegExBudget budget(REGEX_MAX_MATCH_STEPS, REGEX_REPLACE_TIMEOUT_MS, nullptr);
+            Assert::IsTrue(backend->Replace(source, L"x", true, budget, result) == HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+
+            // Without a step budget the deadline still ends the match
+            CRegExBudget deadline(UINT64_MAX, 50, nullptr);
+            Assert::IsTrue(backend->Replace(source, L"x", false, deadline, result) == HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+        }
+
+        TEST_METHOD(VerifyBudgetCanceledMidMatch)
+        {
+            HANDLE cancelEvent = CreateEvent(nullptr, TRUE, TRUE, nullptr);
+            std::wstring source(64, L'a');
+            source += L'b';
+            std::wstring result;
+
+            std::unique_ptr<CRegExBackend> stdBackend = CRegExBackend::s_Create(L"(a+)+$", true);
+            CRegExBudget budget(UINT64_MAX, INFINITE, cancelEvent);
+            Assert::IsTrue(stdBackend->Replace(source, L"x", true, budget, result) == HRESULT_FROM_WIN32(ERROR_CANCELLED));
+
+            CAutomatonRegExBackend automatonBackend;
+            Assert::IsTrue(automatonBackend.Init(L"(?:a|aa)+b", true));
+            std::wstring longSource(20000, L'a');
+            CRegExBudget automatonBudget(UINT64_MAX, INFINITE, cancelEvent);
+            Assert::IsTrue(automatonBackend.Replace(longSource, L"x", true, automatonBudget, result) == HRESULT_FROM_WIN32(ERROR_CANCELLED));
+
+            CloseHandle(cancelEvent);
+        }
+    };
+}
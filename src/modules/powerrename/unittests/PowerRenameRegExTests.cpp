@@ -2,6 +2,7 @@
 #include "CppUnitTest.h"
 #include <PowerRenameInterfaces.h>
 #include <PowerRenameRegEx.h>
+#include <PowerRenameTemplate.h>
 #include "MockPowerRenameRegExEvents.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
@@ -331,6 +332,276 @@ TEST_METHOD(VerifyReplaceFirstWildNoFlags)
     VerifyReplaceFirstWildcard(sreTable, ARRAYSIZE(sreTable), 0);
 }
 
+TEST_METHOD(VerifyCompiledRegExUpdatedOnSearchTermChange)
+{
+    CComPtr<IPowerRenameRegEx> renameRegEx;
+    Assert::IsTrue(CPowerRenameRegEx::s_CreateInstance(&renameRegEx) == S_OK);
+    Assert::IsTrue(renameRegEx->put_flags(MatchAllOccurences | UseRegularExpressions) == S_OK);
+    Assert::IsTrue(renameRegEx->put_replaceTerm(L"X") == S_OK);
+
+    PWSTR result = nullptr;
+    Assert::IsTrue(renameRegEx->put_searchTerm(L"a+") == S_OK);
+    Assert::IsTrue(renameRegEx->Replace(L"aabbaa", &result) == S_OK);
+    Assert::AreEqual(L"XbbX", result);
+    CoTaskMemFree(result);
+
+    // Same replace against a new pattern must not reuse the previous compiled pattern
+    Assert::IsTrue(renameRegEx->put_searchTerm(L"b+") == S_OK);
+    Assert::IsTrue(renameRegEx->Replace(L"aabbaa", &result) == S_OK);
+    Assert::AreEqual(L"aaXaa", result);
+    CoTaskMemFree(result);
+}
+
+TEST_METHOD(VerifyCompiledRegExUpdatedOnFlagsChange)
+{
+    CComPtr<IPowerRenameRegEx> renameRegEx;
+    Assert::IsTrue(CPowerRenameRegEx::s_CreateInstance(&renameRegEx) == S_OK);
+    Assert::IsTrue(renameRegEx->put_flags(MatchAllOccurences | UseRegularExpressions) == S_OK);
+    Assert::IsTrue(renameRegEx->put_searchTerm(L"A") == S_OK);
+    Assert::IsTrue(renameRegEx->put_replaceTerm(L"X") == S_OK);
+
+    PWSTR result = nullptr;
+    Assert::IsTrue(renameRegEx->Replace(L"aA", &result) == S_OK);
+    Assert::AreEqual(L"XX", result);
+    CoTaskMemFree(result);
+
+    Assert::IsTrue(renameRegEx->put_flags(MatchAllOccurences | UseRegularExpressions | CaseSensitive) == S_OK);
+    Assert::IsTrue(renameRegEx->Replace(L"aA", &result) == S_OK);
+    Assert::AreEqual(L"aX", result);
+    CoTaskMemFree(result);
+
+    // Turning regular expressions off must fall back to a literal search
+    Assert::IsTrue(renameRegEx->put_searchTerm(L"a.") == S_OK);
+    Assert::IsTrue(renameRegEx->put_flags(MatchAllOccurences) == S_OK);
+    Assert::IsTrue(renameRegEx->Replace(L"abA.", &result) == S_OK);
+    Assert::AreEqual(L"abX", result);
+    CoTaskMemFree(result);
+}
+
+TEST_METHOD(VerifyInvalidRegExRecovers)
+{
+    CComPtr<IPowerRenameRegEx> renameRegEx;
+    Assert::IsTrue(CPowerRenameRegEx::s_CreateInstance(&renameRegEx) == S_OK);
+    Assert::IsTrue(renameRegEx->put_flags(MatchAllOccurences | UseRegularExpressions) == S_OK);
+    Assert::IsTrue(renameRegEx->put_replaceTerm(L"X") == S_OK);
+
+    PWSTR result = nullptr;
+    Assert::IsTrue(renameRegEx->put_searchTerm(L"(a") == S_OK);
+    Assert::IsTrue(renameRegEx->Replace(L"abc", &result) != S_OK);
+    Assert::IsTrue(result == nullptr);
+
+    Assert::IsTrue(renameRegEx->put_searchTerm(L"(a)") == S_OK);
+    Assert::IsTrue(renameRegEx->Replace(L"abc", &result) == S_OK);
+    Assert::AreEqual(L"Xbc", result);
+    CoTaskMemFree(result);
+}
+
+TEST_METHOD(VerifyCatastrophicRegExTimesOut)
+{
+    CComPtr<IPowerRenameRegEx> renameRegEx;
+    Assert::IsTrue(CPowerRenameRegEx::s_CreateInstance(&renameRegEx) == S_OK);
+    Assert::IsTrue(renameRegEx->put_flags(MatchAllOccurences | UseRegularExpressions) == S_OK);
+    Assert::IsTrue(renameRegEx->put_searchTerm(L"(a+)+$") == S_OK);
+    Assert::IsTrue(renameRegEx->put_replaceTerm(L"X") == S_OK);
+
+    PWSTR result = nullptr;
+    Assert::IsTrue(renameRegEx->Replace(L"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab", &result) == HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+    Assert::IsTrue(result == nullptr);
+
+    // The same pattern still works on names it can handle
+    Assert::IsTrue(renameRegEx->Replace(L"baaa", &result) == S_OK);
+    Assert::AreEqual(L"bX", result);
+    CoTaskMemFree(result);
+
+    HANDLE cancelEvent = CreateEvent(nullptr, TRUE, TRUE, nullptr);
+    Assert::IsTrue(renameRegEx->ReplaceWithCancel(L"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab", cancelEvent, &result) == HRESULT_FROM_WIN32(ERROR_CANCELLED));
+    Assert::IsTrue(result == nullptr);
+    CloseHandle(cancelEvent);
+}
+
+TEST_METHOD(VerifyLiteralReplaceLongNames)
+{
+    CComPtr<IPowerRenameRegEx> renameRegEx;
+    Assert::IsTrue(CPowerRenameRegEx::s_CreateInstance(&renameRegEx) == S_OK);
+    Assert::IsTrue(renameRegEx->put_flags(MatchAllOccurences) == S_OK);
+
+    // Longer than one vector of characters so matches are found by the wide scan
+    // as well as by the tail loop.
+    SearchReplaceExpected sreTable[] = {
+        { L"img", L"Photo", L"IMG_0001 holiday img copy.IMG", L"Photo_0001 holiday Photo copy.Photo" },
+        { L"\u00e9t\u00e9", L"summer", L"Photo \u00e9t\u00e9 2019 \u00e9t\u00e9.jpg", L"Photo summer 2019 summer.jpg" },
+        { L"aa", L"b", L"aaaaaaaaaaaaaaaaaaaaa", L"bbbbbbbbbba" },
+        { L"xyz", L"q", L"abcdefghijklmnopqrstuvw", L"abcdefghijklmnopqrstuvw" },
+    };
+
+    for (int i = 0; i < ARRAYSIZE(sreTable); i++)
+    {
+        PWSTR result = nullptr;
+        Assert::IsTrue(renameRegEx->put_searchTerm(sreTable[i].search) == S_OK);
+        Assert::IsTrue(renameRegEx->put_replaceTerm(sreTable[i].replace) == S_OK);
+        Assert::IsTrue(renameRegEx->Replace(sreTable[i].test, &result) == S_OK);
+        Assert::AreEqual(sreTable[i].expected, result);
+        CoTaskMemFree(result);
+    }
+}
+
+TEST_METHOD(VerifyTemplateTokens)
+{
+    SYSTEMTIME fileTime = { 0 };
+    fileTime.wYear = 2020;
+    fileTime.wMonth = 3;
+    fileTime.wDay = 7;
+    fileTime.wHour = 9;
+    fileTime.wMinute = 5;
+    fileTime.wSecond = 30;
+    fileTime.wMilliseconds = 42;
+
+    struct TemplateExpected
+    {
+        PCWSTR replace;
+        ULONG counterIndex;
+        PCWSTR expected;
+    };
+
+    TemplateExpected table[] = {
+        { L"IMG_${}", 0, L"IMG_0" },
+        { L"IMG_${start=10,increment=5,padding=3}", 2, L"IMG_020" },
+        { L"${increment=-2,start=1}", 3, L"-5" },
+        { L"$YYYY-$MM-$DD $hh.$mm.$ss.$fff $YY", 0, L"2020-03-07 09.05.30.042 20" },
+        { L"$$YYYY ${bogus} ${start=} ${padding=1,padding=2} $1", 0, L"$$YYYY ${bogus} ${start=} ${padding=1,padding=2} $1" },
+    };
+
+    for (int i = 0; i < ARRAYSIZE(table); i++)
+    {
+        CPowerRenameTemplate renameTemplate;
+        renameTemplate.Compile(table[i].replace, false);
+        const std::wstring& replaceTerm = renameTemplate.GetReplaceTerm();
+        std::wstring result = L"kept ";
+        renameTemplate.Expand(replaceTerm.c_str(), replaceTerm.length(), table[i].counterIndex, &fileTime, result);
+        Assert::AreEqual((std::wstring(L"kept ") + table[i].expected).c_str(), result.c_str());
+    }
+}
+
+TEST_METHOD(VerifyTemplateThroughRegEx)
+{
+    CComPtr<IPowerRenameRegEx> renameRegEx;
+    Assert::IsTrue(CPowerRenameRegEx::s_CreateInstance(&renameRegEx) == S_OK);
+    Assert::IsTrue(renameRegEx->put_flags(MatchAllOccurences | UseRegularExpressions) == S_OK);
+    Assert::IsTrue(renameRegEx->put_searchTerm(L"(\\w+)\\.jpg") == S_OK);
+    Assert::IsTrue(renameRegEx->put_replaceTerm(L"$1_${start=1,padding=2}.jpg") == S_OK);
+
+    // Without an item the counter gives its first value
+    PWSTR result = nullptr;
+    Assert::IsTrue(renameRegEx->Replace(L"photo.jpg", &result) == S_OK);
+    Assert::AreEqual(L"photo_01.jpg", result);
+    CoTaskMemFree(result);
+
+    // The capture is expanded by the search and the counter is left for Expand
+    CComPtr<IPowerRenameTemplateRegEx> templateRegEx;
+    Assert::IsTrue(renameRegEx->QueryInterface(IID_PPV_ARGS(&templateRegEx)) == S_OK);
+    result = nullptr;
+    Assert::IsTrue(templateRegEx->ReplaceWithPlaceholders(L"photo.jpg", nullptr, &result) == S_OK);
+    Assert::AreNotEqual(L"photo_01.jpg", result);
+
+    CPowerRenameTemplate renameTemplate;
+    renameTemplate.Compile(L"$1_${start=1,padding=2}.jpg", false);
+    Assert::IsTrue(renameTemplate.HasCounter());
+    Assert::IsFalse(renameTemplate.HasFileTime());
+    std::wstring expanded;
+    renameTemplate.Expand(result, wcslen(result), 4, nullptr, expanded);
+    Assert::AreEqual(L"photo_05.jpg", expanded.c_str());
+    CoTaskMemFree(result);
+}
+
+TEST_METHOD(VerifyDollarEscapeInBothModes)
+{
+    // $$ is a single $ whether or not the search uses regular expressions
+    struct TemplateExpected
+    {
+        DWORD flags;
+        PCWSTR replace;
+        PCWSTR expected;
+    };
+
+    TemplateExpected table[] = {
+        { MatchAllOccurences, L"$$YYYY", L"$YYYY.jpg" },
+        { MatchAllOccurences | UseRegularExpressions, L"$$YYYY", L"$YYYY.jpg" },
+        { MatchAllOccurences, L"$$${}$$", L"$0$.jpg" },
+        { MatchAllOccurences | UseRegularExpressions, L"$$${}$$", L"$0$.jpg" },
+    };
+
+    for (int i = 0; i < ARRAYSIZE(table); i++)
+    {
+        // The flags are set last so the replace term is compiled again for them
+        CComPtr<IPowerRenameRegEx> renameRegEx;
+        Assert::IsTrue(CPowerRenameRegEx::s_CreateInstance(&renameRegEx) == S_OK);
+        Assert::IsTrue(renameRegEx->put_searchTerm(L"x") == S_OK);
+        Assert::IsTrue(renameRegEx->put_replaceTerm(table[i].replace) == S_OK);
+        Assert::IsTrue(renameRegEx->put_flags(table[i].flags) == S_OK);
+
+        PWSTR result = nullptr;
+        Assert::IsTrue(renameRegEx->Replace(L"x.jpg", &result) == S_OK);
+        Assert::AreEqual(table[i].expected, result);
+        CoTaskMemFree(result);
+    }
+}
+
+TEST_METHOD(VerifyTemplateKeepsPlaceholderLikeCharacters)
+{
+    // File names may contain the private use characters the placeholders use
+    struct TemplateExpected
+    {
+        DWORD flags;
+        PCWSTR search;
+        PCWSTR replace;
+        PCWSTR test;
+        PCWSTR expected;
+    };
+
+    TemplateExpected table[] = {
+        { MatchAllOccurences, L"photo", L"pic_${start=7}", L"photo\uE000\uE001\uE100.jpg", L"pic_7\uE000\uE001\uE100.jpg" },
+        { MatchAllOccurences | UseRegularExpressions, L"(\\w+)_", L"$1${}\uE000", L"a_\uE000.jpg", L"a0\uE000\uE000.jpg" },
+        { MatchAllOccurences, L"x", L"\uE000$YYYY", L"x\uE001", L"\uE000\uE001" },
+        { MatchAllOccurences, L"x", L"\uE000", L"x\uE001", L"\uE000\uE001" },
+    };
+
+    for (int i = 0; i < ARRAYSIZE(table); i++)
+    {
+        CComPtr<IPowerRenameRegEx> renameRegEx;
+        Assert::IsTrue(CPowerRenameRegEx::s_CreateInstance(&renameRegEx) == S_OK);
+        Assert::IsTrue(renameRegEx->put_flags(table[i].flags) == S_OK);
+        Assert::IsTrue(renameRegEx->put_searchTerm(table[i].search) == S_OK);
+        Assert::IsTrue(renameRegEx->put_replaceTerm(table[i].replace) == S_OK);
+
+        // Searched the way the manager does, then expanded
+        CComPtr<IPowerRenameTemplateRegEx> templateRegEx;
+        Assert::IsTrue(renameRegEx->QueryInterface(IID_PPV_ARGS(&templateRegEx)) == S_OK);
+        PWSTR result = nullptr;
+        Assert::IsTrue(templateRegEx->ReplaceWithPlaceholders(table[i].test, nullptr, &result) == S_OK);
+
+        CPowerRenameTemplate renameTemplate;
+        renameTemplate.Compile(table[i].replace, !(table[i].flags & UseRegularExpressions));
+        std::wstring expanded;
+        if (renameTemplate.HasTokens())
+        {
+            // No file time, so date tokens expand to nothing
+            renameTemplate.Expand(result, wcslen(result), 0, nullptr, expanded);
+        }
+        else
+        {
+            expanded = result;
+        }
+        Assert::AreEqual(table[i].expected, expanded.c_str());
+        CoTaskMemFree(result);
+
+        // Replace gives the same name without the placeholders
+        result = nullptr;
+        Assert::IsTrue(renameRegEx->Replace(table[i].test, &result) == S_OK);
+        Assert::AreEqual(table[i].expected, result);
+        CoTaskMemFree(result);
+    }
+}
+
 TEST_METHOD(VerifyEventsFire)
 {
     CComPtr<IPowerRenameRegEx> renameRegEx;
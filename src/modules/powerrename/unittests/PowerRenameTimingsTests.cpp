@@ -0,0 +1,57 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include <PowerRenameTimings.h>
+#include "TestFileHelper.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace PowerRenameTimingsTests
+{
+    TEST_CLASS(TimingsTests)
+    {
+    public:
+        TEST_METHOD(VerifyPhaseTimer)
+        {
+            CRenameTimings::s_Reset();
+            {
+                CRenamePhaseTimer timer(RenamePhaseFileOp, 10);
+                timer.AddItems(5);
+                Sleep(20);
+            }
+            {
+                CRenamePhaseTimer timer(RenamePhaseFileOp);
+            }
+
+            RenamePhaseTiming timing;
+            CRenameTimings::s_GetTiming(RenamePhaseFileOp, &timing);
+            Assert::IsTrue(timing.runCount == 2);
+            Assert::IsTrue(timing.itemCount == 15);
+            Assert::IsTrue(timing.totalMs >= 15);
+            Assert::IsTrue(timing.maxMs >= 15 && timing.maxMs <= timing.totalMs);
+
+            CRenameTimings::s_GetTiming(RenamePhaseRegEx, &timing);
+            Assert::IsTrue(timing.runCount == 0);
+
+            CRenameTimings::s_Reset();
+            CRenameTimings::s_GetTiming(RenamePhaseFileOp, &timing);
+            Assert::IsTrue(timing.runCount == 0 && timing.itemCount == 0 && timing.totalMs == 0);
+        }
+
+        TEST_METHOD(VerifyWrite)
+        {
+            CRenameTimings::s_Reset();
+            {
+                CRenamePhaseTimer timer(RenamePhaseEnumeration, 100);
+            }
+
+            std::wstring text;
+            CRenameTimings::s_Format(text);
+            Assert::IsTrue(text.find(L"Enumeration") != std::wstring::npos);
+            Assert::IsTrue(text.find(L"FileOp") != std::wstring::npos);
+
+            CTestFileHelper folder;
+            Assert::IsTrue(CRenameTimings::s_Write(folder.GetFullPath(L"Timings.txt").c_str()) == S_OK);
+            Assert::IsTrue(folder.PathExists(L"Timings.txt"));
+        }
+    };
+}